@@ -0,0 +1,142 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Счётчик выделений памяти процесса для отчёта сервера. Глобальный
+// operator new подменяется только при сборке с COUNT_ALLOCATIONS
+// (cmake -DCOUNT_ALLOCATIONS=ON): так видно, выделяет ли память
+// установившийся обмен кадрами. Заголовок подключается в одну единицу
+// трансляции программы.
+namespace alloc_counter {
+
+inline std::atomic<std::uint64_t> allocations{0};
+
+#ifdef COUNT_ALLOCATIONS
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+// Выделения с прошлого вызова
+inline std::uint64_t take() {
+  return allocations.exchange(0, std::memory_order_relaxed);
+}
+
+}  // namespace alloc_counter
+
+#ifdef COUNT_ALLOCATIONS
+// Подменяется весь набор operator new и delete, включая массивы, nothrow
+// и выравнивание: иначе выделение через new[] или aligned new прошло бы
+// мимо счётчика, а его delete освобождал бы память чужой функцией
+namespace alloc_counter::detail {
+
+inline void* allocate(std::size_t size, std::size_t alignment) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (size == 0) {
+    size = 1;
+  }
+  if (alignment > alignof(std::max_align_t)) {
+    // aligned_alloc хочет размер, кратный выравниванию
+    size = (size + alignment - 1) / alignment * alignment;
+  }
+  while (true) {
+    void* pointer = alignment <= alignof(std::max_align_t)
+                        ? std::malloc(size)
+                        : std::aligned_alloc(alignment, size);
+    if (pointer) {
+      return pointer;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+inline void* allocate_nothrow(std::size_t size,
+                              std::size_t alignment) noexcept {
+  try {
+    return allocate(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+}  // namespace alloc_counter::detail
+
+void* operator new(std::size_t size) {
+  return alloc_counter::detail::allocate(size, 0);
+}
+void* operator new[](std::size_t size) {
+  return alloc_counter::detail::allocate(size, 0);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return alloc_counter::detail::allocate_nothrow(size, 0);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return alloc_counter::detail::allocate_nothrow(size, 0);
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return alloc_counter::detail::allocate(
+      size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return alloc_counter::detail::allocate(
+      size, static_cast<std::size_t>(alignment));
+}
+void* operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return alloc_counter::detail::allocate_nothrow(
+      size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return alloc_counter::detail::allocate_nothrow(
+      size, static_cast<std::size_t>(alignment));
+}
+
+// malloc и aligned_alloc освобождаются одним free
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, std::size_t,
+                       std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+#endif
+
+#endif  // ALLOC_COUNTER_H
@@ -0,0 +1,237 @@
+// Проверка, что установившийся обмен голосом не выделяет память.
+// Сервер собирается вместе с тестом (server.cpp без main) и счётчиком
+// выделений alloc_counter.h, сессии — обычные сокеты через loopback
+// в потоке теста, которые сами ничего не выделяют. После разогрева
+// считаются выделения процесса на кадр, пришедший на сервер; тест
+// падает, если их больше нуля.
+//
+// alloctest record — то же с записью голоса (--record), alloctest stage
+// — со слушателями сцены (--stage-port) в двух потоках рассылки: там
+// кадры отпускаются не в io-потоке, и допустимы редкие выделения,
+// до kThreadedLimit на кадр.
+#define SERVER_NO_MAIN
+#include "server.cpp"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+
+#include <cstdio>
+#include <filesystem>
+
+namespace {
+
+constexpr int kSessions = 8;
+constexpr int kStageListeners = 8;
+constexpr int kWarmupRounds = 2000;
+constexpr int kRounds = 2000;
+// Выделений на кадр с потоками записи или рассылки
+constexpr double kThreadedLimit = 0.05;
+// 20 мс float32 48 кГц — формат слушателя по умолчанию, без перекодирования
+constexpr std::size_t kSamples = 960;
+
+unsigned short free_port() {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+  ::close(fd);
+  return ntohs(address.sin_port);
+}
+
+int connect_loopback(unsigned short port) {
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address),
+                         sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  timeval timeout{5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+bool send_all(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+// Сервер не выключает Нейгла в сессиях: подтверждение сразу, иначе
+// каждая его запись ждёт отложенного ACK. QUICKACK сбрасывается ядром,
+// поэтому ставится после каждого чтения
+bool recv_all(int fd, char* data, std::size_t size) {
+  while (size > 0) {
+    ssize_t n = recv(fd, data, size, 0);
+    if (n <= 0) {
+      return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    data += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+// Читает кадры, пока не придёт count кадров голоса; служебные
+// пропускаются
+bool read_voice(int fd, int count, std::vector<char>& buffer) {
+  while (count > 0) {
+    if (!recv_all(fd, buffer.data(), protocol::kHeaderSize)) {
+      return false;
+    }
+    protocol::FrameHeader header = protocol::decode_header(buffer.data());
+    if (header.length > buffer.size() - protocol::kHeaderSize ||
+        !recv_all(fd, buffer.data() + protocol::kHeaderSize,
+                  header.length)) {
+      return false;
+    }
+    if (header.type == protocol::MessageType::kAudio) {
+      --count;
+    }
+  }
+  return true;
+}
+
+// Раунд: каждая сессия говорит кадр, и каждый слушатель слышит все
+// кадры прошлого раунда; сессия — тоже слушатель, сервер рассылает
+// голос всем участникам. Слушает на раунд позже, как настоящий клиент,
+// который говорит, не дожидаясь чужого голоса. Метка времени — настоящее
+// время отправки, иначе сервер сочтёт кадры опоздавшими.
+bool run_rounds(const std::vector<int>& speakers,
+                const std::vector<int>& listeners, int rounds,
+                Clock::time_point start, std::vector<char>& frame,
+                std::vector<char>& buffer) {
+  for (int round = 0; round <= rounds; ++round) {
+    if (round < rounds) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now() - start);
+      protocol::put_u32(frame.data() + 12,
+                        static_cast<std::uint32_t>(elapsed.count()));
+      for (int fd : speakers) {
+        if (!send_all(fd, frame.data(), frame.size())) {
+          return false;
+        }
+      }
+    }
+    for (int fd : listeners) {
+      if (round > 0 && !read_voice(fd, kSessions, buffer)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string mode = argc > 1 ? argv[1] : "";
+  if (!mode.empty() && mode != "record" && mode != "stage") {
+    std::fprintf(stderr, "Usage: alloctest [record|stage]\n");
+    return 1;
+  }
+  char storage[] = "/tmp/alloctest-XXXXXX";
+  if (!mkdtemp(storage)) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  ServerOptions options;
+  options.port = free_port();
+  options.storage_path = storage;
+  if (mode == "record") {
+    options.recording.dir = storage;
+  } else if (mode == "stage") {
+    options.stage_port = free_port();
+    options.stage_workers = 2;
+  }
+  // Раунды идут быстрее реального времени: норма кадров сессии
+  // срезала бы голос, и чтение ждало бы потерянного кадра
+  options.rate_limits = RateLimits{};
+  options.stats_interval = 3600;
+  options.log.level = logger::Level::kWarning;
+  logger::configure(options.log);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  boost::asio::io_context io_context;
+  // Запись закрывает файлы в своём потоке, пока жив сервер: каталог
+  // удаляется после него
+  auto server = std::make_unique<Server>(io_context, options);
+  std::thread io_thread([&io_context]() { io_context.run(); });
+
+  std::vector<int> speakers;
+  std::vector<int> listeners;
+  for (int i = 0; i < kSessions + kStageListeners; ++i) {
+    if (i >= kSessions && mode != "stage") {
+      break;
+    }
+    int fd = connect_loopback(i < kSessions ? options.port
+                                            : options.stage_port);
+    if (fd < 0) {
+      std::perror("connect");
+      return 1;
+    }
+    if (i < kSessions) {
+      speakers.push_back(fd);
+    }
+    listeners.push_back(fd);
+  }
+  // Слушатель сцены, не успевший войти, пропустил бы первый кадр
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  protocol::AudioFormat format;
+  protocol::FrameHeader header;
+  header.type = protocol::MessageType::kAudio;
+  header.flags = protocol::audio_flags(format);
+  header.length = static_cast<std::uint32_t>(kSamples * sizeof(float));
+  std::vector<char> frame(protocol::kHeaderSize + header.length);
+  protocol::encode_header(header, frame.data());
+  std::vector<char> buffer(protocol::kHeaderSize + protocol::kMaxPayloadSize);
+  Clock::time_point start = Clock::now();
+
+  bool ok = run_rounds(speakers, listeners, kWarmupRounds, start, frame,
+                       buffer);
+  alloc_counter::take();
+  ok = ok && run_rounds(speakers, listeners, kRounds, start, frame, buffer);
+  std::uint64_t allocations = alloc_counter::take();
+
+  for (int fd : listeners) {
+    ::close(fd);
+  }
+  io_context.stop();
+  io_thread.join();
+  server.reset();
+  logger::shutdown();
+  std::filesystem::remove_all(storage);
+
+  if (!ok) {
+    std::fprintf(stderr, "Sessions lost frames or the connection\n");
+    return 1;
+  }
+  const double frames = static_cast<double>(kRounds) * kSessions;
+  // Поток записи или рассылки, отставший сильнее прежнего, держит
+  // больше живых кадров, и пулы дорастают до нового рабочего набора
+  const double limit = mode.empty() ? 0.0 : kThreadedLimit;
+  std::printf("%s%d sessions, %zu listeners, %.0f frames in, %.0f out: "
+              "%llu allocations, %.4f per incoming frame\n",
+              mode.empty() ? "" : (mode + ": ").c_str(), kSessions,
+              listeners.size(), frames, frames * listeners.size(),
+              static_cast<unsigned long long>(allocations),
+              allocations / frames);
+  return allocations / frames <= limit ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+#ifndef AUDIO_CONVERT_H
+#define AUDIO_CONVERT_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Преобразование частоты дискретизации и формата сэмплов между
+// устройством и сетью. Ядра имеют скалярную и SIMD-версии (SSE2/AVX2),
+// выбор делается при компиляции.
+namespace audio {
+
+// ---------------------------------------------------------------------
+// float32 <-> int16
+// ---------------------------------------------------------------------
+
+// Состояние генератора для TPDF-дизеринга: независимый xorshift32 на
+// каждую линию вектора
+struct DitherState {
+  std::uint32_t lanes[8] = {0x9e3779b9u, 0x7f4a7c15u, 0x85ebca6bu,
+                            0xc2b2ae35u, 0x27d4eb2fu, 0x165667b1u,
+                            0xd3a2646cu, 0xfd7046c5u};
+};
+
+inline std::uint32_t xorshift32(std::uint32_t& x) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+// Случайное число в [0, 1) из старших 23 бит
+inline float unit_random(std::uint32_t bits) {
+  std::uint32_t mantissa = (bits >> 9) | 0x3f800000u;
+  float value;
+  std::memcpy(&value, &mantissa, sizeof(value));
+  return value - 1.0f;
+}
+
+constexpr float kInt16Scale = 32767.0f;
+
+inline std::int16_t float_to_int16_sample(float sample, float dither) {
+  float scaled = sample * kInt16Scale + dither;
+  if (scaled > kInt16Scale) {
+    scaled = kInt16Scale;
+  } else if (scaled < -kInt16Scale) {
+    scaled = -kInt16Scale;
+  }
+  return static_cast<std::int16_t>(std::lrintf(scaled));
+}
+
+// Треугольный дизер амплитудой ±1 LSB: разность двух равномерных
+inline void float_to_int16_scalar(const float* in, std::int16_t* out,
+                                  std::size_t count, DitherState& dither) {
+  for (std::size_t i = 0; i < count; ++i) {
+    std::uint32_t& lane = dither.lanes[i & 3];
+    float a = unit_random(xorshift32(lane));
+    float b = unit_random(xorshift32(lane));
+    out[i] = float_to_int16_sample(in[i], a - b);
+  }
+}
+
+inline void int16_to_float_scalar(const std::int16_t* in, float* out,
+                                  std::size_t count) {
+  constexpr float kScale = 1.0f / 32768.0f;
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i] = static_cast<float>(in[i]) * kScale;
+  }
+}
+
+#if defined(__SSE2__)
+inline __m128i xorshift32_sse2(__m128i x) {
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+  return x;
+}
+
+inline __m128 unit_random_sse2(__m128i bits) {
+  __m128i mantissa = _mm_or_si128(_mm_srli_epi32(bits, 9),
+                                  _mm_set1_epi32(0x3f800000));
+  return _mm_sub_ps(_mm_castsi128_ps(mantissa), _mm_set1_ps(1.0f));
+}
+
+inline void float_to_int16_sse2(const float* in, std::int16_t* out,
+                                std::size_t count, DitherState& dither) {
+  const __m128 scale = _mm_set1_ps(kInt16Scale);
+  const __m128 upper = _mm_set1_ps(kInt16Scale);
+  const __m128 lower = _mm_set1_ps(-kInt16Scale);
+  __m128i state =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither.lanes));
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128 noise[2];
+    for (auto& n : noise) {
+      state = xorshift32_sse2(state);
+      __m128 a = unit_random_sse2(state);
+      state = xorshift32_sse2(state);
+      n = _mm_sub_ps(a, unit_random_sse2(state));
+    }
+    __m128 lo = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), noise[0]);
+    __m128 hi =
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), noise[1]);
+    lo = _mm_max_ps(_mm_min_ps(lo, upper), lower);
+    hi = _mm_max_ps(_mm_min_ps(hi, upper), lower);
+    __m128i packed =
+        _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dither.lanes), state);
+  float_to_int16_scalar(in + i, out + i, count - i, dither);
+}
+
+inline void int16_to_float_sse2(const std::int16_t* in, float* out,
+                                std::size_t count) {
+  const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // Знаковое расширение: int16 в старшую половину и сдвиг назад
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+  int16_to_float_scalar(in + i, out + i, count - i);
+}
+#endif  // __SSE2__
+
+#if defined(__AVX2__)
+inline __m256i xorshift32_avx2(__m256i x) {
+  x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+  x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+  return x;
+}
+
+inline __m256 unit_random_avx2(__m256i bits) {
+  __m256i mantissa = _mm256_or_si256(_mm256_srli_epi32(bits, 9),
+                                     _mm256_set1_epi32(0x3f800000));
+  return _mm256_sub_ps(_mm256_castsi256_ps(mantissa), _mm256_set1_ps(1.0f));
+}
+
+inline void float_to_int16_avx2(const float* in, std::int16_t* out,
+                                std::size_t count, DitherState& dither) {
+  const __m256 scale = _mm256_set1_ps(kInt16Scale);
+  const __m256 upper = _mm256_set1_ps(kInt16Scale);
+  const __m256 lower = _mm256_set1_ps(-kInt16Scale);
+  __m256i state =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither.lanes));
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256 noise[2];
+    for (auto& n : noise) {
+      state = xorshift32_avx2(state);
+      __m256 a = unit_random_avx2(state);
+      state = xorshift32_avx2(state);
+      n = _mm256_sub_ps(a, unit_random_avx2(state));
+    }
+    __m256 lo =
+        _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), noise[0]);
+    __m256 hi = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), noise[1]);
+    lo = _mm256_max_ps(_mm256_min_ps(lo, upper), lower);
+    hi = _mm256_max_ps(_mm256_min_ps(hi, upper), lower);
+    // packs работает внутри 128-битных половин, порядок восстанавливаем
+    __m256i packed =
+        _mm256_packs_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+    packed = _mm256_permute4x64_epi64(packed, 0xd8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dither.lanes), state);
+  float_to_int16_scalar(in + i, out + i, count - i, dither);
+}
+
+inline void int16_to_float_avx2(const std::int16_t* in, float* out,
+                                std::size_t count) {
+  const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m256 wide = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(wide, scale));
+  }
+  int16_to_float_scalar(in + i, out + i, count - i);
+}
+#endif  // __AVX2__
+
+inline void float_to_int16(const float* in, std::int16_t* out,
+                           std::size_t count, DitherState& dither) {
+#if defined(__AVX2__)
+  float_to_int16_avx2(in, out, count, dither);
+#elif defined(__SSE2__)
+  float_to_int16_sse2(in, out, count, dither);
+#else
+  float_to_int16_scalar(in, out, count, dither);
+#endif
+}
+
+inline void int16_to_float(const std::int16_t* in, float* out,
+                           std::size_t count) {
+#if defined(__AVX2__)
+  int16_to_float_avx2(in, out, count);
+#elif defined(__SSE2__)
+  int16_to_float_sse2(in, out, count);
+#else
+  int16_to_float_scalar(in, out, count);
+#endif
+}
+
+// ---------------------------------------------------------------------
+// Полифазный ресемплер
+// ---------------------------------------------------------------------
+
+inline float dot_scalar(const float* a, const float* b, std::size_t count) {
+  float sum = 0.0f;
+  for (std::size_t i = 0; i < count; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// count кратно 8 (см. PolyphaseResampler::kTapsAlign)
+inline float dot(const float* a, const float* b, std::size_t count) {
+#if defined(__AVX2__)
+  __m256 acc = _mm256_setzero_ps();
+  for (std::size_t i = 0; i < count; i += 8) {
+    acc = _mm256_add_ps(
+        acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                          _mm256_extractf128_ps(acc, 1));
+#elif defined(__SSE2__)
+  __m128 sum = _mm_setzero_ps();
+  for (std::size_t i = 0; i < count; i += 4) {
+    sum = _mm_add_ps(sum,
+                     _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+#endif
+#if defined(__SSE2__)
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+  return _mm_cvtss_f32(sum);
+#else
+  return dot_scalar(a, b, count);
+#endif
+}
+
+// Модифицированная функция Бесселя нулевого порядка для окна Кайзера
+inline double bessel_i0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// Рациональный ресемплер in_rate -> out_rate (up/down после сокращения).
+// Прототип — windowed-sinc с окном Кайзера, разложенный на up фаз,
+// коэффициенты каждой фазы лежат подряд в обратном порядке, так что
+// выходной сэмпл — одно скалярное произведение по непрерывной памяти.
+class PolyphaseResampler {
+ public:
+  static constexpr std::size_t kTapsAlign = 8;
+
+  PolyphaseResampler(int in_rate, int out_rate, std::size_t taps = 32)
+      : in_rate_(in_rate), out_rate_(out_rate) {
+    int divisor = std::gcd(in_rate, out_rate);
+    up_ = static_cast<std::size_t>(out_rate / divisor);
+    down_ = static_cast<std::size_t>(in_rate / divisor);
+    taps_ = (taps + kTapsAlign - 1) / kTapsAlign * kTapsAlign;
+    design_filter();
+    reset();
+  }
+
+  int in_rate() const { return in_rate_; }
+  int out_rate() const { return out_rate_; }
+  bool is_passthrough() const { return up_ == 1 && down_ == 1; }
+
+  void reset() {
+    history_.assign(taps_ - 1, 0.0f);
+    position_ = (taps_ - 1) * up_;
+  }
+
+  // Дописывает результат в конец out, состояние сохраняется между вызовами
+  void process(const float* in, std::size_t count, std::vector<float>& out) {
+    if (is_passthrough()) {
+      out.insert(out.end(), in, in + count);
+      return;
+    }
+    history_.insert(history_.end(), in, in + count);
+    out.reserve(out.size() + count * up_ / down_ + 1);
+    while (position_ / up_ < history_.size()) {
+      std::size_t index = position_ / up_;
+      std::size_t phase = position_ % up_;
+      out.push_back(dot(&coeffs_[phase * taps_], &history_[index + 1 - taps_],
+                        taps_));
+      position_ += down_;
+    }
+    // Оставляем только хвост, нужный для следующих выходных сэмплов
+    std::size_t consumed = position_ / up_ - (taps_ - 1);
+    history_.erase(history_.begin(), history_.begin() + consumed);
+    position_ -= consumed * up_;
+  }
+
+ private:
+  void design_filter() {
+    constexpr double kPi = 3.14159265358979323846;
+    constexpr double kBeta = 8.0;
+    const std::size_t length = taps_ * up_;
+    // Частота среза относительно частоты после повышения в up раз,
+    // с запасом на переходную полосу
+    const double cutoff =
+        0.5 / static_cast<double>(up_ > down_ ? up_ : down_) * 0.92;
+    const double center = (static_cast<double>(length) - 1.0) / 2.0;
+    const double norm = bessel_i0(kBeta);
+
+    std::vector<double> prototype(length);
+    for (std::size_t n = 0; n < length; ++n) {
+      double t = static_cast<double>(n) - center;
+      double sinc = t == 0.0 ? 2.0 * cutoff
+                             : std::sin(2.0 * kPi * cutoff * t) / (kPi * t);
+      double ratio = 2.0 * static_cast<double>(n) / (length - 1) - 1.0;
+      double window = bessel_i0(kBeta * std::sqrt(1.0 - ratio * ratio)) / norm;
+      prototype[n] = sinc * window * static_cast<double>(up_);
+    }
+
+    coeffs_.assign(length, 0.0f);
+    for (std::size_t phase = 0; phase < up_; ++phase) {
+      for (std::size_t k = 0; k < taps_; ++k) {
+        coeffs_[phase * taps_ + (taps_ - 1 - k)] =
+            static_cast<float>(prototype[phase + k * up_]);
+      }
+    }
+  }
+
+  int in_rate_;
+  int out_rate_;
+  std::size_t up_;
+  std::size_t down_;
+  std::size_t taps_;
+  std::vector<float> coeffs_;
+  std::vector<float> history_;
+  std::size_t position_;
+};
+
+}  // namespace audio
+
+#endif  // AUDIO_CONVERT_H
@@ -0,0 +1,218 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Обработка буферов устройства в колбэке PortAudio. Захват: сэмплы
+// устройства -> float -> моно -> усиление -> энергия для детектора
+// речи. Проигрывание: моно float -> усиление -> сэмплы устройства
+// на все каналы. Стадии идут одним циклом, тип сэмпла, число каналов
+// и длина буфера — параметры шаблона, так что на каждую конфигурацию
+// компилятор строит свой цикл без ветвлений внутри. Конфигурацию
+// выбирает таблица при открытии потока; для остальных есть общий
+// цикл с параметрами времени выполнения.
+namespace audio {
+
+enum class DeviceSample : std::uint8_t {
+  kFloat32,
+  kInt16,
+};
+
+struct DeviceFormat {
+  DeviceSample sample = DeviceSample::kFloat32;
+  int channels = 1;
+};
+
+// Возвращает сумму квадратов выходных сэмплов
+using CaptureBlock = float (*)(const DeviceFormat& format, const void* input,
+                               float* out, std::size_t frames, float gain);
+using PlaybackBlock = void (*)(const DeviceFormat& format, const float* in,
+                               void* output, std::size_t frames, float gain);
+
+namespace pipeline {
+
+template <typename Sample>
+inline float to_float(Sample sample);
+
+template <>
+inline float to_float<float>(float sample) {
+  return sample;
+}
+
+template <>
+inline float to_float<std::int16_t>(std::int16_t sample) {
+  return static_cast<float>(sample) * (1.0f / 32768.0f);
+}
+
+template <typename Sample>
+inline Sample from_float(float sample);
+
+template <>
+inline float from_float<float>(float sample) {
+  return sample;
+}
+
+template <>
+inline std::int16_t from_float<std::int16_t>(float sample) {
+  return static_cast<std::int16_t>(std::lrint(sample * 32767.0f));
+}
+
+template <typename Sample, int Channels, std::size_t Frames>
+float capture(const DeviceFormat& /*format*/, const void* input, float* out,
+              std::size_t /*frames*/, float gain) {
+  const Sample* in = static_cast<const Sample*>(input);
+  const float scale = gain / Channels;
+  float energy = 0.0f;
+  for (std::size_t i = 0; i < Frames; ++i) {
+    float sum = 0.0f;
+    for (int channel = 0; channel < Channels; ++channel) {
+      sum += to_float(in[i * Channels + channel]);
+    }
+    float sample = std::clamp(sum * scale, -1.0f, 1.0f);
+    out[i] = sample;
+    energy += sample * sample;
+  }
+  return energy;
+}
+
+template <typename Sample, int Channels, std::size_t Frames>
+void playback(const DeviceFormat& /*format*/, const float* in, void* output,
+              std::size_t /*frames*/, float gain) {
+  Sample* out = static_cast<Sample*>(output);
+  for (std::size_t i = 0; i < Frames; ++i) {
+    Sample sample = from_float<Sample>(std::clamp(in[i] * gain, -1.0f, 1.0f));
+    for (int channel = 0; channel < Channels; ++channel) {
+      out[i * Channels + channel] = sample;
+    }
+  }
+}
+
+// Тот же цикл с форматом и длиной во время выполнения
+inline float capture_generic(const DeviceFormat& format, const void* input,
+                             float* out, std::size_t frames, float gain) {
+  const int channels = format.channels;
+  const float scale = gain / channels;
+  float energy = 0.0f;
+  for (std::size_t i = 0; i < frames; ++i) {
+    float sum = 0.0f;
+    for (int channel = 0; channel < channels; ++channel) {
+      std::size_t at = i * channels + channel;
+      sum += format.sample == DeviceSample::kInt16
+                 ? to_float(static_cast<const std::int16_t*>(input)[at])
+                 : static_cast<const float*>(input)[at];
+    }
+    float sample = std::clamp(sum * scale, -1.0f, 1.0f);
+    out[i] = sample;
+    energy += sample * sample;
+  }
+  return energy;
+}
+
+inline void playback_generic(const DeviceFormat& format, const float* in,
+                             void* output, std::size_t frames, float gain) {
+  const int channels = format.channels;
+  for (std::size_t i = 0; i < frames; ++i) {
+    float sample = std::clamp(in[i] * gain, -1.0f, 1.0f);
+    for (int channel = 0; channel < channels; ++channel) {
+      std::size_t at = i * channels + channel;
+      if (format.sample == DeviceSample::kInt16) {
+        static_cast<std::int16_t*>(output)[at] =
+            from_float<std::int16_t>(sample);
+      } else {
+        static_cast<float*>(output)[at] = sample;
+      }
+    }
+  }
+}
+
+struct Entry {
+  DeviceSample sample;
+  int channels;
+  std::size_t frames;
+  CaptureBlock capture;
+  PlaybackBlock playback;
+};
+
+template <typename Sample, int Channels, std::size_t Frames>
+constexpr Entry entry() {
+  return Entry{std::is_same_v<Sample, float> ? DeviceSample::kFloat32
+                                             : DeviceSample::kInt16,
+               Channels, Frames, &capture<Sample, Channels, Frames>,
+               &playback<Sample, Channels, Frames>};
+}
+
+// Форматы, которые отдают обычные звуковые карты, и длины буфера,
+// которые запрашивает клиент
+inline constexpr std::array<Entry, 12> kTable = {
+    entry<float, 1, 128>(),        entry<float, 1, 256>(),
+    entry<float, 1, 512>(),        entry<float, 2, 128>(),
+    entry<float, 2, 256>(),        entry<float, 2, 512>(),
+    entry<std::int16_t, 1, 128>(), entry<std::int16_t, 1, 256>(),
+    entry<std::int16_t, 1, 512>(), entry<std::int16_t, 2, 128>(),
+    entry<std::int16_t, 2, 256>(), entry<std::int16_t, 2, 512>(),
+};
+
+inline const Entry* find(const DeviceFormat& format, std::size_t frames) {
+  for (const Entry& e : kTable) {
+    if (e.sample == format.sample && e.channels == format.channels &&
+        e.frames == frames) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace pipeline
+
+// Цикл под формат и длину буфера; общий, если такого нет в таблице.
+// Выбранный цикл принимает только буферы ровно такой длины.
+inline CaptureBlock select_capture(const DeviceFormat& format,
+                                   std::size_t frames) {
+  const pipeline::Entry* e = pipeline::find(format, frames);
+  return e ? e->capture : &pipeline::capture_generic;
+}
+
+inline PlaybackBlock select_playback(const DeviceFormat& format,
+                                     std::size_t frames) {
+  const pipeline::Entry* e = pipeline::find(format, frames);
+  return e ? e->playback : &pipeline::playback_generic;
+}
+
+inline std::size_t bytes_per_sample(DeviceSample sample) {
+  return sample == DeviceSample::kInt16 ? sizeof(std::int16_t)
+                                        : sizeof(float);
+}
+
+// Детектор речи по энергии блоков: блок громче порога включает речь,
+// и она держится ещё kHangoverMs после последнего такого блока, чтобы
+// не обрезать окончания слов
+class VoiceActivity {
+ public:
+  static constexpr unsigned kHangoverMs = 300;
+
+  // energy — сумма квадратов count сэмплов блока
+  bool update(float energy, std::size_t count, int sample_rate) {
+    float mean = count ? energy / static_cast<float>(count) : 0.0f;
+    if (mean > kThresholdPower) {
+      remaining_ = static_cast<std::size_t>(sample_rate) * kHangoverMs / 1000;
+      return true;
+    }
+    remaining_ = remaining_ > count ? remaining_ - count : 0;
+    return remaining_ > 0;
+  }
+
+ private:
+  // Средний квадрат сэмпла на пороге -45 dBFS
+  static constexpr float kThresholdPower = 3.1622777e-5f;
+
+  std::size_t remaining_ = 0;
+};
+
+}  // namespace audio
+
+#endif  // AUDIO_PIPELINE_H
@@ -0,0 +1,164 @@
+#ifndef AUDIO_TRANSCODER_H
+#define AUDIO_TRANSCODER_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "audio_convert.h"
+#include "protocol.h"
+#include "stream_scheduler.h"
+
+// Перевод голоса отправителя в форматы слушателей (SessionConfig).
+// Каждый кадр переводится в каждый нужный формат не больше одного
+// раза: слушатели с одинаковым форматом получают общий буфер. Частота
+// меняется тоже один раз на целевую частоту, а int16 и float32 с неё
+// получаются отдельно. Ресемплеры хранят историю между кадрами, поэтому
+// перекодировщик свой у каждого отправителя.
+class AudioTranscoder {
+ public:
+  // Форматы нумеруются по audio_flags: биты 0-1 и 2-4
+  static constexpr std::size_t kFormatSlots = 32;
+  static constexpr std::size_t kRateSlots =
+      sizeof(protocol::kSampleRates) / sizeof(protocol::kSampleRates[0]);
+
+  // Начинает рассылку кадра; результаты прошлого кадра отбрасываются
+  void begin(const SharedFrame& frame) {
+    ++epoch_;
+    source_ = frame;
+    auto header = protocol::decode_header(frame->data());
+    source_header_ = header;
+    source_format_ = protocol::audio_format_from_flags(header.flags);
+    // Кадр в неизвестном формате уходит всем как есть
+    valid_ = protocol::is_valid_audio_format(source_format_) &&
+             header.length %
+                     protocol::bytes_per_sample(source_format_.sample_format) ==
+                 0;
+    decoded_epoch_ = 0;
+  }
+
+  // Кадр для слушателя с форматом format
+  const SharedFrame& frame_for(const protocol::AudioFormat& format) {
+    std::uint8_t key = protocol::audio_flags(format);
+    if (!valid_ || key == protocol::audio_flags(source_format_)) {
+      return source_;
+    }
+    Slot& slot = slots_[key % kFormatSlots];
+    if (slot.epoch == epoch_) {
+      ++avoided_;
+      return slot.frame;
+    }
+    slot.epoch = epoch_;
+    slot.frame = encode(format);
+    ++encodes_;
+    return slot.frame;
+  }
+
+  // Отпускает буферы кадра, когда рассылка закончена
+  void end() {
+    source_.reset();
+    for (auto& slot : slots_) {
+      slot.frame.reset();
+    }
+  }
+
+  // Сколько раз кадр переводился в другой формат и сколько слушателей
+  // получили уже готовый перевод
+  std::uint64_t encodes() const { return encodes_; }
+  std::uint64_t avoided() const { return avoided_; }
+
+ private:
+  struct Slot {
+    std::uint64_t epoch = 0;
+    SharedFrame frame;
+  };
+
+  struct RateSlot {
+    std::uint64_t epoch = 0;
+    std::unique_ptr<audio::PolyphaseResampler> resampler;
+    std::vector<float> samples;
+  };
+
+  // Сэмплы источника в float32, по одному разу на кадр
+  const std::vector<float>& decoded() {
+    if (decoded_epoch_ == epoch_) {
+      return decoded_;
+    }
+    decoded_epoch_ = epoch_;
+    const char* payload = source_->data() + protocol::kHeaderSize;
+    std::uint32_t length = source_header_.length;
+    if (source_format_.sample_format == protocol::SampleFormat::kInt16) {
+      decoded_.resize(length / sizeof(std::int16_t));
+      // Полезная нагрузка кадра не выровнена под int16
+      int16_.resize(decoded_.size());
+      std::memcpy(int16_.data(), payload, length);
+      audio::int16_to_float(int16_.data(), decoded_.data(), decoded_.size());
+    } else {
+      decoded_.resize(length / sizeof(float));
+      std::memcpy(decoded_.data(), payload, length);
+    }
+    return decoded_;
+  }
+
+  // Сэмплы на частоте rate, по одному разу на кадр и частоту
+  const std::vector<float>& resampled(std::uint32_t rate) {
+    if (rate == source_format_.sample_rate) {
+      return decoded();
+    }
+    RateSlot& slot =
+        rates_[static_cast<std::size_t>(protocol::sample_rate_index(rate))];
+    if (slot.epoch == epoch_) {
+      return slot.samples;
+    }
+    slot.epoch = epoch_;
+    if (!slot.resampler ||
+        slot.resampler->in_rate() !=
+            static_cast<int>(source_format_.sample_rate)) {
+      slot.resampler = std::make_unique<audio::PolyphaseResampler>(
+          static_cast<int>(source_format_.sample_rate),
+          static_cast<int>(rate));
+    }
+    const std::vector<float>& in = decoded();
+    slot.samples.clear();
+    slot.resampler->process(in.data(), in.size(), slot.samples);
+    return slot.samples;
+  }
+
+  SharedFrame encode(const protocol::AudioFormat& format) {
+    const std::vector<float>& samples = resampled(format.sample_rate);
+    protocol::FrameHeader header = source_header_;
+    header.flags = protocol::audio_flags(format);
+    header.length = static_cast<std::uint32_t>(
+        samples.size() * protocol::bytes_per_sample(format.sample_format));
+    std::vector<char> frame =
+        FramePool::acquire(protocol::kHeaderSize + header.length);
+    protocol::encode_header(header, frame.data());
+    char* payload = frame.data() + protocol::kHeaderSize;
+    if (format.sample_format == protocol::SampleFormat::kInt16) {
+      int16_.resize(samples.size());
+      audio::float_to_int16(samples.data(), int16_.data(), samples.size(),
+                            dither_);
+      std::memcpy(payload, int16_.data(), header.length);
+    } else {
+      std::memcpy(payload, samples.data(), header.length);
+    }
+    return make_shared_frame(std::move(frame));
+  }
+
+  std::uint64_t epoch_ = 0;
+  SharedFrame source_;
+  protocol::FrameHeader source_header_;
+  protocol::AudioFormat source_format_;
+  bool valid_ = false;
+  Slot slots_[kFormatSlots];
+  RateSlot rates_[kRateSlots];
+  std::uint64_t decoded_epoch_ = 0;
+  std::vector<float> decoded_;
+  std::vector<std::int16_t> int16_;
+  audio::DitherState dither_;
+  std::uint64_t encodes_ = 0;
+  std::uint64_t avoided_ = 0;
+};
+
+#endif  // AUDIO_TRANSCODER_H
@@ -0,0 +1,149 @@
+// Сравнение двух прогонов microbench (JSON Google Benchmark): печатает
+// время каждого бенчмарка до и после и падает, если среднее
+// геометрическое отношений выросло больше чем на долю tolerance, какой-то
+// бенчмарк замедлился больше чем в kMaxSlowdown раз или завершился
+// ошибкой. Без прошлого прогона проверяются только ошибки.
+//
+// Отдельный бенчмарк на общей машине гуляет на десятки процентов даже
+// по медиане повторов, среднее по всем — на единицы, поэтому жёсткий
+// порог у среднего, а у отдельных только грубый. Абсолютного порога нет:
+// время зависит от машины, и сравнивать имеет смысл только прогоны
+// на одной машине, например до и после коммита:
+//
+//   cp build/microbench.json /tmp/base.json   # на старом коммите
+//   cmake -DMICROBENCH_BASELINE=/tmp/base.json build && ctest -R microbench
+//
+// Разбор построчный: Google Benchmark пишет по одному ключу на строку.
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace {
+
+constexpr double kMaxSlowdown = 2.0;
+
+struct Result {
+  double cpu_time = 0;
+  std::string unit;
+  bool error = false;
+};
+
+// Значение строки `"key": value,`; пусто, если ключ другой
+std::string value_of(const std::string& line, const std::string& key) {
+  std::string quoted = "\"" + key + "\":";
+  std::size_t at = line.find(quoted);
+  if (at == std::string::npos) {
+    return {};
+  }
+  std::size_t begin = line.find_first_not_of(' ', at + quoted.size());
+  std::size_t end = line.find_last_not_of(", \r");
+  if (begin == std::string::npos || end < begin) {
+    return {};
+  }
+  std::string value = line.substr(begin, end - begin + 1);
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+    value = value.substr(1, value.size() - 2);
+  }
+  return value;
+}
+
+// Результаты по имени бенчмарка. С повторами берётся медиана, а прочие
+// агрегаты (mean, stddev, cv) и отдельные повторы пропускаются
+bool read_results(const char* path, std::map<std::string, Result>& results) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return false;
+  }
+  std::map<std::string, Result> medians;
+  std::string line;
+  std::string name;
+  std::map<std::string, Result>* target = nullptr;
+  while (std::getline(in, line)) {
+    std::string value;
+    if (!(value = value_of(line, "run_name")).empty()) {
+      name = value;
+      target = &results;
+    } else if (!(value = value_of(line, "aggregate_name")).empty()) {
+      target = value == "median" ? &medians : nullptr;
+    } else if (value_of(line, "error_occurred") == "true") {
+      results[name].error = true;
+    } else if (!target) {
+      continue;
+    } else if (!(value = value_of(line, "cpu_time")).empty()) {
+      (*target)[name].cpu_time = std::stod(value);
+    } else if (!(value = value_of(line, "time_unit")).empty()) {
+      (*target)[name].unit = value;
+    }
+  }
+  for (const auto& [median_name, median] : medians) {
+    bool error = results[median_name].error;
+    results[median_name] = median;
+    results[median_name].error = error;
+  }
+  if (results.empty()) {
+    std::cerr << "No benchmarks in " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: benchcompare CURRENT [BASELINE [TOLERANCE]]"
+              << std::endl;
+    return 1;
+  }
+  double tolerance = argc > 3 ? std::stod(argv[3]) : 0.15;
+  std::map<std::string, Result> current;
+  std::map<std::string, Result> baseline;
+  if (!read_results(argv[1], current) ||
+      (argc > 2 && !read_results(argv[2], baseline))) {
+    return 1;
+  }
+  int failed = 0;
+  int compared = 0;
+  double log_sum = 0;
+  for (const auto& [name, result] : current) {
+    if (result.error) {
+      std::printf("%-48s error\n", name.c_str());
+      ++failed;
+      continue;
+    }
+    auto old = baseline.find(name);
+    if (old == baseline.end() || old->second.error ||
+        old->second.unit != result.unit || old->second.cpu_time <= 0) {
+      std::printf("%-48s %12.1f %s\n", name.c_str(), result.cpu_time,
+                  result.unit.c_str());
+      continue;
+    }
+    double ratio = result.cpu_time / old->second.cpu_time;
+    bool failing = ratio > kMaxSlowdown;
+    std::printf("%-48s %12.1f -> %12.1f %s %+7.1f%%%s\n", name.c_str(),
+                old->second.cpu_time, result.cpu_time, result.unit.c_str(),
+                (ratio - 1) * 100,
+                failing ? "  FAILED" : ratio > 1 + tolerance ? "  slower" : "");
+    failed += failing;
+    ++compared;
+    log_sum += std::log(ratio);
+  }
+  if (failed > 0) {
+    std::printf("%d benchmarks failed or slowed down more than %.0f times\n",
+                failed, kMaxSlowdown);
+    return 1;
+  }
+  if (compared > 0) {
+    double change = std::exp(log_sum / compared) - 1;
+    std::printf("Geometric mean of %d benchmarks: %+.1f%% (limit %+.0f%%)\n",
+                compared, change * 100, tolerance * 100);
+    if (change > tolerance) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,319 @@
+#ifndef BITRATE_CONTROL_H
+#define BITRATE_CONTROL_H
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol.h"
+
+// Подстройка голоса под канал клиента. Раз в несколько сотен
+// миллисекунд сервер сравнивает то, что видит сам (возраст голоса
+// в очереди отправки, потерянные кадры, рост задержки входящего голоса
+// по меткам времени клиента), и то, что видит ядро (TCP_INFO: RTT, окно,
+// повторы), и двигает сессию по лестнице уровней. Уровень ограничивает
+// формат сети и интервал пакета; клиент получает их в SessionConfig
+// и перестраивает кодер со следующего пакета. Перегруженный канал
+// получает звук хуже, но без секунд задержки.
+
+struct BitrateLevel {
+  std::uint32_t max_sample_rate;
+  bool int16;
+  std::uint16_t min_packet_ms;
+};
+
+// Уровень 0 — ровно то, что просил клиент
+constexpr BitrateLevel kBitrateLevels[] = {
+    {48000, false, 10},  // до 1536 кбит/с
+    {48000, true, 20},   // 768
+    {24000, true, 20},   // 384
+    {24000, true, 40},   // 384, вдвое меньше кадров
+    {16000, true, 60},   // 256
+};
+constexpr std::size_t kBitrateLevelCount =
+    sizeof(kBitrateLevels) / sizeof(kBitrateLevels[0]);
+
+// Запрос клиента, урезанный до уровня; минимум сервера накладывает
+// вызывающий
+inline protocol::SessionConfig apply_bitrate_level(
+    const protocol::SessionConfig& requested, std::size_t level) {
+  const BitrateLevel& limit = kBitrateLevels[level];
+  protocol::SessionConfig config = requested;
+  if (config.wire_format.sample_rate > limit.max_sample_rate) {
+    config.wire_format.sample_rate = limit.max_sample_rate;
+  }
+  if (limit.int16) {
+    config.wire_format.sample_format = protocol::SampleFormat::kInt16;
+  }
+  config.packet_ms = protocol::negotiate_packet_interval(
+      requested.packet_ms, limit.min_packet_ms);
+  return config;
+}
+
+// Байт голоса в секунду без заголовков
+inline std::uint32_t voice_byte_rate(const protocol::AudioFormat& format) {
+  return format.sample_rate *
+         static_cast<std::uint32_t>(
+             protocol::bytes_per_sample(format.sample_format));
+}
+
+// Замер канала на момент оценки; счётчики — накопленные
+struct LinkSample {
+  // Возраст самого старого голосового кадра в очереди отправки
+  std::chrono::milliseconds voice_age{0};
+  std::uint64_t frames_dropped = 0;
+  // Рост задержки входящего голоса над минимумом
+  std::chrono::milliseconds uplink_delay{0};
+  // Поля TCP_INFO, если их читали в этот раз
+  bool has_tcp_info = false;
+  std::uint32_t rtt_us = 0;
+  std::uint32_t cwnd = 0;
+  std::uint32_t mss = 0;
+  std::uint32_t total_retrans = 0;
+};
+
+// Поля TCP_INFO для LinkSample; false — сокет уже закрыт
+inline bool read_tcp_info(int fd, LinkSample& sample) {
+  tcp_info info{};
+  socklen_t length = sizeof(info);
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0) {
+    return false;
+  }
+  sample.has_tcp_info = true;
+  sample.rtt_us = info.tcpi_rtt;
+  sample.cwnd = info.tcpi_snd_cwnd;
+  sample.mss = info.tcpi_snd_mss;
+  sample.total_retrans = info.tcpi_total_retrans;
+  return true;
+}
+
+enum class Congestion : std::uint8_t {
+  kNone,
+  kQueue,   // голос ждёт в нашей очереди
+  kDrops,   // кадры теряются по памяти
+  kLoss,    // ядро повторяет сегменты
+  kRtt,     // RTT вырос над минимумом: очередь в сети
+  kUplink,  // голос клиента приходит всё позже
+};
+
+inline const char* congestion_name(Congestion congestion) {
+  switch (congestion) {
+    case Congestion::kNone:
+      return "none";
+    case Congestion::kQueue:
+      return "queue";
+    case Congestion::kDrops:
+      return "drops";
+    case Congestion::kLoss:
+      return "loss";
+    case Congestion::kRtt:
+      return "rtt";
+    case Congestion::kUplink:
+      return "uplink";
+  }
+  return "none";
+}
+
+// Понижение — сразу при перегрузке, но не чаще kReaction: клиенту нужно
+// время перейти на новый формат, а очереди — разойтись. Повышение —
+// после probe_wait без перегрузки и при запасе окна TCP; неудачная проба
+// (перегрузка вскоре после повышения) удваивает ожидание.
+class BitrateController {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::milliseconds kReaction{300};
+  static constexpr std::chrono::milliseconds kMaxVoiceAge{150};
+  static constexpr std::chrono::milliseconds kSevereVoiceAge{1000};
+  static constexpr std::chrono::milliseconds kMaxRttGrowth{150};
+  static constexpr std::chrono::milliseconds kMaxUplinkDelay{200};
+  static constexpr std::uint32_t kMaxRetransPerEval = 3;
+  static constexpr std::chrono::seconds kProbeWait{5};
+  static constexpr std::chrono::seconds kMaxProbeWait{60};
+  static constexpr std::chrono::seconds kProbeGrace{10};
+  static constexpr std::chrono::seconds kMinRttWindow{60};
+
+  // Новый уровень или прежний; voice_rate — байт голоса в секунду,
+  // которые сейчас идут клиенту
+  std::size_t update(const LinkSample& sample, double voice_rate,
+                     Clock::time_point now) {
+    congestion_ = classify(sample);
+    remember(sample, now);
+    if (congestion_ != Congestion::kNone) {
+      clean_since_ = now;
+      if (level_ + 1 < kBitrateLevelCount && now - changed_ >= kReaction) {
+        // Повышение не выдержало: следующая проба позже
+        probe_wait_ = now - upgraded_ < kProbeGrace
+                          ? std::min<Clock::duration>(probe_wait_ * 2,
+                                                      kMaxProbeWait)
+                          : Clock::duration(kProbeWait);
+        std::size_t step = sample.voice_age >= kSevereVoiceAge ? 2 : 1;
+        level_ = std::min(level_ + step, kBitrateLevelCount - 1);
+        changed_ = now;
+        ++downgrades_;
+      }
+      return level_;
+    }
+    if (level_ > 0 && now - clean_since_ >= probe_wait_ &&
+        has_headroom(voice_rate)) {
+      --level_;
+      changed_ = now;
+      upgraded_ = now;
+      clean_since_ = now;
+      ++upgrades_;
+    }
+    return level_;
+  }
+
+  std::size_t level() const { return level_; }
+  Congestion congestion() const { return congestion_; }
+  std::uint32_t min_rtt_us() const { return min_rtt_us_; }
+  std::uint64_t downgrades() const { return downgrades_; }
+  std::uint64_t upgrades() const { return upgrades_; }
+
+ private:
+  Congestion classify(const LinkSample& sample) const {
+    if (sample.voice_age >= kMaxVoiceAge) {
+      return Congestion::kQueue;
+    }
+    if (sample.frames_dropped > frames_dropped_) {
+      return Congestion::kDrops;
+    }
+    if (sample.uplink_delay >= kMaxUplinkDelay) {
+      return Congestion::kUplink;
+    }
+    if (!sample.has_tcp_info) {
+      return Congestion::kNone;
+    }
+    if (has_retrans_ &&
+        sample.total_retrans - total_retrans_ >= kMaxRetransPerEval) {
+      return Congestion::kLoss;
+    }
+    if (min_rtt_us_ != 0 &&
+        sample.rtt_us > min_rtt_us_ + static_cast<std::uint32_t>(
+                                          kMaxRttGrowth.count() * 1000)) {
+      return Congestion::kRtt;
+    }
+    return Congestion::kNone;
+  }
+
+  // Минимум RTT заново набирается раз в kMinRttWindow: смена маршрута
+  // не должна навсегда выглядеть перегрузкой
+  void remember(const LinkSample& sample, Clock::time_point now) {
+    frames_dropped_ = sample.frames_dropped;
+    if (!sample.has_tcp_info) {
+      return;
+    }
+    total_retrans_ = sample.total_retrans;
+    has_retrans_ = true;
+    if (now - min_rtt_since_ >= kMinRttWindow) {
+      min_rtt_us_ = 0;
+      min_rtt_since_ = now;
+    }
+    if (sample.rtt_us != 0 &&
+        (min_rtt_us_ == 0 || sample.rtt_us < min_rtt_us_)) {
+      min_rtt_us_ = sample.rtt_us;
+    }
+    cwnd_bytes_ = static_cast<double>(sample.cwnd) * sample.mss;
+    rtt_us_ = sample.rtt_us;
+  }
+
+  // Окно TCP за RTT должно вдвое перекрывать голос следующего уровня;
+  // без замера окна пробуем по одному времени
+  bool has_headroom(double voice_rate) const {
+    if (rtt_us_ == 0 || cwnd_bytes_ == 0 || voice_rate == 0) {
+      return true;
+    }
+    double capacity = cwnd_bytes_ * 1e6 / rtt_us_;
+    double next = voice_rate * level_ratio(level_ - 1, level_);
+    return capacity >= 2 * next;
+  }
+
+  // Во сколько раз голос уровня to тяжелее голоса уровня from
+  static double level_ratio(std::size_t to, std::size_t from) {
+    protocol::SessionConfig full;
+    full.wire_format.sample_rate = 48000;
+    return static_cast<double>(voice_byte_rate(
+               apply_bitrate_level(full, to).wire_format)) /
+           voice_byte_rate(apply_bitrate_level(full, from).wire_format);
+  }
+
+  std::size_t level_ = 0;
+  Congestion congestion_ = Congestion::kNone;
+  Clock::time_point changed_;
+  Clock::time_point upgraded_;
+  Clock::time_point clean_since_;
+  Clock::duration probe_wait_ = kProbeWait;
+  std::uint64_t frames_dropped_ = 0;
+  std::uint32_t total_retrans_ = 0;
+  bool has_retrans_ = false;
+  std::uint32_t min_rtt_us_ = 0;
+  Clock::time_point min_rtt_since_;
+  std::uint32_t rtt_us_ = 0;
+  double cwnd_bytes_ = 0;
+  std::uint64_t downgrades_ = 0;
+  std::uint64_t upgrades_ = 0;
+};
+
+// Задержка входящего голоса по меткам времени клиента: разница между
+// приходом и меткой кадра минус её минимум. Минимум берётся по двум
+// окнам, чтобы расхождение часов не копилось; скачок сразу на полсекунды
+// — это пауза захвата, а не очередь, и отсчёт начинается заново.
+// С коротким окном минимум за одно-два окна догоняет и устойчивый сдвиг
+// задержки меньше полусекунды: так считается опоздание кадра к сроку,
+// а длинное окно нужно подстройке битрейта, для которой такой сдвиг —
+// растущая очередь.
+class UplinkDelay {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::seconds kWindow{10};
+  static constexpr std::chrono::milliseconds kShortWindow{500};
+  static constexpr std::int64_t kDiscontinuityMs = 500;
+
+  explicit UplinkDelay(Clock::duration window = kWindow) : window_(window) {}
+
+  void on_frame(std::uint32_t timestamp_ms, Clock::time_point arrival) {
+    std::int64_t arrival_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            arrival.time_since_epoch())
+            .count();
+    std::int64_t offset = arrival_ms - static_cast<std::int64_t>(timestamp_ms);
+    if (!started_ || offset - last_offset_ > kDiscontinuityMs ||
+        offset < last_offset_ - kDiscontinuityMs) {
+      started_ = true;
+      window_started_ = arrival;
+      current_min_ = previous_min_ = offset;
+    }
+    if (arrival - window_started_ >= window_) {
+      previous_min_ = current_min_;
+      current_min_ = offset;
+      window_started_ = arrival;
+    }
+    current_min_ = std::min(current_min_, offset);
+    last_offset_ = offset;
+  }
+
+  std::chrono::milliseconds delay() const {
+    if (!started_) {
+      return std::chrono::milliseconds(0);
+    }
+    return std::chrono::milliseconds(
+        last_offset_ - std::min(current_min_, previous_min_));
+  }
+
+ private:
+  Clock::duration window_;
+  bool started_ = false;
+  Clock::time_point window_started_;
+  std::int64_t last_offset_ = 0;
+  std::int64_t current_min_ = 0;
+  std::int64_t previous_min_ = 0;
+};
+
+#endif  // BITRATE_CONTROL_H
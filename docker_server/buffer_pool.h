@@ -0,0 +1,329 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Пул буферов чтения, общий для всех сессий одного io_context.
+// Сессия берёт буфер только на время обработки готового к чтению
+// сокета и сразу возвращает, поэтому на сервер нужно несколько буферов,
+// а не по одному на соединение.
+class ReadBufferPool {
+ public:
+  class Buffer {
+   public:
+    Buffer(ReadBufferPool& pool, std::unique_ptr<char[]> data)
+        : pool_(&pool), data_(std::move(data)) {}
+    Buffer(Buffer&& other) = default;
+    Buffer& operator=(Buffer&& other) = default;
+    ~Buffer() {
+      if (data_) {
+        pool_->release(std::move(data_));
+      }
+    }
+
+    char* data() { return data_.get(); }
+    std::size_t size() const { return pool_->buffer_size(); }
+
+   private:
+    ReadBufferPool* pool_;
+    std::unique_ptr<char[]> data_;
+  };
+
+  ReadBufferPool(std::size_t buffer_size, std::size_t max_cached)
+      : buffer_size_(buffer_size), max_cached_(max_cached) {}
+
+  Buffer acquire() {
+    ++in_use_;
+    if (free_.empty()) {
+      return Buffer(*this, std::unique_ptr<char[]>(new char[buffer_size_]));
+    }
+    auto data = std::move(free_.back());
+    free_.pop_back();
+    return Buffer(*this, std::move(data));
+  }
+
+  std::size_t buffer_size() const { return buffer_size_; }
+  // Память, занятая пулом: свободные буферы плюс выданные
+  std::size_t allocated_bytes() const {
+    return (free_.size() + in_use_) * buffer_size_;
+  }
+
+ private:
+  void release(std::unique_ptr<char[]> data) {
+    --in_use_;
+    if (free_.size() < max_cached_) {
+      free_.push_back(std::move(data));
+    }
+  }
+
+  std::size_t buffer_size_;
+  std::size_t max_cached_;
+  std::size_t in_use_ = 0;
+  std::vector<std::unique_ptr<char[]>> free_;
+};
+
+// Буферы кадров по классам размеров, от 256 Б до 128 КиБ: кадр голоса
+// или кусок сообщения получает буфер прошлого такого же кадра вместо
+// нового выделения. У каждого потока свой кэш без блокировок. Излишки
+// уходят пачками на общий склад, а поток с пустым кэшем берёт оттуда:
+// так переиспользуются и буферы, которые создаёт один поток, а отпускает
+// другой (захват звука и io_context клиента, io_context и запись
+// голоса на сервере).
+class FramePool {
+ public:
+  static constexpr std::size_t kMinClassBits = 8;
+  static constexpr std::size_t kClassCount = 10;
+  // Сколько памяти каждого класса держат кэш потока и склад
+  static constexpr std::size_t kLocalBytes = 256 * 1024;
+  static constexpr std::size_t kDepotBytes = 4 * 1024 * 1024;
+
+  struct Stats {
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+    // Байты в кэшах потоков и на складе
+    std::atomic<std::size_t> cached_bytes{0};
+  };
+
+  // Буфер длины size; крупнее старшего класса — обычный вектор
+  static std::vector<char> acquire(std::size_t size) {
+    int index = class_index(size);
+    if (index < 0) {
+      return std::vector<char>(size);
+    }
+    auto& free = local().free[index];
+    if (free.empty()) {
+      depot().take(index, free);
+    }
+    std::vector<char> buffer;
+    if (free.empty()) {
+      stats().misses.fetch_add(1, std::memory_order_relaxed);
+      buffer.reserve(class_size(index));
+    } else {
+      stats().hits.fetch_add(1, std::memory_order_relaxed);
+      stats().cached_bytes.fetch_sub(class_size(index),
+                                     std::memory_order_relaxed);
+      buffer = std::move(free.back());
+      free.pop_back();
+    }
+    buffer.resize(size);
+    return buffer;
+  }
+
+  // Забирает память буфера в пул; buffer остаётся пустым. Буферы
+  // не из пула просто освобождаются.
+  static void release(std::vector<char>& buffer) {
+    int index = class_index(buffer.capacity());
+    if (index < 0 || buffer.capacity() != class_size(index)) {
+      std::vector<char>().swap(buffer);
+      return;
+    }
+    auto& free = local().free[index];
+    if (free.size() >= local_limit(index)) {
+      depot().give(index, free, free.size() / 2);
+    }
+    buffer.clear();
+    stats().cached_bytes.fetch_add(class_size(index),
+                                   std::memory_order_relaxed);
+    free.push_back(std::move(buffer));
+  }
+
+  static Stats& stats() {
+    static Stats stats;
+    return stats;
+  }
+
+ private:
+  using FreeList = std::vector<std::vector<char>>;
+
+  struct Depot {
+    std::mutex mutex;
+    FreeList free[kClassCount];
+
+    // count буферов из кэша потока; сверх предела склада освобождаются
+    void give(int index, FreeList& from, std::size_t count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      FreeList& to = free[index];
+      std::size_t limit = kDepotBytes / class_size(index);
+      for (std::size_t i = 0; i < count; ++i) {
+        if (to.size() < limit) {
+          to.push_back(std::move(from.back()));
+        } else {
+          stats().cached_bytes.fetch_sub(class_size(index),
+                                         std::memory_order_relaxed);
+        }
+        from.pop_back();
+      }
+    }
+
+    void take(int index, FreeList& to) {
+      std::lock_guard<std::mutex> lock(mutex);
+      FreeList& from = free[index];
+      std::size_t count = std::min(from.size(), local_limit(index) / 2);
+      for (std::size_t i = 0; i < count; ++i) {
+        to.push_back(std::move(from.back()));
+        from.pop_back();
+      }
+    }
+  };
+
+  // Кэш уходящего потока достаётся складу
+  struct Cache {
+    FreeList free[kClassCount];
+
+    Cache() { depot(); }
+    ~Cache() {
+      for (std::size_t index = 0; index < kClassCount; ++index) {
+        depot().give(static_cast<int>(index), free[index],
+                     free[index].size());
+      }
+    }
+  };
+
+  static int class_index(std::size_t size) {
+    std::size_t bits = kMinClassBits;
+    while ((std::size_t{1} << bits) < size) {
+      ++bits;
+    }
+    std::size_t index = bits - kMinClassBits;
+    return index < kClassCount ? static_cast<int>(index) : -1;
+  }
+
+  static std::size_t class_size(std::size_t index) {
+    return std::size_t{1} << (kMinClassBits + index);
+  }
+
+  static std::size_t local_limit(std::size_t index) {
+    return std::max<std::size_t>(4, kLocalBytes / class_size(index));
+  }
+
+  static Cache& local() {
+    thread_local Cache cache;
+    return cache;
+  }
+
+  static Depot& depot() {
+    static Depot depot;
+    return depot;
+  }
+};
+
+// Аллокатор для std::allocate_shared: блок управления кадра рассылки
+// берётся из списка своего потока. Как у FramePool, излишки уходят
+// пачками на общий склад, а поток с пустым списком берёт оттуда: кадр
+// создаёт io-поток, а отпускают его и потоки рассылки сцены, и запись
+// голоса. Блоки одного размера — блок управления одного типа.
+template <typename T>
+class RecyclingAllocator {
+ public:
+  using value_type = T;
+  static constexpr std::size_t kLocalBlocks = 256;
+  static constexpr std::size_t kDepotBlocks = 4096;
+
+  RecyclingAllocator() = default;
+  template <typename U>
+  RecyclingAllocator(const RecyclingAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    if (n != 1) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    auto& free = local().blocks;
+    if (free.empty()) {
+      depot().take(free);
+    }
+    if (free.empty()) {
+      return static_cast<T*>(::operator new(sizeof(T)));
+    }
+    void* block = free.back();
+    free.pop_back();
+    return static_cast<T*>(block);
+  }
+
+  void deallocate(T* pointer, std::size_t n) {
+    if (n != 1) {
+      ::operator delete(pointer);
+      return;
+    }
+    auto& free = local().blocks;
+    if (free.size() >= kLocalBlocks) {
+      depot().give(free, free.size() / 2);
+    }
+    free.push_back(pointer);
+  }
+
+  template <typename U>
+  bool operator==(const RecyclingAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const RecyclingAllocator<U>&) const {
+    return false;
+  }
+
+ private:
+  using FreeList = std::vector<void*>;
+
+  struct Depot {
+    std::mutex mutex;
+    FreeList blocks;
+
+    Depot() { blocks.reserve(kDepotBlocks); }
+    ~Depot() {
+      for (void* block : blocks) {
+        ::operator delete(block);
+      }
+    }
+
+    // count блоков из списка потока; сверх предела склада освобождаются
+    void give(FreeList& from, std::size_t count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t i = 0; i < count; ++i) {
+        if (blocks.size() < kDepotBlocks) {
+          blocks.push_back(from.back());
+        } else {
+          ::operator delete(from.back());
+        }
+        from.pop_back();
+      }
+    }
+
+    void take(FreeList& to) {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::size_t count = std::min(blocks.size(), kLocalBlocks / 2);
+      for (std::size_t i = 0; i < count; ++i) {
+        to.push_back(blocks.back());
+        blocks.pop_back();
+      }
+    }
+  };
+
+  // Список уходящего потока достаётся складу
+  struct Cache {
+    FreeList blocks;
+
+    Cache() {
+      depot();
+      blocks.reserve(kLocalBlocks);
+    }
+    ~Cache() { depot().give(blocks, blocks.size()); }
+  };
+
+  static Cache& local() {
+    thread_local Cache cache;
+    return cache;
+  }
+
+  static Depot& depot() {
+    static Depot depot;
+    return depot;
+  }
+};
+
+#endif  // BUFFER_POOL_H
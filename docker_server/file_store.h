@@ -0,0 +1,635 @@
+#ifndef FILE_STORE_H
+#define FILE_STORE_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+#include "sha256.h"
+
+// Хранилище файлов с дедупликацией. Файл режется на куски по
+// содержимому (content-defined chunking), куски хранятся один раз под
+// именем SHA-256 и считаются ссылками из описей файлов. Одинаковые
+// файлы делят все куски, похожие — все, кроме кусков у места правки.
+//
+// Каталог:
+//   chunks/ab/<hash>   — куски, ab — первый байт хеша
+//   files/<id>         — опись файла: размер, число ссылок, список кусков
+//   uploads/<id>.part  — незавершённые загрузки
+
+// Разбиение по содержимому в духе FastCDC: gear-хеш, граница там, где
+// хеш попал под маску. До среднего размера маска строже, после —
+// мягче, чтобы размеры кусков жались к среднему. Граница зависит
+// только от последних 64 байт, поэтому вставка в начало файла сдвигает
+// один-два куска, а не все.
+class ContentChunker {
+ public:
+  static constexpr std::size_t kMinSize = 2 * 1024;
+  static constexpr std::size_t kAvgSize = 8 * 1024;
+  static constexpr std::size_t kMaxSize = 64 * 1024;
+
+  // emit(data, size) вызывается для каждого готового куска
+  template <typename F>
+  void feed(const char* data, std::size_t size, F&& emit) {
+    const std::uint64_t* gear = gear_table();
+    std::size_t start = 0;
+    std::size_t i = 0;
+    while (i < size) {
+      std::size_t length = pending_.size() + (i - start) + 1;
+      if (length < kMinSize) {
+        // Границы короче минимума не бывает: хешировать незачем
+        i += std::min(kMinSize - length, size - i);
+        continue;
+      }
+      hash_ = (hash_ << 1) + gear[static_cast<unsigned char>(data[i])];
+      std::uint64_t mask = length < kAvgSize ? kMaskSmall : kMaskLarge;
+      ++i;
+      if ((hash_ & mask) != 0 && length < kMaxSize) {
+        continue;
+      }
+      if (pending_.empty()) {
+        emit(data + start, i - start);
+      } else {
+        pending_.insert(pending_.end(), data + start, data + i);
+        emit(pending_.data(), pending_.size());
+        pending_.clear();
+      }
+      start = i;
+      hash_ = 0;
+    }
+    pending_.insert(pending_.end(), data + start, data + size);
+  }
+
+  template <typename F>
+  void finish(F&& emit) {
+    if (!pending_.empty()) {
+      emit(pending_.data(), pending_.size());
+    }
+    pending_.clear();
+    hash_ = 0;
+  }
+
+ private:
+  // Маски FastCDC для среднего куска 8 КиБ: 15 и 11 значимых бит
+  static constexpr std::uint64_t kMaskSmall = 0x0003590703530000ull;
+  static constexpr std::uint64_t kMaskLarge = 0x0000d90003530000ull;
+
+  // Таблица фиксирована: от неё зависят границы уже сохранённых кусков
+  static const std::uint64_t* gear_table() {
+    static const auto table = []() {
+      std::vector<std::uint64_t> values(256);
+      std::uint64_t state = 0;
+      for (auto& value : values) {
+        // splitmix64
+        state += 0x9e3779b97f4a7c15ull;
+        std::uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        value = z ^ (z >> 31);
+      }
+      return values;
+    }();
+    return table.data();
+  }
+
+  std::vector<char> pending_;
+  std::uint64_t hash_ = 0;
+};
+
+struct FileIdHash {
+  std::size_t operator()(const protocol::FileId& id) const {
+    std::size_t value;
+    std::memcpy(&value, id.data(), sizeof(value));
+    return value;
+  }
+};
+
+struct StoredChunk {
+  protocol::FileId hash;
+  std::uint32_t size;
+};
+
+// Владелец ссылки на файл: пользователь из токена входа или, без
+// --auth-key, случайный номер сессии с битом kAnonymousHolder. Анонимная
+// ссылка снимается только той же сессией.
+using Holder = std::uint64_t;
+constexpr Holder kAnonymousHolder = Holder(1) << 63;
+// Ссылки из описей старого формата, где владельцев не было; их
+// не снимает никто
+constexpr Holder kLegacyHolder = kAnonymousHolder;
+
+// Опись файла. holders — по записи на каждую загрузку (повторная
+// публикация — ещё одна ссылка её автора); без ссылок опись удаляется,
+// а её куски теряют по ссылке.
+struct Manifest {
+  protocol::FileId id{};
+  std::uint64_t size = 0;
+  std::vector<Holder> holders;
+  std::vector<StoredChunk> chunks;
+};
+
+struct StoreStats {
+  std::size_t files = 0;
+  std::size_t chunks = 0;
+  // Сумма размеров файлов с учётом повторных загрузок
+  std::uint64_t logical_bytes = 0;
+  // Занято кусками на диске
+  std::uint64_t stored_bytes = 0;
+};
+
+class FileStore;
+
+// Незавершённая загрузка. Куски передачи пишутся строго по порядку
+// в .part, поэтому число принятых — это его длина, и загрузка переживает
+// и обрыв соединения, и перезапуск сервера. Параллельно данные режутся
+// по содержимому и сразу сохраняются в хранилище, так что завершение
+// не требует второго прохода по файлу. Куски незавершённой загрузки
+// держат ссылки до её конца; брошенная загрузка их отпускает.
+class Upload {
+ public:
+  Upload(FileStore& store, const protocol::FileId& id, std::uint64_t size,
+         Holder holder, int fd, std::string part_path)
+      : store_(store),
+        id_(id),
+        size_(size),
+        holder_(holder),
+        chunk_count_(protocol::file_chunk_count(size)),
+        fd_(fd),
+        part_path_(std::move(part_path)) {}
+
+  inline ~Upload();
+
+  Upload(const Upload&) = delete;
+  Upload& operator=(const Upload&) = delete;
+
+  const protocol::FileId& id() const { return id_; }
+  std::uint64_t size() const { return size_; }
+  std::uint32_t next_chunk() const { return next_chunk_; }
+
+  // Продолжает с принятых кусков .part: обрезает недописанный хвост
+  // и заново прогоняет принятую часть через хеш и разбиение
+  bool resume() {
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      return false;
+    }
+    std::uint64_t complete = static_cast<std::uint64_t>(st.st_size) /
+                             protocol::kFileChunkSize;
+    next_chunk_ = static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(complete, chunk_count_));
+    std::uint64_t prefix = std::min<std::uint64_t>(
+        std::uint64_t{next_chunk_} * protocol::kFileChunkSize, size_);
+    if (ftruncate(fd_, static_cast<off_t>(prefix)) != 0) {
+      return false;
+    }
+    std::vector<char> buffer(protocol::kFileChunkSize);
+    for (std::uint64_t offset = 0; offset < prefix;) {
+      ssize_t n = pread(fd_, buffer.data(), buffer.size(),
+                        static_cast<off_t>(offset));
+      if (n <= 0) {
+        return false;
+      }
+      consume(buffer.data(), static_cast<std::size_t>(n));
+      offset += static_cast<std::uint64_t>(n);
+    }
+    return true;
+  }
+
+  // Кусок не по порядку (повтор после продолжения) пропускается,
+  // в ответе клиент узнаёт номер ожидаемого
+  protocol::TransferState write_chunk(const protocol::UploadChunk& chunk) {
+    if (chunk.index != next_chunk_) {
+      return protocol::TransferState::kInProgress;
+    }
+    std::uint64_t offset =
+        std::uint64_t{chunk.index} * protocol::kFileChunkSize;
+    std::uint64_t expected =
+        std::min<std::uint64_t>(protocol::kFileChunkSize, size_ - offset);
+    if (chunk.size != expected ||
+        Sha256::digest(chunk.data, chunk.size) != chunk.hash) {
+      return protocol::TransferState::kBadChunk;
+    }
+    for (std::size_t written = 0; written < chunk.size;) {
+      ssize_t n = pwrite(fd_, chunk.data + written, chunk.size - written,
+                         static_cast<off_t>(offset + written));
+      if (n < 0) {
+        return protocol::TransferState::kError;
+      }
+      written += static_cast<std::size_t>(n);
+    }
+    consume(chunk.data, chunk.size);
+    ++next_chunk_;
+    return next_chunk_ == chunk_count_ ? finish()
+                                       : protocol::TransferState::kInProgress;
+  }
+
+  // Все куски приняты (или файл пуст): сверяем хеш всего файла
+  // и записываем опись
+  inline protocol::TransferState finish();
+
+ private:
+  void consume(const char* data, std::size_t size) {
+    whole_.update(data, size);
+    chunker_.feed(data, size, [this](const char* chunk, std::size_t length) {
+      store_chunk(chunk, length);
+    });
+  }
+
+  inline void store_chunk(const char* data, std::size_t size);
+
+  FileStore& store_;
+  protocol::FileId id_;
+  std::uint64_t size_;
+  Holder holder_;
+  std::uint32_t chunk_count_;
+  std::uint32_t next_chunk_ = 0;
+  int fd_;
+  std::string part_path_;
+  Sha256 whole_;
+  ContentChunker chunker_;
+  Manifest manifest_;
+  bool failed_ = false;
+  bool committed_ = false;
+};
+
+class FileStore {
+ public:
+  FileStore(std::string dir, std::uint64_t max_file_size)
+      : dir_(std::move(dir)), max_file_size_(max_file_size) {
+    for (const char* sub : {"", "/chunks", "/files", "/uploads"}) {
+      mkdir((dir_ + sub).c_str(), 0755);
+    }
+    load();
+  }
+
+  // Известный файл (проба по хешу) завершается сразу и получает ещё
+  // одну ссылку holder; nullptr — загружать нечего, state объясняет
+  // почему
+  std::unique_ptr<Upload> begin_upload(const protocol::UploadBegin& begin,
+                                       Holder holder,
+                                       protocol::TransferState& state) {
+    state = protocol::TransferState::kError;
+    if (begin.size > max_file_size_) {
+      return nullptr;
+    }
+    auto known = files_.find(begin.id);
+    if (known != files_.end()) {
+      Manifest& manifest = *known->second;
+      manifest.holders.push_back(holder);
+      if (!save_manifest(manifest)) {
+        manifest.holders.pop_back();
+        return nullptr;
+      }
+      logical_bytes_ += manifest.size;
+      state = protocol::TransferState::kComplete;
+      return nullptr;
+    }
+    std::string part = dir_ + "/uploads/" + to_hex(begin.id) + ".part";
+    int fd = ::open(part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return nullptr;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+      ::close(fd);
+      state = protocol::TransferState::kBusy;
+      return nullptr;
+    }
+    auto upload = std::make_unique<Upload>(*this, begin.id, begin.size,
+                                           holder, fd, std::move(part));
+    if (!upload->resume()) {
+      return nullptr;
+    }
+    if (begin.size == 0) {
+      state = upload->finish();
+      return nullptr;
+    }
+    state = protocol::TransferState::kInProgress;
+    return upload;
+  }
+
+  // Опись для отдачи; nullptr — файла нет. Отдача держит опись, а не
+  // ссылку: если файл удалят посреди скачивания, куски, уже убранные
+  // сборкой мусора, просто не откроются.
+  std::shared_ptr<const Manifest> open_file(const protocol::FileId& id) const {
+    auto it = files_.find(id);
+    if (it == files_.end()) {
+      return nullptr;
+    }
+    return it->second;
+  }
+
+  // Дескриптор куска для sendfile, -1 — куска нет
+  int open_chunk(const protocol::FileId& hash) const {
+    return ::open(chunk_path(hash).c_str(), O_RDONLY | O_CLOEXEC);
+  }
+
+  // Снимает одну ссылку holder на файл. Идентификатор файла знает
+  // каждый, кто его скачивал, поэтому чужие ссылки не снимаются:
+  // kDenied
+  protocol::TransferState release_file(const protocol::FileId& id,
+                                       Holder holder) {
+    auto it = files_.find(id);
+    if (it == files_.end()) {
+      return protocol::TransferState::kNotFound;
+    }
+    Manifest& manifest = *it->second;
+    auto held = std::find(manifest.holders.begin(), manifest.holders.end(),
+                          holder);
+    if (held == manifest.holders.end()) {
+      return protocol::TransferState::kDenied;
+    }
+    manifest.holders.erase(held);
+    logical_bytes_ -= manifest.size;
+    if (!manifest.holders.empty()) {
+      save_manifest(manifest);
+      return protocol::TransferState::kComplete;
+    }
+    std::remove(manifest_path(id).c_str());
+    for (const auto& chunk : manifest.chunks) {
+      release_chunk(chunk.hash);
+    }
+    files_.erase(it);
+    return protocol::TransferState::kComplete;
+  }
+
+  // Удаляет куски без ссылок. Кусок мог снова понадобиться после
+  // того, как попал в список, — такие пропускаем.
+  std::size_t collect_garbage() {
+    std::size_t removed = 0;
+    for (const auto& hash : garbage_) {
+      auto it = chunks_.find(hash);
+      if (it == chunks_.end() || it->second.refs > 0) {
+        continue;
+      }
+      std::remove(chunk_path(hash).c_str());
+      stored_bytes_ -= it->second.size;
+      chunks_.erase(it);
+      ++removed;
+    }
+    garbage_.clear();
+    return removed;
+  }
+
+  StoreStats stats() const {
+    StoreStats stats;
+    stats.files = files_.size();
+    stats.chunks = chunks_.size();
+    stats.logical_bytes = logical_bytes_;
+    stats.stored_bytes = stored_bytes_;
+    return stats;
+  }
+
+ private:
+  friend class Upload;
+
+  struct ChunkEntry {
+    std::uint32_t refs;
+    std::uint32_t size;
+  };
+
+  // Опись: magic, u64 size, u32 ссылок, u32 кусков, куски, затем
+  // владельцы ссылок по u64. В описях kLegacyManifestMagic владельцев
+  // нет.
+  static constexpr char kManifestMagic[4] = {'V', 'M', 'A', '2'};
+  static constexpr char kLegacyManifestMagic[4] = {'V', 'M', 'A', 'N'};
+  static constexpr std::size_t kManifestHeaderSize = 4 + 8 + 4 + 4;
+  static constexpr std::size_t kManifestEntrySize = protocol::kFileIdSize + 4;
+  static constexpr std::size_t kHolderSize = 8;
+
+  std::string chunk_path(const protocol::FileId& hash) const {
+    std::string hex = to_hex(hash);
+    return dir_ + "/chunks/" + hex.substr(0, 2) + "/" + hex;
+  }
+
+  std::string manifest_path(const protocol::FileId& id) const {
+    return dir_ + "/files/" + to_hex(id);
+  }
+
+  // Сохраняет кусок, если его ещё нет, и берёт на него ссылку
+  bool acquire_chunk(const protocol::FileId& hash, const char* data,
+                     std::size_t size) {
+    auto it = chunks_.find(hash);
+    if (it != chunks_.end()) {
+      ++it->second.refs;
+      return true;
+    }
+    std::string path = chunk_path(hash);
+    mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+    if (!write_file(path, data, size)) {
+      return false;
+    }
+    chunks_.emplace(hash, ChunkEntry{1, static_cast<std::uint32_t>(size)});
+    stored_bytes_ += size;
+    return true;
+  }
+
+  void release_chunk(const protocol::FileId& hash) {
+    auto it = chunks_.find(hash);
+    if (it != chunks_.end() && --it->second.refs == 0) {
+      garbage_.push_back(hash);
+    }
+  }
+
+  // Ссылки на куски уже взяты загрузкой и переходят к описи
+  bool commit(const Manifest& manifest) {
+    if (!save_manifest(manifest)) {
+      return false;
+    }
+    logical_bytes_ += manifest.size;
+    files_[manifest.id] = std::make_shared<Manifest>(manifest);
+    return true;
+  }
+
+  // Запись через временный файл и rename: после сбоя на диске либо
+  // старая версия, либо новая
+  static bool write_file(const std::string& path, const char* data,
+                         std::size_t size) {
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    for (std::size_t written = 0; written < size;) {
+      ssize_t n = ::write(fd, data + written, size - written);
+      if (n < 0) {
+        ::close(fd);
+        std::remove(temp.c_str());
+        return false;
+      }
+      written += static_cast<std::size_t>(n);
+    }
+    ::close(fd);
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+  }
+
+  bool save_manifest(const Manifest& manifest) const {
+    std::vector<char> data(kManifestHeaderSize +
+                           manifest.chunks.size() * kManifestEntrySize +
+                           manifest.holders.size() * kHolderSize);
+    std::memcpy(data.data(), kManifestMagic, sizeof(kManifestMagic));
+    protocol::put_u64(data.data() + 4, manifest.size);
+    protocol::put_u32(data.data() + 12,
+                      static_cast<std::uint32_t>(manifest.holders.size()));
+    protocol::put_u32(data.data() + 16,
+                      static_cast<std::uint32_t>(manifest.chunks.size()));
+    char* out = data.data() + kManifestHeaderSize;
+    for (const auto& chunk : manifest.chunks) {
+      std::memcpy(out, chunk.hash.data(), protocol::kFileIdSize);
+      protocol::put_u32(out + protocol::kFileIdSize, chunk.size);
+      out += kManifestEntrySize;
+    }
+    for (Holder holder : manifest.holders) {
+      protocol::put_u64(out, holder);
+      out += kHolderSize;
+    }
+    return write_file(manifest_path(manifest.id), data.data(), data.size());
+  }
+
+  bool load_manifest(const std::string& path, Manifest& manifest) const {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    if (data.size() < kManifestHeaderSize) {
+      return false;
+    }
+    bool legacy = std::memcmp(data.data(), kLegacyManifestMagic,
+                              sizeof(kLegacyManifestMagic)) == 0;
+    if (!legacy &&
+        std::memcmp(data.data(), kManifestMagic, sizeof(kManifestMagic)) !=
+            0) {
+      return false;
+    }
+    manifest.size = protocol::get_u64(data.data() + 4);
+    std::size_t refs = protocol::get_u32(data.data() + 12);
+    std::size_t count = protocol::get_u32(data.data() + 16);
+    if (data.size() != kManifestHeaderSize + count * kManifestEntrySize +
+                           (legacy ? 0 : refs * kHolderSize)) {
+      return false;
+    }
+    const char* entry = data.data() + kManifestHeaderSize;
+    manifest.chunks.resize(count);
+    for (auto& chunk : manifest.chunks) {
+      std::memcpy(chunk.hash.data(), entry, protocol::kFileIdSize);
+      chunk.size = protocol::get_u32(entry + protocol::kFileIdSize);
+      entry += kManifestEntrySize;
+    }
+    manifest.holders.assign(refs, kLegacyHolder);
+    if (!legacy) {
+      for (Holder& holder : manifest.holders) {
+        holder = protocol::get_u64(entry);
+        entry += kHolderSize;
+      }
+    }
+    return true;
+  }
+
+  template <typename F>
+  static void list_dir(const std::string& path, F&& visit) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+      return;
+    }
+    while (dirent* entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        visit(name);
+      }
+    }
+    closedir(dir);
+  }
+
+  // Ссылки на куски восстанавливаются по описям; куски, на которые
+  // никто не ссылается (брошенные загрузки, сбой посреди записи),
+  // удаляются. Брошенные .part остаются для продолжения: их куски
+  // сохранятся заново при повторном проходе.
+  void load() {
+    list_dir(dir_ + "/files", [this](const std::string& name) {
+      auto manifest = std::make_shared<Manifest>();
+      if (!from_hex(name, manifest->id) ||
+          !load_manifest(dir_ + "/files/" + name, *manifest)) {
+        return;
+      }
+      for (const auto& chunk : manifest->chunks) {
+        auto& entry = chunks_[chunk.hash];
+        if (entry.refs++ == 0) {
+          entry.size = chunk.size;
+          stored_bytes_ += chunk.size;
+        }
+      }
+      logical_bytes_ += manifest->size * manifest->holders.size();
+      files_[manifest->id] = std::move(manifest);
+    });
+    list_dir(dir_ + "/chunks", [this](const std::string& sub) {
+      std::string sub_path = dir_ + "/chunks/" + sub;
+      list_dir(sub_path, [this, &sub_path](const std::string& name) {
+        protocol::FileId hash;
+        if (!from_hex(name, hash) || chunks_.count(hash) == 0) {
+          std::remove((sub_path + "/" + name).c_str());
+        }
+      });
+    });
+  }
+
+  std::string dir_;
+  std::uint64_t max_file_size_;
+  std::unordered_map<protocol::FileId, std::shared_ptr<Manifest>, FileIdHash>
+      files_;
+  std::unordered_map<protocol::FileId, ChunkEntry, FileIdHash> chunks_;
+  std::vector<protocol::FileId> garbage_;
+  std::uint64_t logical_bytes_ = 0;
+  std::uint64_t stored_bytes_ = 0;
+};
+
+Upload::~Upload() {
+  ::close(fd_);
+  if (!committed_) {
+    for (const auto& chunk : manifest_.chunks) {
+      store_.release_chunk(chunk.hash);
+    }
+  }
+}
+
+void Upload::store_chunk(const char* data, std::size_t size) {
+  StoredChunk chunk{Sha256::digest(data, size),
+                    static_cast<std::uint32_t>(size)};
+  if (store_.acquire_chunk(chunk.hash, data, size)) {
+    manifest_.chunks.push_back(chunk);
+  } else {
+    failed_ = true;
+  }
+}
+
+protocol::TransferState Upload::finish() {
+  chunker_.finish([this](const char* chunk, std::size_t length) {
+    store_chunk(chunk, length);
+  });
+  if (failed_ || whole_.finish() != id_) {
+    std::remove(part_path_.c_str());
+    return protocol::TransferState::kError;
+  }
+  manifest_.id = id_;
+  manifest_.size = size_;
+  manifest_.holders.assign(1, holder_);
+  if (!store_.commit(manifest_)) {
+    return protocol::TransferState::kError;
+  }
+  committed_ = true;
+  std::remove(part_path_.c_str());
+  return protocol::TransferState::kComplete;
+}
+
+#endif  // FILE_STORE_H
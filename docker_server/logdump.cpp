@@ -0,0 +1,22 @@
+// Перевод бинарного журнала (server --log-format binary) в текст
+#include <fstream>
+#include <iostream>
+
+#include "logger.h"
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: logdump FILE" << std::endl;
+    return 1;
+  }
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    std::cerr << "Cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+  if (!logger::decode_binary(in, std::cout)) {
+    std::cerr << "Corrupted log file" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,577 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Асинхронный журнал для сервера и клиента.
+//
+// Поток, который пишет в журнал, только копирует указатель на строку
+// формата и аргументы в свой кольцевой буфер (SPSC, без блокировок и
+// выделения памяти). Форматирование и запись в файл делает фоновый
+// поток. Если буфер переполнен, сообщение отбрасывается и учитывается
+// в счётчике потерь: журнал никогда не тормозит ни io-поток, ни звук.
+//
+// Формат — строковый литерал с подстановками "{}":
+//   LOG_INFO("New connection from {}:{}", address, port);
+// Для горячих путей есть LOG_SAMPLED (каждое n-е) и LOG_RATE_LIMITED
+// (не чаще раза в интервал).
+namespace logger {
+
+enum class Level : std::uint8_t {
+  kDebug = 0,
+  kInfo = 1,
+  kWarning = 2,
+  kError = 3,
+};
+
+struct Options {
+  Level level = Level::kInfo;
+  // Пусто — stderr
+  std::string path;
+  // Бинарный формат без форматирования; читается утилитой logdump
+  bool binary = false;
+};
+
+inline const char* level_name(Level level) {
+  switch (level) {
+    case Level::kDebug:
+      return "DEBUG";
+    case Level::kInfo:
+      return "INFO";
+    case Level::kWarning:
+      return "WARN";
+    case Level::kError:
+      return "ERROR";
+  }
+  return "?";
+}
+
+inline bool parse_level(const std::string& name, Level& level) {
+  static const std::pair<const char*, Level> kNames[] = {
+      {"debug", Level::kDebug},
+      {"info", Level::kInfo},
+      {"warning", Level::kWarning},
+      {"error", Level::kError}};
+  for (const auto& entry : kNames) {
+    if (name == entry.first) {
+      level = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+namespace detail {
+
+enum class ArgType : std::uint8_t {
+  kInt = 0,
+  kUint = 1,
+  kDouble = 2,
+  kString = 3,
+};
+
+constexpr std::size_t kRecordSize = 256;
+constexpr std::size_t kArgsCapacity = kRecordSize - 24;
+
+struct Record {
+  std::uint64_t timestamp_ns;
+  const char* format;
+  std::uint16_t args_size;
+  Level level;
+  std::uint8_t arg_count;
+  char args[kArgsCapacity];
+};
+static_assert(sizeof(Record) == kRecordSize, "record layout");
+
+// Кольцо одного потока-писателя; читает только фоновый поток
+class Ring {
+ public:
+  static constexpr std::size_t kCapacity = 512;
+
+  explicit Ring(std::uint32_t thread_id) : thread_id_(thread_id) {}
+
+  Record* reserve() {
+    std::uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &records_[head % kCapacity];
+  }
+
+  void commit() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  template <typename F>
+  std::size_t drain(F&& consume) {
+    std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+    std::uint64_t head = head_.load(std::memory_order_acquire);
+    for (std::uint64_t i = tail; i != head; ++i) {
+      consume(records_[i % kCapacity]);
+    }
+    tail_.store(head, std::memory_order_release);
+    return static_cast<std::size_t>(head - tail);
+  }
+
+  std::uint64_t take_dropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+  std::uint32_t thread_id() const { return thread_id_; }
+  void retire() { retired_.store(true, std::memory_order_release); }
+  bool retired() const { return retired_.load(std::memory_order_acquire); }
+
+ private:
+  alignas(64) std::atomic<std::uint64_t> head_{0};
+  alignas(64) std::atomic<std::uint64_t> tail_{0};
+  alignas(64) std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<bool> retired_{false};
+  std::uint32_t thread_id_;
+  Record records_[kCapacity];
+};
+
+// Запись аргументов: тег типа + значение; строки — u16 длина + байты,
+// обрезаются по месту в записи
+class ArgWriter {
+ public:
+  explicit ArgWriter(Record& record) : record_(record) {}
+
+  void write(ArgType type, const void* data, std::size_t size) {
+    if (size_ + 1 + size > kArgsCapacity) {
+      return;
+    }
+    record_.args[size_++] = static_cast<char>(type);
+    std::memcpy(record_.args + size_, data, size);
+    size_ += size;
+    ++record_.arg_count;
+  }
+
+  void write_string(std::string_view value) {
+    if (size_ + 3 > kArgsCapacity) {
+      return;
+    }
+    std::uint16_t length = static_cast<std::uint16_t>(
+        std::min(value.size(), kArgsCapacity - size_ - 3));
+    record_.args[size_++] = static_cast<char>(ArgType::kString);
+    std::memcpy(record_.args + size_, &length, sizeof(length));
+    std::memcpy(record_.args + size_ + 2, value.data(), length);
+    size_ += 2 + length;
+    ++record_.arg_count;
+  }
+
+  std::uint16_t size() const { return static_cast<std::uint16_t>(size_); }
+
+ private:
+  Record& record_;
+  std::size_t size_ = 0;
+};
+
+template <typename T>
+struct AlwaysFalse : std::false_type {};
+
+template <typename T>
+void write_arg(ArgWriter& writer, const T& value) {
+  if constexpr (std::is_same_v<T, bool>) {
+    writer.write_string(value ? "true" : "false");
+  } else if constexpr (std::is_enum_v<T>) {
+    auto raw = static_cast<std::int64_t>(value);
+    writer.write(ArgType::kInt, &raw, sizeof(raw));
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    auto raw = static_cast<std::int64_t>(value);
+    writer.write(ArgType::kInt, &raw, sizeof(raw));
+  } else if constexpr (std::is_integral_v<T>) {
+    auto raw = static_cast<std::uint64_t>(value);
+    writer.write(ArgType::kUint, &raw, sizeof(raw));
+  } else if constexpr (std::is_floating_point_v<T>) {
+    auto raw = static_cast<double>(value);
+    writer.write(ArgType::kDouble, &raw, sizeof(raw));
+  } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    writer.write_string(std::string_view(value));
+  } else {
+    static_assert(AlwaysFalse<T>::value, "unsupported log argument type");
+  }
+}
+
+// Подставляет аргументы записи в формат; общая для текстового вывода
+// и для logdump
+inline std::string format_message(const char* format, std::uint8_t arg_count,
+                                  const char* args, std::size_t args_size) {
+  std::string out;
+  std::size_t offset = 0;
+  std::uint8_t used = 0;
+  for (const char* p = format; *p; ++p) {
+    if (p[0] != '{' || p[1] != '}') {
+      out.push_back(*p);
+      continue;
+    }
+    ++p;
+    if (used == arg_count || offset >= args_size) {
+      out += "{}";
+      continue;
+    }
+    ++used;
+    auto type = static_cast<ArgType>(args[offset++]);
+    switch (type) {
+      case ArgType::kInt: {
+        std::int64_t value;
+        std::memcpy(&value, args + offset, sizeof(value));
+        offset += sizeof(value);
+        out += std::to_string(value);
+        break;
+      }
+      case ArgType::kUint: {
+        std::uint64_t value;
+        std::memcpy(&value, args + offset, sizeof(value));
+        offset += sizeof(value);
+        out += std::to_string(value);
+        break;
+      }
+      case ArgType::kDouble: {
+        double value;
+        std::memcpy(&value, args + offset, sizeof(value));
+        offset += sizeof(value);
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%g", value);
+        out += buffer;
+        break;
+      }
+      case ArgType::kString: {
+        std::uint16_t length;
+        std::memcpy(&length, args + offset, sizeof(length));
+        out.append(args + offset + 2, length);
+        offset += 2 + length;
+        break;
+      }
+    }
+  }
+  return out;
+}
+
+inline std::string format_line(std::uint64_t timestamp_ns, Level level,
+                               std::uint32_t thread_id,
+                               const std::string& message) {
+  std::time_t seconds = static_cast<std::time_t>(timestamp_ns / 1000000000);
+  std::tm local;
+  localtime_r(&seconds, &local);
+  char prefix[64];
+  std::size_t length = std::strftime(prefix, sizeof(prefix),
+                                     "%Y-%m-%d %H:%M:%S", &local);
+  std::snprintf(prefix + length, sizeof(prefix) - length, ".%06u %-5s [T%u] ",
+                static_cast<unsigned>(timestamp_ns / 1000 % 1000000),
+                level_name(level), thread_id);
+  return prefix + message + "\n";
+}
+
+// Бинарный журнал: 'F' id len строка — определение формата при первом
+// использовании; 'R' — запись с неотформатированными аргументами
+constexpr char kBinaryFormatTag = 'F';
+constexpr char kBinaryRecordTag = 'R';
+
+class Logger {
+ public:
+  static Logger& instance() {
+    static Logger logger;
+    return logger;
+  }
+
+  ~Logger() { shutdown(); }
+
+  void configure(const Options& options) {
+    level_.store(options.level, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    if (sink_ && sink_ != stderr) {
+      std::fclose(sink_);
+    }
+    sink_ = stderr;
+    if (!options.path.empty()) {
+      if (std::FILE* file =
+              std::fopen(options.path.c_str(), options.binary ? "wb" : "a")) {
+        sink_ = file;
+      }
+    }
+    binary_ = options.binary && sink_ != stderr;
+    known_formats_.clear();
+  }
+
+  bool enabled(Level level) const {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
+
+  Ring* ring() {
+    thread_local ThreadRing local;
+    if (!local.ring) {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      local.ring = std::make_shared<Ring>(next_thread_id_++);
+      rings_.push_back(local.ring);
+    }
+    return local.ring.get();
+  }
+
+  // Дожидается записи всего, что уже в буферах, и останавливает поток
+  void shutdown() {
+    if (stop_.exchange(true)) {
+      return;
+    }
+    if (writer_.joinable()) {
+      writer_.join();
+    }
+    drain_all();
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    if (sink_) {
+      std::fflush(sink_);
+    }
+  }
+
+ private:
+  static constexpr std::chrono::milliseconds kIdleSleep{5};
+
+  struct ThreadRing {
+    std::shared_ptr<Ring> ring;
+    ~ThreadRing() {
+      if (ring) {
+        ring->retire();
+      }
+    }
+  };
+
+  Logger() : sink_(stderr) {
+    writer_ = std::thread([this]() { run(); });
+  }
+
+  // Без уведомлений от писателей: фоновый поток сам опрашивает кольца,
+  // так что запись в журнал не делает системных вызовов
+  void run() {
+    while (!stop_.load(std::memory_order_acquire)) {
+      if (drain_all() == 0) {
+        std::this_thread::sleep_for(kIdleSleep);
+      }
+    }
+  }
+
+  std::size_t drain_all() {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      rings = rings_;
+    }
+    std::size_t drained = 0;
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    for (auto& ring : rings) {
+      bool retired = ring->retired();
+      drained += ring->drain(
+          [this, &ring](const Record& record) { write(*ring, record); });
+      if (std::uint64_t dropped = ring->take_dropped()) {
+        write_dropped(*ring, dropped);
+      }
+      if (retired) {
+        std::lock_guard<std::mutex> rings_lock(rings_mutex_);
+        rings_.erase(std::remove(rings_.begin(), rings_.end(), ring),
+                     rings_.end());
+      }
+    }
+    if (drained > 0) {
+      std::fflush(sink_);
+    }
+    return drained;
+  }
+
+  void write(const Ring& ring, const Record& record) {
+    if (binary_) {
+      write_binary(ring, record);
+      return;
+    }
+    std::string line = format_line(
+        record.timestamp_ns, record.level, ring.thread_id(),
+        format_message(record.format, record.arg_count, record.args,
+                       record.args_size));
+    std::fwrite(line.data(), 1, line.size(), sink_);
+  }
+
+  void write_binary(const Ring& ring, const Record& record) {
+    auto id = reinterpret_cast<std::uint64_t>(record.format);
+    if (known_formats_.emplace(id, true).second) {
+      std::uint16_t length =
+          static_cast<std::uint16_t>(std::strlen(record.format));
+      std::fputc(kBinaryFormatTag, sink_);
+      std::fwrite(&id, sizeof(id), 1, sink_);
+      std::fwrite(&length, sizeof(length), 1, sink_);
+      std::fwrite(record.format, 1, length, sink_);
+    }
+    std::uint32_t thread_id = ring.thread_id();
+    std::fputc(kBinaryRecordTag, sink_);
+    std::fwrite(&record.timestamp_ns, sizeof(record.timestamp_ns), 1, sink_);
+    std::fputc(static_cast<int>(record.level), sink_);
+    std::fwrite(&thread_id, sizeof(thread_id), 1, sink_);
+    std::fwrite(&id, sizeof(id), 1, sink_);
+    std::fputc(record.arg_count, sink_);
+    std::fwrite(&record.args_size, sizeof(record.args_size), 1, sink_);
+    std::fwrite(record.args, 1, record.args_size, sink_);
+  }
+
+  void write_dropped(const Ring& ring, std::uint64_t dropped) {
+    static const char kFormat[] = "Log buffer full, dropped {} messages";
+    Record record;
+    record.timestamp_ns = now_ns();
+    record.format = kFormat;
+    record.level = Level::kWarning;
+    record.arg_count = 0;
+    ArgWriter writer(record);
+    write_arg(writer, dropped);
+    record.args_size = writer.size();
+    write(ring, record);
+  }
+
+ public:
+  static std::uint64_t now_ns() {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+  }
+
+ private:
+  std::atomic<Level> level_{Level::kInfo};
+  std::atomic<bool> stop_{false};
+  std::mutex rings_mutex_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::uint32_t next_thread_id_ = 1;
+  std::mutex sink_mutex_;
+  std::FILE* sink_;
+  bool binary_ = false;
+  std::unordered_map<std::uint64_t, bool> known_formats_;
+  std::thread writer_;
+};
+
+}  // namespace detail
+
+inline void configure(const Options& options) {
+  detail::Logger::instance().configure(options);
+}
+
+inline void shutdown() { detail::Logger::instance().shutdown(); }
+
+inline bool enabled(Level level) {
+  return detail::Logger::instance().enabled(level);
+}
+
+template <std::size_t N, typename... Args>
+void log(Level level, const char (&format)[N], const Args&... args) {
+  auto& logger = detail::Logger::instance();
+  if (!logger.enabled(level)) {
+    return;
+  }
+  detail::Ring* ring = logger.ring();
+  detail::Record* record = ring->reserve();
+  if (!record) {
+    return;
+  }
+  record->timestamp_ns = detail::Logger::now_ns();
+  record->format = format;
+  record->level = level;
+  record->arg_count = 0;
+  detail::ArgWriter writer(*record);
+  (detail::write_arg(writer, args), ...);
+  record->args_size = writer.size();
+  ring->commit();
+}
+
+// Переводит бинарный журнал в текст; false — файл повреждён
+inline bool decode_binary(std::istream& in, std::ostream& out) {
+  std::unordered_map<std::uint64_t, std::string> formats;
+  auto read = [&in](void* data, std::size_t size) {
+    return static_cast<bool>(
+        in.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+  };
+  for (int tag = in.get(); tag != std::char_traits<char>::eof();
+       tag = in.get()) {
+    std::uint64_t id;
+    if (tag == detail::kBinaryFormatTag) {
+      std::uint16_t length;
+      if (!read(&id, sizeof(id)) || !read(&length, sizeof(length))) {
+        return false;
+      }
+      std::string format(length, '\0');
+      if (!read(format.data(), length)) {
+        return false;
+      }
+      formats[id] = std::move(format);
+      continue;
+    }
+    if (tag != detail::kBinaryRecordTag) {
+      return false;
+    }
+    std::uint64_t timestamp_ns;
+    std::uint8_t level;
+    std::uint32_t thread_id;
+    std::uint8_t arg_count;
+    std::uint16_t args_size;
+    char args[detail::kArgsCapacity];
+    if (!read(&timestamp_ns, sizeof(timestamp_ns)) ||
+        !read(&level, sizeof(level)) ||
+        !read(&thread_id, sizeof(thread_id)) || !read(&id, sizeof(id)) ||
+        !read(&arg_count, sizeof(arg_count)) ||
+        !read(&args_size, sizeof(args_size)) ||
+        args_size > sizeof(args) || !read(args, args_size)) {
+      return false;
+    }
+    auto format = formats.find(id);
+    if (format == formats.end()) {
+      return false;
+    }
+    out << detail::format_line(
+        timestamp_ns, static_cast<Level>(level), thread_id,
+        detail::format_message(format->second.c_str(), arg_count, args,
+                               args_size));
+  }
+  return true;
+}
+
+}  // namespace logger
+
+#define LOG_AT(level, ...) ::logger::log(level, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(::logger::Level::kDebug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(::logger::Level::kInfo, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(::logger::Level::kWarning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(::logger::Level::kError, __VA_ARGS__)
+
+// Каждое n-е сообщение из этого места (счётчик на поток)
+#define LOG_SAMPLED(level, n, ...)                           \
+  do {                                                       \
+    static thread_local std::uint64_t log_sample_counter = 0; \
+    if (log_sample_counter++ % (n) == 0) {                   \
+      LOG_AT(level, __VA_ARGS__);                            \
+    }                                                        \
+  } while (0)
+
+// Не чаще раза в interval_ms миллисекунд из этого места
+#define LOG_RATE_LIMITED(level, interval_ms, ...)                          \
+  do {                                                                     \
+    static std::atomic<std::uint64_t> log_last_ns{0};                      \
+    std::uint64_t log_now_ns = ::logger::detail::Logger::now_ns();         \
+    std::uint64_t log_prev_ns = log_last_ns.load(std::memory_order_relaxed); \
+    if (log_now_ns - log_prev_ns >=                                        \
+            static_cast<std::uint64_t>(interval_ms) * 1000000 &&           \
+        log_last_ns.compare_exchange_strong(log_prev_ns, log_now_ns)) {    \
+      LOG_AT(level, __VA_ARGS__);                                          \
+    }                                                                      \
+  } while (0)
+
+#endif  // LOGGER_H
@@ -0,0 +1,175 @@
+#ifndef LOSS_CONCEALMENT_H
+#define LOSS_CONCEALMENT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Маскировка потерянных кадров голоса по форме волны, в духе
+// G.711 Appendix I: по истории ищется период основного тона, и потеря
+// заполняется повторением последнего периода. Чем дольше потеря, тем
+// больше периодов повторяется (1, 2, 3 — меньше «жужжания»), а после
+// 10 мс звук затухает до тишины. Первый кадр после потери сводится
+// с продолжением подмены, так что на стыке нет щелчка.
+namespace audio {
+
+class LossConcealer {
+ public:
+  // Диапазон периода тона: 400 Гц .. ~66 Гц
+  static constexpr int kMinPitchUs = 2500;
+  static constexpr int kMaxPitchUs = 15000;
+  static constexpr int kFullGainMs = 10;
+  // Затухание до тишины после kFullGainMs; у шума — быстрее
+  static constexpr int kFadeMs = 50;
+  static constexpr int kUnvoicedFadeMs = 20;
+  // Сведение первого кадра после потери
+  static constexpr int kMergeMs = 5;
+  // Нормированная корреляция, ниже которой сигнал считается шумом
+  static constexpr float kVoicedCorrelation = 0.3f;
+
+  explicit LossConcealer(int sample_rate)
+      : sample_rate_(sample_rate),
+        min_pitch_(samples_for_us(kMinPitchUs)),
+        max_pitch_(samples_for_us(kMaxPitchUs)),
+        history_(3 * max_pitch_ + max_pitch_ / 4 + 1, 0.0f),
+        source_(history_.size(), 0.0f) {}
+
+  int sample_rate() const { return sample_rate_; }
+  // Сколько сэмплов подряд подменено сейчас
+  std::size_t concealed() const { return concealed_; }
+
+  // Принятый кадр, на месте: сразу после потери его начало сводится
+  // с продолжением подмены
+  void receive(float* samples, std::size_t count) {
+    if (concealed_ > 0) {
+      std::size_t merge = std::min(
+          count, static_cast<std::size_t>(sample_rate_) * kMergeMs / 1000);
+      for (std::size_t i = 0; i < merge; ++i) {
+        float weight = static_cast<float>(i + 1) / (merge + 1);
+        samples[i] = synthesize() * (1 - weight) + samples[i] * weight;
+      }
+      concealed_ = 0;
+    }
+    remember(samples, count);
+  }
+
+  // Подмена потерянного кадра из count сэмплов
+  void conceal(float* out, std::size_t count) {
+    if (concealed_ == 0) {
+      start();
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      out[i] = synthesize();
+    }
+    remember(out, count);
+  }
+
+ private:
+  std::size_t samples_for_us(int us) const {
+    return static_cast<std::size_t>(sample_rate_) * us / 1000000;
+  }
+
+  void remember(const float* samples, std::size_t count) {
+    std::size_t size = history_.size();
+    if (count >= size) {
+      std::copy(samples + count - size, samples + count, history_.begin());
+      return;
+    }
+    std::copy(history_.begin() + count, history_.end(), history_.begin());
+    std::copy(samples, samples + count, history_.end() - count);
+  }
+
+  // Период тона — сдвиг с наибольшей нормированной корреляцией
+  // последнего max_pitch_ сэмплов истории с более ранними
+  void start() {
+    source_ = history_;
+    const std::size_t size = source_.size();
+    const std::size_t window = max_pitch_;
+    const float* recent = source_.data() + size - window;
+    double recent_energy = 0;
+    for (std::size_t i = 0; i < window; ++i) {
+      recent_energy += recent[i] * recent[i];
+    }
+    const float* earlier = recent - min_pitch_;
+    double energy = 0;
+    for (std::size_t i = 0; i < window; ++i) {
+      energy += earlier[i] * earlier[i];
+    }
+    double best = -1;
+    pitch_ = max_pitch_;
+    for (std::size_t lag = min_pitch_; lag <= max_pitch_; ++lag) {
+      earlier = recent - lag;
+      if (lag > min_pitch_) {
+        // Окно сдвинулось на сэмпл назад
+        energy += earlier[0] * earlier[0] - earlier[window] * earlier[window];
+      }
+      double correlation = 0;
+      for (std::size_t i = 0; i < window; ++i) {
+        correlation += recent[i] * earlier[i];
+      }
+      double norm = std::sqrt(std::max(energy, 0.0) * recent_energy);
+      double score = norm > 0 ? correlation / norm : 0;
+      if (score > best) {
+        best = score;
+        pitch_ = lag;
+      }
+    }
+    voiced_ = best >= kVoicedCorrelation;
+    periods_ = 1;
+    position_ = size - pitch_;
+  }
+
+  // Следующий сэмпл подмены: повтор последних periods_ периодов.
+  // Перед концом повторяемого отрезка сэмплы сводятся с началом, так что
+  // переход на начало отрезка гладкий.
+  float synthesize() {
+    const std::size_t size = source_.size();
+    // Каждые kFullGainMs потери — на период больше, но не больше трёх
+    std::size_t ms = concealed_ * 1000 / static_cast<std::size_t>(sample_rate_);
+    periods_ = std::min<std::size_t>(1 + ms / kFullGainMs, 3);
+    std::size_t span = periods_ * pitch_;
+    std::size_t merge = pitch_ / 4;
+    float value = source_[position_];
+    if (position_ + merge >= size) {
+      float weight = static_cast<float>(size - position_) / (merge + 1);
+      value = value * weight + source_[position_ - span] * (1 - weight);
+    }
+    if (++position_ == size) {
+      position_ = size - span;
+    }
+    float result = value * gain();
+    ++concealed_;
+    return result;
+  }
+
+  float gain() const {
+    std::size_t full = static_cast<std::size_t>(sample_rate_) * kFullGainMs /
+                       1000;
+    if (concealed_ < full) {
+      return 1.0f;
+    }
+    std::size_t fade = static_cast<std::size_t>(sample_rate_) *
+                       (voiced_ ? kFadeMs : kUnvoicedFadeMs) / 1000;
+    std::size_t faded = concealed_ - full;
+    return faded >= fade ? 0.0f : 1.0f - static_cast<float>(faded) / fade;
+  }
+
+  int sample_rate_;
+  std::size_t min_pitch_;
+  std::size_t max_pitch_;
+  // Последние сэмплы на выходе: три наибольших периода и запас на сведение
+  std::vector<float> history_;
+  // История на момент потери, из неё и строится подмена; размер задан
+  // сразу, и копирование в start не выделяет память
+  std::vector<float> source_;
+  std::size_t pitch_ = 0;
+  std::size_t periods_ = 1;
+  std::size_t position_ = 0;
+  std::size_t concealed_ = 0;
+  bool voiced_ = false;
+};
+
+}  // namespace audio
+
+#endif  // LOSS_CONCEALMENT_H
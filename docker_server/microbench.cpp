@@ -0,0 +1,641 @@
+// Микробенчмарки горячих путей сервера на Google Benchmark: разбор
+// кадров из буфера чтения, рассылка голоса слушателям, очередь
+// отправки, пул буферов, преобразование сэмплов и перекодирование
+// голоса с чётностью. Запускается из CTest и пишет JSON, который
+// benchcompare сравнивает с прошлым прогоном:
+//
+//   ctest -R microbench
+//   benchcompare build/microbench.json old.json
+//
+// Сжимающего кодека в проекте нет, голос идёт PCM. Кодирование
+// и декодирование здесь — то, что его заменяет: перевод формата
+// (AudioTranscoder), чётность FEC и маскировка потерь на приёме.
+//
+// Сервер собирается вместе с бенчмарками (server.cpp без main, как
+// в alloctest): разбор и рассылка идут через настоящие Session
+// и Server::deliver_audio на сессиях, подключённых через loopback.
+#define SERVER_NO_MAIN
+#include "server.cpp"
+
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "audio_pipeline.h"
+#include "loss_concealment.h"
+
+namespace {
+
+// 20 мс голоса на 48 кГц
+constexpr std::size_t kVoiceSamples = 960;
+
+std::vector<float> make_noise(std::size_t count) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+  std::vector<float> samples(count);
+  for (float& sample : samples) {
+    sample = noise(random);
+  }
+  return samples;
+}
+
+std::vector<char> make_voice(std::uint32_t sequence,
+                             const protocol::AudioFormat& format) {
+  static const std::vector<float> samples = make_noise(kVoiceSamples);
+  protocol::FrameHeader header;
+  header.type = protocol::MessageType::kAudio;
+  header.flags = protocol::audio_flags(format);
+  header.stream = 1;
+  header.sequence = sequence;
+  header.timestamp = sequence * 20;
+  if (format.sample_format == protocol::SampleFormat::kInt16) {
+    std::vector<std::int16_t> int16(samples.size());
+    audio::DitherState dither;
+    audio::float_to_int16(samples.data(), int16.data(), int16.size(),
+                          dither);
+    return protocol::make_frame(header, int16.data(),
+                                int16.size() * sizeof(std::int16_t));
+  }
+  return protocol::make_frame(header, samples.data(),
+                              samples.size() * sizeof(float));
+}
+
+// Копия принятого кадра в общий буфер, как в Session::handle_frame
+SharedFrame copy_frame(const std::vector<char>& frame) {
+  std::vector<char> copy = FramePool::acquire(frame.size());
+  std::memcpy(copy.data(), frame.data(), frame.size());
+  return make_shared_frame(std::move(copy));
+}
+
+// Сервер и sessions настоящих сессий на соединениях через loopback.
+// io_context крутится вручную (poll) в потоке бенчмарка, он и служит
+// io-потоком сервера. Клиентские концы только вычитываются, чтобы
+// запись сессий не вставала на полном сокете.
+class Room {
+ public:
+  Room(std::size_t sessions, std::size_t converting,
+       const protocol::AudioFormat& other) {
+    if (!mkdtemp(storage_)) {
+      return;
+    }
+    ServerOptions options;
+    options.port = 0;
+    options.storage_path = storage_;
+    // Кадры идут быстрее реального времени и со старыми метками:
+    // ни норма кадров, ни срок голоса не должны их отбрасывать
+    options.rate_limits = RateLimits{};
+    options.voice_deadline_ms = 0;
+    options.stats_interval = 3600;
+    server_ = std::make_unique<Server>(io_context_, options);
+    tcp::acceptor acceptor(
+        io_context_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    for (std::size_t i = 0; i < sessions; ++i) {
+      tcp::socket client(io_context_);
+      client.connect(acceptor.local_endpoint());
+      client.set_option(tcp::no_delay(true));
+      client.non_blocking(true);
+      sessions_.push_back(server_->start_session(acceptor.accept()));
+      clients_.push_back(std::move(client));
+    }
+    // Корзины сессии наполняются только при чтении, поэтому сначала
+    // формат other просят все (каждая сессия что-то прочла), а потом
+    // лишние возвращаются к обычному
+    ready_ = request(0, sessions, other) &&
+             request(converting, sessions, protocol::AudioFormat{});
+    drain();
+  }
+
+  ~Room() {
+    clients_.clear();
+    sessions_.clear();
+    // Как в alloctest: сервер уходит раньше io_context с корутинами сессий
+    server_.reset();
+    std::error_code ec;
+    std::filesystem::remove_all(storage_, ec);
+  }
+
+  // Все сессии вошли и получают нужный формат
+  bool ready() const { return ready_; }
+
+  // Вычитывает всё, что сервер отправил клиентам, и даёт дописать
+  // записям, вставшим на полном сокете
+  void drain() {
+    static char discard[64 * 1024];
+    for (auto& client : clients_) {
+      boost::system::error_code ec;
+      while (client.read_some(boost::asio::buffer(discard), ec) > 0) {
+      }
+    }
+    io_context_.poll();
+  }
+
+  Server& server() { return *server_; }
+  Session& session(std::size_t index) { return *sessions_[index]; }
+
+ private:
+  // Клиенты [begin, end) просят format; false — сессии не вошли или
+  // не переключились
+  bool request(std::size_t begin, std::size_t end,
+               const protocol::AudioFormat& format) {
+    protocol::SessionConfig config;
+    config.wire_format = format;
+    const std::vector<char> frame = protocol::make_session_config(config);
+    for (std::size_t i = begin; i < end; ++i) {
+      boost::asio::write(clients_[i], boost::asio::buffer(frame));
+    }
+    for (int round = 0; round < 1000; ++round) {
+      io_context_.poll();
+      bool switched = true;
+      for (std::size_t i = begin; i < end && switched; ++i) {
+        switched = sessions_[i]->admitted() &&
+                   protocol::audio_flags(sessions_[i]->wire_format()) ==
+                       protocol::audio_flags(format);
+      }
+      if (switched) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  }
+
+  char storage_[32] = "/tmp/microbench-XXXXXX";
+  bool ready_ = false;
+  boost::asio::io_context io_context_{1};
+  std::unique_ptr<Server> server_;
+  std::vector<std::shared_ptr<Session>> sessions_;
+  std::vector<tcp::socket> clients_;
+};
+
+// Session::handle_frames на буфере чтения с кадрами голоса подряд,
+// последний обрезан. Каждый кадр проходит весь путь приёма до рассылки
+// единственному участнику — самой сессии. Аргумент — длина полезной
+// нагрузки.
+void BM_HandleFrames(benchmark::State& state) {
+  const std::size_t payload = static_cast<std::size_t>(state.range(0));
+  Room room(1, 0, protocol::AudioFormat{});
+  if (!room.ready()) {
+    state.SkipWithError("session not admitted");
+    return;
+  }
+  std::vector<char> buffer;
+  protocol::FrameHeader header;
+  header.type = protocol::MessageType::kAudio;
+  header.flags = protocol::audio_flags(protocol::AudioFormat{});
+  std::vector<char> body(payload, 1);
+  while (buffer.size() < 64 * 1024) {
+    auto frame = protocol::make_frame(header, body.data(), body.size());
+    buffer.insert(buffer.end(), frame.begin(), frame.end());
+    ++header.sequence;
+    header.timestamp += 20;
+  }
+  buffer.resize(64 * 1024);
+  Session& session = room.session(0);
+  std::size_t frames = 0;
+  for (auto _ : state) {
+    std::size_t consumed = 0;
+    if (!session.handle_frames(buffer.data(), buffer.size(), consumed)) {
+      state.SkipWithError("bad frame");
+      break;
+    }
+    frames += consumed / (protocol::kHeaderSize + payload);
+    state.PauseTiming();
+    room.drain();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(frames));
+}
+BENCHMARK(BM_HandleFrames)->Arg(8)->Arg(1920)->Arg(4096);
+
+// Server::deliver_audio кадра голоса в комнату: аргументы — число
+// сессий и сколько из них просят другой формат (int16 44.1 кГц вместо
+// float32 48 кГц). Кадр копируется в общий буфер, как в handle_frame.
+void BM_DeliverAudio(benchmark::State& state) {
+  const auto sessions = static_cast<std::size_t>(state.range(0));
+  const auto converting = static_cast<std::size_t>(state.range(1));
+  const protocol::AudioFormat other{44100, protocol::SampleFormat::kInt16};
+  Room room(sessions, converting, other);
+  if (!room.ready()) {
+    state.SkipWithError("sessions not ready");
+    return;
+  }
+  const std::vector<char> voice = make_voice(0, protocol::AudioFormat{});
+  AudioTranscoder transcoder;
+  std::size_t pending = 0;
+  for (auto _ : state) {
+    room.server().deliver_audio(copy_frame(voice), transcoder,
+                                Clock::time_point::max());
+    // Буфера сокета хватает на десятки кадров: вычитываем пачками
+    if (++pending == 16) {
+      pending = 0;
+      state.PauseTiming();
+      room.drain();
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(sessions));
+}
+BENCHMARK(BM_DeliverAudio)
+    ->Args({2, 0})
+    ->Args({8, 0})
+    ->Args({32, 0})
+    ->Args({128, 0})
+    ->Args({512, 0})
+    ->Args({32, 16})
+    ->Args({128, 64});
+
+// Очередь отправки с накопленным хвостом: аргумент — сколько кадров
+// голоса и кусков сообщения стоит в очереди перед разбором
+void BM_WriteQueue(benchmark::State& state) {
+  const auto depth = static_cast<std::size_t>(state.range(0));
+  const protocol::AudioFormat format{48000, protocol::SampleFormat::kInt16};
+  SharedFrame voice = make_shared_frame(make_voice(0, format));
+  std::vector<char> data(depth * protocol::kChunkSize);
+  SharedMessage message = make_shared_message(
+      protocol::make_chunks(7, data.data(), data.size()));
+  SharedFrame ping = make_shared_frame(protocol::make_ping(0));
+  StreamScheduler queue;
+  for (auto _ : state) {
+    Clock::time_point now = Clock::now();
+    queue.push_message(7, 1, message, now);
+    for (std::size_t i = 0; i < depth; ++i) {
+      queue.push(voice, now, Clock::time_point::max());
+    }
+    queue.push(ping, now);
+    while (!queue.empty()) {
+      benchmark::DoNotOptimize(queue.pop(now));
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(2 * depth + 1));
+}
+BENCHMARK(BM_WriteQueue)->Arg(1)->Arg(16)->Arg(256);
+
+// Участники сервера: std::set из shared_ptr, каким был participants_,
+// против SlabTable. Аргумент — число сессий; перед замером треть
+// из них переподключается, чтобы узлы set разошлись по куче, как
+// у долго работающего сервера.
+struct Member {
+  std::uint64_t delivered = 0;
+};
+
+void fill_set(std::set<std::shared_ptr<Member>>& members, std::size_t count,
+              std::mt19937& random) {
+  std::vector<std::shared_ptr<Member>> order;
+  for (std::size_t i = 0; i < count; ++i) {
+    order.push_back(std::make_shared<Member>());
+    members.insert(order.back());
+  }
+  // Чужие выделения между новыми узлами, чтобы те не легли подряд
+  std::vector<std::shared_ptr<Member>> extra;
+  for (std::size_t i = 0; i < count * 3 / 10; ++i) {
+    std::size_t at = random() % order.size();
+    members.erase(order[at]);
+    extra.push_back(std::make_shared<Member>());
+    order[at] = std::make_shared<Member>();
+    members.insert(order[at]);
+  }
+}
+
+void fill_slab(SlabTable<std::shared_ptr<Member>>& members,
+               std::vector<SessionHandle>& handles, std::size_t count,
+               std::mt19937& random) {
+  // Как в fill_set: сессии вперемешку с чужими выделениями
+  std::vector<std::shared_ptr<Member>> extra;
+  for (std::size_t i = 0; i < count; ++i) {
+    handles.push_back(members.insert(std::make_shared<Member>()));
+  }
+  for (std::size_t i = 0; i < count * 3 / 10; ++i) {
+    std::size_t at = random() % handles.size();
+    members.erase(handles[at]);
+    extra.push_back(std::make_shared<Member>());
+    handles[at] = members.insert(std::make_shared<Member>());
+  }
+}
+
+void BM_SessionSetFanout(benchmark::State& state) {
+  std::mt19937 random(1);
+  std::set<std::shared_ptr<Member>> members;
+  fill_set(members, static_cast<std::size_t>(state.range(0)), random);
+  for (auto _ : state) {
+    for (const auto& member : members) {
+      ++member->delivered;
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          state.range(0));
+}
+BENCHMARK(BM_SessionSetFanout)->Arg(1000)->Arg(10000);
+
+void BM_SessionSlabFanout(benchmark::State& state) {
+  std::mt19937 random(1);
+  SlabTable<std::shared_ptr<Member>> members;
+  std::vector<SessionHandle> handles;
+  fill_slab(members, handles, static_cast<std::size_t>(state.range(0)),
+            random);
+  for (auto _ : state) {
+    for (const auto& member : members) {
+      ++member->delivered;
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          state.range(0));
+}
+BENCHMARK(BM_SessionSlabFanout)->Arg(1000)->Arg(10000);
+
+// Выход и вход одной сессии при 10k подключённых
+void BM_SessionSetChurn(benchmark::State& state) {
+  std::mt19937 random(1);
+  std::set<std::shared_ptr<Member>> members;
+  fill_set(members, 10000, random);
+  auto member = std::make_shared<Member>();
+  for (auto _ : state) {
+    members.insert(member);
+    members.erase(member);
+  }
+}
+BENCHMARK(BM_SessionSetChurn);
+
+void BM_SessionSlabChurn(benchmark::State& state) {
+  std::mt19937 random(1);
+  SlabTable<std::shared_ptr<Member>> members;
+  std::vector<SessionHandle> handles;
+  fill_slab(members, handles, 10000, random);
+  auto member = std::make_shared<Member>();
+  for (auto _ : state) {
+    members.erase(members.insert(member));
+  }
+}
+BENCHMARK(BM_SessionSlabChurn);
+
+void BM_FramePool(benchmark::State& state) {
+  const auto size = static_cast<std::size_t>(state.range(0));
+  for (auto _ : state) {
+    std::vector<char> buffer = FramePool::acquire(size);
+    benchmark::DoNotOptimize(buffer.data());
+    FramePool::release(buffer);
+  }
+}
+BENCHMARK(BM_FramePool)->Arg(64)->Arg(1936)->Arg(64 * 1024);
+
+// То же без пула, для сравнения
+void BM_FrameHeap(benchmark::State& state) {
+  const auto size = static_cast<std::size_t>(state.range(0));
+  for (auto _ : state) {
+    std::vector<char> buffer(size);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+}
+BENCHMARK(BM_FrameHeap)->Arg(64)->Arg(1936)->Arg(64 * 1024);
+
+// Кадр от разбора до общего буфера рассылки
+void BM_MakeSharedFrame(benchmark::State& state) {
+  protocol::FrameHeader header;
+  header.type = protocol::MessageType::kAudio;
+  std::vector<char> body(1920, 1);
+  for (auto _ : state) {
+    SharedFrame frame = make_shared_frame(
+        protocol::make_frame(header, body.data(), body.size()));
+    benchmark::DoNotOptimize(frame.get());
+  }
+}
+BENCHMARK(BM_MakeSharedFrame);
+
+// Ядра преобразования по отдельности: скалярное, SSE2 и AVX2 (строки
+// AVX2 есть при сборке с -mavx2) против выбранного при компиляции
+using FloatToInt16 = void (*)(const float*, std::int16_t*, std::size_t,
+                              audio::DitherState&);
+using Int16ToFloat = void (*)(const std::int16_t*, float*, std::size_t);
+using Dot = float (*)(const float*, const float*, std::size_t);
+
+void BM_FloatToInt16(benchmark::State& state, FloatToInt16 kernel) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+  std::vector<float> in = make_noise(count);
+  std::vector<std::int16_t> out(count);
+  audio::DitherState dither;
+  for (auto _ : state) {
+    kernel(in.data(), out.data(), count, dither);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(count));
+}
+BENCHMARK_CAPTURE(BM_FloatToInt16, dispatch, &audio::float_to_int16)
+    ->Arg(kVoiceSamples)
+    ->Arg(4 * kVoiceSamples);
+BENCHMARK_CAPTURE(BM_FloatToInt16, scalar, &audio::float_to_int16_scalar)
+    ->Arg(kVoiceSamples);
+#if defined(__SSE2__)
+BENCHMARK_CAPTURE(BM_FloatToInt16, sse2, &audio::float_to_int16_sse2)
+    ->Arg(kVoiceSamples);
+#endif
+#if defined(__AVX2__)
+BENCHMARK_CAPTURE(BM_FloatToInt16, avx2, &audio::float_to_int16_avx2)
+    ->Arg(kVoiceSamples);
+#endif
+
+void BM_Int16ToFloat(benchmark::State& state, Int16ToFloat kernel) {
+  const auto count = static_cast<std::size_t>(state.range(0));
+  std::vector<std::int16_t> in(count, 1000);
+  std::vector<float> out(count);
+  for (auto _ : state) {
+    kernel(in.data(), out.data(), count);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(count));
+}
+BENCHMARK_CAPTURE(BM_Int16ToFloat, dispatch, &audio::int16_to_float)
+    ->Arg(kVoiceSamples)
+    ->Arg(4 * kVoiceSamples);
+BENCHMARK_CAPTURE(BM_Int16ToFloat, scalar, &audio::int16_to_float_scalar)
+    ->Arg(kVoiceSamples);
+#if defined(__SSE2__)
+BENCHMARK_CAPTURE(BM_Int16ToFloat, sse2, &audio::int16_to_float_sse2)
+    ->Arg(kVoiceSamples);
+#endif
+#if defined(__AVX2__)
+BENCHMARK_CAPTURE(BM_Int16ToFloat, avx2, &audio::int16_to_float_avx2)
+    ->Arg(kVoiceSamples);
+#endif
+
+// Свёртка ресемплера на одну фазу (32 отвода)
+void BM_Dot(benchmark::State& state, Dot kernel) {
+  std::vector<float> a = make_noise(32);
+  std::vector<float> b = make_noise(32);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(kernel(a.data(), b.data(), a.size()));
+  }
+}
+BENCHMARK_CAPTURE(BM_Dot, dispatch, &audio::dot);
+BENCHMARK_CAPTURE(BM_Dot, scalar, &audio::dot_scalar);
+
+// Аргументы — частоты входа и выхода
+void BM_Resample(benchmark::State& state) {
+  const auto in_rate = static_cast<int>(state.range(0));
+  const auto out_rate = static_cast<int>(state.range(1));
+  std::vector<float> in = make_noise(static_cast<std::size_t>(in_rate) / 50);
+  std::vector<float> out;
+  audio::PolyphaseResampler resampler(in_rate, out_rate);
+  for (auto _ : state) {
+    out.clear();
+    resampler.process(in.data(), in.size(), out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(in.size()));
+}
+BENCHMARK(BM_Resample)
+    ->Args({48000, 44100})
+    ->Args({44100, 48000})
+    ->Args({48000, 16000});
+
+// Буфер звуковой карты int16 стерео: цикл из таблицы и общий
+void BM_CaptureBlock(benchmark::State& state) {
+  const bool specialized = state.range(0) != 0;
+  const audio::DeviceFormat format{audio::DeviceSample::kInt16, 2};
+  constexpr std::size_t kFrames = 256;
+  std::vector<std::int16_t> in(kFrames * 2, 1000);
+  std::vector<float> out(kFrames);
+  audio::CaptureBlock block =
+      specialized ? audio::select_capture(format, kFrames)
+                  : &audio::pipeline::capture_generic;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        block(format, in.data(), out.data(), kFrames, 1.0f));
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) *
+                          static_cast<std::int64_t>(kFrames));
+}
+BENCHMARK(BM_CaptureBlock)->Arg(0)->Arg(1);
+
+// Перевод кадра в формат слушателя: int16 48 кГц в float32 на другой
+// частоте и обратно
+void BM_TranscodeFrame(benchmark::State& state) {
+  const protocol::AudioFormat source{
+      48000, state.range(0) != 0 ? protocol::SampleFormat::kInt16
+                                 : protocol::SampleFormat::kFloat32};
+  const protocol::AudioFormat target{
+      static_cast<std::uint32_t>(state.range(1)),
+      state.range(0) != 0 ? protocol::SampleFormat::kFloat32
+                          : protocol::SampleFormat::kInt16};
+  const std::vector<char> voice = make_voice(0, source);
+  AudioTranscoder transcoder;
+  for (auto _ : state) {
+    transcoder.begin(copy_frame(voice));
+    benchmark::DoNotOptimize(transcoder.frame_for(target).get());
+    transcoder.end();
+  }
+}
+BENCHMARK(BM_TranscodeFrame)
+    ->Args({1, 48000})
+    ->Args({1, 44100})
+    ->Args({0, 16000});
+
+// Чётность к голосу: аргумент — размер группы
+void BM_ParityEncode(benchmark::State& state) {
+  const protocol::AudioFormat format{48000, protocol::SampleFormat::kInt16};
+  std::vector<std::vector<char>> frames;
+  for (std::uint32_t i = 0; i < 64; ++i) {
+    frames.push_back(make_voice(i, format));
+  }
+  ParityEncoder encoder;
+  encoder.set_group(static_cast<std::uint8_t>(state.range(0)));
+  std::vector<char> parity;
+  std::size_t next = 0;
+  for (auto _ : state) {
+    if (encoder.add(frames[next].data(), parity)) {
+      FramePool::release(parity);
+    }
+    next = (next + 1) % frames.size();
+  }
+}
+BENCHMARK(BM_ParityEncode)->Arg(2)->Arg(5)->Arg(10);
+
+// Приём группы из group кадров, один из которых потерян и
+// восстанавливается по чётности
+void BM_FecRecover(benchmark::State& state) {
+  const auto group = static_cast<std::uint8_t>(state.range(0));
+  const protocol::AudioFormat format{48000, protocol::SampleFormat::kInt16};
+  ParityEncoder encoder;
+  encoder.set_group(group);
+  std::vector<std::vector<char>> frames;
+  std::vector<char> parity;
+  for (std::uint32_t i = 0; i < group; ++i) {
+    frames.push_back(make_voice(i, format));
+    encoder.add(frames.back().data(), parity);
+  }
+  auto parity_header = protocol::decode_header(parity.data());
+  ReceivedVoice voice;
+  for (auto _ : state) {
+    // Новый приёмник: номера те же, и старое окно их бы отбросило
+    FecReceiver receiver;
+    for (std::uint8_t i = 0; i < group; ++i) {
+      if (i == group / 2) {
+        continue;
+      }
+      auto header = protocol::decode_header(frames[i].data());
+      receiver.on_audio(header, frames[i].data() + protocol::kHeaderSize);
+    }
+    receiver.on_parity(parity_header, parity.data() + protocol::kHeaderSize);
+    std::size_t recovered = 0;
+    while (receiver.pop(voice)) {
+      recovered += voice.kind == ReceivedVoice::Kind::kRecovered;
+    }
+    if (recovered != 1) {
+      state.SkipWithError("frame not recovered");
+      break;
+    }
+  }
+}
+BENCHMARK(BM_FecRecover)->Arg(2)->Arg(5)->Arg(10);
+
+// Приём у клиента: кадр принят, следующий потерян и подменён
+// LossConcealer с поиском тона. Аргумент — частота
+void BM_ConcealLoss(benchmark::State& state) {
+  const int rate = static_cast<int>(state.range(0));
+  const std::size_t count = static_cast<std::size_t>(rate) / 50;
+  std::vector<float> voice(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    double phase = 2 * 3.14159265358979323846 * 150 * i / rate;
+    voice[i] = static_cast<float>(0.4 * std::sin(phase) +
+                                  0.2 * std::sin(3 * phase));
+  }
+  audio::LossConcealer concealer(rate);
+  std::vector<float> received(count);
+  std::vector<float> concealed(count);
+  for (auto _ : state) {
+    received = voice;
+    concealer.receive(received.data(), count);
+    concealer.conceal(concealed.data(), count);
+    benchmark::DoNotOptimize(concealed.data());
+  }
+}
+BENCHMARK(BM_ConcealLoss)->Arg(16000)->Arg(48000);
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  logger::Options log;
+  log.level = logger::Level::kWarning;
+  logger::configure(log);
+  std::signal(SIGPIPE, SIG_IGN);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  logger::shutdown();
+  return 0;
+}
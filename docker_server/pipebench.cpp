@@ -0,0 +1,161 @@
+// Цена обработки буфера звуковой карты (audio_pipeline.h) для каждой
+// конфигурации из таблицы: цикл, собранный под конфигурацию, общий
+// цикл с параметрами времени выполнения и цепочка стадий за
+// std::function, где преобразование, сведение в моно, усиление
+// с ограничением и энергия — отдельные проходы по буферу. Печатается
+// время на буфер в наносекундах.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "audio_pipeline.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr float kGain = 1.4f;
+
+// Стадия цепочки работает над общим буфером моно float
+struct Chain {
+  std::function<void(const void* input, std::size_t frames)> convert;
+  std::vector<std::function<void(std::size_t frames)>> stages;
+};
+
+Chain make_capture_chain(const audio::DeviceFormat& format,
+                         std::vector<float>& wide, std::vector<float>& mono,
+                         float& energy) {
+  Chain chain;
+  const int channels = format.channels;
+  if (format.sample == audio::DeviceSample::kInt16) {
+    chain.convert = [&wide, channels](const void* input, std::size_t frames) {
+      const auto* in = static_cast<const std::int16_t*>(input);
+      for (std::size_t i = 0; i < frames * channels; ++i) {
+        wide[i] = audio::pipeline::to_float(in[i]);
+      }
+    };
+  } else {
+    chain.convert = [&wide, channels](const void* input, std::size_t frames) {
+      const auto* in = static_cast<const float*>(input);
+      std::copy(in, in + frames * channels, wide.begin());
+    };
+  }
+  chain.stages.push_back([&wide, &mono, channels](std::size_t frames) {
+    for (std::size_t i = 0; i < frames; ++i) {
+      float sum = 0.0f;
+      for (int channel = 0; channel < channels; ++channel) {
+        sum += wide[i * channels + channel];
+      }
+      mono[i] = sum / channels;
+    }
+  });
+  chain.stages.push_back([&mono](std::size_t frames) {
+    for (std::size_t i = 0; i < frames; ++i) {
+      mono[i] = std::clamp(mono[i] * kGain, -1.0f, 1.0f);
+    }
+  });
+  chain.stages.push_back([&mono, &energy](std::size_t frames) {
+    energy = 0.0f;
+    for (std::size_t i = 0; i < frames; ++i) {
+      energy += mono[i] * mono[i];
+    }
+  });
+  return chain;
+}
+
+template <typename Body>
+double ns_per_block(unsigned blocks, Body&& body) {
+  body();  // прогрев
+  auto start = Clock::now();
+  for (unsigned i = 0; i < blocks; ++i) {
+    body();
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / blocks;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  unsigned blocks = 100000;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--blocks") {
+      blocks = static_cast<unsigned>(std::stoul(argv[++i]));
+    } else {
+      blocks = 0;
+      break;
+    }
+  }
+  if (blocks == 0) {
+    std::cerr << "Usage: pipebench [--blocks N]" << std::endl;
+    return 1;
+  }
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+  // Хватает на самый длинный буфер в стерео
+  constexpr std::size_t kMaxSamples = 512 * 2;
+  std::vector<float> float_in(kMaxSamples);
+  std::vector<std::int16_t> int16_in(kMaxSamples);
+  for (std::size_t i = 0; i < kMaxSamples; ++i) {
+    float_in[i] = noise(random);
+    int16_in[i] = audio::pipeline::from_float<std::int16_t>(float_in[i]);
+  }
+  std::vector<float> mono(kMaxSamples);
+  std::vector<float> wide(kMaxSamples);
+  std::vector<char> device(kMaxSamples * sizeof(float));
+  // Результаты копятся, чтобы компилятор не выбросил работу
+  float sink = 0.0f;
+
+  std::printf("format  ch frames   capture: table generic  chain   "
+              "playback: table generic\n");
+  for (const audio::pipeline::Entry& entry : audio::pipeline::kTable) {
+    audio::DeviceFormat format{entry.sample, entry.channels};
+    const std::size_t frames = entry.frames;
+    const void* input = format.sample == audio::DeviceSample::kInt16
+                            ? static_cast<const void*>(int16_in.data())
+                            : static_cast<const void*>(float_in.data());
+
+    double capture_table = ns_per_block(blocks, [&] {
+      sink += entry.capture(format, input, mono.data(), frames, kGain);
+    });
+    double capture_generic = ns_per_block(blocks, [&] {
+      sink += audio::pipeline::capture_generic(format, input, mono.data(),
+                                               frames, kGain);
+    });
+    float energy = 0.0f;
+    Chain chain = make_capture_chain(format, wide, mono, energy);
+    double capture_chain = ns_per_block(blocks, [&] {
+      chain.convert(input, frames);
+      for (const auto& stage : chain.stages) {
+        stage(frames);
+      }
+      sink += energy;
+    });
+
+    double playback_table = ns_per_block(blocks, [&] {
+      entry.playback(format, mono.data(), device.data(), frames, kGain);
+      sink += static_cast<float>(device[frames]);
+    });
+    double playback_generic = ns_per_block(blocks, [&] {
+      audio::pipeline::playback_generic(format, mono.data(), device.data(),
+                                        frames, kGain);
+      sink += static_cast<float>(device[frames]);
+    });
+
+    std::printf("%-7s %2d %6zu %14.0f %7.0f %6.0f %16.0f %7.0f\n",
+                format.sample == audio::DeviceSample::kInt16 ? "int16"
+                                                             : "float32",
+                format.channels, frames, capture_table, capture_generic,
+                capture_chain, playback_table, playback_generic);
+  }
+  std::fprintf(stderr, "checksum %g\n", static_cast<double>(sink));
+  return 0;
+}
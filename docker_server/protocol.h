@@ -0,0 +1,653 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "buffer_pool.h"
+
+// Формат кадров, общий для сервера и клиентов.
+// Каждое сообщение: заголовок фиксированной длины + полезная нагрузка.
+// Все поля передаются в little-endian.
+namespace protocol {
+
+enum class MessageType : std::uint8_t {
+  kAudio = 1,          // кадр голоса
+  kSessionConfig = 2,  // согласование параметров сессии
+  kPing = 3,           // проверка живости от сервера
+  kPong = 4,           // ответ клиента, payload копируется из kPing
+  kData = 5,           // сообщение логического потока (чат, файлы...)
+  kUploadBegin = 6,    // начало или продолжение загрузки файла
+  kUploadChunk = 7,    // кусок загружаемого файла с его хешем
+  kDownloadRequest = 8,
+  kTransferStatus = 9,  // ответ сервера на загрузку или запрос файла
+  kFileData = 10,       // кусок отдаваемого файла
+  kReleaseFile = 11,    // снять ссылку на загруженный файл
+  kHello = 12,          // токен сессии, первый кадр клиента
+  kWelcome = 13,        // ответ на kHello: токен для следующего входа
+  kAudioParity = 14,    // чётность группы кадров голоса (voice_fec.h)
+  kPeerCandidates = 15,  // UDP-адреса клиента для прямого звонка
+  kPeerOffer = 16,       // адреса собеседника и ключ пары
+  kPeerProbe = 17,       // проверка пути между клиентами, только UDP
+  kPeerState = 18,       // голос идёт напрямую или через сервер
+};
+
+struct FrameHeader {
+  std::uint32_t length = 0;  // размер полезной нагрузки в байтах
+  MessageType type = MessageType::kAudio;
+  std::uint8_t flags = 0;
+  // Логический поток для kData; у голоса от сервера — отправитель
+  std::uint16_t stream = 0;
+  std::uint32_t sequence = 0;   // номер кадра у отправителя
+  std::uint32_t timestamp = 0;  // время захвата, мс от начала потока
+};
+
+constexpr std::size_t kHeaderSize = 16;
+constexpr std::uint32_t kMaxPayloadSize = 64 * 1024;
+
+inline void put_u16(char* out, std::uint16_t value) {
+  out[0] = static_cast<char>(value & 0xff);
+  out[1] = static_cast<char>(value >> 8);
+}
+
+inline void put_u32(char* out, std::uint32_t value) {
+  put_u16(out, static_cast<std::uint16_t>(value & 0xffff));
+  put_u16(out + 2, static_cast<std::uint16_t>(value >> 16));
+}
+
+inline std::uint16_t get_u16(const char* in) {
+  return static_cast<std::uint16_t>(static_cast<unsigned char>(in[0]) |
+                                    static_cast<unsigned char>(in[1]) << 8);
+}
+
+inline std::uint32_t get_u32(const char* in) {
+  return get_u16(in) | static_cast<std::uint32_t>(get_u16(in + 2)) << 16;
+}
+
+inline void put_u64(char* out, std::uint64_t value) {
+  put_u32(out, static_cast<std::uint32_t>(value & 0xffffffffu));
+  put_u32(out + 4, static_cast<std::uint32_t>(value >> 32));
+}
+
+inline std::uint64_t get_u64(const char* in) {
+  return get_u32(in) | static_cast<std::uint64_t>(get_u32(in + 4)) << 32;
+}
+
+inline void encode_header(const FrameHeader& header, char* out) {
+  put_u32(out, header.length);
+  out[4] = static_cast<char>(header.type);
+  out[5] = static_cast<char>(header.flags);
+  put_u16(out + 6, header.stream);
+  put_u32(out + 8, header.sequence);
+  put_u32(out + 12, header.timestamp);
+}
+
+inline FrameHeader decode_header(const char* in) {
+  FrameHeader header;
+  header.length = get_u32(in);
+  header.type = static_cast<MessageType>(in[4]);
+  header.flags = static_cast<std::uint8_t>(in[5]);
+  header.stream = get_u16(in + 6);
+  header.sequence = get_u32(in + 8);
+  header.timestamp = get_u32(in + 12);
+  return header;
+}
+
+// Собирает готовый к отправке кадр: заголовок + данные
+inline std::vector<char> make_frame(FrameHeader header, const void* payload,
+                                    std::size_t size) {
+  header.length = static_cast<std::uint32_t>(size);
+  std::vector<char> frame = FramePool::acquire(kHeaderSize + size);
+  encode_header(header, frame.data());
+  if (size > 0) {
+    std::memcpy(frame.data() + kHeaderSize, payload, size);
+  }
+  return frame;
+}
+
+// Ping несёт время отправки по часам сервера (нс); клиент возвращает
+// payload без изменений, и сервер считает RTT без синхронизации часов
+constexpr std::size_t kPingSize = 8;
+
+inline std::vector<char> make_ping(std::uint64_t sent_ns) {
+  char payload[kPingSize];
+  put_u64(payload, sent_ns);
+  FrameHeader header;
+  header.type = MessageType::kPing;
+  return make_frame(header, payload, sizeof(payload));
+}
+
+inline std::vector<char> make_pong(const char* ping_payload,
+                                   std::size_t size) {
+  FrameHeader header;
+  header.type = MessageType::kPong;
+  return make_frame(header, ping_payload, size);
+}
+
+// Интервал пакетизации: сколько миллисекунд звука несёт один кадр.
+// Отвязан от размера буфера устройства, клиент копит данные до интервала.
+constexpr std::uint16_t kPacketIntervalsMs[] = {10, 20, 40, 60};
+constexpr std::uint16_t kDefaultPacketMs = 20;
+constexpr std::uint16_t kMaxPacketMs = 60;
+
+inline bool is_valid_packet_interval(std::uint16_t ms) {
+  for (auto allowed : kPacketIntervalsMs) {
+    if (allowed == ms) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Наименьший допустимый интервал, не меньше запрошенного и минимума сервера
+inline std::uint16_t negotiate_packet_interval(std::uint16_t requested,
+                                               std::uint16_t server_min) {
+  std::uint16_t wanted = requested > server_min ? requested : server_min;
+  for (auto allowed : kPacketIntervalsMs) {
+    if (allowed >= wanted) {
+      return allowed;
+    }
+  }
+  return kMaxPacketMs;
+}
+
+// Следующий интервал в списке (step > 0 — крупнее, step < 0 — мельче)
+inline std::uint16_t step_packet_interval(std::uint16_t ms, int step) {
+  constexpr int count =
+      sizeof(kPacketIntervalsMs) / sizeof(kPacketIntervalsMs[0]);
+  int index = 0;
+  while (index < count - 1 && kPacketIntervalsMs[index] < ms) {
+    ++index;
+  }
+  index += step;
+  if (index < 0) {
+    index = 0;
+  } else if (index >= count) {
+    index = count - 1;
+  }
+  return kPacketIntervalsMs[index];
+}
+
+// Формат звука в сети. Для аудиокадров он же кодируется во flags
+// заголовка: биты 0-1 — формат сэмплов, биты 2-4 — индекс частоты.
+enum class SampleFormat : std::uint8_t {
+  kFloat32 = 0,
+  kInt16 = 1,
+};
+
+constexpr std::uint32_t kSampleRates[] = {44100, 48000, 24000, 16000};
+
+struct AudioFormat {
+  std::uint32_t sample_rate = 48000;
+  SampleFormat sample_format = SampleFormat::kFloat32;
+};
+
+inline int sample_rate_index(std::uint32_t sample_rate) {
+  for (int i = 0; i < static_cast<int>(sizeof(kSampleRates) /
+                                       sizeof(kSampleRates[0]));
+       ++i) {
+    if (kSampleRates[i] == sample_rate) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+inline bool is_valid_audio_format(const AudioFormat& format) {
+  return sample_rate_index(format.sample_rate) >= 0 &&
+         (format.sample_format == SampleFormat::kFloat32 ||
+          format.sample_format == SampleFormat::kInt16);
+}
+
+inline std::size_t bytes_per_sample(SampleFormat format) {
+  return format == SampleFormat::kInt16 ? 2 : 4;
+}
+
+inline std::uint8_t audio_flags(const AudioFormat& format) {
+  return static_cast<std::uint8_t>(
+      static_cast<std::uint8_t>(format.sample_format) |
+      sample_rate_index(format.sample_rate) << 2);
+}
+
+inline AudioFormat audio_format_from_flags(std::uint8_t flags) {
+  AudioFormat format;
+  format.sample_format = static_cast<SampleFormat>(flags & 0x03);
+  std::size_t index = (flags >> 2) & 0x07;
+  if (index < sizeof(kSampleRates) / sizeof(kSampleRates[0])) {
+    format.sample_rate = kSampleRates[index];
+  }
+  return format;
+}
+
+// Параметры сессии. Клиент присылает желаемые значения,
+// сервер отвечает принятыми и может прислать новые в любой момент.
+struct SessionConfig {
+  std::uint16_t packet_ms = kDefaultPacketMs;
+  AudioFormat wire_format;
+  // Клиент просит кадры чётности к голосу (kAudioParity)
+  bool fec = false;
+};
+
+// Старые клиенты шлют 4 байта без флага FEC
+constexpr std::size_t kSessionConfigSize = 4;
+constexpr std::size_t kSessionConfigFecSize = 5;
+
+inline std::vector<char> make_session_config(const SessionConfig& config) {
+  char payload[kSessionConfigFecSize] = {};
+  put_u16(payload, config.packet_ms);
+  payload[2] =
+      static_cast<char>(sample_rate_index(config.wire_format.sample_rate));
+  payload[3] = static_cast<char>(config.wire_format.sample_format);
+  payload[4] = config.fec ? 1 : 0;
+  FrameHeader header;
+  header.type = MessageType::kSessionConfig;
+  return make_frame(header, payload, sizeof(payload));
+}
+
+inline bool decode_session_config(const char* payload, std::size_t size,
+                                  SessionConfig& config) {
+  if (size < kSessionConfigSize) {
+    return false;
+  }
+  config.packet_ms = get_u16(payload);
+  std::size_t rate_index = static_cast<unsigned char>(payload[2]);
+  if (rate_index >= sizeof(kSampleRates) / sizeof(kSampleRates[0])) {
+    return false;
+  }
+  config.wire_format.sample_rate = kSampleRates[rate_index];
+  config.wire_format.sample_format = static_cast<SampleFormat>(payload[3]);
+  config.fec = size >= kSessionConfigFecSize && payload[4] != 0;
+  return is_valid_audio_format(config.wire_format);
+}
+
+// Кадр чётности закрывает группу подряд идущих кадров голоса одного
+// отправителя: sequence и stream заголовка — первый кадр группы и
+// отправитель. Payload: число кадров, XOR их flags, длин и меток времени,
+// затем XOR полезных нагрузок, дополненных нулями до самой длинной.
+// По нему восстанавливается один потерянный кадр группы.
+struct ParityHeader {
+  std::uint8_t count = 0;
+  std::uint8_t flags_xor = 0;
+  std::uint32_t length_xor = 0;
+  std::uint32_t timestamp_xor = 0;
+};
+
+constexpr std::size_t kParityHeaderSize = 12;
+
+inline void encode_parity_header(const ParityHeader& parity, char* out) {
+  out[0] = static_cast<char>(parity.count);
+  out[1] = static_cast<char>(parity.flags_xor);
+  put_u16(out + 2, 0);
+  put_u32(out + 4, parity.length_xor);
+  put_u32(out + 8, parity.timestamp_xor);
+}
+
+inline bool decode_parity_header(const char* payload, std::size_t size,
+                                 ParityHeader& parity) {
+  if (size < kParityHeaderSize) {
+    return false;
+  }
+  parity.count = static_cast<std::uint8_t>(payload[0]);
+  parity.flags_xor = static_cast<std::uint8_t>(payload[1]);
+  parity.length_xor = get_u32(payload + 4);
+  parity.timestamp_xor = get_u32(payload + 8);
+  return parity.count > 0;
+}
+
+// Логические потоки поверх одного соединения. Голос (kAudio) и служебные
+// кадры идут вне потоков со строгим приоритетом; сообщения kData несут
+// номер потока в заголовке и делят остаток канала по весам.
+constexpr std::uint16_t kStreamChat = 1;
+constexpr std::uint16_t kStreamPresence = 2;
+constexpr std::uint16_t kStreamFile = 3;
+
+// Большое сообщение kData режется на куски не длиннее kChunkSize; у всех
+// кусков, кроме последнего, стоит kFlagMoreChunks. Куски одного потока
+// не перемежаются с другими сообщениями того же потока, так что
+// получатель собирает сообщение по номеру потока.
+constexpr std::size_t kChunkSize = 4096;
+constexpr std::uint8_t kFlagMoreChunks = 0x80;
+// Предел собранного сообщения, которое сервер пересылает другим
+constexpr std::size_t kMaxMessageSize = 1024 * 1024;
+
+inline std::vector<std::vector<char>> make_chunks(std::uint16_t stream,
+                                                  const char* payload,
+                                                  std::size_t size) {
+  std::vector<std::vector<char>> chunks;
+  FrameHeader header;
+  header.type = MessageType::kData;
+  header.stream = stream;
+  std::size_t offset = 0;
+  do {
+    std::size_t length = size - offset < kChunkSize ? size - offset
+                                                    : kChunkSize;
+    header.flags = offset + length < size ? kFlagMoreChunks : 0;
+    chunks.push_back(make_frame(header, payload + offset, length));
+    offset += length;
+  } while (offset < size);
+  return chunks;
+}
+
+// Передача файлов. Файл адресуется SHA-256 содержимого и передаётся
+// кусками по kFileChunkSize. Загрузка идёт по порядку кусков, каждый со
+// своим хешем; сервер подтверждает каждый кусок номером следующего
+// ожидаемого, так что после обрыва клиент продолжает с этого номера.
+// Скачивание продолжается со смещения, которое уже есть у клиента.
+using FileId = std::array<unsigned char, 32>;
+
+constexpr std::size_t kFileIdSize = 32;
+constexpr std::uint32_t kFileChunkSize = 32 * 1024;
+
+inline std::uint32_t file_chunk_count(std::uint64_t size) {
+  return static_cast<std::uint32_t>((size + kFileChunkSize - 1) /
+                                    kFileChunkSize);
+}
+
+enum class TransferState : std::uint8_t {
+  kInProgress = 0,
+  kComplete = 1,
+  kBadChunk = 2,  // кусок не сошёлся с хешем, повторить с next_chunk
+  kBusy = 3,      // файл уже загружается другим соединением
+  kNotFound = 4,
+  kError = 5,
+  kDenied = 6,  // ссылку на файл держит другой пользователь
+};
+
+struct UploadBegin {
+  FileId id{};
+  std::uint64_t size = 0;
+};
+
+struct UploadChunk {
+  FileId id{};
+  std::uint32_t index = 0;
+  FileId hash{};
+  const char* data = nullptr;
+  std::size_t size = 0;
+};
+
+struct DownloadRequest {
+  FileId id{};
+  std::uint64_t offset = 0;
+};
+
+struct TransferStatus {
+  FileId id{};
+  TransferState state = TransferState::kInProgress;
+  std::uint32_t next_chunk = 0;
+  std::uint64_t size = 0;
+};
+
+constexpr std::size_t kUploadBeginSize = kFileIdSize + 8;
+constexpr std::size_t kUploadChunkHeaderSize = kFileIdSize + 4 + kFileIdSize;
+constexpr std::size_t kDownloadRequestSize = kFileIdSize + 8;
+constexpr std::size_t kTransferStatusSize = kFileIdSize + 1 + 4 + 8;
+
+inline std::vector<char> make_upload_begin(const UploadBegin& begin) {
+  char payload[kUploadBeginSize];
+  std::memcpy(payload, begin.id.data(), kFileIdSize);
+  put_u64(payload + kFileIdSize, begin.size);
+  FrameHeader header;
+  header.type = MessageType::kUploadBegin;
+  return make_frame(header, payload, sizeof(payload));
+}
+
+inline bool decode_upload_begin(const char* payload, std::size_t size,
+                                UploadBegin& begin) {
+  if (size < kUploadBeginSize) {
+    return false;
+  }
+  std::memcpy(begin.id.data(), payload, kFileIdSize);
+  begin.size = get_u64(payload + kFileIdSize);
+  return true;
+}
+
+inline std::vector<char> make_upload_chunk(const UploadChunk& chunk) {
+  FrameHeader header;
+  header.type = MessageType::kUploadChunk;
+  header.stream = kStreamFile;
+  header.length =
+      static_cast<std::uint32_t>(kUploadChunkHeaderSize + chunk.size);
+  std::vector<char> frame(kHeaderSize + header.length);
+  encode_header(header, frame.data());
+  char* out = frame.data() + kHeaderSize;
+  std::memcpy(out, chunk.id.data(), kFileIdSize);
+  put_u32(out + kFileIdSize, chunk.index);
+  std::memcpy(out + kFileIdSize + 4, chunk.hash.data(), kFileIdSize);
+  if (chunk.size > 0) {
+    std::memcpy(out + kUploadChunkHeaderSize, chunk.data, chunk.size);
+  }
+  return frame;
+}
+
+// data указывает внутрь payload, копирования нет
+inline bool decode_upload_chunk(const char* payload, std::size_t size,
+                                UploadChunk& chunk) {
+  if (size < kUploadChunkHeaderSize) {
+    return false;
+  }
+  std::memcpy(chunk.id.data(), payload, kFileIdSize);
+  chunk.index = get_u32(payload + kFileIdSize);
+  std::memcpy(chunk.hash.data(), payload + kFileIdSize + 4, kFileIdSize);
+  chunk.data = payload + kUploadChunkHeaderSize;
+  chunk.size = size - kUploadChunkHeaderSize;
+  return true;
+}
+
+inline std::vector<char> make_download_request(
+    const DownloadRequest& request) {
+  char payload[kDownloadRequestSize];
+  std::memcpy(payload, request.id.data(), kFileIdSize);
+  put_u64(payload + kFileIdSize, request.offset);
+  FrameHeader header;
+  header.type = MessageType::kDownloadRequest;
+  return make_frame(header, payload, sizeof(payload));
+}
+
+inline bool decode_download_request(const char* payload, std::size_t size,
+                                    DownloadRequest& request) {
+  if (size < kDownloadRequestSize) {
+    return false;
+  }
+  std::memcpy(request.id.data(), payload, kFileIdSize);
+  request.offset = get_u64(payload + kFileIdSize);
+  return true;
+}
+
+inline std::vector<char> make_transfer_status(const TransferStatus& status) {
+  char payload[kTransferStatusSize];
+  std::memcpy(payload, status.id.data(), kFileIdSize);
+  payload[kFileIdSize] = static_cast<char>(status.state);
+  put_u32(payload + kFileIdSize + 1, status.next_chunk);
+  put_u64(payload + kFileIdSize + 5, status.size);
+  FrameHeader header;
+  header.type = MessageType::kTransferStatus;
+  return make_frame(header, payload, sizeof(payload));
+}
+
+inline bool decode_transfer_status(const char* payload, std::size_t size,
+                                   TransferStatus& status) {
+  if (size < kTransferStatusSize) {
+    return false;
+  }
+  std::memcpy(status.id.data(), payload, kFileIdSize);
+  status.state = static_cast<TransferState>(payload[kFileIdSize]);
+  status.next_chunk = get_u32(payload + kFileIdSize + 1);
+  status.size = get_u64(payload + kFileIdSize + 5);
+  return true;
+}
+
+// Ссылку на файл снимает тот, кто его опубликовал, например при удалении
+// сообщения; ответ — kTransferStatus с kComplete или kNotFound
+inline std::vector<char> make_release_file(const FileId& id) {
+  FrameHeader header;
+  header.type = MessageType::kReleaseFile;
+  return make_frame(header, id.data(), id.size());
+}
+
+// Заголовок кадра kFileData; содержимое сервер отправляет отдельно,
+// sendfile из файла. sequence — номер куска.
+inline FrameHeader file_data_header(std::uint64_t offset, std::uint32_t length,
+                                    bool more) {
+  FrameHeader header;
+  header.type = MessageType::kFileData;
+  header.stream = kStreamFile;
+  header.length = length;
+  header.flags = more ? kFlagMoreChunks : 0;
+  header.sequence = static_cast<std::uint32_t>(offset / kFileChunkSize);
+  return header;
+}
+
+// Вход в сессию. Токен проверяется без обращения к хранилищу:
+// id пользователя и срок действия (UNIX-время, секунды) подписаны
+// HMAC-SHA256 ключом сервера. Если сервер требует вход, kHello —
+// обязательный первый кадр; kWelcome возвращает токен, который
+// клиент предъявит при следующем подключении.
+constexpr std::size_t kSessionTokenSize = 8 + 8 + 32;
+using SessionToken = std::array<unsigned char, kSessionTokenSize>;
+
+inline std::vector<char> make_hello(const SessionToken& token) {
+  FrameHeader header;
+  header.type = MessageType::kHello;
+  return make_frame(header, token.data(), token.size());
+}
+
+inline std::vector<char> make_welcome(const SessionToken& token) {
+  FrameHeader header;
+  header.type = MessageType::kWelcome;
+  return make_frame(header, token.data(), token.size());
+}
+
+inline bool decode_session_token(const char* payload, std::size_t size,
+                                 SessionToken& token) {
+  if (size < kSessionTokenSize) {
+    return false;
+  }
+  std::memcpy(token.data(), payload, kSessionTokenSize);
+  return true;
+}
+
+// Прямой звонок. Когда в комнате ровно двое, сервер пересылает каждому
+// UDP-адреса другого (kPeerOffer) и общий ключ. Клиенты шлют друг другу
+// kPeerProbe на все адреса; ответ с kFlagProbeAck подтверждает путь
+// в обе стороны, и клиент переводит свой голос на UDP, сообщив серверу
+// kPeerState kDirect. Голос по UDP — обычные кадры kAudio. Если путь
+// не нашёлся или пропал, клиент возвращается к серверу (kRelay); сервер
+// шлёт kRelay обоим, когда в комнате появляется третий.
+struct PeerCandidate {
+  std::uint32_t address = 0;  // IPv4, порядок хоста
+  std::uint16_t port = 0;
+};
+
+constexpr std::size_t kMaxPeerCandidates = 8;
+constexpr std::size_t kPeerCandidateSize = 6;
+
+struct PeerOffer {
+  std::uint16_t peer = 0;  // номер потока голоса собеседника
+  std::uint64_t key = 0;
+  std::vector<PeerCandidate> candidates;
+};
+
+enum class PeerState : std::uint8_t {
+  kRelay = 0,
+  kDirect = 1,
+};
+
+constexpr std::size_t kPeerOfferHeaderSize = 2 + 8;
+constexpr std::size_t kPeerProbeSize = 8;
+constexpr std::uint8_t kFlagProbeAck = 0x01;
+
+inline void put_peer_candidates(std::vector<char>& out,
+                                const std::vector<PeerCandidate>& list) {
+  std::size_t count = std::min(list.size(), kMaxPeerCandidates);
+  out.push_back(static_cast<char>(count));
+  for (std::size_t i = 0; i < count; ++i) {
+    char entry[kPeerCandidateSize];
+    put_u32(entry, list[i].address);
+    put_u16(entry + 4, list[i].port);
+    out.insert(out.end(), entry, entry + sizeof(entry));
+  }
+}
+
+inline bool decode_peer_candidates(const char* payload, std::size_t size,
+                                   std::vector<PeerCandidate>& list) {
+  if (size < 1) {
+    return false;
+  }
+  std::size_t count = static_cast<unsigned char>(payload[0]);
+  if (count > kMaxPeerCandidates || size < 1 + count * kPeerCandidateSize) {
+    return false;
+  }
+  list.resize(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const char* entry = payload + 1 + i * kPeerCandidateSize;
+    list[i].address = get_u32(entry);
+    list[i].port = get_u16(entry + 4);
+  }
+  return true;
+}
+
+inline std::vector<char> make_peer_candidates(
+    const std::vector<PeerCandidate>& list) {
+  std::vector<char> payload;
+  put_peer_candidates(payload, list);
+  FrameHeader header;
+  header.type = MessageType::kPeerCandidates;
+  return make_frame(header, payload.data(), payload.size());
+}
+
+inline std::vector<char> make_peer_offer(const PeerOffer& offer) {
+  std::vector<char> payload(kPeerOfferHeaderSize);
+  put_u16(payload.data(), offer.peer);
+  put_u64(payload.data() + 2, offer.key);
+  put_peer_candidates(payload, offer.candidates);
+  FrameHeader header;
+  header.type = MessageType::kPeerOffer;
+  return make_frame(header, payload.data(), payload.size());
+}
+
+inline bool decode_peer_offer(const char* payload, std::size_t size,
+                              PeerOffer& offer) {
+  if (size < kPeerOfferHeaderSize) {
+    return false;
+  }
+  offer.peer = get_u16(payload);
+  offer.key = get_u64(payload + 2);
+  return decode_peer_candidates(payload + kPeerOfferHeaderSize,
+                                size - kPeerOfferHeaderSize,
+                                offer.candidates);
+}
+
+inline std::vector<char> make_peer_probe(std::uint64_t key, bool ack) {
+  char payload[kPeerProbeSize];
+  put_u64(payload, key);
+  FrameHeader header;
+  header.type = MessageType::kPeerProbe;
+  header.flags = ack ? kFlagProbeAck : 0;
+  return make_frame(header, payload, sizeof(payload));
+}
+
+inline std::vector<char> make_peer_state(PeerState state) {
+  char payload = static_cast<char>(state);
+  FrameHeader header;
+  header.type = MessageType::kPeerState;
+  return make_frame(header, &payload, 1);
+}
+
+inline bool decode_peer_state(const char* payload, std::size_t size,
+                              PeerState& state) {
+  if (size < 1 || static_cast<std::uint8_t>(payload[0]) >
+                      static_cast<std::uint8_t>(PeerState::kDirect)) {
+    return false;
+  }
+  state = static_cast<PeerState>(payload[0]);
+  return true;
+}
+
+}  // namespace protocol
+
+#endif  // PROTOCOL_H
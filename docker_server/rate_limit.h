@@ -0,0 +1,123 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "stream_scheduler.h"
+
+// Защита от клиента, заваливающего сервер кадрами: входящий поток
+// каждой сессии ограничен корзинами токенов, а все очереди отправки
+// вместе — общим бюджетом памяти. Сброс нагрузки ступенчатый: сначала
+// теряется голос, затем приостанавливается чтение, и только потом
+// соединения разрываются.
+
+struct RateLimits {
+  // 0 — без ограничения
+  double bytes_per_second = 0;
+  double frames_per_second = 0;
+  // Ёмкость корзины в секундах нормы
+  double burst_seconds = 1.0;
+  // Долг по кадрам, после которого соединение разрывается, в секундах
+  // нормы: клиент, игнорирующий потерю голоса, — не жертва сети
+  double abuse_seconds = 5.0;
+};
+
+// Две корзины одной сессии с общим временем пополнения. Токены уходят
+// в минус внутри одной пачки чтений: кадры сверх нормы теряют голос,
+// а весь долг оплачивается паузой чтения.
+class SessionLimiter {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  void refill(const RateLimits& limits, Clock::time_point now) {
+    double elapsed =
+        updated_ == Clock::time_point()
+            ? limits.burst_seconds
+            : std::chrono::duration<double>(now - updated_).count();
+    updated_ = now;
+    bytes_ = refill(bytes_, limits.bytes_per_second, limits, elapsed);
+    frames_ = refill(frames_, limits.frames_per_second, limits, elapsed);
+  }
+
+  void spend_bytes(std::size_t bytes) {
+    bytes_ -= static_cast<double>(bytes);
+  }
+  // false — кадр сверх нормы
+  bool spend_frame() {
+    frames_ -= 1;
+    return frames_ >= 0;
+  }
+
+  // Чтение ждёт, пока долг не будет оплачен
+  bool exhausted() const { return bytes_ < 0 || frames_ < 0; }
+  bool abusive(const RateLimits& limits) const {
+    return frames_ < -limits.frames_per_second * limits.abuse_seconds;
+  }
+
+ private:
+  static double refill(double tokens, double rate, const RateLimits& limits,
+                       double elapsed) {
+    if (rate <= 0) {
+      return std::numeric_limits<double>::infinity();
+    }
+    return std::min(tokens + rate * elapsed, rate * limits.burst_seconds);
+  }
+
+  double bytes_ = 0;
+  double frames_ = 0;
+  Clock::time_point updated_;
+};
+
+enum class MemoryPressure {
+  kNormal,
+  kShedVoice,     // с половины бюджета: голос отстающим не ставится
+  kThrottleReads,  // с 3/4: чтение приостанавливается
+  kDisconnect,     // бюджет исчерпан: отстающие отключаются
+};
+
+// Память под данные клиентов: кадры рассылки (их учитывает
+// make_shared_frame) и буферы сессий вне очередей — хвосты чтения
+// и недособранные сообщения. Буферы сессия сообщает сама, целиком,
+// а бюджет хранит только разницу. Обновляет бюджет io-поток, а давление
+// читают и потоки рассылки сцены (stage.h).
+class MemoryBudget {
+ public:
+  // limit 0 — без ограничения
+  explicit MemoryBudget(std::size_t limit) : limit_(limit) {}
+
+  // accounted — прошлый вклад владельца; становится равным bytes
+  void update(std::size_t& accounted, std::size_t bytes) {
+    buffers_.fetch_add(bytes, std::memory_order_relaxed);
+    buffers_.fetch_sub(accounted, std::memory_order_relaxed);
+    accounted = bytes;
+  }
+
+  MemoryPressure pressure() const {
+    std::size_t used = this->used();
+    if (limit_ == 0 || used < limit_ / 2) {
+      return MemoryPressure::kNormal;
+    }
+    if (used < limit_ / 4 * 3) {
+      return MemoryPressure::kShedVoice;
+    }
+    return used < limit_ ? MemoryPressure::kThrottleReads
+                         : MemoryPressure::kDisconnect;
+  }
+
+  std::size_t used() const {
+    return buffers_.load(std::memory_order_relaxed) +
+           shared_frame_bytes.load(std::memory_order_relaxed);
+  }
+  std::size_t limit() const { return limit_; }
+
+ private:
+  std::size_t limit_;
+  std::atomic<std::size_t> buffers_{0};
+};
+
+#endif  // RATE_LIMIT_H
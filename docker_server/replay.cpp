@@ -0,0 +1,321 @@
+// Воспроизведение записанного трафика (server --capture) против сервера.
+// Каждая записанная сессия становится отдельным TCP-соединением, кадры
+// отправляются в записанные моменты времени с заданным ускорением.
+// Boost 1.74 берёт std::exchange в awaitable.hpp, не подключая <utility>
+#include <utility>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+#include "traffic_capture.h"
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+struct ReplayStats {
+  std::uint64_t sessions = 0;
+  std::uint64_t frames_sent = 0;
+  std::uint64_t bytes_sent = 0;
+  std::uint64_t bytes_received = 0;
+  std::uint64_t connect_errors = 0;
+  // Насколько отправка отстала от расписания (макс.), мкс
+  std::uint64_t max_lag_us = 0;
+};
+
+class ReplaySession : public std::enable_shared_from_this<ReplaySession> {
+ public:
+  ReplaySession(boost::asio::io_context& io_context, ReplayStats& stats)
+      : socket_(io_context), stats_(stats) {}
+
+  void connect(const tcp::resolver::results_type& endpoints) {
+    auto self(shared_from_this());
+    boost::asio::async_connect(
+        socket_, endpoints,
+        [this, self](boost::system::error_code ec, tcp::endpoint) {
+          if (ec) {
+            ++stats_.connect_errors;
+            write_msgs_.clear();
+            return;
+          }
+          connected_ = true;
+          do_read_header();
+          if (!write_msgs_.empty()) {
+            do_write();
+          }
+        });
+  }
+
+  void send(std::vector<char> frame) {
+    bool write_in_progress = !write_msgs_.empty();
+    write_msgs_.push_back(std::move(frame));
+    if (connected_ && !write_in_progress) {
+      do_write();
+    }
+  }
+
+  // Закрывает соединение, как только уйдут все поставленные кадры
+  void close() {
+    closing_ = true;
+    if (write_msgs_.empty()) {
+      shutdown();
+    }
+  }
+
+ private:
+  void shutdown() {
+    boost::system::error_code ec;
+    socket_.shutdown(tcp::socket::shutdown_both, ec);
+    socket_.close(ec);
+  }
+
+  void do_write() {
+    auto self(shared_from_this());
+    boost::asio::async_write(
+        socket_, boost::asio::buffer(write_msgs_.front()),
+        [this, self](boost::system::error_code ec, std::size_t length) {
+          if (ec) {
+            write_msgs_.clear();
+            return;
+          }
+          stats_.bytes_sent += length;
+          ++stats_.frames_sent;
+          write_msgs_.pop_front();
+          if (!write_msgs_.empty()) {
+            do_write();
+          } else if (closing_) {
+            shutdown();
+          }
+        });
+  }
+
+  // Ответы сервера читаем и отбрасываем; на ping отвечаем сами,
+  // записанные pong с чужим временем не воспроизводятся
+  void do_read_header() {
+    auto self(shared_from_this());
+    boost::asio::async_read(
+        socket_, boost::asio::buffer(header_),
+        [this, self](boost::system::error_code ec, std::size_t length) {
+          if (ec) {
+            return;
+          }
+          stats_.bytes_received += length;
+          auto header = protocol::decode_header(header_.data());
+          if (header.length > protocol::kMaxPayloadSize) {
+            shutdown();
+            return;
+          }
+          body_.resize(header.length);
+          do_read_body(header.type);
+        });
+  }
+
+  void do_read_body(protocol::MessageType type) {
+    auto self(shared_from_this());
+    boost::asio::async_read(
+        socket_, boost::asio::buffer(body_),
+        [this, self, type](boost::system::error_code ec, std::size_t length) {
+          if (ec) {
+            return;
+          }
+          stats_.bytes_received += length;
+          if (type == protocol::MessageType::kPing && !closing_) {
+            send(protocol::make_pong(body_.data(), body_.size()));
+          }
+          do_read_header();
+        });
+  }
+
+  tcp::socket socket_;
+  ReplayStats& stats_;
+  std::deque<std::vector<char>> write_msgs_;
+  std::array<char, protocol::kHeaderSize> header_;
+  std::vector<char> body_;
+  bool connected_ = false;
+  bool closing_ = false;
+};
+
+class Replayer {
+ public:
+  // speed <= 0 — без пауз, с максимальной скоростью
+  Replayer(boost::asio::io_context& io_context, const std::string& path,
+           const std::string& host, const std::string& port, double speed)
+      : io_context_(io_context),
+        reader_(path),
+        timer_(io_context),
+        speed_(speed) {
+    tcp::resolver resolver(io_context_);
+    endpoints_ = resolver.resolve(host, port);
+  }
+
+  void start() {
+    start_ = Clock::now();
+    has_record_ = reader_.next(record_);
+    dispatch();
+  }
+
+  const ReplayStats& stats() const { return stats_; }
+  Clock::duration elapsed() const { return Clock::now() - start_; }
+
+ private:
+  // Максимум записей за один проход, чтобы не блокировать io_context
+  static constexpr int kBatch = 1024;
+
+  Clock::time_point due(std::uint64_t time_us) const {
+    return start_ + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double, std::micro>(
+                            static_cast<double>(time_us) / speed_));
+  }
+
+  void dispatch() {
+    for (int i = 0; i < kBatch && has_record_; ++i) {
+      if (speed_ > 0) {
+        auto when = due(record_.time_us);
+        auto now = Clock::now();
+        if (when > now) {
+          timer_.expires_at(when);
+          timer_.async_wait([this](boost::system::error_code ec) {
+            if (!ec) {
+              dispatch();
+            }
+          });
+          return;
+        }
+        auto lag = std::chrono::duration_cast<std::chrono::microseconds>(
+                       now - when)
+                       .count();
+        if (static_cast<std::uint64_t>(lag) > stats_.max_lag_us) {
+          stats_.max_lag_us = static_cast<std::uint64_t>(lag);
+        }
+      }
+      apply(record_);
+      has_record_ = reader_.next(record_);
+    }
+    if (has_record_) {
+      boost::asio::post(io_context_, [this]() { dispatch(); });
+      return;
+    }
+    // Запись закончилась: закрываем оставшиеся сессии после отправки
+    for (auto& entry : sessions_) {
+      entry.second->close();
+    }
+    sessions_.clear();
+  }
+
+  void apply(capture::Record& record) {
+    switch (record.kind) {
+      case capture::RecordKind::kOpen:
+        open(record.session_id);
+        break;
+      case capture::RecordKind::kClose: {
+        auto it = sessions_.find(record.session_id);
+        if (it != sessions_.end()) {
+          it->second->close();
+          sessions_.erase(it);
+        }
+        break;
+      }
+      case capture::RecordKind::kFrame: {
+        if (record.frame.size() >= protocol::kHeaderSize &&
+            protocol::decode_header(record.frame.data()).type ==
+                protocol::MessageType::kPong) {
+          break;
+        }
+        auto it = sessions_.find(record.session_id);
+        // Запись могла начаться при уже подключённой сессии
+        auto& session =
+            it != sessions_.end() ? it->second : open(record.session_id);
+        session->send(std::move(record.frame));
+        break;
+      }
+    }
+  }
+
+  std::shared_ptr<ReplaySession>& open(std::uint32_t session_id) {
+    auto session = std::make_shared<ReplaySession>(io_context_, stats_);
+    session->connect(endpoints_);
+    ++stats_.sessions;
+    auto& slot = sessions_[session_id];
+    if (slot) {
+      slot->close();
+    }
+    slot = std::move(session);
+    return slot;
+  }
+
+  boost::asio::io_context& io_context_;
+  capture::TrafficReader reader_;
+  boost::asio::steady_timer timer_;
+  tcp::resolver::results_type endpoints_;
+  double speed_;
+  Clock::time_point start_;
+  capture::Record record_;
+  bool has_record_ = false;
+  std::unordered_map<std::uint32_t, std::shared_ptr<ReplaySession>> sessions_;
+  ReplayStats stats_;
+};
+
+int main(int argc, char* argv[]) {
+  std::string path;
+  std::string host = "127.0.0.1";
+  std::string port = "8080";
+  double speed = 1.0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--max") {
+      speed = 0;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return 1;
+    }
+    std::string value = argv[++i];
+    if (arg == "--file") {
+      path = value;
+    } else if (arg == "--host") {
+      host = value;
+    } else if (arg == "--port") {
+      port = value;
+    } else if (arg == "--speed") {
+      speed = std::stod(value);
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    }
+  }
+  if (path.empty()) {
+    std::cerr << "Usage: replay --file CAPTURE [--host H] [--port P] "
+                 "[--speed N | --max]"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    boost::asio::io_context io_context;
+    Replayer replayer(io_context, path, host, port, speed);
+    replayer.start();
+    io_context.run();
+
+    const auto& stats = replayer.stats();
+    double seconds =
+        std::chrono::duration<double>(replayer.elapsed()).count();
+    std::cout << "Replayed " << stats.sessions << " sessions, "
+              << stats.frames_sent << " frames, " << stats.bytes_sent
+              << " bytes in " << seconds << " s ("
+              << (seconds > 0 ? stats.frames_sent / seconds : 0)
+              << " frames/s); received " << stats.bytes_received
+              << " bytes; connect errors " << stats.connect_errors
+              << "; max schedule lag " << stats.max_lag_us / 1000.0 << " ms"
+              << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << "Exception: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1,12 +1,52 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+// Boost 1.74 берёт std::exchange в awaitable.hpp, не подключая <utility>
+#include <utility>
 #include <boost/asio.hpp>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
 #include <deque>
+#include <fstream>
 #include <iostream>
 #include <memory>
-#include <set>
+#include <optional>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "alloc_counter.h"
+#include "audio_transcoder.h"
+#include "bitrate_control.h"
+#include "buffer_pool.h"
+#include "file_store.h"
+#include "logger.h"
+#include "protocol.h"
+#include "rate_limit.h"
+#include "session_table.h"
+#include "session_token.h"
+#include "shm_ring.h"
+#include "stage.h"
+#include "stream_scheduler.h"
+#include "timing_wheel.h"
+#include "tls.h"
+#include "traffic_capture.h"
+#include "voice_fec.h"
+#include "voice_recorder.h"
+
 using boost::asio::ip::tcp;
+using boost::asio::local::stream_protocol;
+using Clock = std::chrono::steady_clock;
 
 // Предварительное объявление класса Server
 class Server;
@@ -14,122 +54,2670 @@ class Server;
 class Session : public std::enable_shared_from_this<Session> {
  public:
   Session(tcp::socket socket, Server& server);
-  void start();
-  void deliver(const std::vector<char>& msg);
+  void start(SessionHandle handle, std::uint32_t capture_id);
+  void stop();
+  std::uint32_t capture_id() const { return capture_id_; }
+  // deadline — срок голосового кадра, после него кадр не отправляется
+  void deliver(SharedFrame msg,
+               Clock::time_point deadline = Clock::time_point::max());
+  // Сообщение логического потока; уходит кусками с учётом веса потока
+  void deliver_message(std::uint16_t stream, std::uint32_t weight,
+                       SharedMessage message);
+  SessionHandle handle() const { return handle_; }
+  // Прошла TLS и вход; до этого рассылка сессии не достаётся
+  bool admitted() const { return admitted_; }
+
+  std::uint16_t packet_ms() const { return config_.packet_ms; }
+  const protocol::AudioFormat& wire_format() const {
+    return config_.wire_format;
+  }
+  // Пересчитывает параметры из запроса клиента, уровня битрейта
+  // и минимума сервера и сообщает их клиенту
+  void refresh_config();
+  // Оценка канала и, если нужно, новый уровень битрейта
+  void adapt_bitrate(Clock::time_point now);
+  // 0 — полное качество
+  std::size_t bitrate_level() const {
+    return voice_link_ ? voice_link_->controller.level() : 0;
+  }
+  // UDP-адреса клиента для прямого звонка; пусто — не предлагал
+  const std::vector<protocol::PeerCandidate>& peer_candidates() const {
+    return peer_candidates_;
+  }
+  // Размер группы чётности; 0 — без неё
+  std::uint8_t fec_group() const {
+    return voice_link_ && requested_.fec ? voice_link_->fec.group() : 0;
+  }
+
+  Clock::time_point last_receive() const { return last_receive_; }
+  void send_ping();
+  // Сглаженный и последний RTT по ответам на ping, 0 — ещё не измерен
+  std::uint32_t srtt_us() const { return srtt_us_; }
+  std::uint32_t last_rtt_us() const { return last_rtt_us_; }
+  // Чтение приостановлено ограничением скорости или нехваткой памяти
+  bool reads_paused() const { return reads_paused_; }
+  // Возобновляет чтение, если долг по корзинам оплачен; false — рано
+  bool resume_reads();
+
+  // Память сессии вне самого объекта: очередь записи, неполный кадр
+  // и недособранные сообщения потоков
+  std::size_t heap_bytes() const {
+    std::size_t bytes = outgoing_.heap_bytes() + pending_.capacity() +
+                        incoming_.capacity() * sizeof(IncomingMessage);
+    for (const auto& message : incoming_) {
+      bytes += message.payload.capacity();
+    }
+    return bytes;
+  }
+  std::size_t queued_frames() const { return outgoing_.queued_frames(); }
+  std::size_t queued_bytes() const { return outgoing_.queued_bytes(); }
+  void take_queue_delays(QueueDelay (&out)[kTrafficClassCount]) {
+    outgoing_.take_delays(out);
+  }
+
+  // Чётность к голосу одного отправителя
+  struct ParityStream {
+    std::uint16_t sender;
+    // Оценка канала, на которой через поток шёл последний кадр
+    unsigned used;
+    ParityEncoder encoder;
+  };
+
+  // Состояние подстройки битрейта и FEC; есть только у сессий с голосом
+  struct VoiceLink {
+    BitrateController controller;
+    UplinkDelay uplink;
+    // Та же задержка над минимумом за короткое окно, для сроков кадров
+    UplinkDelay transit{UplinkDelay::kShortWindow};
+    // Последний замер, для отчёта
+    LinkSample last;
+    std::uint64_t voice_bytes = 0;
+    std::uint64_t voice_bytes_evaluated = 0;
+    // Кадры голоса для этого клиента, включая отброшенные
+    std::uint64_t voice_frames = 0;
+    std::uint64_t voice_frames_evaluated = 0;
+    std::uint64_t frames_dropped = 0;
+    std::uint64_t frames_dropped_evaluated = 0;
+    Clock::time_point evaluated;
+    unsigned evaluations = 0;
+    // Группа чётности по доле отброшенных кадров; потоки — только
+    // у клиентов, просивших FEC
+    FecPolicy fec;
+    std::vector<ParityStream> parity;
+  };
+  const VoiceLink* voice_link() const { return voice_link_.get(); }
+
+  // Обрабатывает все целые кадры в буфере и возвращает число
+  // использованных байт; false — нарушение протокола. Открыт для
+  // microbench, который гоняет разбор на заполненном буфере
+  bool handle_frames(const char* data, std::size_t size,
+                     std::size_t& consumed);
 
  private:
-  void do_read();
-  void do_write();
+  // TCP_INFO читается раз в столько оценок, если очередь пуста
+  // и качество полное
+  static constexpr unsigned kTcpInfoEvery = 5;
+  // Поток чётности отправителя, молчащего столько оценок, забывается
+  static constexpr unsigned kParityIdleEvaluations = 50;
+  // Сколько раз подряд читаем из готового сокета, прежде чем
+  // уступить другим сессиям
+  static constexpr int kMaxReadsPerWakeup = 4;
+  // Сколько неотправленных байт держим в ядре: несколько кусков
+  static constexpr std::size_t kNotSentLowat = 4 * protocol::kChunkSize;
+
+  // Чего ждёт запись, когда сокет перестал принимать данные
+  enum class WriteWait : std::uint8_t {
+    kNone,  // очередь дописана
+    kReadable,
+    kWritable,
+    kFailed,
+  };
+
+  void spawn(boost::asio::awaitable<void> task);
+  // Рукопожатие TLS, вход и чтение до закрытия или паузы
+  boost::asio::awaitable<void> run();
+  boost::asio::awaitable<void> read_loop();
+  void admit(Holder holder);
+  // false — вход отклонён
+  bool on_hello(const char* payload, std::size_t size);
+  // false — чтение остановлено: сессия закрыта или на паузе
+  bool on_readable();
+  // Сообщает бюджету памяти хвост чтения и недособранные сообщения;
+  // кадры очереди бюджет считает сам
+  void account_memory();
+  void account_queue();
+  // Чтение из сокета или через TLS; would_block — данных пока нет
+  std::size_t read_some(char* data, std::size_t size,
+                        boost::system::error_code& ec);
+  void handle_frame(const protocol::FrameHeader& header, const char* frame);
+  // Добавляет кадр голоса в группу его отправителя; true — группа
+  // закрыта и в parity кадр чётности
+  bool add_parity(const std::vector<char>& frame, std::vector<char>& parity);
+  // Размер группы чётности по потерям с прошлой оценки
+  void adapt_fec();
+  void on_pong(const char* payload, std::size_t size);
+  // Собирает куски сообщения kData и пересылает готовое сообщение
+  void on_data(const protocol::FrameHeader& header, const char* payload);
+  void on_upload_begin(const char* payload, std::size_t size);
+  void on_upload_chunk(const char* payload, std::size_t size);
+  void on_download_request(const char* payload, std::size_t size);
+  void on_release_file(const char* payload, std::size_t size);
+  // Адреса клиента и адрес, с которого его видит сервер
+  void on_peer_candidates(const char* payload, std::size_t size);
+  void send_status(const protocol::TransferStatus& status);
+  // Начинает запись, если она ещё не идёт
+  void flush();
+  // Дописывает очередь, дожидаясь готовности сокета
+  boost::asio::awaitable<void> write_loop(WriteWait wait);
+  // Пишет, пока сокет принимает данные
+  WriteWait write_ready();
+  // Очередной кадр файла через sendfile; kNone — кадр дописан
+  // или передача закончилась
+  WriteWait send_file();
+  // Запись через OpenSSL, когда ядро не шифрует само: кадры и файл
+  // идут через буфер процесса
+  SharedFrame next_tls_frame();
+
+  // Отдача файла кадр за кадром, когда очередь кадров пуста. Кадр
+  // не пересекает границу куска хранилища и отдаётся из одного файла.
+  struct Download {
+    std::shared_ptr<const Manifest> manifest;
+    std::uint64_t offset;
+    // Текущий кусок хранилища, смещение в нём и его дескриптор
+    std::size_t chunk;
+    std::uint64_t chunk_offset;
+    int fd;
+    std::uint64_t frame_end;
+    char header[protocol::kHeaderSize];
+    // Отправленная часть заголовка текущего кадра; 0 — кадр не начат
+    std::size_t header_sent;
+
+    ~Download() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+
+    // Готовит заголовок следующего кадра и открывает его кусок;
+    // false — кусок пропал из хранилища
+    bool begin_frame(const FileStore& files) {
+      const auto& chunks = manifest->chunks;
+      while (chunk < chunks.size() && chunk_offset == chunks[chunk].size) {
+        ++chunk;
+        chunk_offset = 0;
+        if (fd >= 0) {
+          ::close(fd);
+          fd = -1;
+        }
+      }
+      std::uint32_t length = 0;
+      if (chunk < chunks.size()) {
+        if (fd < 0 && (fd = files.open_chunk(chunks[chunk].hash)) < 0) {
+          return false;
+        }
+        length = static_cast<std::uint32_t>(std::min<std::uint64_t>(
+            protocol::kFileChunkSize, chunks[chunk].size - chunk_offset));
+      }
+      frame_end = offset + length;
+      protocol::encode_header(
+          protocol::file_data_header(offset, length,
+                                     frame_end < manifest->size),
+          header);
+      return true;
+    }
+
+    // Кадр, начатый begin_frame, целиком в памяти
+    bool read_frame(std::vector<char>& frame) {
+      frame.assign(header, header + protocol::kHeaderSize);
+      frame.resize(protocol::kHeaderSize + (frame_end - offset));
+      char* out = frame.data() + protocol::kHeaderSize;
+      while (offset < frame_end) {
+        ssize_t n = ::pread(fd, out, frame_end - offset,
+                            static_cast<off_t>(chunk_offset));
+        if (n <= 0) {
+          return false;
+        }
+        out += n;
+        offset += static_cast<std::uint64_t>(n);
+        chunk_offset += static_cast<std::uint64_t>(n);
+      }
+      return true;
+    }
+  };
+
+  struct IncomingMessage {
+    std::uint16_t stream;
+    // Сообщение превысило kMaxMessageSize: куски до последнего
+    // отбрасываются
+    bool discarding;
+    std::vector<char> payload;
+  };
 
   tcp::socket socket_;
+  // nullptr — соединение без TLS
+  std::unique_ptr<tls::Connection> tls_;
   Server& server_;
-  std::array<char, 1024> read_msg_;
-  std::deque<std::vector<char>> write_msgs_;
+  SessionHandle handle_;
+  // Номер сессии в файле записи трафика; в отличие от handle
+  // не переиспользуется
+  std::uint32_t capture_id_ = 0;
+  // Хвост неполного кадра между чтениями. У молчащей сессии пуст и не
+  // держит памяти: буфер для чтения берётся из общего пула.
+  std::vector<char> pending_;
+  StreamScheduler outgoing_;
+  // Кадр, который сокет принял не целиком
+  SharedFrame write_frame_;
+  std::size_t write_offset_ = 0;
+  bool writing_ = false;
+  bool admitted_ = false;
+  // Владелец ссылок на файлы, которые загружает сессия
+  Holder holder_ = kLegacyHolder;
+  bool reads_paused_ = false;
+  SessionLimiter limiter_;
+  // Учтено в бюджете памяти сервера
+  std::size_t accounted_bytes_ = 0;
+  // Слоты очереди отправки; меняется при записи, а не при чтении
+  std::size_t accounted_queue_bytes_ = 0;
+  // Передачи файлов; у сессии без передач не занимают памяти
+  std::unique_ptr<Upload> upload_;
+  std::unique_ptr<Download> download_;
+  std::vector<IncomingMessage> incoming_;
+  // Есть только у сессий, присылавших голос
+  std::unique_ptr<AudioTranscoder> transcoder_;
+  std::unique_ptr<VoiceLink> voice_link_;
+  std::vector<protocol::PeerCandidate> peer_candidates_;
+  // Запрошено клиентом и действует с учётом уровня битрейта
+  protocol::SessionConfig requested_;
+  protocol::SessionConfig config_;
+  Clock::time_point last_receive_;
+  std::uint32_t srtt_us_ = 0;
+  std::uint32_t last_rtt_us_ = 0;
 };
 
+// Клиент на той же машине, получающий рассылку через кольцо
+// в разделяемой памяти (shm_ring.h). Кадры, которым не хватило места
+// в кольце, ждут в планировщике с тем же порядком классов, что и у
+// TCP-сессии, пока читатель не освободит место.
+class ShmSubscriber : public std::enable_shared_from_this<ShmSubscriber> {
+ public:
+  ShmSubscriber(stream_protocol::socket socket, Server& server);
+  void start(SessionHandle handle);
+  void stop();
+  void deliver(SharedFrame frame,
+               Clock::time_point deadline = Clock::time_point::max());
+  void deliver_message(std::uint16_t stream, std::uint32_t weight,
+                       SharedMessage message);
+  bool opened() const { return writer_ != nullptr; }
+  std::size_t queued_frames() const {
+    return backlog_.queued_frames() + (pending_ ? 1 : 0);
+  }
+  std::size_t queued_bytes() const {
+    return backlog_.queued_bytes() + (pending_ ? pending_->size() : 0);
+  }
+  std::uint64_t bytes_written() const {
+    return writer_ ? writer_->bytes_written() : 0;
+  }
+  std::uint64_t wakeups() const { return writer_ ? writer_->wakeups() : 0; }
+
+ private:
+  void read_hello();
+  void open_ring(const protocol::SessionToken* renewed);
+  // Клиент ничего не шлёт после входа: чтение лишь ловит закрытие
+  void watch_socket();
+  void flush();
+  void wait_space();
+  // Одно пробуждение читателя на проход цикла событий, а не на кадр
+  void schedule_wake();
+
+  stream_protocol::socket socket_;
+  Server& server_;
+  SessionHandle handle_;
+  shm::Mapping mapping_;
+  std::unique_ptr<shm::RingWriter> writer_;
+  // Копия space_ready для ожидания через реактор
+  boost::asio::posix::stream_descriptor space_ready_;
+  StreamScheduler backlog_;
+  // Снят с планировщика, но не поместился в кольцо
+  SharedFrame pending_;
+  bool waiting_space_ = false;
+  bool wake_scheduled_ = false;
+  char hello_[protocol::kHeaderSize + protocol::kSessionTokenSize];
+};
+
+struct ServerOptions {
+  unsigned short port = 8080;
+  std::uint16_t min_packet_ms = protocol::kPacketIntervalsMs[0];
+  // Период отчёта о памяти и RTT в секундах, 0 — отключён
+  unsigned stats_interval = 0;
+  // Молчащей сессии шлём ping раз в keepalive_interval секунд,
+  // а после peer_timeout секунд тишины отключаем
+  unsigned keepalive_interval = 5;
+  unsigned peer_timeout = 15;
+  // Файл для записи входящего трафика, пусто — не записывать
+  std::string capture_path;
+  // Каталог записи голоса по каналам, пусто — не записывать
+  recording::Options recording;
+  // Каталог загруженных файлов и предел размера одного файла
+  std::string storage_path = "files";
+  unsigned max_file_mb = 1024;
+  // Ключ подписи токенов; пусто — вход без токена
+  std::string auth_key_path;
+  unsigned token_ttl_hours = 24 * 7;
+  // Сколько соединений одновременно проходят TLS и вход; остальные
+  // ждут своей очереди уже принятыми. 0 — без предела.
+  unsigned max_handshakes = 256;
+  // Сколько принятых соединений ждут очереди и сколько секунд; сверх
+  // предела соединение закрывается сразу, а не копится без конца
+  unsigned max_deferred = 4096;
+  unsigned deferred_timeout = 10;
+  // Unix-сокет для клиентов через разделяемую память, пусто — выключено;
+  // размер кольца одного клиента
+  std::string shm_socket_path;
+  unsigned shm_ring_kb = 4096;
+  // Порт слушателей сцены (только приём голоса, без TLS), 0 — выключено;
+  // потоки рассылки сцены
+  unsigned short stage_port = 0;
+  unsigned stage_workers = std::max(1u, std::thread::hardware_concurrency());
+  // Входящий поток одной сессии и все очереди отправки вместе,
+  // 0 — без ограничения
+  RateLimits rate_limits{8 * 1024 * 1024, 2000};
+  unsigned memory_budget_mb = 1024;
+  // Голос, не отправленный слушателю за столько миллисекунд после
+  // отправки говорящим, выбрасывается; 0 — без срока
+  unsigned voice_deadline_ms = 300;
+  logger::Options log;
+  tls::Options tls;
+};
+
+// Доли потоков при делёжке канала после голоса: чат и присутствие
+// должны оставаться отзывчивыми на фоне передачи файлов
+std::uint32_t stream_weight(std::uint16_t stream) {
+  switch (stream) {
+    case protocol::kStreamChat:
+      return 4;
+    case protocol::kStreamPresence:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
 class Server {
  public:
-  Server(boost::asio::io_context& io_context, short port);
-  void deliver(const std::vector<char>& msg);
-  void join(std::shared_ptr<Session> session);
-  void leave(std::shared_ptr<Session> session);
+  Server(boost::asio::io_context& io_context, const ServerOptions& options);
+  void deliver(const SharedFrame& msg);
+  // Голос: каждый слушатель получает кадр в своём формате
+  void deliver_audio(const SharedFrame& frame, AudioTranscoder& transcoder,
+                     Clock::time_point deadline);
+  // Срок голосового кадра, отправленного клиентом в момент sent
+  Clock::time_point voice_deadline(Clock::time_point sent) const {
+    return voice_deadline_ == Clock::duration::zero()
+               ? Clock::time_point::max()
+               : sent + voice_deadline_;
+  }
+  void deliver_message(std::uint16_t stream, const char* payload,
+                       std::size_t size);
+  SessionHandle join(std::shared_ptr<Session> session);
+  // Повторный вызов с тем же handle безопасен
+  void leave(SessionHandle handle);
+
+  std::uint16_t min_packet_ms() const { return min_packet_ms_; }
+  // Меняет минимальный интервал пакетизации на лету: сессии с более
+  // мелкими пакетами получают новый интервал
+  void set_min_packet_ms(std::uint16_t min_packet_ms);
+
+  ReadBufferPool& read_buffers() { return read_buffers_; }
+  // nullptr — сервер без TLS
+  const tls::Context* tls() const { return tls_.get(); }
+  void count_handshake(const tls::Connection& connection);
+
+  bool auth_required() const { return signer_ != nullptr; }
+  // Владелец файлов сессии без токена: только она и может их удалить
+  Holder anonymous_holder() {
+    Holder holder;
+    do {
+      holder = holder_ids_() | kAnonymousHolder;
+    } while (holder == kLegacyHolder);
+    return holder;
+  }
+  // Проверяет токен; в renewed — токен для следующего входа
+  bool check_token(const protocol::SessionToken& token,
+                   protocol::SessionToken& renewed);
+  // Сессия прошла вход: освобождает место для новых рукопожатий
+  void on_admitted();
+  std::size_t shm_ring_bytes() const { return shm_ring_bytes_; }
+  // Повторный вызов с тем же handle безопасен
+  void leave_shm(SessionHandle handle);
+  FileStore& files() { return files_; }
+
+  const RateLimits& rate_limits() const { return rate_limits_; }
+  MemoryBudget& memory() { return memory_; }
+  // Ставить ли кадр в очередь сессии при нынешнем давлении на память;
+  // backlogged — у сессии уже есть очередь
+  bool should_queue(const std::vector<char>& frame, bool backlogged);
+  // Сессия перестала читать; колесо тиков вернёт её к чтению
+  void pause_reads(SessionHandle handle) { paused_.push_back(handle); }
+  void count_voice_shed() { ++voice_shed_rate_; }
+  void count_bitrate_change(bool down) {
+    ++(down ? bitrate_downgrades_ : bitrate_upgrades_);
+  }
+  void count_parity(std::size_t bytes) {
+    ++parity_frames_;
+    parity_bytes_ += bytes;
+  }
+  void count_abuse() { ++abuse_disconnects_; }
+  // Предлагает прямой звонок, когда в комнате ровно двое, и отзывает
+  // его, когда голос пары снова нужен кому-то ещё
+  void update_call();
+  void on_peer_state(SessionHandle handle, protocol::PeerState state);
+  // Время последнего тика колеса; точности тика хватает для
+  // отметок активности сессий
+  Clock::time_point now() const { return now_; }
+
+  // Голос сессии channel для записи каналов
+  void record_voice(std::uint32_t channel, const SharedFrame& frame) {
+    if (recorder_) {
+      recorder_->tap(channel, frame);
+    }
+  }
+
+  // Запись входящих кадров для инструмента replay
+  void capture_frame(std::uint32_t capture_id, const char* frame,
+                     std::size_t size) {
+    if (capture_) {
+      capture_->record_frame(capture_id, frame, size);
+    }
+  }
+
+  void report_stats();
+
+  // Сессия на уже принятом сокете, без admit_or_defer; microbench
+  // заводит так сессии на своих соединениях
+  std::shared_ptr<Session> start_session(tcp::socket socket);
 
  private:
+  // Уровни битрейта и сессии с самым урезанным качеством
+  void report_bitrate();
+  // Шаг колеса keepalive-таймеров
+  static constexpr std::chrono::milliseconds kTick{100};
+  static constexpr std::size_t kWheelSlots = 512;
+
+  // Сколько готовых соединений забираем за одно пробуждение приёма
+  static constexpr int kAcceptBatch = 32;
+  // Сколько чтение может стоять из-за памяти до отключения отстающих
+  static constexpr std::chrono::seconds kMaxReadPause{5};
+  // Период оценки каналов для подстройки битрейта
+  static constexpr std::chrono::milliseconds kBitrateEval{200};
+
   void do_accept();
+  void admit_or_defer(tcp::socket socket);
+  bool admission_full() const {
+    return max_handshakes_ != 0 && admitting_ >= max_handshakes_;
+  }
+  // Отложенные сессии стартуют из отдельного обработчика: leave
+  // и вход случаются посреди обхода participants_
+  void schedule_deferred();
+  void start_deferred();
+  // Закрывает соединения, прождавшие очереди дольше deferred_timeout_
+  void expire_deferred();
+  void do_accept_shm();
+  void do_accept_stage();
+  // Слушатель сцены входит в io-потоке и только потом уходит
+  // в поток рассылки
+  void admit_listener(tcp::socket socket);
+  void do_await_signal();
+  void schedule_stats();
+  void schedule_tick();
+  void check_liveness(SessionHandle handle);
+  void resume_paused();
+  // Бюджет исчерпан: отключает сессии с самыми длинными очередями
+  void shed_backlogged();
+  // Пара для прямого звонка: две сессии с адресами и никого, кто слушал
+  // бы их голос через сервер
+  bool find_call_pair(SessionHandle (&pair)[2]);
+  void end_call();
 
   tcp::acceptor acceptor_;
-  std::set<std::shared_ptr<Session>> participants_;
+  boost::asio::signal_set signals_;
+  boost::asio::steady_timer stats_timer_;
+  boost::asio::steady_timer tick_timer_;
+  SlabTable<std::shared_ptr<Session>> participants_;
+  ReadBufferPool read_buffers_;
+  FileStore files_;
+  std::unique_ptr<tls::Context> tls_;
+  std::uint64_t tls_handshakes_ = 0;
+  std::uint64_t tls_resumed_ = 0;
+  std::uint64_t tls_ktls_ = 0;
+  std::unique_ptr<auth::TokenSigner> signer_;
+  std::unique_ptr<auth::VerifiedTokenCache> token_cache_;
+  std::chrono::seconds token_ttl_;
+  std::uint64_t hellos_ = 0;
+  std::uint64_t hellos_cached_ = 0;
+  std::uint64_t hellos_rejected_ = 0;
+  std::uint64_t tokens_renewed_ = 0;
+  std::uint64_t audio_encodes_ = 0;
+  std::uint64_t audio_encodes_avoided_ = 0;
+  RateLimits rate_limits_;
+  MemoryBudget memory_;
+  // Сессии с приостановленным чтением
+  std::vector<SessionHandle> paused_;
+  Clock::time_point reads_paused_since_;
+  std::uint64_t voice_shed_rate_ = 0;
+  std::uint64_t voice_shed_memory_ = 0;
+  std::uint64_t bulk_shed_memory_ = 0;
+  std::uint64_t abuse_disconnects_ = 0;
+  std::uint64_t memory_disconnects_ = 0;
+  std::uint64_t bitrate_downgrades_ = 0;
+  std::uint64_t bitrate_upgrades_ = 0;
+  Clock::time_point last_bitrate_eval_;
+  std::uint64_t parity_frames_ = 0;
+  std::uint64_t parity_bytes_ = 0;
+  // Звонок один на один, которому предложен прямой путь
+  std::optional<std::array<SessionHandle, 2>> call_;
+  std::mt19937_64 call_keys_{std::random_device{}()};
+  std::mt19937_64 holder_ids_{std::random_device{}()};
+  std::uint64_t calls_offered_ = 0;
+  std::uint64_t calls_direct_ = 0;
+  std::uint64_t calls_relayed_ = 0;
+  // Сессии между началом рукопожатия и входом
+  unsigned admitting_ = 0;
+  unsigned max_handshakes_;
+  // Принятые соединения, ждущие места для рукопожатия, по порядку
+  // прихода: первое в очереди всегда ждёт дольше всех
+  struct Deferred {
+    tcp::socket socket;
+    Clock::time_point since;
+  };
+  std::deque<Deferred> deferred_;
+  std::size_t max_deferred_;
+  std::chrono::seconds deferred_timeout_;
+  bool deferred_scheduled_ = false;
+  std::uint64_t deferred_total_ = 0;
+  std::uint64_t deferred_refused_ = 0;
+  std::uint64_t deferred_expired_ = 0;
+  // nullptr — транспорт через разделяемую память выключен
+  std::unique_ptr<stream_protocol::acceptor> shm_acceptor_;
+  SlabTable<std::shared_ptr<ShmSubscriber>> shm_subscribers_;
+  std::size_t shm_ring_bytes_;
+  // nullptr — сцена выключена
+  std::unique_ptr<tcp::acceptor> stage_acceptor_;
+  std::unique_ptr<stage::Stage> stage_;
+  // Одна запись на сессию вместо steady_timer на каждую
+  TimingWheel<SessionHandle> keepalive_wheel_;
+  Clock::time_point now_;
+  Clock::duration keepalive_interval_;
+  Clock::duration peer_timeout_;
+  std::uint16_t min_packet_ms_;
+  Clock::duration voice_deadline_;
+  unsigned stats_interval_;
+  std::size_t baseline_rss_;
+  std::unique_ptr<capture::TrafficRecorder> capture_;
+  std::unique_ptr<recording::Recorder> recorder_;
+  std::uint32_t next_capture_id_ = 1;
+  Clock::time_point last_capture_flush_;
+  Clock::time_point last_gc_;
 };
 
+// Резидентная память процесса по /proc/self/statm
+std::size_t resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  std::size_t total_pages = 0;
+  std::size_t resident_pages = 0;
+  statm >> total_pages >> resident_pages;
+  return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
 // Реализация методов Session
 Session::Session(tcp::socket socket, Server& server)
-    : socket_(std::move(socket)), server_(server) {}
+    : socket_(std::move(socket)),
+      server_(server),
+      last_receive_(server.now()) {
+  config_.packet_ms = protocol::negotiate_packet_interval(
+      protocol::kDefaultPacketMs, server.min_packet_ms());
+}
+
+void Session::start(SessionHandle handle, std::uint32_t capture_id) {
+  handle_ = handle;
+  capture_id_ = capture_id;
+  boost::system::error_code ec;
+  socket_.non_blocking(true, ec);
+  // Планировщик решает порядок только пока кадры у нас: без предела
+  // ядро набрало бы в буфер отправки мегабайты файла впереди голоса
+  int lowat = static_cast<int>(kNotSentLowat);
+  setsockopt(socket_.native_handle(), IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat,
+             sizeof(lowat));
+  if (const tls::Context* context = server_.tls()) {
+    tls_ = std::make_unique<tls::Connection>(*context,
+                                             socket_.native_handle());
+  }
+  spawn(run());
+}
+
+// Исключение из корутины, как и из обычного обработчика, выходит
+// из io_context.run()
+void Session::spawn(boost::asio::awaitable<void> task) {
+  boost::asio::co_spawn(socket_.get_executor(), std::move(task),
+                        [](std::exception_ptr error) {
+                          if (error) {
+                            std::rethrow_exception(error);
+                          }
+                        });
+}
+
+void Session::admit(Holder holder) {
+  admitted_ = true;
+  holder_ = holder;
+  server_.on_admitted();
+}
 
-void Session::start() { do_read(); }
+bool Session::on_hello(const char* payload, std::size_t size) {
+  protocol::SessionToken token;
+  protocol::SessionToken renewed;
+  if (!protocol::decode_session_token(payload, size, token) ||
+      !server_.check_token(token, renewed)) {
+    LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                     "Session {}: rejected session token", handle_.index);
+    return false;
+  }
+  // Ссылки на файлы принадлежат пользователю и переживают его сессии
+  admit(auth::token_claims(token).user & ~kAnonymousHolder);
+  deliver(make_shared_frame(protocol::make_welcome(renewed)));
+  return true;
+}
 
-void Session::deliver(const std::vector<char>& msg) {
-  bool write_in_progress = !write_msgs_.empty();
-  write_msgs_.push_back(msg);
-  if (!write_in_progress) {
-    do_write();
+void Session::stop() {
+  if (tls_) {
+    tls_->shutdown();
   }
+  boost::system::error_code ec;
+  socket_.close(ec);
+  // Очереди больше не нужны: освобождаем их и место в бюджете сразу
+  outgoing_ = StreamScheduler();
+  write_frame_.reset();
+  std::vector<IncomingMessage>().swap(incoming_);
+  FramePool::release(pending_);
+  account_memory();
+  account_queue();
 }
 
-void Session::do_read() {
+// Рукопожатие ограничено тем же таймаутом тишины, что и работающая
+// сессия: колесо keepalive отключит клиента, застрявшего посередине.
+// Когда транспорт готов, сессия ждёт kHello или допускается сразу.
+boost::asio::awaitable<void> Session::run() {
   auto self(shared_from_this());
-  socket_.async_read_some(
-      boost::asio::buffer(read_msg_),
-      [this, self](boost::system::error_code ec, std::size_t length) {
-        if (!ec) {
-          std::vector<char> msg(read_msg_.begin(), read_msg_.begin() + length);
-          server_.deliver(msg);
-          do_read();
-        } else if (ec != boost::asio::error::operation_aborted) {
-          server_.leave(shared_from_this());
+  while (tls_) {
+    tls::Status status = tls_->handshake();
+    if (status == tls::Status::kOk) {
+      server_.count_handshake(*tls_);
+      LOG_DEBUG("Session {}: {} {}, {}, kTLS send {}", handle_.index,
+                tls_->version(), tls_->cipher(),
+                tls_->resumed() ? "resumed" : "full handshake",
+                tls_->ktls_send() ? "on" : "off");
+      break;
+    }
+    if (status != tls::Status::kWantRead &&
+        status != tls::Status::kWantWrite) {
+      if (socket_.is_open()) {
+        LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                         "Session {}: TLS handshake failed: {}",
+                         handle_.index, tls_->error());
+        server_.leave(handle_);
+      }
+      co_return;
+    }
+    boost::system::error_code ec;
+    co_await socket_.async_wait(
+        status == tls::Status::kWantRead ? tcp::socket::wait_read
+                                         : tcp::socket::wait_write,
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (ec != boost::asio::error::operation_aborted) {
+        server_.leave(handle_);
+      }
+      co_return;
+    }
+  }
+  if (!server_.auth_required()) {
+    admit(server_.anonymous_holder());
+  }
+  co_await read_loop();
+}
+
+void Session::deliver(SharedFrame msg, Clock::time_point deadline) {
+  if (!admitted_) {
+    return;
+  }
+  bool voice = protocol::decode_header(msg->data()).type ==
+               protocol::MessageType::kAudio;
+  if (voice && !voice_link_) {
+    voice_link_ = std::make_unique<VoiceLink>();
+  }
+  // Чётность считается и по кадрам, которые сейчас будут отброшены:
+  // именно их она и восстановит
+  std::vector<char> parity;
+  bool has_parity = voice && requested_.fec && add_parity(*msg, parity);
+  if (voice) {
+    ++voice_link_->voice_frames;
+  }
+  if (!server_.should_queue(*msg, !outgoing_.empty())) {
+    if (voice) {
+      ++voice_link_->frames_dropped;
+    }
+  } else {
+    if (voice) {
+      voice_link_->voice_bytes += msg->size();
+    }
+    outgoing_.push(std::move(msg), Clock::now(), deadline);
+    flush();
+  }
+  if (has_parity) {
+    server_.count_parity(parity.size());
+    deliver(make_shared_frame(std::move(parity)), deadline);
+  }
+}
+
+bool Session::add_parity(const std::vector<char>& frame,
+                         std::vector<char>& parity) {
+  VoiceLink& link = *voice_link_;
+  std::uint16_t sender = protocol::decode_header(frame.data()).stream;
+  auto it = std::find_if(link.parity.begin(), link.parity.end(),
+                         [sender](const ParityStream& stream) {
+                           return stream.sender == sender;
+                         });
+  if (it == link.parity.end()) {
+    link.parity.push_back(ParityStream{sender, 0, ParityEncoder()});
+    it = link.parity.end() - 1;
+    it->encoder.set_group(link.fec.group());
+  }
+  it->used = link.evaluations;
+  return it->encoder.add(frame.data(), parity);
+}
+
+// Потери здесь — кадры, которые сервер сам не поставил в очередь
+// или выбросил по сроку: других на TCP не бывает
+void Session::adapt_fec() {
+  VoiceLink& link = *voice_link_;
+  std::uint8_t group = link.fec.group();
+  link.fec.update(link.voice_frames - link.voice_frames_evaluated,
+                  link.frames_dropped - link.frames_dropped_evaluated);
+  link.voice_frames_evaluated = link.voice_frames;
+  link.frames_dropped_evaluated = link.frames_dropped;
+  link.parity.erase(
+      std::remove_if(link.parity.begin(), link.parity.end(),
+                     [&link](const ParityStream& stream) {
+                       return link.evaluations - stream.used >
+                              kParityIdleEvaluations;
+                     }),
+      link.parity.end());
+  if (link.fec.group() == group) {
+    return;
+  }
+  for (ParityStream& stream : link.parity) {
+    stream.encoder.set_group(link.fec.group());
+  }
+  if (requested_.fec) {
+    LOG_DEBUG("Session {}: FEC group {} at {}% loss", handle_.index,
+              link.fec.group(), link.fec.loss() * 100);
+  }
+}
+
+void Session::deliver_message(std::uint16_t stream, std::uint32_t weight,
+                              SharedMessage message) {
+  if (!admitted_ || message->empty() ||
+      !server_.should_queue(*message->front(), !outgoing_.empty())) {
+    return;
+  }
+  outgoing_.push_message(stream, weight, std::move(message), Clock::now());
+  flush();
+}
+
+void Session::refresh_config() {
+  config_ = apply_bitrate_level(requested_, bitrate_level());
+  config_.packet_ms = protocol::negotiate_packet_interval(
+      config_.packet_ms, server_.min_packet_ms());
+  deliver(make_shared_frame(protocol::make_session_config(config_)));
+}
+
+// Сигналы без системных вызовов — на каждой оценке, TCP_INFO — реже,
+// пока с каналом всё хорошо
+void Session::adapt_bitrate(Clock::time_point now) {
+  if (!voice_link_) {
+    return;
+  }
+  VoiceLink& link = *voice_link_;
+  double elapsed = std::chrono::duration<double>(now - link.evaluated).count();
+  double voice_rate =
+      link.evaluated == Clock::time_point() || elapsed <= 0
+          ? 0
+          : (link.voice_bytes - link.voice_bytes_evaluated) / elapsed;
+  link.evaluated = now;
+  link.voice_bytes_evaluated = link.voice_bytes;
+  link.frames_dropped += outgoing_.take_expired_audio();
+  adapt_fec();
+
+  LinkSample sample;
+  sample.voice_age = std::chrono::duration_cast<std::chrono::milliseconds>(
+      outgoing_.voice_age(Clock::now()));
+  sample.frames_dropped = link.frames_dropped;
+  sample.uplink_delay = link.uplink.delay();
+  if (++link.evaluations % kTcpInfoEvery == 0 || !outgoing_.empty() ||
+      link.controller.level() > 0) {
+    read_tcp_info(socket_.native_handle(), sample);
+  }
+  std::size_t level = link.controller.level();
+  link.last = sample;
+  if (link.controller.update(sample, voice_rate, now) == level) {
+    return;
+  }
+  bool down = link.controller.level() > level;
+  server_.count_bitrate_change(down);
+  refresh_config();
+  LOG_INFO("Session {}: bitrate level {} ({}), {} Hz {} {} ms",
+           handle_.index, link.controller.level(),
+           down ? congestion_name(link.controller.congestion()) : "probe",
+           config_.wire_format.sample_rate,
+           config_.wire_format.sample_format == protocol::SampleFormat::kInt16
+               ? "int16"
+               : "float32",
+           config_.packet_ms);
+}
+
+void Session::send_ping() {
+  auto sent = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch());
+  deliver(make_shared_frame(
+      protocol::make_ping(static_cast<std::uint64_t>(sent.count()))));
+}
+
+void Session::on_pong(const char* payload, std::size_t size) {
+  if (size < protocol::kPingSize) {
+    return;
+  }
+  auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch());
+  std::int64_t rtt_ns =
+      now.count() - static_cast<std::int64_t>(protocol::get_u64(payload));
+  if (rtt_ns < 0) {
+    return;
+  }
+  last_rtt_us_ = static_cast<std::uint32_t>(rtt_ns / 1000);
+  // Сглаживание как у TCP (RFC 6298): srtt = 7/8 srtt + 1/8 rtt
+  srtt_us_ = srtt_us_ == 0 ? last_rtt_us_
+                           : srtt_us_ - srtt_us_ / 8 + last_rtt_us_ / 8;
+}
+
+// Ждём готовности сокета без буфера: пока клиент молчит, сессия
+// не держит ни одного байта под чтение. На пробуждение — одно ожидание,
+// память под которое и под кадр корутины asio берёт из своего кэша
+// потока, а не из кучи.
+boost::asio::awaitable<void> Session::read_loop() {
+  auto self(shared_from_this());
+  do {
+    if (tls_ && tls_->has_pending()) {
+      // Запись TLS уже прочитана из сокета; уступаем другим сессиям
+      co_await boost::asio::post(socket_.get_executor(),
+                                 boost::asio::use_awaitable);
+      continue;
+    }
+    boost::system::error_code ec;
+    co_await socket_.async_wait(
+        tcp::socket::wait_read,
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (ec != boost::asio::error::operation_aborted) {
+        server_.leave(handle_);
+      }
+      co_return;
+    }
+  } while (on_readable());
+}
+
+bool Session::on_readable() {
+  limiter_.refill(server_.rate_limits(), server_.now());
+  auto buffer = server_.read_buffers().acquire();
+  char* data = buffer.data();
+  std::size_t filled = pending_.size();
+  if (filled > 0) {
+    std::memcpy(data, pending_.data(), filled);
+    FramePool::release(pending_);
+  }
+
+  for (int reads = 0; reads < kMaxReadsPerWakeup; ++reads) {
+    boost::system::error_code ec;
+    std::size_t length =
+        read_some(data + filled, buffer.size() - filled, ec);
+    if (ec == boost::asio::error::would_block) {
+      break;
+    }
+    if (ec) {
+      server_.leave(handle_);
+      return false;
+    }
+    filled += length;
+    last_receive_ = server_.now();
+    limiter_.spend_bytes(length);
+
+    std::size_t consumed = 0;
+    if (!handle_frames(data, filled, consumed)) {
+      server_.leave(handle_);
+      return false;
+    }
+    filled -= consumed;
+    std::memmove(data, data + consumed, filled);
+    if (limiter_.exhausted()) {
+      break;
+    }
+  }
+
+  if (filled > 0) {
+    pending_ = FramePool::acquire(filled);
+    std::memcpy(pending_.data(), data, filled);
+  }
+  account_memory();
+  // Не читая, перекладываем давление на TCP-окно клиента
+  if (limiter_.exhausted() ||
+      server_.memory().pressure() >= MemoryPressure::kThrottleReads) {
+    reads_paused_ = true;
+    server_.pause_reads(handle_);
+    return false;
+  }
+  // Кадр мог отключить саму сессию
+  return socket_.is_open();
+}
+
+bool Session::resume_reads() {
+  limiter_.refill(server_.rate_limits(), server_.now());
+  if (limiter_.exhausted()) {
+    return false;
+  }
+  reads_paused_ = false;
+  // Пауза наша, а не молчание клиента
+  last_receive_ = server_.now();
+  spawn(read_loop());
+  return true;
+}
+
+void Session::account_memory() {
+  std::size_t bytes = pending_.capacity();
+  for (const auto& message : incoming_) {
+    bytes += message.payload.capacity();
+  }
+  server_.memory().update(accounted_bytes_, bytes);
+}
+
+void Session::account_queue() {
+  std::size_t bytes = outgoing_.heap_bytes();
+  if (bytes != accounted_queue_bytes_) {
+    server_.memory().update(accounted_queue_bytes_, bytes);
+  }
+}
+
+
+
+std::size_t Session::read_some(char* data, std::size_t size,
+                               boost::system::error_code& ec) {
+  if (!tls_) {
+    return socket_.read_some(boost::asio::buffer(data, size), ec);
+  }
+  std::size_t length = 0;
+  switch (tls_->read(data, size, length)) {
+    case tls::Status::kOk:
+      ec = boost::system::error_code();
+      break;
+    // kWantWrite при чтении бывает только при ответе на KeyUpdate
+    // в переполненный сокет; запись допишется со следующим чтением
+    case tls::Status::kWantRead:
+    case tls::Status::kWantWrite:
+      ec = boost::asio::error::would_block;
+      break;
+    case tls::Status::kClosed:
+      ec = boost::asio::error::eof;
+      break;
+    case tls::Status::kError:
+      ec = boost::asio::error::connection_reset;
+      break;
+  }
+  return length;
+}
+
+bool Session::handle_frames(const char* data, std::size_t size,
+                            std::size_t& consumed) {
+  consumed = 0;
+  while (size - consumed >= protocol::kHeaderSize) {
+    auto header = protocol::decode_header(data + consumed);
+    if (header.length > protocol::kMaxPayloadSize) {
+      LOG_WARNING("Session {}: frame too large: {}", handle_.index,
+                  header.length);
+      return false;
+    }
+    std::size_t frame_size = protocol::kHeaderSize + header.length;
+    if (size - consumed < frame_size) {
+      break;
+    }
+    server_.capture_frame(capture_id_, data + consumed, frame_size);
+    if (admitted_ && !limiter_.spend_frame()) {
+      // Сверх нормы кадров теряется голос; остальное держит протокол
+      // и ограничено паузами чтения
+      if (limiter_.abusive(server_.rate_limits())) {
+        LOG_WARNING("Session {}: frame rate far above the limit",
+                    handle_.index);
+        server_.count_abuse();
+        return false;
+      }
+      if (header.type == protocol::MessageType::kAudio) {
+        server_.count_voice_shed();
+        consumed += frame_size;
+        continue;
+      }
+    }
+    if (admitted_) {
+      handle_frame(header, data + consumed);
+    } else if (header.type != protocol::MessageType::kHello ||
+               !on_hello(data + consumed + protocol::kHeaderSize,
+                         header.length)) {
+      // До входа принимается только kHello
+      return false;
+    }
+    consumed += frame_size;
+  }
+  return true;
+}
+
+void Session::handle_frame(const protocol::FrameHeader& header,
+                           const char* frame) {
+  const char* payload = frame + protocol::kHeaderSize;
+  switch (header.type) {
+    case protocol::MessageType::kAudio:
+      if (!transcoder_) {
+        transcoder_ = std::make_unique<AudioTranscoder>();
+      }
+      if (!voice_link_) {
+        voice_link_ = std::make_unique<VoiceLink>();
+      }
+      {
+        Clock::time_point arrival = Clock::now();
+        voice_link_->uplink.on_frame(header.timestamp, arrival);
+        voice_link_->transit.on_frame(header.timestamp, arrival);
+        // Срок считается от отправки кадра: задержка по меткам времени
+        // клиента — время, которое он уже провёл в пути. База для неё
+        // — минимум за короткое окно: после устойчивого сдвига задержки
+        // сроки снова сходятся за секунду, а не за 10-20
+        Clock::time_point deadline =
+            server_.voice_deadline(arrival - voice_link_->transit.delay());
+        // Слушатели различают отправителей по номеру потока
+        std::vector<char> copy =
+            FramePool::acquire(protocol::kHeaderSize + header.length);
+        std::memcpy(copy.data(), frame, copy.size());
+        protocol::put_u16(copy.data() + 6,
+                          static_cast<std::uint16_t>(handle_.index));
+        SharedFrame voice = make_shared_frame(std::move(copy));
+        server_.deliver_audio(voice, *transcoder_, deadline);
+        server_.record_voice(capture_id_, voice);
+      }
+      break;
+    case protocol::MessageType::kSessionConfig: {
+      protocol::SessionConfig requested;
+      if (protocol::decode_session_config(payload, header.length,
+                                          requested)) {
+        // Формат сети выбирает клиент, а сервер может его только
+        // урезать по уровню битрейта. В нём клиент шлёт голос и в нём же
+        // получает чужой: сервер переводит кадры (deliver_audio), а
+        // flags каждого кадра называют его формат
+        requested_ = requested;
+        refresh_config();
+      }
+      break;
+    }
+    case protocol::MessageType::kPong:
+      on_pong(payload, header.length);
+      break;
+    case protocol::MessageType::kData:
+      on_data(header, payload);
+      break;
+    case protocol::MessageType::kUploadBegin:
+      on_upload_begin(payload, header.length);
+      break;
+    case protocol::MessageType::kUploadChunk:
+      on_upload_chunk(payload, header.length);
+      break;
+    case protocol::MessageType::kDownloadRequest:
+      on_download_request(payload, header.length);
+      break;
+    case protocol::MessageType::kReleaseFile:
+      on_release_file(payload, header.length);
+      break;
+    case protocol::MessageType::kPeerCandidates:
+      on_peer_candidates(payload, header.length);
+      break;
+    case protocol::MessageType::kPeerState: {
+      protocol::PeerState state;
+      if (protocol::decode_peer_state(payload, header.length, state)) {
+        server_.on_peer_state(handle_, state);
+      }
+      break;
+    }
+    default:
+      // Неизвестные типы пропускаем, чтобы старый сервер
+      // не рвал соединения с новыми клиентами
+      break;
+  }
+}
+
+// Клиент знает только свои адреса; за NAT собеседнику нужен адрес,
+// который видит сервер. Порт UDP берётся из первого адреса клиента:
+// отдельного UDP-порта, чтобы узнать внешний, у сервера нет.
+void Session::on_peer_candidates(const char* payload, std::size_t size) {
+  std::vector<protocol::PeerCandidate> candidates;
+  if (!protocol::decode_peer_candidates(payload, size, candidates) ||
+      candidates.empty()) {
+    return;
+  }
+  boost::system::error_code ec;
+  auto remote = socket_.remote_endpoint(ec);
+  if (!ec && remote.address().is_v4()) {
+    protocol::PeerCandidate observed;
+    observed.address = remote.address().to_v4().to_uint();
+    observed.port = candidates.front().port;
+    auto same = [&observed](const protocol::PeerCandidate& candidate) {
+      return candidate.address == observed.address &&
+             candidate.port == observed.port;
+    };
+    if (std::none_of(candidates.begin(), candidates.end(), same)) {
+      candidates.insert(candidates.begin(), observed);
+      if (candidates.size() > protocol::kMaxPeerCandidates) {
+        candidates.pop_back();
+      }
+    }
+  }
+  peer_candidates_ = std::move(candidates);
+  server_.update_call();
+}
+
+void Session::on_data(const protocol::FrameHeader& header,
+                      const char* payload) {
+  auto it = std::find_if(incoming_.begin(), incoming_.end(),
+                         [&header](const IncomingMessage& message) {
+                           return message.stream == header.stream;
+                         });
+  if (it == incoming_.end()) {
+    incoming_.push_back(IncomingMessage{header.stream, false, {}});
+    it = incoming_.end() - 1;
+  }
+  if (!it->discarding) {
+    if (it->payload.size() + header.length > protocol::kMaxMessageSize) {
+      LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                       "Session {}: message on stream {} exceeds {} bytes",
+                       handle_.index, header.stream,
+                       protocol::kMaxMessageSize);
+      it->discarding = true;
+      std::vector<char>().swap(it->payload);
+    } else {
+      it->payload.insert(it->payload.end(), payload, payload + header.length);
+    }
+  }
+  if (header.flags & protocol::kFlagMoreChunks) {
+    return;
+  }
+  if (!it->discarding) {
+    server_.deliver_message(header.stream, it->payload.data(),
+                            it->payload.size());
+  }
+  incoming_.erase(it);
+  if (incoming_.empty()) {
+    incoming_.shrink_to_fit();
+  }
+}
+
+void Session::send_status(const protocol::TransferStatus& status) {
+  deliver(make_shared_frame(protocol::make_transfer_status(status)));
+}
+
+// Новая загрузка заменяет прежнюю; .part прежней остаётся на диске
+// для продолжения
+void Session::on_upload_begin(const char* payload, std::size_t size) {
+  protocol::UploadBegin begin;
+  if (!protocol::decode_upload_begin(payload, size, begin)) {
+    return;
+  }
+  upload_.reset();
+  protocol::TransferStatus status;
+  status.id = begin.id;
+  status.size = begin.size;
+  upload_ = server_.files().begin_upload(begin, holder_, status.state);
+  status.next_chunk = upload_ ? upload_->next_chunk()
+                              : protocol::file_chunk_count(begin.size);
+  if (upload_) {
+    LOG_INFO("Session {}: upload {} from chunk {}", handle_.index,
+             to_hex(begin.id), status.next_chunk);
+  }
+  send_status(status);
+}
+
+// Каждый кусок подтверждается номером следующего ожидаемого
+void Session::on_upload_chunk(const char* payload, std::size_t size) {
+  protocol::UploadChunk chunk;
+  if (!protocol::decode_upload_chunk(payload, size, chunk)) {
+    return;
+  }
+  protocol::TransferStatus status;
+  status.id = chunk.id;
+  if (!upload_ || upload_->id() != chunk.id) {
+    status.state = protocol::TransferState::kError;
+    send_status(status);
+    return;
+  }
+  status.size = upload_->size();
+  status.state = upload_->write_chunk(chunk);
+  status.next_chunk = upload_->next_chunk();
+  if (status.state == protocol::TransferState::kComplete ||
+      status.state == protocol::TransferState::kError) {
+    LOG_INFO("Session {}: upload {} {}", handle_.index, to_hex(chunk.id),
+             status.state == protocol::TransferState::kComplete ? "complete"
+                                                                : "failed");
+    upload_.reset();
+  }
+  send_status(status);
+}
+
+void Session::on_download_request(const char* payload, std::size_t size) {
+  protocol::DownloadRequest request;
+  if (!protocol::decode_download_request(payload, size, request)) {
+    return;
+  }
+  protocol::TransferStatus status;
+  status.id = request.id;
+  // Недописанный кусок прежней отдачи нельзя прервать посреди кадра
+  if (download_ && download_->header_sent > 0) {
+    status.state = protocol::TransferState::kBusy;
+    send_status(status);
+    return;
+  }
+  download_.reset();
+  auto manifest = server_.files().open_file(request.id);
+  if (!manifest) {
+    status.state = protocol::TransferState::kNotFound;
+    send_status(status);
+    return;
+  }
+  status.size = manifest->size;
+  if (request.offset > status.size) {
+    status.state = protocol::TransferState::kError;
+    send_status(status);
+    return;
+  }
+  std::size_t chunk = 0;
+  std::uint64_t chunk_offset = request.offset;
+  while (chunk < manifest->chunks.size() &&
+         chunk_offset >= manifest->chunks[chunk].size) {
+    chunk_offset -= manifest->chunks[chunk].size;
+    ++chunk;
+  }
+  // Статус уходит раньше данных: очередь кадров отправляется до файла
+  download_.reset(new Download{std::move(manifest), request.offset, chunk,
+                               chunk_offset, -1, 0, {}, 0});
+  send_status(status);
+}
+
+void Session::on_release_file(const char* payload, std::size_t size) {
+  protocol::TransferStatus status;
+  if (size < protocol::kFileIdSize) {
+    return;
+  }
+  std::memcpy(status.id.data(), payload, protocol::kFileIdSize);
+  status.state = server_.files().release_file(status.id, holder_);
+  send_status(status);
+}
+
+// Пишем, пока сокет принимает данные, прямо из deliver: без операции
+// asio и без обработчика на каждый кадр. Корутина нужна, только когда
+// сокет заполнен. Кадры берутся по одному, так что между кусками
+// большого сообщения планировщик успевает вставить голос и служебные
+// кадры; TCP_NOTSENT_LOWAT не даёт ядру набрать очередь впереди него.
+void Session::flush() {
+  // Очередь отстающего растёт и тогда, когда запись стоит
+  account_queue();
+  if (writing_) {
+    return;
+  }
+  writing_ = true;
+  WriteWait wait = write_ready();
+  account_queue();
+  if (wait == WriteWait::kNone) {
+    writing_ = false;
+  } else if (wait == WriteWait::kFailed) {
+    // Сервер может быть посреди обхода сессий: отключаем позже
+    boost::asio::post(socket_.get_executor(),
+                      [this, self = shared_from_this()]() {
+                        server_.leave(handle_);
+                      });
+  } else {
+    spawn(write_loop(wait));
+  }
+}
+
+boost::asio::awaitable<void> Session::write_loop(WriteWait wait) {
+  auto self(shared_from_this());
+  while (wait != WriteWait::kNone) {
+    if (wait == WriteWait::kFailed) {
+      server_.leave(handle_);
+      co_return;
+    }
+    boost::system::error_code ec;
+    co_await socket_.async_wait(
+        wait == WriteWait::kReadable ? tcp::socket::wait_read
+                                     : tcp::socket::wait_write,
+        boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {
+      if (ec != boost::asio::error::operation_aborted) {
+        server_.leave(handle_);
+      }
+      co_return;
+    }
+    wait = write_ready();
+    account_queue();
+  }
+  writing_ = false;
+}
+
+// Файл отдаётся, только когда очередь кадров пуста. Цикл, а не цепочка
+// вызовов: запись обычно завершается сразу, и рекурсия по длинной
+// очереди переполнила бы стек.
+Session::WriteWait Session::write_ready() {
+  const bool encrypt = tls_ && !tls_->ktls_send();
+  for (;;) {
+    if (!write_frame_) {
+      if (encrypt) {
+        write_frame_ = next_tls_frame();
+      } else if (!outgoing_.empty()) {
+        // Очередь могла состоять из одного просроченного голоса
+        write_frame_ = outgoing_.pop(Clock::now());
+      }
+      if (!write_frame_) {
+        if (encrypt || !download_) {
+          return WriteWait::kNone;
         }
+        WriteWait wait = send_file();
+        if (wait != WriteWait::kNone) {
+          return wait;
+        }
+        continue;
+      }
+      write_offset_ = 0;
+    }
+    const auto& data = *write_frame_;
+    std::size_t written = 0;
+    if (encrypt) {
+      switch (tls_->write(data.data() + write_offset_,
+                          data.size() - write_offset_, written)) {
+        case tls::Status::kOk:
+          break;
+        case tls::Status::kWantRead:
+          return WriteWait::kReadable;
+        case tls::Status::kWantWrite:
+          return WriteWait::kWritable;
+        default:
+          return WriteWait::kFailed;
+      }
+    } else {
+      boost::system::error_code ec;
+      written = socket_.write_some(
+          boost::asio::buffer(data.data() + write_offset_,
+                              data.size() - write_offset_),
+          ec);
+      if (ec == boost::asio::error::would_block) {
+        return WriteWait::kWritable;
+      }
+      if (ec) {
+        return WriteWait::kFailed;
+      }
+    }
+    write_offset_ += written;
+    if (write_offset_ == data.size()) {
+      write_frame_.reset();
+    }
+  }
+}
+
+// Кадр kFileData: заголовок обычным send, содержимое — sendfile из
+// файла куска в page cache, минуя буферы процесса
+Session::WriteWait Session::send_file() {
+  Download& download = *download_;
+  int socket_fd = socket_.native_handle();
+  if (download.header_sent == 0 && !download.begin_frame(server_.files())) {
+    protocol::TransferStatus status;
+    status.id = download.manifest->id;
+    status.state = protocol::TransferState::kError;
+    download_.reset();
+    send_status(status);
+    return WriteWait::kNone;
+  }
+  while (download.header_sent < protocol::kHeaderSize) {
+    ssize_t n = ::send(socket_fd, download.header + download.header_sent,
+                       protocol::kHeaderSize - download.header_sent,
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK ? WriteWait::kWritable
+                                                     : WriteWait::kFailed;
+    }
+    download.header_sent += static_cast<std::size_t>(n);
+  }
+  while (download.offset < download.frame_end) {
+    auto offset = static_cast<off_t>(download.chunk_offset);
+    ssize_t n = ::sendfile(socket_fd, download.fd, &offset,
+                           download.frame_end - download.offset);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return WriteWait::kWritable;
+    }
+    if (n <= 0) {
+      // Ошибка сокета или кусок укоротился: кадр уже не дописать
+      return WriteWait::kFailed;
+    }
+    download.offset += static_cast<std::uint64_t>(n);
+    download.chunk_offset = static_cast<std::uint64_t>(offset);
+  }
+  download.header_sent = 0;
+  if (download.offset == download.manifest->size) {
+    download_.reset();
+  }
+  return WriteWait::kNone;
+}
+
+// Тот же порядок, что у write_ready: файл — только при пустой очереди
+SharedFrame Session::next_tls_frame() {
+  if (!outgoing_.empty()) {
+    if (SharedFrame frame = outgoing_.pop(Clock::now())) {
+      return frame;
+    }
+  }
+  if (!download_) {
+    return nullptr;
+  }
+  Download& download = *download_;
+  std::vector<char> frame;
+  if (!download.begin_frame(server_.files()) ||
+      !download.read_frame(frame)) {
+    protocol::TransferStatus status;
+    status.id = download.manifest->id;
+    status.state = protocol::TransferState::kError;
+    download_.reset();
+    send_status(status);
+    return outgoing_.pop(Clock::now());
+  }
+  if (download.offset == download.manifest->size) {
+    download_.reset();
+  }
+  return make_shared_frame(std::move(frame));
+}
+
+// Реализация методов ShmSubscriber
+ShmSubscriber::ShmSubscriber(stream_protocol::socket socket, Server& server)
+    : socket_(std::move(socket)),
+      server_(server),
+      space_ready_(socket_.get_executor()) {}
+
+// С ключом подписи клиент сначала шлёт kHello, как по TCP; кольцо
+// он получает только после проверки токена
+void ShmSubscriber::start(SessionHandle handle) {
+  handle_ = handle;
+  if (server_.auth_required()) {
+    read_hello();
+    return;
+  }
+  open_ring(nullptr);
+}
+
+void ShmSubscriber::stop() {
+  boost::system::error_code ec;
+  socket_.close(ec);
+  space_ready_.close(ec);
+  backlog_ = StreamScheduler();
+  pending_.reset();
+}
+
+void ShmSubscriber::read_hello() {
+  auto self(shared_from_this());
+  boost::asio::async_read(
+      socket_, boost::asio::buffer(hello_),
+      [this, self](boost::system::error_code ec, std::size_t) {
+        if (ec) {
+          server_.leave_shm(handle_);
+          return;
+        }
+        auto header = protocol::decode_header(hello_);
+        protocol::SessionToken token;
+        protocol::SessionToken renewed;
+        if (header.type != protocol::MessageType::kHello ||
+            !protocol::decode_session_token(hello_ + protocol::kHeaderSize,
+                                            header.length, token) ||
+            !server_.check_token(token, renewed)) {
+          LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                           "Shared memory client {}: rejected session token",
+                           handle_.index);
+          server_.leave_shm(handle_);
+          return;
+        }
+        open_ring(&renewed);
       });
 }
 
-void Session::do_write() {
+void ShmSubscriber::open_ring(const protocol::SessionToken* renewed) {
+  try {
+    mapping_ = shm::Mapping::create(server_.shm_ring_bytes());
+  } catch (const std::exception& e) {
+    LOG_WARNING("Shared memory client {}: {}", handle_.index, e.what());
+    server_.leave_shm(handle_);
+    return;
+  }
+  int space_ready = dup(mapping_.space_ready());
+  if (space_ready < 0 ||
+      !shm::send_ring(socket_.native_handle(), mapping_)) {
+    if (space_ready >= 0) {
+      ::close(space_ready);
+    }
+    server_.leave_shm(handle_);
+    return;
+  }
+  space_ready_.assign(space_ready);
+  writer_ = std::make_unique<shm::RingWriter>(mapping_);
+  LOG_INFO("Shared memory client {}: ring of {} KiB", handle_.index,
+           mapping_.capacity() / 1024);
+  // Первый кадр кольца — новый токен, как kWelcome по TCP
+  if (renewed) {
+    deliver(make_shared_frame(protocol::make_welcome(*renewed)));
+  }
+  watch_socket();
+}
+
+void ShmSubscriber::watch_socket() {
   auto self(shared_from_this());
-  boost::asio::async_write(
-      socket_,
-      boost::asio::buffer(write_msgs_.front().data(),
-                          write_msgs_.front().size()),
-      [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-        if (!ec) {
-          write_msgs_.pop_front();
-          if (!write_msgs_.empty()) {
-            do_write();
-          }
-        } else {
-          server_.leave(shared_from_this());
+  socket_.async_wait(
+      stream_protocol::socket::wait_read,
+      [this, self](boost::system::error_code ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+        char discard[256];
+        std::size_t n = ec ? 0 : socket_.read_some(
+                                     boost::asio::buffer(discard), ec);
+        if (ec || n == 0) {
+          server_.leave_shm(handle_);
+          return;
+        }
+        watch_socket();
+      });
+}
+
+// Голос в обход планировщика, пока очередь пуста: в установившемся
+// режиме кадр сразу копируется в кольцо
+void ShmSubscriber::deliver(SharedFrame frame, Clock::time_point deadline) {
+  if (!writer_) {
+    return;
+  }
+  if (!pending_ && backlog_.empty() &&
+      writer_->write(frame->data(), frame->size())) {
+    schedule_wake();
+    return;
+  }
+  backlog_.push(std::move(frame), Clock::now(), deadline);
+  flush();
+}
+
+void ShmSubscriber::deliver_message(std::uint16_t stream,
+                                    std::uint32_t weight,
+                                    SharedMessage message) {
+  if (!writer_) {
+    return;
+  }
+  backlog_.push_message(stream, weight, std::move(message), Clock::now());
+  flush();
+}
+
+void ShmSubscriber::flush() {
+  if (waiting_space_) {
+    return;
+  }
+  for (;;) {
+    if (!pending_) {
+      if (backlog_.empty()) {
+        return;
+      }
+      pending_ = backlog_.pop(Clock::now());
+      if (!pending_) {
+        return;
+      }
+    }
+    if (!writer_->write(pending_->data(), pending_->size())) {
+      writer_->wake();
+      wait_space();
+      return;
+    }
+    pending_.reset();
+    schedule_wake();
+  }
+}
+
+void ShmSubscriber::schedule_wake() {
+  if (wake_scheduled_) {
+    return;
+  }
+  wake_scheduled_ = true;
+  boost::asio::post(socket_.get_executor(), [self = shared_from_this()]() {
+    self->wake_scheduled_ = false;
+    self->writer_->wake();
+  });
+}
+
+void ShmSubscriber::wait_space() {
+  if (!writer_->prepare_wait(pending_->size())) {
+    // Читатель успел освободить место
+    boost::asio::post(socket_.get_executor(),
+                      [self = shared_from_this()]() { self->flush(); });
+    return;
+  }
+  waiting_space_ = true;
+  auto self(shared_from_this());
+  space_ready_.async_wait(
+      boost::asio::posix::stream_descriptor::wait_read,
+      [this, self](boost::system::error_code ec) {
+        waiting_space_ = false;
+        if (ec) {
+          return;
         }
+        shm::drain_event(space_ready_.native_handle());
+        flush();
       });
 }
 
 // Реализация методов Server
-Server::Server(boost::asio::io_context& io_context, short port)
-    : acceptor_(io_context,
-                tcp::endpoint(boost::asio::ip::address_v4::any(), port)) {
+Server::Server(boost::asio::io_context& io_context,
+               const ServerOptions& options)
+    : acceptor_(io_context, tcp::endpoint(boost::asio::ip::address_v4::any(),
+                                          options.port)),
+      signals_(io_context, SIGUSR1, SIGUSR2),
+      stats_timer_(io_context),
+      tick_timer_(io_context),
+      read_buffers_(2 * (protocol::kHeaderSize + protocol::kMaxPayloadSize),
+                    4),
+      files_(options.storage_path,
+             std::uint64_t{options.max_file_mb} * 1024 * 1024),
+      token_ttl_(std::chrono::hours(options.token_ttl_hours)),
+      rate_limits_(options.rate_limits),
+      memory_(std::size_t{options.memory_budget_mb} * 1024 * 1024),
+      max_handshakes_(options.max_handshakes),
+      max_deferred_(options.max_deferred),
+      deferred_timeout_(std::chrono::seconds(options.deferred_timeout)),
+      shm_ring_bytes_(std::size_t{options.shm_ring_kb} * 1024),
+      keepalive_wheel_(kWheelSlots),
+      now_(Clock::now()),
+      keepalive_interval_(std::chrono::seconds(options.keepalive_interval)),
+      peer_timeout_(std::chrono::seconds(options.peer_timeout)),
+      min_packet_ms_(options.min_packet_ms),
+      voice_deadline_(std::chrono::milliseconds(options.voice_deadline_ms)),
+      stats_interval_(options.stats_interval),
+      baseline_rss_(resident_bytes()),
+      last_capture_flush_(now_),
+      last_gc_(now_) {
+  if (!options.capture_path.empty()) {
+    capture_ =
+        std::make_unique<capture::TrafficRecorder>(options.capture_path);
+  }
+  if (!options.recording.dir.empty()) {
+    recorder_ = std::make_unique<recording::Recorder>(options.recording);
+    if (recorder_->recovered() > 0) {
+      LOG_WARNING("Recording: recovered {} unfinished segments",
+                  recorder_->recovered());
+    }
+  }
+  if (!options.tls.cert_path.empty()) {
+    tls_ = std::make_unique<tls::Context>(options.tls);
+  }
+  if (!options.auth_key_path.empty()) {
+    signer_ = std::make_unique<auth::TokenSigner>(options.auth_key_path);
+    token_cache_ = std::make_unique<auth::VerifiedTokenCache>();
+  }
+  if (!options.shm_socket_path.empty()) {
+    // Сокет от прошлого запуска мешал бы bind
+    ::unlink(options.shm_socket_path.c_str());
+    shm_acceptor_ = std::make_unique<stream_protocol::acceptor>(
+        io_context, stream_protocol::endpoint(options.shm_socket_path));
+    do_accept_shm();
+  }
+  if (options.stage_port != 0) {
+    stage::Options stage_options;
+    stage_options.workers = options.stage_workers;
+    stage_options.keepalive_interval = options.keepalive_interval;
+    stage_options.peer_timeout = options.peer_timeout;
+    stage_ = std::make_unique<stage::Stage>(stage_options, memory_);
+    stage_acceptor_ = std::make_unique<tcp::acceptor>(
+        io_context, tcp::endpoint(boost::asio::ip::address_v4::any(),
+                                  options.stage_port));
+    stage_acceptor_->non_blocking(true);
+    do_accept_stage();
+  }
+  acceptor_.non_blocking(true);
   do_accept();
+  do_await_signal();
+  schedule_stats();
+  tick_timer_.expires_at(now_ + kTick);
+  schedule_tick();
 }
 
-void Server::deliver(const std::vector<char>& msg) {
+void Server::deliver(const SharedFrame& msg) {
   for (auto& participant : participants_) {
     participant->deliver(msg);
   }
+  for (auto& subscriber : shm_subscribers_) {
+    subscriber->deliver(msg);
+  }
+}
+
+// Клиенты через разделяемую память и слушатели сцены формат
+// не согласуют и получают кадр как есть
+void Server::deliver_audio(const SharedFrame& frame,
+                           AudioTranscoder& transcoder,
+                           Clock::time_point deadline) {
+  std::uint64_t encodes = transcoder.encodes();
+  std::uint64_t avoided = transcoder.avoided();
+  transcoder.begin(frame);
+  for (auto& participant : participants_) {
+    if (participant->admitted()) {
+      participant->deliver(transcoder.frame_for(participant->wire_format()),
+                           deadline);
+    }
+  }
+  transcoder.end();
+  for (auto& subscriber : shm_subscribers_) {
+    subscriber->deliver(frame, deadline);
+  }
+  if (stage_) {
+    stage_->broadcast(frame);
+  }
+  audio_encodes_ += transcoder.encodes() - encodes;
+  audio_encodes_avoided_ += transcoder.avoided() - avoided;
+}
+
+void Server::deliver_message(std::uint16_t stream, const char* payload,
+                             std::size_t size) {
+  // Режем один раз: куски разделяются всеми получателями
+  auto message = make_shared_message(protocol::make_chunks(stream, payload,
+                                                           size));
+  std::uint32_t weight = stream_weight(stream);
+  for (auto& participant : participants_) {
+    participant->deliver_message(stream, weight, message);
+  }
+  for (auto& subscriber : shm_subscribers_) {
+    subscriber->deliver_message(stream, weight, message);
+  }
+}
+
+bool Server::should_queue(const std::vector<char>& frame, bool backlogged) {
+  MemoryPressure pressure = memory_.pressure();
+  if (pressure == MemoryPressure::kNormal || !backlogged) {
+    return true;
+  }
+  switch (traffic_class(protocol::decode_header(frame.data()).type)) {
+    case TrafficClass::kControl:
+      return true;
+    case TrafficClass::kVoice:
+      ++voice_shed_memory_;
+      return false;
+    case TrafficClass::kBulk:
+      // Отстающий всё равно будет отключён на ближайшем тике
+      if (pressure == MemoryPressure::kDisconnect) {
+        ++bulk_shed_memory_;
+        return false;
+      }
+      return true;
+  }
+  return true;
+}
+
+void Server::count_handshake(const tls::Connection& connection) {
+  ++tls_handshakes_;
+  tls_resumed_ += connection.resumed();
+  tls_ktls_ += connection.ktls_send();
+}
+
+bool Server::check_token(const protocol::SessionToken& token,
+                         protocol::SessionToken& renewed) {
+  ++hellos_;
+  if (token_cache_->contains(token)) {
+    ++hellos_cached_;
+  } else if (signer_->verify(token)) {
+    token_cache_->insert(token);
+  } else {
+    ++hellos_rejected_;
+    return false;
+  }
+  auto now = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+  auth::TokenClaims claims = auth::token_claims(token);
+  if (claims.expires <= static_cast<std::uint64_t>(now.count())) {
+    ++hellos_rejected_;
+    return false;
+  }
+  // Новая подпись — только когда прошла половина срока: в шторм
+  // переподключений большинство входов обходится без HMAC
+  if (claims.expires - static_cast<std::uint64_t>(now.count()) >
+      static_cast<std::uint64_t>(token_ttl_.count() / 2)) {
+    renewed = token;
+    return true;
+  }
+  claims.expires = static_cast<std::uint64_t>((now + token_ttl_).count());
+  renewed = signer_->sign(claims);
+  ++tokens_renewed_;
+  return true;
+}
+
+void Server::on_admitted() {
+  --admitting_;
+  schedule_deferred();
+}
+
+SessionHandle Server::join(std::shared_ptr<Session> session) {
+  auto handle = participants_.insert(std::move(session));
+  keepalive_wheel_.schedule(handle, keepalive_interval_ / kTick);
+  return handle;
+}
+
+void Server::leave(SessionHandle handle) {
+  auto* session = participants_.get(handle);
+  if (!session) {
+    return;
+  }
+  // Закрываем сокет, чтобы отменить ожидания и сразу освободить сессию
+  auto closing = std::move(*session);
+  participants_.erase(handle);
+  closing->stop();
+  if (!closing->admitted()) {
+    --admitting_;
+    schedule_deferred();
+  }
+  if (capture_) {
+    capture_->record_close(closing->capture_id());
+  }
+  if (recorder_) {
+    recorder_->close(closing->capture_id());
+  }
+}
+
+bool Server::find_call_pair(SessionHandle (&pair)[2]) {
+  if (participants_.size() != 2 || !shm_subscribers_.empty() ||
+      (stage_ && stage_->listeners() > 0) || recorder_) {
+    return false;
+  }
+  for (std::size_t i = 0; i < 2; ++i) {
+    const Session& session = *participants_.begin()[i];
+    if (!session.admitted() || session.peer_candidates().empty()) {
+      return false;
+    }
+    pair[i] = participants_.handle_at(i);
+  }
+  return true;
+}
+
+// Вызывается на каждом тике: так пара теряет прямой путь и после
+// выхода собеседника, и когда появляется слушатель сцены или клиент
+// через разделяемую память
+void Server::update_call() {
+  SessionHandle pair[2];
+  bool eligible = find_call_pair(pair);
+  if (call_) {
+    const auto& current = *call_;
+    if (eligible && ((pair[0] == current[0] && pair[1] == current[1]) ||
+                     (pair[0] == current[1] && pair[1] == current[0]))) {
+      return;
+    }
+    end_call();
+  }
+  if (!eligible) {
+    return;
+  }
+  call_ = std::array<SessionHandle, 2>{pair[0], pair[1]};
+  protocol::PeerOffer offer;
+  offer.key = call_keys_();
+  for (std::size_t i = 0; i < 2; ++i) {
+    const Session& other = **participants_.get(pair[1 - i]);
+    offer.peer = static_cast<std::uint16_t>(pair[1 - i].index);
+    offer.candidates = other.peer_candidates();
+    (*participants_.get(pair[i]))
+        ->deliver(make_shared_frame(protocol::make_peer_offer(offer)));
+  }
+  ++calls_offered_;
+  LOG_INFO("Call: sessions {} and {} may connect directly", pair[0].index,
+           pair[1].index);
+}
+
+void Server::end_call() {
+  auto relay = make_shared_frame(
+      protocol::make_peer_state(protocol::PeerState::kRelay));
+  for (SessionHandle handle : *call_) {
+    if (auto* session = participants_.get(handle)) {
+      (*session)->deliver(relay);
+    }
+  }
+  LOG_INFO("Call: sessions {} and {} back to relay", (*call_)[0].index,
+           (*call_)[1].index);
+  call_.reset();
+}
+
+// Каждый клиент сам решает, куда слать свой голос: прямой путь
+// одного не зависит от другого
+void Server::on_peer_state(SessionHandle handle, protocol::PeerState state) {
+  if (!call_ || (handle != (*call_)[0] && handle != (*call_)[1])) {
+    return;
+  }
+  bool direct = state == protocol::PeerState::kDirect;
+  ++(direct ? calls_direct_ : calls_relayed_);
+  LOG_INFO("Call: session {} sends voice {}", handle.index,
+           direct ? "directly" : "through the server");
+}
+
+void Server::leave_shm(SessionHandle handle) {
+  auto* subscriber = shm_subscribers_.get(handle);
+  if (!subscriber) {
+    return;
+  }
+  auto closing = std::move(*subscriber);
+  shm_subscribers_.erase(handle);
+  closing->stop();
+  LOG_INFO("Shared memory client {} disconnected", handle.index);
+}
+
+void Server::set_min_packet_ms(std::uint16_t min_packet_ms) {
+  min_packet_ms_ = min_packet_ms;
+  for (auto& participant : participants_) {
+    if (participant->packet_ms() < min_packet_ms_) {
+      participant->refresh_config();
+    }
+  }
+}
+
+// Запись колеса не отменяется при leave: устаревший handle просто
+// не находит сессию
+void Server::check_liveness(SessionHandle handle) {
+  auto* session = participants_.get(handle);
+  if (!session) {
+    return;
+  }
+  if ((*session)->reads_paused()) {
+    // Клиент мог и писать: мы его просто не читаем
+    keepalive_wheel_.schedule(handle, keepalive_interval_ / kTick);
+    return;
+  }
+  auto idle = now_ - (*session)->last_receive();
+  if (idle >= peer_timeout_) {
+    LOG_INFO("Evicting silent peer {}", handle.index);
+    leave(handle);
+    return;
+  }
+  if (idle >= keepalive_interval_) {
+    (*session)->send_ping();
+  }
+  keepalive_wheel_.schedule(handle, keepalive_interval_ / kTick);
 }
 
-void Server::join(std::shared_ptr<Session> session) {
-  participants_.insert(session);
+void Server::resume_paused() {
+  if (paused_.empty() ||
+      memory_.pressure() >= MemoryPressure::kThrottleReads) {
+    return;
+  }
+  std::vector<SessionHandle> paused;
+  paused.swap(paused_);
+  for (SessionHandle handle : paused) {
+    auto* session = participants_.get(handle);
+    if (session && !(*session)->resume_reads()) {
+      paused_.push_back(handle);
+    }
+  }
+}
+
+// Отключаем до тех пор, пока давление не спадёт до паузы чтения:
+// иначе следующий же всплеск вернул бы бюджет к пределу
+void Server::shed_backlogged() {
+  struct Backlogged {
+    std::size_t bytes;
+    SessionHandle handle;
+    bool shm;
+  };
+  std::vector<Backlogged> backlogged;
+  for (std::size_t i = 0; i < participants_.size(); ++i) {
+    std::size_t bytes = participants_.begin()[i]->queued_bytes();
+    if (bytes > 0) {
+      backlogged.push_back({bytes, participants_.handle_at(i), false});
+    }
+  }
+  for (std::size_t i = 0; i < shm_subscribers_.size(); ++i) {
+    std::size_t bytes = shm_subscribers_.begin()[i]->queued_bytes();
+    if (bytes > 0) {
+      backlogged.push_back({bytes, shm_subscribers_.handle_at(i), true});
+    }
+  }
+  std::sort(backlogged.begin(), backlogged.end(),
+            [](const Backlogged& a, const Backlogged& b) {
+              return a.bytes > b.bytes;
+            });
+  for (const auto& entry : backlogged) {
+    if (memory_.used() < memory_.limit() / 4 * 3) {
+      break;
+    }
+    LOG_WARNING("Memory pressure: disconnecting {} {} with {} KiB queued",
+                entry.shm ? "shared memory client" : "session",
+                entry.handle.index, entry.bytes / 1024);
+    ++memory_disconnects_;
+    if (entry.shm) {
+      leave_shm(entry.handle);
+    } else {
+      leave(entry.handle);
+    }
+  }
+}
+
+void Server::report_stats() {
+  std::size_t sessions = participants_.size();
+  std::size_t session_heap = 0;
+  std::size_t queued = 0;
+  QueueDelay delays[kTrafficClassCount];
+  for (auto& participant : participants_) {
+    session_heap += participant->heap_bytes();
+    queued += participant->queued_frames();
+    participant->take_queue_delays(delays);
+  }
+  std::size_t rss = resident_bytes();
+  std::size_t growth = rss > baseline_rss_ ? rss - baseline_rss_ : 0;
+
+  LOG_INFO(
+      "Memory: {} sessions, object {} B, per-session heap {} B, "
+      "queued frames {}, read pool {} KiB, RSS {} MiB ({} B per connection)",
+      sessions, sizeof(Session), sessions ? session_heap / sessions : 0,
+      queued, read_buffers_.allocated_bytes() / 1024, rss / (1024 * 1024),
+      sessions ? growth / sessions : 0);
+  FramePool::Stats& pool = FramePool::stats();
+  LOG_INFO("Frame pool: {} KiB cached, {} buffers reused, {} allocated",
+           pool.cached_bytes.load() / 1024, pool.hits.exchange(0),
+           pool.misses.exchange(0));
+  if (alloc_counter::kEnabled) {
+    LOG_INFO("Allocations: {} per second",
+             alloc_counter::take() / stats_interval_);
+  }
+
+  // Задержка в очередях отправки по классам за период отчёта
+  auto avg_ms = [](const QueueDelay& delay) {
+    return delay.count ? delay.total_us / delay.count / 1000.0 : 0.0;
+  };
+  const auto& control = delays[static_cast<int>(TrafficClass::kControl)];
+  const auto& voice = delays[static_cast<int>(TrafficClass::kVoice)];
+  const auto& bulk = delays[static_cast<int>(TrafficClass::kBulk)];
+  LOG_INFO(
+      "Queue delay: control avg {} max {} ms, voice avg {} max {} ms "
+      "({} expired), bulk avg {} max {} ms",
+      avg_ms(control), control.max_us / 1000.0, avg_ms(voice),
+      voice.max_us / 1000.0, voice.expired, avg_ms(bulk),
+      bulk.max_us / 1000.0);
+
+  report_bitrate();
+
+  if (tls_) {
+    LOG_INFO("TLS: {} handshakes, {} resumed, {} with kTLS send",
+             tls_handshakes_, tls_resumed_, tls_ktls_);
+  }
+  LOG_INFO(
+      "Admission: {} in progress, {} waiting, {} deferred in total, {} "
+      "refused over the queue limit, {} closed after waiting too long",
+      admitting_, deferred_.size(), deferred_total_, deferred_refused_,
+      deferred_expired_);
+  LOG_INFO(
+      "Limits: memory {} of {} MiB, {} sessions not reading, voice shed "
+      "{} by rate and {} by memory, bulk shed {}, disconnected {} for "
+      "abuse and {} for memory",
+      memory_.used() / (1024 * 1024), memory_.limit() / (1024 * 1024),
+      paused_.size(), voice_shed_rate_, voice_shed_memory_,
+      bulk_shed_memory_, abuse_disconnects_, memory_disconnects_);
+  LOG_INFO("Transcoding: {} encodes, {} avoided by sharing", audio_encodes_,
+           audio_encodes_avoided_);
+  if (calls_offered_ > 0) {
+    LOG_INFO("Calls: {} offered direct media, {} sessions went direct, {} "
+             "fell back to relay",
+             calls_offered_, calls_direct_, calls_relayed_);
+  }
+  if (recorder_) {
+    recording::RecorderStats& recorded = recorder_->stats();
+    LOG_INFO(
+        "Recording: {} channels, {} frames, {} MiB, {} segments, {} frames "
+        "dropped, {} errors, longest write {} ms",
+        recorded.channels.load(), recorded.frames.load(),
+        recorded.bytes.load() / (1024 * 1024), recorded.segments.load(),
+        recorded.dropped.load(), recorded.errors.load(),
+        recorded.max_write_us.exchange(0) / 1000.0);
+  }
+  if (stage_) {
+    // Время рассылки — за период отчёта
+    stage::FanoutStats& fanout = stage_->stats();
+    std::uint64_t frames = fanout.frames.exchange(0);
+    std::uint64_t total_ns = fanout.total_ns.exchange(0);
+    std::uint64_t max_ns = fanout.max_ns.exchange(0);
+    LOG_INFO(
+        "Stage: {} listeners on {} workers, fan-out avg {} max {} us "
+        "over {} frames, {} writes, {} frames dropped for slow listeners, "
+        "{} write failures",
+        stage_->listeners(), stage_->workers(),
+        frames ? total_ns / frames / 1000.0 : 0.0, max_ns / 1000.0, frames,
+        fanout.writes.load(), fanout.dropped.load(),
+        fanout.disconnects.load());
+  }
+  if (shm_acceptor_) {
+    std::uint64_t written = 0;
+    std::uint64_t wakeups = 0;
+    std::size_t backlog = 0;
+    for (auto& subscriber : shm_subscribers_) {
+      written += subscriber->bytes_written();
+      wakeups += subscriber->wakeups();
+      backlog += subscriber->queued_frames();
+    }
+    LOG_INFO(
+        "Shared memory: {} clients, {} MiB written, {} reader wakeups, "
+        "{} frames waiting for ring space",
+        shm_subscribers_.size(), written / (1024 * 1024), wakeups, backlog);
+  }
+  if (signer_) {
+    LOG_INFO("Auth: {} hellos, {} from cache, {} renewed, {} rejected",
+             hellos_, hellos_cached_, tokens_renewed_, hellos_rejected_);
+  }
+
+  StoreStats storage = files_.stats();
+  LOG_INFO(
+      "Storage: {} files, {} chunks, logical {} MiB, stored {} MiB, "
+      "dedup {}x",
+      storage.files, storage.chunks, storage.logical_bytes / (1024 * 1024),
+      storage.stored_bytes / (1024 * 1024),
+      storage.stored_bytes
+          ? static_cast<double>(storage.logical_bytes) / storage.stored_bytes
+          : 1.0);
+
+  // RTT: сводка и самые медленные сессии
+  std::vector<std::pair<std::uint32_t, SessionHandle>> rtts;
+  rtts.reserve(sessions);
+  for (std::size_t i = 0; i < sessions; ++i) {
+    std::uint32_t srtt = participants_.begin()[i]->srtt_us();
+    if (srtt > 0) {
+      rtts.emplace_back(srtt, participants_.handle_at(i));
+    }
+  }
+  if (rtts.empty()) {
+    return;
+  }
+  constexpr std::size_t kSlowest = 5;
+  std::size_t shown = std::min(kSlowest, rtts.size());
+  std::partial_sort(
+      rtts.begin(), rtts.begin() + shown, rtts.end(),
+      [](const auto& a, const auto& b) { return a.first > b.first; });
+  std::uint64_t total = 0;
+  for (const auto& rtt : rtts) {
+    total += rtt.first;
+  }
+  std::ostringstream slowest;
+  for (std::size_t i = 0; i < shown; ++i) {
+    slowest << " #" << rtts[i].second.index << "=" << rtts[i].first / 1000.0
+            << "ms";
+  }
+  LOG_INFO("RTT: {} sessions, avg {} ms, slowest:{}", rtts.size(),
+           total / rtts.size() / 1000.0, slowest.str());
 }
 
-void Server::leave(std::shared_ptr<Session> session) {
-  participants_.erase(session);
+void Server::report_bitrate() {
+  std::size_t levels[kBitrateLevelCount] = {};
+  std::vector<std::pair<std::size_t, SessionHandle>> degraded;
+  for (std::size_t i = 0; i < participants_.size(); ++i) {
+    std::size_t level = participants_.begin()[i]->bitrate_level();
+    ++levels[level];
+    if (level > 0) {
+      degraded.emplace_back(level, participants_.handle_at(i));
+    }
+  }
+  std::ostringstream histogram;
+  for (std::size_t level = 0; level < kBitrateLevelCount; ++level) {
+    histogram << (level ? "/" : "") << levels[level];
+  }
+  LOG_INFO("Bitrate: levels {}, {} downgrades, {} upgrades", histogram.str(),
+           bitrate_downgrades_, bitrate_upgrades_);
+  std::size_t protected_sessions = 0;
+  for (auto& participant : participants_) {
+    protected_sessions += participant->fec_group() > 0;
+  }
+  LOG_INFO("FEC: {} sessions protected, {} parity frames, {} KiB",
+           protected_sessions, parity_frames_, parity_bytes_ / 1024);
+  if (degraded.empty()) {
+    return;
+  }
+  constexpr std::size_t kWorst = 5;
+  std::size_t shown = std::min(kWorst, degraded.size());
+  std::partial_sort(
+      degraded.begin(), degraded.begin() + shown, degraded.end(),
+      [](const auto& a, const auto& b) { return a.first > b.first; });
+  std::ostringstream worst;
+  for (std::size_t i = 0; i < shown; ++i) {
+    const Session& session = **participants_.get(degraded[i].second);
+    const Session::VoiceLink& link = *session.voice_link();
+    worst << " #" << degraded[i].second.index << "=L" << degraded[i].first
+          << "(" << congestion_name(link.controller.congestion())
+          << " queue " << link.last.voice_age.count() << "ms drops "
+          << link.frames_dropped << " uplink "
+          << link.last.uplink_delay.count() << "ms rtt "
+          << link.last.rtt_us / 1000.0 << "ms cwnd " << link.last.cwnd
+          << " retrans " << link.last.total_retrans << ")";
+  }
+  LOG_INFO("Bitrate: {} degraded sessions, worst:{}", degraded.size(),
+           worst.str());
 }
 
+// Приём с допуском: рукопожатия TLS и вход одновременно проходят
+// не больше max_handshakes соединений, остальные ждут по порядку
+// прихода. Без предела в шторм переподключений все рукопожатия идут
+// вперемешку и заканчиваются разом и поздно, а часть клиентов
+// отваливается по таймауту и приходит снова. Принимать при этом
+// продолжаем: очередь ядра (somaxconn) переполнилась бы, и клиенты
+// ждали бы повтора SYN секундами.
 void Server::do_accept() {
   acceptor_.async_accept(
       [this](boost::system::error_code ec, tcp::socket socket) {
-        if (!ec) {
-          std::cout << "New connection" << std::endl;
-          auto session = std::make_shared<Session>(std::move(socket), *this);
-          join(session);
-          session->start();
+        if (ec) {
+          LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                           "Accept failed: {}", ec.message());
+          do_accept();
+          return;
+        }
+        admit_or_defer(std::move(socket));
+        // Остальные готовые соединения забираем неблокирующим accept,
+        // без возврата в реактор за каждым
+        for (int i = 1; i < kAcceptBatch; ++i) {
+          tcp::socket next = acceptor_.accept(ec);
+          if (ec) {
+            break;
+          }
+          admit_or_defer(std::move(next));
         }
         do_accept();
       });
 }
 
-int main() {
+void Server::admit_or_defer(tcp::socket socket) {
+  if (admission_full()) {
+    // Клиент, которому не хватило и очереди, получит обрыв сразу и
+    // повторит позже, вместо того чтобы держать дескриптор и память
+    if (deferred_.size() >= max_deferred_) {
+      ++deferred_refused_;
+      boost::system::error_code ignored;
+      socket.close(ignored);
+      return;
+    }
+    deferred_.push_back({std::move(socket), now_});
+    ++deferred_total_;
+    return;
+  }
+  start_session(std::move(socket));
+}
+
+std::shared_ptr<Session> Server::start_session(tcp::socket socket) {
+  boost::system::error_code endpoint_ec;
+  auto endpoint = socket.remote_endpoint(endpoint_ec);
+  LOG_INFO("New connection from {}:{}", endpoint.address().to_string(),
+           endpoint.port());
+  auto session = std::make_shared<Session>(std::move(socket), *this);
+  std::uint32_t capture_id = next_capture_id_++;
+  if (capture_) {
+    capture_->record_open(capture_id);
+  }
+  ++admitting_;
+  session->start(join(session), capture_id);
+  return session;
+}
+
+void Server::schedule_deferred() {
+  if (deferred_.empty() || deferred_scheduled_) {
+    return;
+  }
+  deferred_scheduled_ = true;
+  boost::asio::post(acceptor_.get_executor(), [this]() {
+    deferred_scheduled_ = false;
+    start_deferred();
+  });
+}
+
+// Клиент, не дождавшийся очереди, отвалится на рукопожатии сразу
+void Server::start_deferred() {
+  while (!deferred_.empty() && !admission_full()) {
+    tcp::socket socket = std::move(deferred_.front().socket);
+    deferred_.pop_front();
+    start_session(std::move(socket));
+  }
+}
+
+void Server::expire_deferred() {
+  while (!deferred_.empty() &&
+         now_ - deferred_.front().since >= deferred_timeout_) {
+    boost::system::error_code ignored;
+    deferred_.front().socket.close(ignored);
+    deferred_.pop_front();
+    ++deferred_expired_;
+  }
+}
+
+void Server::do_accept_shm() {
+  shm_acceptor_->async_accept(
+      [this](boost::system::error_code ec, stream_protocol::socket socket) {
+        if (ec) {
+          LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                           "Shared memory accept failed: {}", ec.message());
+        } else {
+          auto subscriber =
+              std::make_shared<ShmSubscriber>(std::move(socket), *this);
+          subscriber->start(shm_subscribers_.insert(subscriber));
+        }
+        do_accept_shm();
+      });
+}
+
+void Server::do_accept_stage() {
+  stage_acceptor_->async_accept(
+      [this](boost::system::error_code ec, tcp::socket socket) {
+        if (ec) {
+          LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                           "Stage accept failed: {}", ec.message());
+          do_accept_stage();
+          return;
+        }
+        admit_listener(std::move(socket));
+        for (int i = 1; i < kAcceptBatch; ++i) {
+          tcp::socket next = stage_acceptor_->accept(ec);
+          if (ec) {
+            break;
+          }
+          admit_listener(std::move(next));
+        }
+        do_accept_stage();
+      });
+}
+
+// С ключом подписи слушатель, как и TCP-сессия, сначала шлёт kHello
+// и получает kWelcome первым кадром
+void Server::admit_listener(tcp::socket socket) {
+  if (!signer_) {
+    stage_->add(std::move(socket), nullptr);
+    return;
+  }
+  struct PendingListener {
+    explicit PendingListener(tcp::socket s) : socket(std::move(s)) {}
+    tcp::socket socket;
+    char hello[protocol::kHeaderSize + protocol::kSessionTokenSize];
+  };
+  auto pending = std::make_shared<PendingListener>(std::move(socket));
+  boost::asio::async_read(
+      pending->socket, boost::asio::buffer(pending->hello),
+      [this, pending](boost::system::error_code ec, std::size_t) {
+        if (ec) {
+          return;
+        }
+        auto header = protocol::decode_header(pending->hello);
+        protocol::SessionToken token;
+        protocol::SessionToken renewed;
+        if (header.type != protocol::MessageType::kHello ||
+            !protocol::decode_session_token(
+                pending->hello + protocol::kHeaderSize, header.length,
+                token) ||
+            !check_token(token, renewed)) {
+          LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                           "Stage listener: rejected session token");
+          return;
+        }
+        stage_->add(std::move(pending->socket),
+                    make_shared_frame(protocol::make_welcome(renewed)));
+      });
+}
+
+// SIGUSR1 укрупняет пакеты (меньше пакетов в секунду на загруженном
+// сервере), SIGUSR2 возвращает более мелкие
+void Server::do_await_signal() {
+  signals_.async_wait([this](boost::system::error_code ec, int signal) {
+    if (ec) {
+      return;
+    }
+    int step = signal == SIGUSR1 ? 1 : -1;
+    set_min_packet_ms(protocol::step_packet_interval(min_packet_ms_, step));
+    LOG_INFO("Minimum packet interval: {} ms", min_packet_ms_);
+    do_await_signal();
+  });
+}
+
+void Server::schedule_stats() {
+  if (stats_interval_ == 0) {
+    return;
+  }
+  stats_timer_.expires_after(std::chrono::seconds(stats_interval_));
+  stats_timer_.async_wait([this](boost::system::error_code ec) {
+    if (!ec) {
+      report_stats();
+      schedule_stats();
+    }
+  });
+}
+
+// Таймер с абсолютными сроками, чтобы тики не накапливали дрейф
+void Server::schedule_tick() {
+  tick_timer_.async_wait([this](boost::system::error_code ec) {
+    if (ec) {
+      return;
+    }
+    now_ = Clock::now();
+    keepalive_wheel_.tick(
+        [this](SessionHandle handle) { check_liveness(handle); });
+    // Пауза чтения, не разгрузившая память за kMaxReadPause, значит,
+    // что очереди держат отстающие: ждать их дальше — держать паузу
+    // у всех остальных
+    MemoryPressure pressure = memory_.pressure();
+    if (pressure < MemoryPressure::kThrottleReads) {
+      reads_paused_since_ = Clock::time_point();
+    } else if (reads_paused_since_ == Clock::time_point()) {
+      reads_paused_since_ = now_;
+    }
+    if (pressure == MemoryPressure::kDisconnect ||
+        (reads_paused_since_ != Clock::time_point() &&
+         now_ - reads_paused_since_ >= kMaxReadPause)) {
+      shed_backlogged();
+    }
+    resume_paused();
+    expire_deferred();
+    if (now_ - last_bitrate_eval_ >= kBitrateEval) {
+      for (auto& participant : participants_) {
+        participant->adapt_bitrate(now_);
+      }
+      last_bitrate_eval_ = now_;
+    }
+    if (call_ || participants_.size() == 2) {
+      update_call();
+    }
+    if (capture_ && now_ - last_capture_flush_ >= std::chrono::seconds(1)) {
+      capture_->flush();
+      last_capture_flush_ = now_;
+    }
+    // Куски без ссылок удаляются пачкой, а не при каждом release_file
+    if (now_ - last_gc_ >= std::chrono::seconds(60)) {
+      std::size_t removed = files_.collect_garbage();
+      if (removed > 0) {
+        LOG_INFO("Storage GC: removed {} chunks", removed);
+      }
+      last_gc_ = now_;
+    }
+    tick_timer_.expires_at(tick_timer_.expiry() + kTick);
+    schedule_tick();
+  });
+}
+
+// Каждое соединение — дескриптор; поднимаем мягкий лимит до жёсткого,
+// чтобы держать 100k+ соединений без настройки ulimit снаружи
+void raise_fd_limit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+bool parse_options(int argc, char* argv[], ServerOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+    std::string value = argv[++i];
+    if (arg == "--port") {
+      options.port = static_cast<unsigned short>(std::stoi(value));
+    } else if (arg == "--min-packet-ms") {
+      options.min_packet_ms = static_cast<std::uint16_t>(std::stoi(value));
+      if (!protocol::is_valid_packet_interval(options.min_packet_ms)) {
+        std::cerr << "Packet interval must be 10, 20, 40 or 60 ms"
+                  << std::endl;
+        return false;
+      }
+    } else if (arg == "--stats-interval") {
+      options.stats_interval = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--keepalive-interval") {
+      options.keepalive_interval = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--peer-timeout") {
+      options.peer_timeout = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--capture") {
+      options.capture_path = value;
+    } else if (arg == "--record") {
+      options.recording.dir = value;
+    } else if (arg == "--record-segment-s") {
+      options.recording.segment_seconds =
+          static_cast<unsigned>(std::stoul(value));
+      if (options.recording.segment_seconds == 0) {
+        std::cerr << "Segment length must be positive" << std::endl;
+        return false;
+      }
+    } else if (arg == "--storage") {
+      options.storage_path = value;
+    } else if (arg == "--max-file-mb") {
+      options.max_file_mb = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--log-level") {
+      if (!logger::parse_level(value, options.log.level)) {
+        std::cerr << "Log level must be debug, info, warning or error"
+                  << std::endl;
+        return false;
+      }
+    } else if (arg == "--log-file") {
+      options.log.path = value;
+    } else if (arg == "--auth-key") {
+      options.auth_key_path = value;
+    } else if (arg == "--token-ttl-hours") {
+      options.token_ttl_hours = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--max-handshakes") {
+      options.max_handshakes = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--max-deferred") {
+      options.max_deferred = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--deferred-timeout") {
+      options.deferred_timeout = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--session-kbps") {
+      options.rate_limits.bytes_per_second = std::stod(value) * 1024;
+    } else if (arg == "--session-fps") {
+      options.rate_limits.frames_per_second = std::stod(value);
+    } else if (arg == "--memory-budget-mb") {
+      options.memory_budget_mb = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--voice-deadline-ms") {
+      options.voice_deadline_ms = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--shm-socket") {
+      options.shm_socket_path = value;
+    } else if (arg == "--shm-ring-kb") {
+      options.shm_ring_kb = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--stage-port") {
+      options.stage_port = static_cast<unsigned short>(std::stoi(value));
+    } else if (arg == "--stage-workers") {
+      options.stage_workers = static_cast<unsigned>(std::stoul(value));
+    } else if (arg == "--tls-cert") {
+      options.tls.cert_path = value;
+    } else if (arg == "--tls-key") {
+      options.tls.key_path = value;
+    } else if (arg == "--ktls") {
+      if (value != "on" && value != "off") {
+        std::cerr << "kTLS must be on or off" << std::endl;
+        return false;
+      }
+      options.tls.ktls = value == "on";
+    } else if (arg == "--log-format") {
+      if (value != "text" && value != "binary") {
+        std::cerr << "Log format must be text or binary" << std::endl;
+        return false;
+      }
+      options.log.binary = value == "binary";
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// alloctest.cpp собирает сервер без main
+#ifndef SERVER_NO_MAIN
+int main(int argc, char* argv[]) {
   try {
+    ServerOptions options;
+    if (!parse_options(argc, argv, options)) {
+      std::cerr << "Usage: server [--port N] [--min-packet-ms 10|20|40|60] "
+                   "[--stats-interval SECONDS] [--keepalive-interval SECONDS] "
+                   "[--peer-timeout SECONDS] [--capture FILE] "
+                   "[--record DIR] [--record-segment-s N] "
+                   "[--storage DIR] [--max-file-mb N] "
+                   "[--log-level LEVEL] [--log-file FILE] "
+                   "[--log-format text|binary] "
+                   "[--tls-cert FILE --tls-key FILE] [--ktls on|off] "
+                   "[--auth-key FILE] [--token-ttl-hours N] "
+                   "[--max-handshakes N] [--max-deferred N] "
+                   "[--deferred-timeout SECONDS] "
+                   "[--shm-socket PATH] [--shm-ring-kb N] "
+                   "[--stage-port N] [--stage-workers N] "
+                   "[--session-kbps N] [--session-fps N] "
+                   "[--memory-budget-mb N] [--voice-deadline-ms N]"
+                << std::endl;
+      return 1;
+    }
+    if (options.tls.cert_path.empty() != options.tls.key_path.empty()) {
+      std::cerr << "TLS needs both --tls-cert and --tls-key" << std::endl;
+      return 1;
+    }
+    std::size_t ring_bytes = std::size_t{options.shm_ring_kb} * 1024;
+    if (ring_bytes < shm::kMinCapacity ||
+        (ring_bytes & (ring_bytes - 1)) != 0) {
+      std::cerr << "Ring size must be a power of two of at least "
+                << shm::kMinCapacity / 1024 << " KiB" << std::endl;
+      return 1;
+    }
+    if (options.keepalive_interval == 0 ||
+        options.peer_timeout <= options.keepalive_interval) {
+      std::cerr << "Peer timeout must exceed a non-zero keepalive interval"
+                << std::endl;
+      return 1;
+    }
+    logger::configure(options.log);
+    raise_fd_limit();
+    // OpenSSL пишет в сокет через write(), а не send(MSG_NOSIGNAL):
+    // обрыв соединения не должен завершать процесс
+    std::signal(SIGPIPE, SIG_IGN);
+
     boost::asio::io_context io_context;
-    Server server(io_context, 8080);
-    std::cout << "Server running on port 8080" << std::endl;
+    Server server(io_context, options);
+    // Штатная остановка, чтобы деструкторы дописали файл записи трафика
+    boost::asio::signal_set stop_signals(io_context, SIGINT, SIGTERM);
+    stop_signals.async_wait(
+        [&io_context](boost::system::error_code, int) { io_context.stop(); });
+    LOG_INFO("Server running on port {}", options.port);
     io_context.run();
   } catch (std::exception& e) {
-    std::cerr << "Exception: " << e.what() << std::endl;
+    LOG_ERROR("Exception: {}", e.what());
   }
+  logger::shutdown();
   return 0;
 }
+#endif  // SERVER_NO_MAIN
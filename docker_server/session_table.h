@@ -0,0 +1,134 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Устойчивый идентификатор записи в SlabTable. Индекс слота плюс
+// поколение: после удаления записи старый handle перестаёт находить
+// что-либо, даже если слот уже занят новой записью.
+struct SessionHandle {
+  static constexpr std::uint32_t kInvalidIndex = 0xffffffffu;
+
+  std::uint32_t index = kInvalidIndex;
+  std::uint32_t generation = 0;
+
+  bool valid() const { return index != kInvalidIndex; }
+  bool operator==(const SessionHandle& other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const SessionHandle& other) const {
+    return !(*this == other);
+  }
+};
+
+// Таблица с O(1) вставкой и удалением и плотным хранением значений.
+// Значения лежат подряд в одном векторе (удаление переносит последний
+// элемент на место удалённого), поэтому обход для рассылки идёт по
+// непрерывной памяти. Слоты переиспользуются через список свободных,
+// так что в установившемся режиме вставка не выделяет память.
+template <typename T>
+class SlabTable {
+ public:
+  using iterator = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  SessionHandle insert(T value) {
+    std::uint32_t index;
+    if (free_head_ != kNoSlot) {
+      index = free_head_;
+      free_head_ = slots_[index].dense_index;
+    } else {
+      index = static_cast<std::uint32_t>(slots_.size());
+      slots_.push_back(Slot{});
+    }
+    Slot& slot = slots_[index];
+    slot.dense_index = static_cast<std::uint32_t>(values_.size());
+    values_.push_back(std::move(value));
+    dense_to_slot_.push_back(index);
+    return SessionHandle{index, slot.generation};
+  }
+
+  // Возвращает false, если handle устарел (запись уже удалена)
+  bool erase(SessionHandle handle) {
+    if (!contains(handle)) {
+      return false;
+    }
+    Slot& slot = slots_[handle.index];
+    const std::uint32_t dense = slot.dense_index;
+    const std::uint32_t last = static_cast<std::uint32_t>(values_.size() - 1);
+    if (dense != last) {
+      values_[dense] = std::move(values_[last]);
+      dense_to_slot_[dense] = dense_to_slot_[last];
+      slots_[dense_to_slot_[dense]].dense_index = dense;
+    }
+    values_.pop_back();
+    dense_to_slot_.pop_back();
+
+    ++slot.generation;
+    slot.dense_index = free_head_;
+    free_head_ = handle.index;
+    return true;
+  }
+
+  bool contains(SessionHandle handle) const {
+    return handle.index < slots_.size() &&
+           slots_[handle.index].generation == handle.generation &&
+           is_live(slots_[handle.index]);
+  }
+
+  T* get(SessionHandle handle) {
+    return contains(handle) ? &values_[slots_[handle.index].dense_index]
+                            : nullptr;
+  }
+
+  const T* get(SessionHandle handle) const {
+    return contains(handle) ? &values_[slots_[handle.index].dense_index]
+                            : nullptr;
+  }
+
+  // Handle записи по её позиции в плотном массиве (для обхода)
+  SessionHandle handle_at(std::size_t dense_index) const {
+    std::uint32_t index = dense_to_slot_[dense_index];
+    return SessionHandle{index, slots_[index].generation};
+  }
+
+  std::size_t size() const { return values_.size(); }
+  bool empty() const { return values_.empty(); }
+
+  void reserve(std::size_t capacity) {
+    slots_.reserve(capacity);
+    values_.reserve(capacity);
+    dense_to_slot_.reserve(capacity);
+  }
+
+  iterator begin() { return values_.begin(); }
+  iterator end() { return values_.end(); }
+  const_iterator begin() const { return values_.begin(); }
+  const_iterator end() const { return values_.end(); }
+
+ private:
+  static constexpr std::uint32_t kNoSlot = 0xffffffffu;
+
+  // Для занятого слота dense_index — позиция значения в values_,
+  // для свободного — следующий свободный слот
+  struct Slot {
+    std::uint32_t generation = 0;
+    std::uint32_t dense_index = kNoSlot;
+  };
+
+  bool is_live(const Slot& slot) const {
+    return slot.dense_index < dense_to_slot_.size() &&
+           dense_to_slot_[slot.dense_index] ==
+               static_cast<std::uint32_t>(&slot - slots_.data());
+  }
+
+  std::vector<Slot> slots_;
+  std::vector<T> values_;
+  std::vector<std::uint32_t> dense_to_slot_;
+  std::uint32_t free_head_ = kNoSlot;
+};
+
+#endif  // SESSION_TABLE_H
@@ -0,0 +1,149 @@
+#ifndef SESSION_TOKEN_H
+#define SESSION_TOKEN_H
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "protocol.h"
+
+// Токены сессий без состояния на сервере (см. kHello в protocol.h).
+// Формат: u64 user, u64 expires, HMAC-SHA256(key, первые 16 байт).
+namespace auth {
+
+struct TokenClaims {
+  std::uint64_t user = 0;
+  std::uint64_t expires = 0;  // UNIX-время, секунды
+};
+
+constexpr std::size_t kTokenBodySize = 16;
+
+inline TokenClaims token_claims(const protocol::SessionToken& token) {
+  const char* body = reinterpret_cast<const char*>(token.data());
+  TokenClaims claims;
+  claims.user = protocol::get_u64(body);
+  claims.expires = protocol::get_u64(body + 8);
+  return claims;
+}
+
+class TokenSigner {
+ public:
+  static constexpr std::size_t kKeySize = 32;
+
+  // Ключ — первые kKeySize байт файла, например
+  // head -c 32 /dev/urandom > auth.key
+  explicit TokenSigner(const std::string& key_path) {
+    std::ifstream in(key_path, std::ios::binary);
+    in.read(reinterpret_cast<char*>(key_), kKeySize);
+    if (in.gcount() != static_cast<std::streamsize>(kKeySize)) {
+      throw std::runtime_error("Auth key " + key_path + " must hold " +
+                               std::to_string(kKeySize) + " bytes");
+    }
+  }
+
+  ~TokenSigner() { OPENSSL_cleanse(key_, kKeySize); }
+  TokenSigner(const TokenSigner&) = delete;
+  TokenSigner& operator=(const TokenSigner&) = delete;
+
+  protocol::SessionToken sign(const TokenClaims& claims) const {
+    protocol::SessionToken token;
+    char* body = reinterpret_cast<char*>(token.data());
+    protocol::put_u64(body, claims.user);
+    protocol::put_u64(body + 8, claims.expires);
+    mac(token.data(), token.data() + kTokenBodySize);
+    return token;
+  }
+
+  // Подпись сошлась; срок действия проверяет вызывающий
+  bool verify(const protocol::SessionToken& token) const {
+    unsigned char expected[EVP_MAX_MD_SIZE];
+    mac(token.data(), expected);
+    return CRYPTO_memcmp(expected, token.data() + kTokenBodySize,
+                         token.size() - kTokenBodySize) == 0;
+  }
+
+ private:
+  void mac(const unsigned char* body, unsigned char* out) const {
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), key_, kKeySize, body, kTokenBodySize, out, &length);
+  }
+
+  unsigned char key_[kKeySize];
+};
+
+// Недавно проверенные токены: повторный вход того же клиента
+// (переподключение после отказа, мигающая сеть) обходится без HMAC.
+// Таблица прямого отображения без блокировок: слот защищён счётчиком
+// версий (seqlock), читатель при гонке с записью просто промахивается,
+// а писатель, застав слот занятым, пропускает вставку.
+//
+// Ключ слота — начало MAC, но попадание требует совпадения и тела
+// токена: чужой MAC с подменённым телом в кэше не найдётся, а хвост
+// MAC при том же теле ничего не меняет.
+class VerifiedTokenCache {
+ public:
+  static constexpr std::size_t kSlots = 1 << 15;
+
+  VerifiedTokenCache() : slots_(new Slot[kSlots]) {}
+
+  bool contains(const protocol::SessionToken& token) const {
+    std::uint64_t tag = tag_of(token);
+    TokenClaims claims = token_claims(token);
+    const Slot& slot = slots_[tag & (kSlots - 1)];
+    std::uint32_t version = slot.version.load(std::memory_order_acquire);
+    if (version & 1) {
+      return false;
+    }
+    bool match = slot.tag.load(std::memory_order_relaxed) == tag &&
+                 slot.user.load(std::memory_order_relaxed) == claims.user &&
+                 slot.expires.load(std::memory_order_relaxed) ==
+                     claims.expires;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return match &&
+           slot.version.load(std::memory_order_relaxed) == version;
+  }
+
+  // Токен уже проверен подписью
+  void insert(const protocol::SessionToken& token) {
+    std::uint64_t tag = tag_of(token);
+    TokenClaims claims = token_claims(token);
+    Slot& slot = slots_[tag & (kSlots - 1)];
+    std::uint32_t version = slot.version.load(std::memory_order_relaxed);
+    if ((version & 1) ||
+        !slot.version.compare_exchange_strong(version, version + 1,
+                                              std::memory_order_acquire)) {
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.tag.store(tag, std::memory_order_relaxed);
+    slot.user.store(claims.user, std::memory_order_relaxed);
+    slot.expires.store(claims.expires, std::memory_order_relaxed);
+    slot.version.store(version + 2, std::memory_order_release);
+  }
+
+ private:
+  struct alignas(32) Slot {
+    std::atomic<std::uint32_t> version{0};
+    std::atomic<std::uint64_t> tag{0};
+    std::atomic<std::uint64_t> user{0};
+    std::atomic<std::uint64_t> expires{0};
+  };
+
+  static std::uint64_t tag_of(const protocol::SessionToken& token) {
+    return protocol::get_u64(
+        reinterpret_cast<const char*>(token.data()) + kTokenBodySize);
+  }
+
+  std::unique_ptr<Slot[]> slots_;
+};
+
+}  // namespace auth
+
+#endif  // SESSION_TOKEN_H
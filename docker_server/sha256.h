@@ -0,0 +1,83 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <openssl/evp.h>
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+#include "protocol.h"
+
+// SHA-256 через EVP OpenSSL: идентификаторы файлов и хеши кусков
+class Sha256 {
+ public:
+  Sha256() : ctx_(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr);
+  }
+  ~Sha256() { EVP_MD_CTX_free(ctx_); }
+  Sha256(const Sha256&) = delete;
+  Sha256& operator=(const Sha256&) = delete;
+
+  void update(const void* data, std::size_t size) {
+    EVP_DigestUpdate(ctx_, data, size);
+  }
+
+  protocol::FileId finish() {
+    protocol::FileId digest{};
+    EVP_DigestFinal_ex(ctx_, digest.data(), nullptr);
+    EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr);
+    return digest;
+  }
+
+  static protocol::FileId digest(const void* data, std::size_t size) {
+    protocol::FileId digest{};
+    EVP_Digest(data, size, digest.data(), nullptr, EVP_sha256(), nullptr);
+    return digest;
+  }
+
+ private:
+  EVP_MD_CTX* ctx_;
+};
+
+template <std::size_t N>
+std::string to_hex(const std::array<unsigned char, N>& id) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(id.size() * 2);
+  for (unsigned char byte : id) {
+    hex.push_back(kDigits[byte >> 4]);
+    hex.push_back(kDigits[byte & 0x0f]);
+  }
+  return hex;
+}
+
+template <std::size_t N>
+bool from_hex(const std::string& hex, std::array<unsigned char, N>& id) {
+  if (hex.size() != id.size() * 2) {
+    return false;
+  }
+  auto nibble = [](char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    }
+    return -1;
+  };
+  for (std::size_t i = 0; i < id.size(); ++i) {
+    int high = nibble(hex[2 * i]);
+    int low = nibble(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    id[i] = static_cast<unsigned char>(high << 4 | low);
+  }
+  return true;
+}
+
+#endif  // SHA256_H
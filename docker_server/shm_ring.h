@@ -0,0 +1,412 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include "protocol.h"
+
+// Транспорт через разделяемую память для клиентов на той же машине
+// (боты, запись, мосты). Кольцо одного писателя и одного читателя
+// лежит в memfd и несёт те же кадры, что и TCP: заголовок protocol.h
+// и полезная нагрузка, подряд. В установившемся режиме ни писатель,
+// ни читатель не делают системных вызовов на кадр: eventfd будит
+// только уснувшую сторону, и о сне она сообщает флагом в заголовке.
+//
+// Кольцо и оба eventfd сервер передаёт через Unix-сокет (SCM_RIGHTS);
+// сам сокет остаётся открытым как признак жизни клиента.
+namespace shm {
+
+constexpr std::uint32_t kRingMagic = 0x474e5256;  // "VRNG"
+constexpr std::uint32_t kRingVersion = 1;
+// Данные начинаются со второй страницы: заголовок не делит с ними
+// кэш-линии
+constexpr std::size_t kDataOffset = 4096;
+// Кадр выравнивается на 8 байт; метка вместо длины означает, что
+// остаток до конца кольца пропущен и следующий кадр лежит в начале
+constexpr std::uint32_t kWrapMarker = 0xffffffffu;
+constexpr std::size_t kMinCapacity = 256 * 1024;
+
+// Позиции растут монотонно, смещение в кольце — позиция по модулю
+// ёмкости. Поля писателя и читателя на разных кэш-линиях.
+struct RingHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t capacity;
+  alignas(64) std::atomic<std::uint64_t> write_pos;
+  // Читатель собирается уснуть на data_ready
+  std::atomic<std::uint32_t> reader_waiting;
+  alignas(64) std::atomic<std::uint64_t> read_pos;
+  // Писатель ждёт места на space_ready
+  std::atomic<std::uint32_t> writer_waiting;
+};
+
+static_assert(sizeof(RingHeader) <= kDataOffset, "ring header too large");
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "ring needs lock-free 64-bit atomics");
+
+inline std::size_t record_size(std::size_t frame_size) {
+  return (frame_size + 7) & ~std::size_t{7};
+}
+
+// Сколько байт кольца займёт кадр, записанный с позиции position,
+// с учётом пропуска хвоста при переходе через конец
+inline std::size_t space_needed(std::uint64_t position, std::size_t capacity,
+                                std::size_t frame_size) {
+  std::size_t need = record_size(frame_size);
+  std::size_t tail = capacity - (position & (capacity - 1));
+  return need <= tail ? need : tail + need;
+}
+
+inline void notify(int event_fd) {
+  std::uint64_t one = 1;
+  ssize_t written = ::write(event_fd, &one, sizeof(one));
+  (void)written;  // переполнение счётчика невозможно, EAGAIN не важен
+}
+
+// Сбрасывает счётчик eventfd; false — ожидание прервано сигналом
+inline bool drain_event(int event_fd) {
+  std::uint64_t value;
+  return ::read(event_fd, &value, sizeof(value)) == sizeof(value) ||
+         errno == EAGAIN;
+}
+
+// Отображение кольца и его eventfd; владеет дескрипторами
+class Mapping {
+ public:
+  Mapping() = default;
+  ~Mapping() { reset(); }
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  // Создаёт кольцо с capacity байт данных (степень двойки)
+  static Mapping create(std::size_t capacity) {
+    if (capacity < kMinCapacity || (capacity & (capacity - 1)) != 0) {
+      throw std::runtime_error("Ring capacity must be a power of two >= " +
+                               std::to_string(kMinCapacity));
+    }
+    Mapping mapping;
+    mapping.memfd_ = memfd_create("voice-ring", MFD_CLOEXEC);
+    if (mapping.memfd_ < 0 ||
+        ftruncate(mapping.memfd_,
+                  static_cast<off_t>(kDataOffset + capacity)) != 0) {
+      throw std::runtime_error(std::string("memfd: ") + std::strerror(errno));
+    }
+    mapping.data_ready_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    mapping.space_ready_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mapping.data_ready_ < 0 || mapping.space_ready_ < 0) {
+      throw std::runtime_error(std::string("eventfd: ") +
+                               std::strerror(errno));
+    }
+    mapping.map(kDataOffset + capacity);
+    RingHeader* header = new (mapping.base_) RingHeader();
+    header->magic = kRingMagic;
+    header->version = kRingVersion;
+    header->capacity = capacity;
+    return mapping;
+  }
+
+  // Принимает дескрипторы, полученные от сервера, и проверяет кольцо
+  static Mapping attach(int memfd, int data_ready, int space_ready) {
+    Mapping mapping;
+    mapping.memfd_ = memfd;
+    mapping.data_ready_ = data_ready;
+    mapping.space_ready_ = space_ready;
+    struct stat st;
+    if (fstat(memfd, &st) != 0 ||
+        static_cast<std::size_t>(st.st_size) < kDataOffset + kMinCapacity) {
+      throw std::runtime_error("Ring memfd is too small");
+    }
+    mapping.map(static_cast<std::size_t>(st.st_size));
+    const RingHeader* header = mapping.header();
+    if (header->magic != kRingMagic || header->version != kRingVersion ||
+        (header->capacity & (header->capacity - 1)) != 0 ||
+        kDataOffset + header->capacity != mapping.size_) {
+      throw std::runtime_error("Not a voice ring");
+    }
+    return mapping;
+  }
+
+  Mapping(Mapping&& other) noexcept { *this = std::move(other); }
+  Mapping& operator=(Mapping&& other) noexcept {
+    if (this != &other) {
+      reset();
+      base_ = other.base_;
+      size_ = other.size_;
+      memfd_ = other.memfd_;
+      data_ready_ = other.data_ready_;
+      space_ready_ = other.space_ready_;
+      other.base_ = nullptr;
+      other.memfd_ = other.data_ready_ = other.space_ready_ = -1;
+    }
+    return *this;
+  }
+
+  RingHeader* header() const { return static_cast<RingHeader*>(base_); }
+  char* data() const { return static_cast<char*>(base_) + kDataOffset; }
+  std::size_t capacity() const { return header()->capacity; }
+  int memfd() const { return memfd_; }
+  // Писатель будит читателя
+  int data_ready() const { return data_ready_; }
+  // Читатель будит писателя
+  int space_ready() const { return space_ready_; }
+
+ private:
+  void map(std::size_t size) {
+    void* base =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+    if (base == MAP_FAILED) {
+      throw std::runtime_error(std::string("mmap: ") + std::strerror(errno));
+    }
+    base_ = base;
+    size_ = size;
+  }
+
+  void reset() {
+    if (base_) {
+      munmap(base_, size_);
+      base_ = nullptr;
+    }
+    for (int* fd : {&memfd_, &data_ready_, &space_ready_}) {
+      if (*fd >= 0) {
+        ::close(*fd);
+        *fd = -1;
+      }
+    }
+  }
+
+  void* base_ = nullptr;
+  std::size_t size_ = 0;
+  int memfd_ = -1;
+  int data_ready_ = -1;
+  int space_ready_ = -1;
+};
+
+// Сторона сервера. Писатель не блокируется: кадр, которому нет места,
+// остаётся у вызывающего, а готовность места он узнаёт по space_ready.
+// Запись сразу видна читателю, который не спит; спящего будит wake().
+class RingWriter {
+ public:
+  explicit RingWriter(const Mapping& mapping)
+      : header_(mapping.header()),
+        data_(mapping.data()),
+        mask_(mapping.capacity() - 1),
+        data_ready_(mapping.data_ready()) {}
+
+  // Копирует кадр в кольцо и публикует его; false — места нет
+  bool write(const char* frame, std::size_t size) {
+    if (!fits(size)) {
+      // Кэшированная позиция читателя устарела: перечитываем её только
+      // здесь, а не на каждый кадр
+      read_pos_ = header_->read_pos.load(std::memory_order_acquire);
+      if (!fits(size)) {
+        return false;
+      }
+    }
+    std::size_t need = record_size(size);
+    std::size_t offset = write_pos_ & mask_;
+    std::size_t tail = mask_ + 1 - offset;
+    if (need > tail) {
+      protocol::put_u32(data_ + offset, kWrapMarker);
+      write_pos_ += tail;
+      offset = 0;
+    }
+    std::memcpy(data_ + offset, frame, size);
+    write_pos_ += need;
+    header_->write_pos.store(write_pos_, std::memory_order_release);
+    return true;
+  }
+
+  // Будит уснувшего читателя. Вызывается после пачки write: читатель,
+  // разбуженный на каждый кадр, тратил бы на пробуждения больше, чем
+  // на сами кадры.
+  void wake() {
+    // Пара к барьеру читателя в wait(): либо читатель увидит новую
+    // позицию, либо мы увидим его флаг
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->reader_waiting.load(std::memory_order_relaxed) &&
+        header_->reader_waiting.exchange(0, std::memory_order_relaxed)) {
+      notify(data_ready_);
+      ++wakeups_;
+    }
+  }
+
+  // Перед ожиданием space_ready; false — место уже освободилось
+  bool prepare_wait(std::size_t frame_size) {
+    header_->writer_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    read_pos_ = header_->read_pos.load(std::memory_order_acquire);
+    if (fits(frame_size)) {
+      header_->writer_waiting.store(0, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  std::uint64_t bytes_written() const { return write_pos_; }
+  std::uint64_t wakeups() const { return wakeups_; }
+
+ private:
+  bool fits(std::size_t size) const {
+    return mask_ + 1 - (write_pos_ - read_pos_) >=
+           space_needed(write_pos_, mask_ + 1, size);
+  }
+
+  RingHeader* header_;
+  char* data_;
+  std::size_t mask_;
+  int data_ready_;
+  std::uint64_t write_pos_ = 0;
+  std::uint64_t read_pos_ = 0;
+  std::uint64_t wakeups_ = 0;
+};
+
+// Сторона клиента
+class RingReader {
+ public:
+  static constexpr unsigned kSpin = 1000;
+
+  explicit RingReader(const Mapping& mapping)
+      : header_(mapping.header()),
+        data_(mapping.data()),
+        mask_(mapping.capacity() - 1),
+        data_ready_(mapping.data_ready()),
+        space_ready_(mapping.space_ready()),
+        // На одном ядре писатель не может работать, пока мы крутимся
+        spin_(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? kSpin : 0) {}
+
+  // Передаёт handler(frame, size) все опубликованные кадры и
+  // освобождает их место; возвращает число кадров. Кадр действителен
+  // только внутри вызова handler.
+  template <typename Handler>
+  std::size_t poll(Handler&& handler) {
+    std::uint64_t end = header_->write_pos.load(std::memory_order_acquire);
+    std::size_t frames = 0;
+    while (read_pos_ != end) {
+      std::size_t offset = read_pos_ & mask_;
+      const char* record = data_ + offset;
+      if (protocol::get_u32(record) == kWrapMarker) {
+        read_pos_ += mask_ + 1 - offset;
+        continue;
+      }
+      std::size_t size = protocol::kHeaderSize + protocol::get_u32(record);
+      handler(record, size);
+      read_pos_ += record_size(size);
+      ++frames;
+    }
+    if (frames > 0) {
+      header_->read_pos.store(read_pos_, std::memory_order_release);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (header_->writer_waiting.load(std::memory_order_relaxed) &&
+          header_->writer_waiting.exchange(0, std::memory_order_relaxed)) {
+        notify(space_ready_);
+      }
+    }
+    return frames;
+  }
+
+  // Ждёт нового кадра не дольше timeout_ms (-1 — без предела), перед
+  // сном до kSpin раз проверив кольцо без системных вызовов. false —
+  // сервер закрыл control_fd или ожидание прервано сигналом.
+  bool wait(int control_fd, int timeout_ms = -1) {
+    for (unsigned i = 0; i < spin_; ++i) {
+      if (header_->write_pos.load(std::memory_order_acquire) != read_pos_) {
+        return true;
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+    header_->reader_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->write_pos.load(std::memory_order_acquire) != read_pos_) {
+      header_->reader_waiting.store(0, std::memory_order_relaxed);
+      return true;
+    }
+    ++sleeps_;
+    pollfd fds[2] = {{data_ready_, POLLIN, 0}, {control_fd, POLLIN, 0}};
+    int ready = ::poll(fds, 2, timeout_ms);
+    header_->reader_waiting.store(0, std::memory_order_relaxed);
+    if (ready < 0 || fds[1].revents != 0) {
+      return false;
+    }
+    return drain_event(data_ready_);
+  }
+
+  std::uint64_t bytes_read() const { return read_pos_; }
+  std::uint64_t sleeps() const { return sleeps_; }
+
+ private:
+  RingHeader* header_;
+  const char* data_;
+  std::size_t mask_;
+  int data_ready_;
+  int space_ready_;
+  unsigned spin_;
+  std::uint64_t read_pos_ = 0;
+  std::uint64_t sleeps_ = 0;
+};
+
+// Дескрипторы кольца в одном сообщении Unix-сокета
+constexpr int kRingFdCount = 3;
+
+inline bool send_ring(int socket, const Mapping& mapping) {
+  char byte = 'R';
+  iovec iov{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kRingFdCount)] = {};
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * kRingFdCount);
+  int fds[kRingFdCount] = {mapping.memfd(), mapping.data_ready(),
+                           mapping.space_ready()};
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  return sendmsg(socket, &message, MSG_NOSIGNAL) == 1;
+}
+
+// Блокирующий приём кольца; исключение, если сервер закрыл сокет
+// (например, отклонил токен)
+inline Mapping receive_ring(int socket) {
+  char byte = 0;
+  iovec iov{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kRingFdCount)] = {};
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+  if (n != 1 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * kRingFdCount)) {
+    throw std::runtime_error("Server closed the connection");
+  }
+  int fds[kRingFdCount];
+  std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  return Mapping::attach(fds[0], fds[1], fds[2]);
+}
+
+}  // namespace shm
+
+#endif  // SHM_RING_H
@@ -0,0 +1,182 @@
+// Клиент рассылки через разделяемую память (server --shm-socket):
+// читает кадры из кольца, раз в секунду печатает пропускную
+// способность и по желанию пишет поток кадров в файл в той же
+// разметке, что идёт по TCP
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "protocol.h"
+#include "sha256.h"
+#include "shm_ring.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void on_signal(int) { stop_requested = 1; }
+
+int connect_unix(const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address),
+                         sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+struct TapStats {
+  std::uint64_t frames = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t audio = 0;
+  std::uint64_t data = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string socket_path;
+  std::string token_hex;
+  std::string out_path;
+  unsigned seconds = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0 && socket_path.empty()) {
+      socket_path = arg;
+    } else if (i + 1 < argc && arg == "--token") {
+      token_hex = argv[++i];
+    } else if (i + 1 < argc && arg == "--out") {
+      out_path = argv[++i];
+    } else if (i + 1 < argc && arg == "--seconds") {
+      seconds = static_cast<unsigned>(std::stoul(argv[++i]));
+    } else {
+      socket_path.clear();
+      break;
+    }
+  }
+  if (socket_path.empty()) {
+    std::cerr << "Usage: shmtap SOCKET [--token HEX] [--out FILE] "
+                 "[--seconds N]"
+              << std::endl;
+    return 1;
+  }
+
+  int control = connect_unix(socket_path);
+  if (control < 0) {
+    std::cerr << "Cannot connect to " << socket_path << ": "
+              << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  if (!token_hex.empty()) {
+    protocol::SessionToken token;
+    if (!from_hex(token_hex, token)) {
+      std::cerr << "Token must be " << protocol::kSessionTokenSize * 2
+                << " hex digits" << std::endl;
+      return 1;
+    }
+    auto hello = protocol::make_hello(token);
+    if (send(control, hello.data(), hello.size(), MSG_NOSIGNAL) !=
+        static_cast<ssize_t>(hello.size())) {
+      std::cerr << "Cannot send hello" << std::endl;
+      return 1;
+    }
+  }
+
+  std::FILE* out = nullptr;
+  if (!out_path.empty()) {
+    out = std::fopen(out_path.c_str(), "wb");
+    if (!out) {
+      std::cerr << "Cannot open " << out_path << std::endl;
+      return 1;
+    }
+  }
+
+  try {
+    shm::Mapping mapping = shm::receive_ring(control);
+    shm::RingReader reader(mapping);
+    std::cerr << "Attached ring of " << mapping.capacity() / 1024 << " KiB"
+              << std::endl;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    TapStats total;
+    TapStats period;
+    auto started = Clock::now();
+    auto reported = started;
+    std::uint64_t sleeps = 0;
+    auto handle = [&](const char* frame, std::size_t size) {
+      auto header = protocol::decode_header(frame);
+      ++period.frames;
+      period.bytes += size;
+      period.audio += header.type == protocol::MessageType::kAudio;
+      period.data += header.type == protocol::MessageType::kData;
+      if (out) {
+        std::fwrite(frame, 1, size, out);
+      }
+    };
+    while (!stop_requested) {
+      reader.poll(handle);
+      auto now = Clock::now();
+      if (now - reported >= std::chrono::seconds(1)) {
+        double elapsed = std::chrono::duration<double>(now - reported).count();
+        std::printf(
+            "%llu frames/s, %.1f MiB/s, audio %llu, data %llu, "
+            "sleeps %llu\n",
+            static_cast<unsigned long long>(period.frames / elapsed),
+            period.bytes / elapsed / (1024 * 1024),
+            static_cast<unsigned long long>(period.audio),
+            static_cast<unsigned long long>(period.data),
+            static_cast<unsigned long long>(reader.sleeps() - sleeps));
+        std::fflush(stdout);
+        total.frames += period.frames;
+        total.bytes += period.bytes;
+        period = TapStats();
+        sleeps = reader.sleeps();
+        reported = now;
+      }
+      if (seconds != 0 && now - started >= std::chrono::seconds(seconds)) {
+        break;
+      }
+      if (!reader.wait(control, 1000)) {
+        // Сигнал или закрытие сервером: дочитываем то, что уже в кольце
+        reader.poll(handle);
+        if (!stop_requested) {
+          std::cerr << "Server closed the connection" << std::endl;
+        }
+        break;
+      }
+    }
+    total.frames += period.frames;
+    total.bytes += period.bytes;
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - started).count();
+    std::printf("Total: %llu frames, %.1f MiB in %.1f s, %llu sleeps\n",
+                static_cast<unsigned long long>(total.frames),
+                total.bytes / (1024.0 * 1024), elapsed,
+                static_cast<unsigned long long>(reader.sleeps()));
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (out) {
+    std::fclose(out);
+  }
+  ::close(control);
+  return 0;
+}
@@ -0,0 +1,394 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "logger.h"
+#include "rate_limit.h"
+#include "session_table.h"
+#include "stream_scheduler.h"
+
+// Сцена: один-два говорящих и десятки тысяч слушателей. Слушатель
+// только принимает голос: у него нет буфера чтения, планировщика
+// и разбора входящих кадров, а мёртвого клиента находит TCP keepalive
+// ядра, а не ping/pong.
+//
+// Слушатели разложены по потокам рассылки, у каждого свой io_context.
+// Кадр идёт по дереву внутри процесса: io-поток отдаёт его только корню,
+// каждый поток сначала передаёт кадр своим детям, а потом пишет своим
+// слушателям, так что io-поток не растёт с размером зала, а пачки
+// слушателей отправляются параллельно.
+namespace stage {
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+// Детей у каждого узла дерева потоков
+constexpr std::size_t kRelayFanout = 4;
+// Голос сверх этой очереди теряется: слушатель отстал больше чем
+// на секунду при пакетах по 20 мс
+constexpr std::size_t kMaxQueuedFrames = 50;
+
+struct Options {
+  unsigned workers = 1;
+  // Параметры TCP keepalive слушателя, секунды
+  unsigned keepalive_interval = 5;
+  unsigned peer_timeout = 15;
+};
+
+// Счётчики всех потоков сцены; время рассылки — от передачи кадра
+// корню до последней записи последнего потока
+struct FanoutStats {
+  std::atomic<std::uint64_t> frames{0};
+  std::atomic<std::uint64_t> total_ns{0};
+  std::atomic<std::uint64_t> max_ns{0};
+  std::atomic<std::uint64_t> writes{0};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<std::uint64_t> disconnects{0};
+
+  void record(std::uint64_t ns) {
+    frames.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns, std::memory_order_relaxed);
+    std::uint64_t max = max_ns.load(std::memory_order_relaxed);
+    while (ns > max &&
+           !max_ns.compare_exchange_weak(max, ns,
+                                         std::memory_order_relaxed)) {
+    }
+  }
+};
+
+// Кадр в пути по дереву; последний поток, закончивший запись,
+// отмечает время рассылки
+struct Broadcast {
+  SharedFrame frame;
+  Clock::time_point started;
+  std::atomic<std::size_t> pending{0};
+};
+
+class Worker;
+
+// Слушатель сцены. Все методы — в потоке своего Worker.
+class Listener : public std::enable_shared_from_this<Listener> {
+ public:
+  Listener(tcp::socket socket, Worker& worker)
+      : socket_(std::move(socket)), worker_(worker) {}
+
+  void start(SessionHandle handle, SharedFrame welcome);
+  void stop() {
+    boost::system::error_code ec;
+    socket_.close(ec);
+    queued_.clear();
+  }
+  // false — кадр потерян
+  bool deliver(const SharedFrame& frame, bool shed_voice);
+
+ private:
+  // Клиент ничего не шлёт: чтение лишь ловит закрытие
+  void watch_socket();
+  // Всё накопленное уходит одной записью со сборкой буферов; sent —
+  // уже отправленная часть первого кадра
+  void do_write(std::size_t sent);
+
+  tcp::socket socket_;
+  Worker& worker_;
+  SessionHandle handle_;
+  std::vector<SharedFrame> queued_;
+  std::vector<SharedFrame> writing_;
+  std::vector<boost::asio::const_buffer> buffers_;
+};
+
+class Worker {
+ public:
+  Worker(FanoutStats& stats, const MemoryBudget& memory)
+      : stats_(stats),
+        memory_(memory),
+        work_(boost::asio::make_work_guard(io_context_)) {}
+
+  ~Worker() {
+    work_.reset();
+    io_context_.stop();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    for (auto& listener : listeners_) {
+      listener->stop();
+    }
+  }
+
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+
+  void start() {
+    thread_ = std::thread([this]() { io_context_.run(); });
+  }
+  void add_child(Worker* child) { children_.push_back(child); }
+
+  // Из любого потока
+  void adopt(int fd, tcp protocol, SharedFrame welcome) {
+    listener_count_.fetch_add(1, std::memory_order_relaxed);
+    boost::asio::post(io_context_, [this, fd, protocol,
+                                    welcome = std::move(welcome)]() {
+      boost::system::error_code ec;
+      tcp::socket socket(io_context_);
+      socket.assign(protocol, fd, ec);
+      if (ec) {
+        ::close(fd);
+        listener_count_.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+      auto listener = std::make_shared<Listener>(std::move(socket), *this);
+      listener->start(listeners_.insert(listener), welcome);
+    });
+  }
+  void relay(std::shared_ptr<Broadcast> broadcast) {
+    boost::asio::post(io_context_, Relay{this, std::move(broadcast)});
+  }
+  std::size_t listeners() const {
+    return listener_count_.load(std::memory_order_relaxed);
+  }
+
+  // Из потока рассылки. Повторный вызов с тем же handle безопасен
+  void leave(SessionHandle handle) {
+    auto* listener = listeners_.get(handle);
+    if (!listener) {
+      return;
+    }
+    auto closing = std::move(*listener);
+    listeners_.erase(handle);
+    closing->stop();
+    listener_count_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  void count_write() { ++writes_; }
+  void count_disconnect() {
+    stats_.disconnects.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  // Операцию post выделяет поток-отправитель, а освобождает этот: кэш
+  // asio остался бы в чужом потоке, поэтому память — через склад
+  // RecyclingAllocator
+  struct Relay {
+    using allocator_type = RecyclingAllocator<void>;
+
+    Worker* worker;
+    std::shared_ptr<Broadcast> broadcast;
+
+    allocator_type get_allocator() const { return allocator_type(); }
+    void operator()() { worker->on_broadcast(broadcast); }
+  };
+
+  void on_broadcast(const std::shared_ptr<Broadcast>& broadcast) {
+    for (Worker* child : children_) {
+      child->relay(broadcast);
+    }
+    // Давление на память одно на весь кадр
+    bool shed_voice = memory_.pressure() >= MemoryPressure::kShedVoice;
+    std::uint64_t dropped = 0;
+    for (auto& listener : listeners_) {
+      dropped += !listener->deliver(broadcast->frame, shed_voice);
+    }
+    // Общие счётчики — раз на кадр, а не на слушателя
+    if (dropped > 0) {
+      stats_.dropped.fetch_add(dropped, std::memory_order_relaxed);
+    }
+    if (writes_ > 0) {
+      stats_.writes.fetch_add(writes_, std::memory_order_relaxed);
+      writes_ = 0;
+    }
+    if (broadcast->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      stats_.record(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              Clock::now() - broadcast->started)
+              .count()));
+    }
+  }
+
+  FanoutStats& stats_;
+  const MemoryBudget& memory_;
+  // io_context переживает слушателей и их сокеты
+  boost::asio::io_context io_context_{1};
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+      work_;
+  SlabTable<std::shared_ptr<Listener>> listeners_;
+  std::vector<Worker*> children_;
+  std::atomic<std::size_t> listener_count_{0};
+  std::uint64_t writes_ = 0;
+  std::thread thread_;
+};
+
+inline void Listener::start(SessionHandle handle, SharedFrame welcome) {
+  handle_ = handle;
+  boost::system::error_code ec;
+  socket_.non_blocking(true, ec);
+  if (welcome) {
+    deliver(welcome, false);
+  }
+  watch_socket();
+}
+
+// Пока очередь пуста, кадр уходит сразу неблокирующим send: без
+// асинхронной операции и обработчика завершения на каждого слушателя
+inline bool Listener::deliver(const SharedFrame& frame, bool shed_voice) {
+  if (writing_.empty()) {
+    boost::system::error_code ec;
+    std::size_t sent = socket_.send(boost::asio::buffer(*frame), 0, ec);
+    worker_.count_write();
+    if (sent == frame->size()) {
+      return true;
+    }
+    // Ошибку сокета вернёт асинхронная запись: отсюда, посреди обхода
+    // слушателей, выходить из таблицы нельзя
+    queued_.push_back(frame);
+    do_write(sent);
+    return true;
+  }
+  if (queued_.size() >= kMaxQueuedFrames || shed_voice) {
+    return false;
+  }
+  queued_.push_back(frame);
+  return true;
+}
+
+inline void Listener::watch_socket() {
+  auto self(shared_from_this());
+  socket_.async_wait(
+      tcp::socket::wait_read, [this, self](boost::system::error_code ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+        char discard[256];
+        std::size_t n = ec ? 0 : socket_.read_some(
+                                     boost::asio::buffer(discard), ec);
+        if (ec || n == 0) {
+          worker_.leave(handle_);
+          return;
+        }
+        watch_socket();
+      });
+}
+
+inline void Listener::do_write(std::size_t sent) {
+  writing_.swap(queued_);
+  buffers_.clear();
+  for (const auto& frame : writing_) {
+    buffers_.emplace_back(frame->data(), frame->size());
+  }
+  buffers_.front() += sent;
+  auto self(shared_from_this());
+  boost::asio::async_write(
+      socket_, buffers_,
+      [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+        writing_.clear();
+        if (ec) {
+          if (ec != boost::asio::error::operation_aborted) {
+            worker_.count_disconnect();
+            worker_.leave(handle_);
+          }
+          return;
+        }
+        if (!queued_.empty()) {
+          worker_.count_write();
+          do_write(0);
+        }
+      });
+}
+
+class Stage {
+ public:
+  Stage(const Options& options, const MemoryBudget& memory)
+      : options_(options) {
+    unsigned count = std::max(options.workers, 1u);
+    workers_.reserve(count);
+    for (unsigned i = 0; i < count; ++i) {
+      workers_.push_back(std::make_unique<Worker>(stats_, memory));
+    }
+    // Узел i передаёт кадр узлам kRelayFanout * i + 1 ...
+    for (std::size_t i = 1; i < workers_.size(); ++i) {
+      workers_[(i - 1) / kRelayFanout]->add_child(workers_[i].get());
+    }
+    for (auto& worker : workers_) {
+      worker->start();
+    }
+  }
+
+  // Сокет уходит в наименее занятый поток; welcome — первый кадр
+  // слушателя или nullptr
+  void add(tcp::socket socket, SharedFrame welcome) {
+    boost::system::error_code ec;
+    socket.set_option(tcp::no_delay(true), ec);
+    socket.set_option(boost::asio::socket_base::keep_alive(true), ec);
+    int fd = socket.native_handle();
+    // Ядро рвёт соединение сам, как наш keepalive: проба после
+    // keepalive_interval тишины, отказ после peer_timeout
+    int idle = static_cast<int>(options_.keepalive_interval);
+    int probes = static_cast<int>(
+        std::max(1u, (options_.peer_timeout - options_.keepalive_interval) /
+                         options_.keepalive_interval));
+    unsigned user_timeout_ms = options_.peer_timeout * 1000;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+    // Не подтверждающий данные слушатель держал бы очередь вечно
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout_ms,
+               sizeof(user_timeout_ms));
+    tcp protocol = socket.local_endpoint(ec).protocol();
+    if (ec) {
+      return;
+    }
+    Worker* target = workers_.front().get();
+    for (auto& worker : workers_) {
+      if (worker->listeners() < target->listeners()) {
+        target = worker.get();
+      }
+    }
+    int released = socket.release(ec);
+    if (!ec) {
+      target->adopt(released, protocol, std::move(welcome));
+    }
+  }
+
+  // Из io-потока
+  void broadcast(const SharedFrame& frame) {
+    if (listeners() == 0) {
+      return;
+    }
+    auto broadcast = std::allocate_shared<Broadcast>(
+        RecyclingAllocator<Broadcast>());
+    broadcast->frame = frame;
+    broadcast->started = Clock::now();
+    broadcast->pending.store(workers_.size(), std::memory_order_relaxed);
+    workers_.front()->relay(std::move(broadcast));
+  }
+
+  std::size_t listeners() const {
+    std::size_t total = 0;
+    for (const auto& worker : workers_) {
+      total += worker->listeners();
+    }
+    return total;
+  }
+  std::size_t workers() const { return workers_.size(); }
+  FanoutStats& stats() { return stats_; }
+
+ private:
+  Options options_;
+  FanoutStats stats_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+}  // namespace stage
+
+#endif  // STAGE_H
@@ -0,0 +1,359 @@
+// Нагрузка на сцену (server --stage-port): N слушателей и один
+// говорящий в основном порту. Говорящий шлёт голос с меткой времени
+// отправки в начале полезной нагрузки; раз в секунду печатается, сколько
+// кадров дошло, задержка доставки слушателю и задержка последнего
+// слушателя кадра — время рассылки, видимое клиентами
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+#include "sha256.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void on_signal(int) { stop_requested = 1; }
+
+std::uint64_t now_ns() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Clock::now().time_since_epoch())
+          .count());
+}
+
+int connect_tcp(const std::string& host, unsigned short port) {
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    return -1;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address),
+                         sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send_all(int fd, const std::vector<char>& data) {
+  std::size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+// Задержки с шагом 10 мкс до секунды; всё дольше — в последней корзине
+class LatencyHistogram {
+ public:
+  static constexpr std::size_t kBuckets = 100000;
+  static constexpr std::uint64_t kStepNs = 10000;
+
+  LatencyHistogram() : buckets_(kBuckets) {}
+
+  void add(std::uint64_t ns) {
+    ++buckets_[std::min<std::uint64_t>(ns / kStepNs, kBuckets - 1)];
+    ++count_;
+    max_ns_ = std::max(max_ns_, ns);
+  }
+  double percentile_ms(double fraction) const {
+    std::uint64_t target = static_cast<std::uint64_t>(count_ * fraction);
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i];
+      if (seen > target) {
+        return (i + 1) * kStepNs / 1e6;
+      }
+    }
+    return max_ms();
+  }
+  double max_ms() const { return max_ns_ / 1e6; }
+  std::uint64_t count() const { return count_; }
+
+ private:
+  std::vector<std::uint64_t> buckets_;
+  std::uint64_t count_ = 0;
+  std::uint64_t max_ns_ = 0;
+};
+
+struct Listener {
+  int fd = -1;
+  std::vector<char> pending;
+};
+
+// Сколько слушателей получили кадр и когда — последний
+struct FrameArrivals {
+  std::uint64_t sent_ns = 0;
+  std::size_t received = 0;
+  std::uint64_t last_ns = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> positional;
+  std::string token_hex;
+  std::size_t listener_count = 1000;
+  unsigned seconds = 10;
+  unsigned packet_ms = protocol::kDefaultPacketMs;
+  // 0 — кадр на каждый интервал пакета; меньше — большой зал на слабой
+  // машине, где рассылка кадра дольше его длительности
+  double frames_per_second = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      positional.push_back(arg);
+    } else if (i + 1 < argc && arg == "--listeners") {
+      listener_count = std::stoul(argv[++i]);
+    } else if (i + 1 < argc && arg == "--seconds") {
+      seconds = static_cast<unsigned>(std::stoul(argv[++i]));
+    } else if (i + 1 < argc && arg == "--packet-ms") {
+      packet_ms = static_cast<unsigned>(std::stoul(argv[++i]));
+    } else if (i + 1 < argc && arg == "--fps") {
+      frames_per_second = std::stod(argv[++i]);
+    } else if (i + 1 < argc && arg == "--token") {
+      token_hex = argv[++i];
+    } else {
+      positional.clear();
+      break;
+    }
+  }
+  if (positional.size() != 3 || packet_ms == 0) {
+    std::cerr << "Usage: stagebench HOST PORT STAGE_PORT [--listeners N] "
+                 "[--seconds N] [--packet-ms N] [--fps N] [--token HEX]"
+              << std::endl;
+    return 1;
+  }
+  const std::string& host = positional[0];
+  auto port = static_cast<unsigned short>(std::stoi(positional[1]));
+  auto stage_port = static_cast<unsigned short>(std::stoi(positional[2]));
+
+  std::vector<char> hello;
+  if (!token_hex.empty()) {
+    protocol::SessionToken token;
+    if (!from_hex(token_hex, token)) {
+      std::cerr << "Token must be " << protocol::kSessionTokenSize * 2
+                << " hex digits" << std::endl;
+      return 1;
+    }
+    hello = protocol::make_hello(token);
+  }
+
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<Listener> listeners(listener_count);
+  for (std::size_t i = 0; i < listener_count; ++i) {
+    int fd = connect_tcp(host, stage_port);
+    if (fd < 0 || (!hello.empty() && !send_all(fd, hello))) {
+      std::cerr << "Listener " << i << ": " << std::strerror(errno)
+                << std::endl;
+      return 1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    listeners[i].fd = fd;
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = i;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+  }
+  int speaker = connect_tcp(host, port);
+  if (speaker < 0 || (!hello.empty() && !send_all(speaker, hello))) {
+    std::cerr << "Speaker: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  int nodelay = 1;
+  setsockopt(speaker, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  fcntl(speaker, F_SETFL, fcntl(speaker, F_GETFL) | O_NONBLOCK);
+  epoll_event speaker_event{};
+  speaker_event.events = EPOLLIN;
+  speaker_event.data.u64 = listener_count;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, speaker, &speaker_event);
+  std::cerr << "Connected " << listener_count << " listeners" << std::endl;
+
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+
+  protocol::AudioFormat format;
+  std::size_t samples = format.sample_rate * packet_ms / 1000;
+  std::vector<char> payload(samples * sizeof(float));
+  protocol::FrameHeader header;
+  header.type = protocol::MessageType::kAudio;
+  header.flags = protocol::audio_flags(format);
+
+  std::unordered_map<std::uint32_t, FrameArrivals> arrivals;
+  LatencyHistogram delivery;
+  LatencyHistogram last_listener;
+  LatencyHistogram period_delivery;
+  std::uint32_t next_sequence = 0;
+  std::uint64_t frames_sent = 0;
+  std::uint64_t period_frames = 0;
+  auto started = Clock::now();
+  auto next_send = started;
+  auto reported = started;
+  auto interval = std::chrono::duration_cast<Clock::duration>(
+      frames_per_second > 0
+          ? std::chrono::duration<double>(1.0 / frames_per_second)
+          : std::chrono::duration<double>(packet_ms / 1000.0));
+  std::vector<char> discard(64 * 1024);
+  std::vector<epoll_event> events(1024);
+
+  // Кадр закрыт через 5 с: опоздавших уже не ждём
+  auto close_frames = [&](std::uint64_t now) {
+    for (auto it = arrivals.begin(); it != arrivals.end();) {
+      if (now - it->second.sent_ns < 5000000000ull) {
+        ++it;
+        continue;
+      }
+      if (it->second.received > 0) {
+        last_listener.add(it->second.last_ns - it->second.sent_ns);
+      }
+      it = arrivals.erase(it);
+    }
+  };
+
+  auto handle_frame = [&](const char* frame) {
+    auto frame_header = protocol::decode_header(frame);
+    if (frame_header.type != protocol::MessageType::kAudio ||
+        frame_header.length < 8) {
+      return;
+    }
+    auto it = arrivals.find(frame_header.sequence);
+    if (it == arrivals.end()) {
+      return;
+    }
+    std::uint64_t now = now_ns();
+    std::uint64_t latency = now - it->second.sent_ns;
+    delivery.add(latency);
+    period_delivery.add(latency);
+    ++it->second.received;
+    it->second.last_ns = now;
+    ++period_frames;
+  };
+
+  while (!stop_requested) {
+    auto now = Clock::now();
+    if (now - started >= std::chrono::seconds(seconds)) {
+      break;
+    }
+    if (now >= next_send) {
+      std::uint64_t sent_ns = now_ns();
+      protocol::put_u64(payload.data(), sent_ns);
+      header.sequence = next_sequence++;
+      header.timestamp = header.sequence * packet_ms;
+      arrivals[header.sequence].sent_ns = sent_ns;
+      if (!send_all(speaker, protocol::make_frame(header, payload.data(),
+                                                  payload.size()))) {
+        std::cerr << "Speaker disconnected" << std::endl;
+        break;
+      }
+      ++frames_sent;
+      next_send += interval;
+    }
+    if (now - reported >= std::chrono::seconds(1)) {
+      double elapsed = std::chrono::duration<double>(now - reported).count();
+      std::printf(
+          "%.0f deliveries/s, delivery p50 %.2f p99 %.2f max %.2f ms\n",
+          period_frames / elapsed, period_delivery.percentile_ms(0.5),
+          period_delivery.percentile_ms(0.99), period_delivery.max_ms());
+      std::fflush(stdout);
+      period_delivery = LatencyHistogram();
+      period_frames = 0;
+      reported = now;
+      close_frames(now_ns());
+    }
+    int timeout_ms = static_cast<int>(std::max<std::int64_t>(
+        0, std::chrono::duration_cast<std::chrono::milliseconds>(
+               next_send - Clock::now())
+               .count()));
+    int ready = epoll_wait(epoll, events.data(),
+                           static_cast<int>(events.size()), timeout_ms);
+    for (int e = 0; e < ready; ++e) {
+      std::size_t index = events[e].data.u64;
+      if (index == listener_count) {
+        // Говорящему рассылка тоже приходит; её не считаем
+        while (recv(speaker, discard.data(), discard.size(), 0) > 0) {
+        }
+        continue;
+      }
+      Listener& listener = listeners[index];
+      for (;;) {
+        ssize_t n = recv(listener.fd, discard.data(), discard.size(), 0);
+        if (n <= 0) {
+          if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            epoll_ctl(epoll, EPOLL_CTL_DEL, listener.fd, nullptr);
+            std::cerr << "Listener " << index << " disconnected"
+                      << std::endl;
+          }
+          break;
+        }
+        listener.pending.insert(listener.pending.end(), discard.data(),
+                                discard.data() + n);
+      }
+      std::size_t consumed = 0;
+      while (listener.pending.size() - consumed >= protocol::kHeaderSize) {
+        auto frame_header =
+            protocol::decode_header(listener.pending.data() + consumed);
+        std::size_t size = protocol::kHeaderSize + frame_header.length;
+        if (listener.pending.size() - consumed < size) {
+          break;
+        }
+        handle_frame(listener.pending.data() + consumed);
+        consumed += size;
+      }
+      listener.pending.erase(listener.pending.begin(),
+                             listener.pending.begin() + consumed);
+    }
+  }
+  close_frames(~0ull);
+
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - started).count();
+  std::uint64_t expected = frames_sent * listener_count;
+  std::printf(
+      "Total: %llu frames sent, %llu of %llu deliveries in %.1f s\n"
+      "Delivery: p50 %.2f p99 %.2f max %.2f ms\n"
+      "Last listener per frame: p50 %.2f p99 %.2f max %.2f ms\n",
+      static_cast<unsigned long long>(frames_sent),
+      static_cast<unsigned long long>(delivery.count()),
+      static_cast<unsigned long long>(expected), elapsed,
+      delivery.percentile_ms(0.5), delivery.percentile_ms(0.99),
+      delivery.max_ms(), last_listener.percentile_ms(0.5),
+      last_listener.percentile_ms(0.99), last_listener.max_ms());
+  for (auto& listener : listeners) {
+    ::close(listener.fd);
+  }
+  ::close(speaker);
+  ::close(epoll);
+  return 0;
+}
@@ -0,0 +1,395 @@
+#ifndef STREAM_SCHEDULER_H
+#define STREAM_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "protocol.h"
+
+// Кадр рассылки хранится один раз и разделяется всеми получателями
+using SharedFrame = std::shared_ptr<const std::vector<char>>;
+
+// Байты всех живых кадров рассылки: очереди сессий держат кадры,
+// поэтому это и есть память очередей, без повторного счёта кадра,
+// разделённого многими получателями
+inline std::atomic<std::size_t> shared_frame_bytes{0};
+
+namespace detail {
+
+struct CountedFrame : std::vector<char> {
+  explicit CountedFrame(std::vector<char> frame)
+      : std::vector<char>(std::move(frame)) {
+    shared_frame_bytes.fetch_add(capacity(), std::memory_order_relaxed);
+  }
+  ~CountedFrame() {
+    shared_frame_bytes.fetch_sub(capacity(), std::memory_order_relaxed);
+    // Память буфера достаётся следующему кадру того же класса
+    FramePool::release(*this);
+  }
+};
+
+}  // namespace detail
+
+inline SharedFrame make_shared_frame(std::vector<char> frame) {
+  return std::allocate_shared<const detail::CountedFrame>(
+      RecyclingAllocator<detail::CountedFrame>(), std::move(frame));
+}
+
+// Сообщение потока kData, уже разрезанное на куски
+using SharedMessage = std::shared_ptr<const std::vector<SharedFrame>>;
+
+inline SharedMessage make_shared_message(
+    std::vector<std::vector<char>> chunks) {
+  std::vector<SharedFrame> frames;
+  frames.reserve(chunks.size());
+  for (auto& chunk : chunks) {
+    frames.push_back(make_shared_frame(std::move(chunk)));
+  }
+  return std::make_shared<const std::vector<SharedFrame>>(std::move(frames));
+}
+
+enum class TrafficClass : std::uint8_t {
+  kControl = 0,  // ping/pong, параметры сессии
+  kVoice = 1,
+  kBulk = 2,  // сообщения kData и куски файлов
+};
+
+constexpr std::size_t kTrafficClassCount = 3;
+
+inline TrafficClass traffic_class(protocol::MessageType type) {
+  switch (type) {
+    case protocol::MessageType::kAudio:
+    case protocol::MessageType::kAudioParity:
+      return TrafficClass::kVoice;
+    case protocol::MessageType::kData:
+    case protocol::MessageType::kUploadChunk:
+    case protocol::MessageType::kFileData:
+      return TrafficClass::kBulk;
+    default:
+      return TrafficClass::kControl;
+  }
+}
+
+// Время ожидания в очереди: от постановки до начала отправки.
+// Для kBulk считается по первому куску сообщения.
+struct QueueDelay {
+  std::uint64_t count = 0;
+  std::uint64_t total_us = 0;
+  std::uint64_t max_us = 0;
+  // Кадры, выброшенные по сроку и не отправленные
+  std::uint64_t expired = 0;
+
+  void add(std::uint64_t us) {
+    ++count;
+    total_us += us;
+    max_us = std::max(max_us, us);
+  }
+
+  void merge(const QueueDelay& other) {
+    count += other.count;
+    total_us += other.total_us;
+    max_us = std::max(max_us, other.max_us);
+    expired += other.expired;
+  }
+};
+
+// Очередь отправки одного соединения. Служебные кадры, затем голос —
+// строгий приоритет; сообщения потоков делят остаток по весам
+// (deficit round robin) и уходят кусками, поэтому голос ждёт не дольше
+// отправки одного куска. Пустой планировщик не держит памяти.
+//
+// У голоса может быть срок: кадр, который не начали отправлять
+// до срока, уже бесполезен слушателю и только задерживает свежие.
+// Просроченные кадры выбрасываются из головы очереди при выборке
+// и при постановке нового голоса, так что после затора очередь
+// сразу возвращается к свежему голосу, а не рассасывается медленно.
+class StreamScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Кадр класса kBulk становится сообщением из одного куска
+  // в потоке из заголовка; срок есть только у голоса
+  void push(SharedFrame frame, Clock::time_point now,
+            Clock::time_point deadline = Clock::time_point::max()) {
+    auto header = protocol::decode_header(frame->data());
+    queued_bytes_ += frame->size();
+    switch (traffic_class(header.type)) {
+      case TrafficClass::kControl:
+        control_.push(Entry{std::move(frame), now, deadline});
+        break;
+      case TrafficClass::kVoice:
+        expire_voice(now);
+        voice_.push(Entry{std::move(frame), now, deadline});
+        break;
+      case TrafficClass::kBulk:
+        queued_bytes_ -= frame->size();
+        push_message(header.stream, 1,
+                     std::make_shared<const std::vector<SharedFrame>>(
+                         1, std::move(frame)),
+                     now);
+        break;
+    }
+  }
+
+  // weight — доля потока относительно других потоков, не меньше 1
+  void push_message(std::uint16_t stream, std::uint32_t weight,
+                    SharedMessage message, Clock::time_point now) {
+    if (message->empty()) {
+      return;
+    }
+    bulk_frames_ += message->size();
+    for (const auto& chunk : *message) {
+      queued_bytes_ += chunk->size();
+    }
+    auto it = std::find_if(streams_.begin(), streams_.end(),
+                           [stream](const BulkStream& s) {
+                             return s.id == stream;
+                           });
+    if (it == streams_.end()) {
+      streams_.push_back(
+          BulkStream{stream, std::max<std::uint32_t>(weight, 1), 0, {}, 0, 0});
+      it = streams_.end() - 1;
+    }
+    it->messages.push_back(BulkEntry{std::move(message), now});
+  }
+
+  bool empty() const {
+    return control_.empty() && voice_.empty() && bulk_frames_ == 0;
+  }
+
+  // Следующий кадр к отправке; планировщик не должен быть пуст.
+  // nullptr — в очереди был только просроченный голос
+  SharedFrame pop(Clock::time_point now) {
+    SharedFrame frame;
+    expire_voice(now);
+    if (!control_.empty()) {
+      frame = control_.pop(now, delay(TrafficClass::kControl));
+    } else if (!voice_.empty()) {
+      frame = voice_.pop(now, delay(TrafficClass::kVoice));
+    } else if (bulk_frames_ > 0) {
+      frame = pop_bulk(now);
+    } else {
+      return nullptr;
+    }
+    queued_bytes_ -= frame->size();
+    return frame;
+  }
+
+  std::size_t queued_frames() const {
+    return control_.size() + voice_.size() + bulk_frames_;
+  }
+
+  // Байты кадров в очереди; кадр, разделённый с другими сессиями,
+  // считается у каждой
+  std::size_t queued_bytes() const { return queued_bytes_; }
+
+  // Сколько ждёт самый старый голосовой кадр
+  Clock::duration voice_age(Clock::time_point now) const {
+    return voice_.empty() ? Clock::duration::zero()
+                          : now - voice_.front_enqueued();
+  }
+
+  std::size_t heap_bytes() const {
+    std::size_t bytes = control_.heap_bytes() + voice_.heap_bytes() +
+                        streams_.capacity() * sizeof(BulkStream);
+    for (const auto& stream : streams_) {
+      bytes += stream.messages.capacity() * sizeof(BulkEntry);
+    }
+    return bytes;
+  }
+
+  // Кадры kAudio, выброшенные по сроку с прошлого вызова
+  std::uint64_t take_expired_audio() {
+    return std::exchange(expired_audio_, 0);
+  }
+
+  // Накопленные задержки по классам; обнуляет их
+  void take_delays(QueueDelay (&out)[kTrafficClassCount]) {
+    for (std::size_t i = 0; i < kTrafficClassCount; ++i) {
+      out[i].merge(delays_[i]);
+      delays_[i] = QueueDelay();
+    }
+  }
+
+ private:
+  // Квант DRR на единицу веса: один полный кусок
+  static constexpr std::int64_t kQuantum =
+      protocol::kHeaderSize + protocol::kChunkSize;
+
+  struct Entry {
+    SharedFrame frame;
+    Clock::time_point enqueued;
+    Clock::time_point deadline;
+  };
+
+  // FIFO на векторе с индексом головы: без std::deque, который
+  // выделяет память даже пустым
+  class FrameQueue {
+   public:
+    bool empty() const { return head_ == entries_.size(); }
+    std::size_t size() const { return entries_.size() - head_; }
+    std::size_t heap_bytes() const {
+      return entries_.capacity() * sizeof(Entry);
+    }
+
+    void push(Entry entry) { entries_.push_back(std::move(entry)); }
+    Clock::time_point front_enqueued() const {
+      return entries_[head_].enqueued;
+    }
+    Clock::time_point front_deadline() const {
+      return entries_[head_].deadline;
+    }
+
+    SharedFrame pop(Clock::time_point now, QueueDelay& delay) {
+      delay.add(elapsed_us(entries_[head_].enqueued, now));
+      return drop();
+    }
+
+    // Снимает голову без учёта задержки
+    SharedFrame drop() {
+      SharedFrame frame = std::move(entries_[head_++].frame);
+      if (head_ == entries_.size()) {
+        // Очередь опустела: возвращаем память, если она разрослась
+        // во время всплеска
+        entries_.clear();
+        head_ = 0;
+        if (entries_.capacity() > 64) {
+          entries_.shrink_to_fit();
+        }
+      } else if (head_ > entries_.size() / 2) {
+        // Очередь отстающего слушателя не пустеет никогда: без сдвига
+        // вектор рос бы мёртвыми слотами. Сдвиг переносит меньше
+        // живых записей, чем было снято, так что в среднем O(1)
+        entries_.erase(entries_.begin(),
+                       entries_.begin() + static_cast<std::ptrdiff_t>(head_));
+        head_ = 0;
+      }
+      return frame;
+    }
+
+   private:
+    std::vector<Entry> entries_;
+    std::size_t head_ = 0;
+  };
+
+  struct BulkEntry {
+    SharedMessage message;
+    Clock::time_point enqueued;
+  };
+
+  struct BulkStream {
+    std::uint16_t id;
+    std::uint32_t weight;
+    std::int64_t deficit;
+    std::vector<BulkEntry> messages;
+    std::size_t head;
+    // Следующий кусок головного сообщения
+    std::size_t chunk;
+
+    bool empty() const { return head == messages.size(); }
+  };
+
+  // Сроки отправителей разные, поэтому проверяется только голова:
+  // кадр глубже выбросится, когда до него дойдёт очередь
+  void expire_voice(Clock::time_point now) {
+    while (!voice_.empty() && voice_.front_deadline() <= now) {
+      SharedFrame frame = voice_.drop();
+      queued_bytes_ -= frame->size();
+      ++delay(TrafficClass::kVoice).expired;
+      if (protocol::decode_header(frame->data()).type ==
+          protocol::MessageType::kAudio) {
+        ++expired_audio_;
+      }
+    }
+  }
+
+  QueueDelay& delay(TrafficClass traffic) {
+    return delays_[static_cast<std::size_t>(traffic)];
+  }
+
+  static std::uint64_t elapsed_us(Clock::time_point from,
+                                  Clock::time_point to) {
+    auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+            .count();
+    return us > 0 ? static_cast<std::uint64_t>(us) : 0;
+  }
+
+  SharedFrame pop_bulk(Clock::time_point now) {
+    for (;;) {
+      auto& stream = streams_[cursor_];
+      if (stream.empty()) {
+        stream.deficit = 0;
+        next_stream();
+        continue;
+      }
+      if (!visited_) {
+        stream.deficit += kQuantum * stream.weight;
+        visited_ = true;
+      }
+      auto& entry = stream.messages[stream.head];
+      const SharedFrame& chunk = (*entry.message)[stream.chunk];
+      auto size = static_cast<std::int64_t>(chunk->size());
+      if (stream.deficit < size) {
+        next_stream();
+        continue;
+      }
+      stream.deficit -= size;
+      if (stream.chunk == 0) {
+        delay(TrafficClass::kBulk).add(elapsed_us(entry.enqueued, now));
+      }
+      SharedFrame frame = chunk;
+      --bulk_frames_;
+      if (++stream.chunk == entry.message->size()) {
+        entry.message.reset();
+        stream.chunk = 0;
+        if (++stream.head == stream.messages.size()) {
+          stream.messages.clear();
+          stream.head = 0;
+          stream.deficit = 0;
+          next_stream();
+        } else if (stream.head > stream.messages.size() / 2) {
+          // Как в FrameQueue::drop: поток, который не выгружается
+          // до конца, не копит снятые сообщения
+          stream.messages.erase(
+              stream.messages.begin(),
+              stream.messages.begin() +
+                  static_cast<std::ptrdiff_t>(stream.head));
+          stream.head = 0;
+        }
+      }
+      if (bulk_frames_ == 0) {
+        // Все потоки выгружены: освобождаем их состояние
+        std::vector<BulkStream>().swap(streams_);
+        cursor_ = 0;
+        visited_ = false;
+      }
+      return frame;
+    }
+  }
+
+  void next_stream() {
+    cursor_ = (cursor_ + 1) % streams_.size();
+    visited_ = false;
+  }
+
+  FrameQueue control_;
+  FrameQueue voice_;
+  std::vector<BulkStream> streams_;
+  std::size_t cursor_ = 0;
+  // Квант текущему потоку уже начислен в этом обходе
+  bool visited_ = false;
+  std::size_t bulk_frames_ = 0;
+  std::size_t queued_bytes_ = 0;
+  std::uint64_t expired_audio_ = 0;
+  QueueDelay delays_[kTrafficClassCount];
+};
+
+#endif  // STREAM_SCHEDULER_H
@@ -0,0 +1,63 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Хешированное колесо таймеров. Один внешний таймер двигает колесо
+// на тик, а записи раскладываются по слотам по времени срабатывания:
+// постановка — O(1), тик обходит только один слот. Записи с интервалом
+// длиннее оборота колеса отсчитывают полные обороты в rounds.
+// Отмены нет: владелец проверяет при срабатывании, актуальна ли запись.
+template <typename T>
+class TimingWheel {
+ public:
+  explicit TimingWheel(std::size_t slot_count) : slots_(slot_count) {}
+
+  // Запись сработает через ticks тиков (не меньше одного)
+  void schedule(T value, std::uint64_t ticks) {
+    if (ticks == 0) {
+      ticks = 1;
+    }
+    std::size_t slot = (cursor_ + ticks) % slots_.size();
+    std::uint64_t rounds = (ticks - 1) / slots_.size();
+    slots_[slot].push_back(Entry{std::move(value), rounds});
+    ++size_;
+  }
+
+  // Сдвигает колесо на тик и вызывает expire для наступивших записей.
+  // Из expire можно снова вызывать schedule.
+  template <typename F>
+  void tick(F&& expire) {
+    cursor_ = (cursor_ + 1) % slots_.size();
+    scratch_.clear();
+    scratch_.swap(slots_[cursor_]);
+    for (auto& entry : scratch_) {
+      if (entry.rounds > 0) {
+        --entry.rounds;
+        slots_[cursor_].push_back(std::move(entry));
+        continue;
+      }
+      --size_;
+      expire(entry.value);
+    }
+  }
+
+  std::size_t size() const { return size_; }
+  std::size_t slot_count() const { return slots_.size(); }
+
+ private:
+  struct Entry {
+    T value;
+    std::uint64_t rounds;
+  };
+
+  std::vector<std::vector<Entry>> slots_;
+  std::vector<Entry> scratch_;
+  std::size_t cursor_ = 0;
+  std::size_t size_ = 0;
+};
+
+#endif  // TIMING_WHEEL_H
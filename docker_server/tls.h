@@ -0,0 +1,187 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <linux/tls.h>
+#endif
+
+// TLS 1.3 поверх неблокирующих сокетов сессий. OpenSSL работает прямо
+// с дескриптором (без BIO-пары Boost.Asio), поэтому после рукопожатия
+// может передать шифрование записи ядру (kTLS): тогда сессия пишет
+// в сокет как в обычный, а sendfile остаётся без копирования.
+// Ожидание готовности сокета — забота вызывающего: операции
+// возвращают kWantRead/kWantWrite вместо блокировки.
+namespace tls {
+
+struct Options {
+  // Цепочка сертификатов и ключ в PEM; пустой cert_path — без TLS
+  std::string cert_path;
+  std::string key_path;
+  bool ktls = true;
+};
+
+enum class Status {
+  kOk,
+  kWantRead,   // повторить, когда сокет станет читаемым
+  kWantWrite,  // повторить, когда сокет станет доступен для записи
+  kClosed,     // собеседник закрыл TLS (close_notify)
+  kError,
+};
+
+// Текст первой ошибки OpenSSL этого потока; очередь ошибок очищается
+inline std::string last_error() {
+  unsigned long code = ERR_get_error();
+  ERR_clear_error();
+  if (code == 0) {
+    return "connection closed";
+  }
+  char text[256];
+  ERR_error_string_n(code, text, sizeof(text));
+  return text;
+}
+
+class Context {
+ public:
+  explicit Context(const Options& options)
+      : ctx_(SSL_CTX_new(TLS_server_method())) {
+    if (!ctx_) {
+      throw std::runtime_error("TLS context: " + last_error());
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_3_VERSION);
+    // Частичная запись нужна неблокирующему сокету; буферы записей
+    // освобождаются между операциями, иначе молчащая сессия держала бы
+    // около 34 КиБ
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                               SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                               SSL_MODE_RELEASE_BUFFERS);
+    // Возобновление только по билетам: состояние сессии хранит клиент,
+    // у сервера нет кэша, растущего с числом соединений
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(ctx_, 1);
+#ifdef SSL_OP_ENABLE_KTLS
+    if (options.ktls) {
+      SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+    if (SSL_CTX_use_certificate_chain_file(ctx_,
+                                           options.cert_path.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx_, options.key_path.c_str(),
+                                    SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx_) != 1) {
+      std::string error = last_error();
+      SSL_CTX_free(ctx_);
+      throw std::runtime_error("TLS certificate " + options.cert_path + ": " +
+                               error);
+    }
+  }
+  ~Context() { SSL_CTX_free(ctx_); }
+  Context(const Context&) = delete;
+  Context& operator=(const Context&) = delete;
+
+  SSL_CTX* native() const { return ctx_; }
+
+ private:
+  SSL_CTX* ctx_;
+};
+
+// Серверная сторона одного соединения
+class Connection {
+ public:
+  Connection(const Context& context, int fd)
+      : ssl_(SSL_new(context.native())), fd_(fd) {
+    SSL_set_fd(ssl_, fd);
+    SSL_set_accept_state(ssl_);
+  }
+  ~Connection() { SSL_free(ssl_); }
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  Status handshake() {
+    ERR_clear_error();
+    int result = SSL_do_handshake(ssl_);
+    if (result != 1) {
+      return status(result);
+    }
+#ifdef BIO_get_ktls_send
+    ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#endif
+#ifdef TLS_TX_ZEROCOPY_RO
+    // Куски хранилища не меняются после записи, поэтому ядру можно
+    // шифровать прямо из page cache без копии
+    if (ktls_send_) {
+      int one = 1;
+      setsockopt(fd_, SOL_TLS, TLS_TX_ZEROCOPY_RO, &one, sizeof(one));
+    }
+#endif
+    return Status::kOk;
+  }
+
+  // При kOk в n — число прочитанных байт
+  Status read(char* data, std::size_t size, std::size_t& n) {
+    ERR_clear_error();
+    n = 0;
+    return SSL_read_ex(ssl_, data, size, &n) == 1 ? Status::kOk
+                                                  : status(0);
+  }
+
+  // При kOk в n — число записанных байт; после kWant* повторяется
+  // с тем же остатком данных
+  Status write(const char* data, std::size_t size, std::size_t& n) {
+    ERR_clear_error();
+    n = 0;
+    return SSL_write_ex(ssl_, data, size, &n) == 1 ? Status::kOk
+                                                   : status(0);
+  }
+
+  // Уведомление о закрытии без ожидания ответа
+  void shutdown() {
+    if (SSL_is_init_finished(ssl_)) {
+      ERR_clear_error();
+      SSL_shutdown(ssl_);
+      ERR_clear_error();
+    }
+  }
+
+  // Данные, уже прочитанные OpenSSL из сокета: готовности сокета
+  // для них не будет
+  bool has_pending() const { return SSL_has_pending(ssl_) == 1; }
+  // Запись шифрует ядро: кадры можно писать прямо в сокет
+  bool ktls_send() const { return ktls_send_; }
+  bool resumed() const { return SSL_session_reused(ssl_) == 1; }
+  const char* version() const { return SSL_get_version(ssl_); }
+  const char* cipher() const { return SSL_get_cipher_name(ssl_); }
+  // Текст ошибки последней операции, вернувшей kError
+  const std::string& error() const { return error_; }
+
+ private:
+  Status status(int result) {
+    switch (SSL_get_error(ssl_, result)) {
+      case SSL_ERROR_WANT_READ:
+        return Status::kWantRead;
+      case SSL_ERROR_WANT_WRITE:
+        return Status::kWantWrite;
+      case SSL_ERROR_ZERO_RETURN:
+        return Status::kClosed;
+      default:
+        error_ = last_error();
+        return Status::kError;
+    }
+  }
+
+  SSL* ssl_;
+  int fd_;
+  bool ktls_send_ = false;
+  std::string error_;
+};
+
+}  // namespace tls
+
+#endif  // TLS_H
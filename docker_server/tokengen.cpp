@@ -0,0 +1,29 @@
+// Выдача токена сессии (server --auth-key) для первого входа клиента;
+// дальше сервер продлевает токен сам в ответе kWelcome
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "session_token.h"
+#include "sha256.h"
+
+int main(int argc, char* argv[]) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: tokengen KEY_FILE USER_ID [TTL_HOURS]" << std::endl;
+    return 1;
+  }
+  try {
+    auth::TokenSigner signer(argv[1]);
+    auth::TokenClaims claims;
+    claims.user = std::stoull(argv[2]);
+    auto ttl = std::chrono::hours(argc == 4 ? std::stoul(argv[3]) : 24 * 7);
+    auto expires = std::chrono::system_clock::now().time_since_epoch() + ttl;
+    claims.expires = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(expires).count());
+    std::cout << to_hex(signer.sign(claims)) << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+#ifndef TRAFFIC_CAPTURE_H
+#define TRAFFIC_CAPTURE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Запись входящего трафика сервера для последующего воспроизведения.
+//
+// Формат файла: заголовок "VCAP", версия (u16), резерв (u16),
+// время начала записи (u64, мкс UNIX-времени), затем записи:
+//   u8 kind, varint delta_us, varint session_id
+//   [для kFrame: varint length, кадр целиком вместе с заголовком]
+// delta_us — время от предыдущей записи, поэтому плотный поток кадров
+// стоит 1-2 байта на метку времени.
+namespace capture {
+
+enum class RecordKind : std::uint8_t {
+  kFrame = 0,   // входящий кадр сессии
+  kOpen = 1,    // сессия подключилась
+  kClose = 2,   // сессия отключилась
+};
+
+struct Record {
+  RecordKind kind = RecordKind::kFrame;
+  std::uint64_t time_us = 0;  // от начала записи
+  std::uint32_t session_id = 0;
+  std::vector<char> frame;
+};
+
+constexpr char kMagic[4] = {'V', 'C', 'A', 'P'};
+constexpr std::uint16_t kVersion = 1;
+constexpr std::size_t kFileHeaderSize = 16;
+
+inline void put_varint(std::vector<char>& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+class TrafficRecorder {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit TrafficRecorder(const std::string& path)
+      : buffer_(new char[kStreamBuffer]), start_(Clock::now()), last_us_(0) {
+    out_.rdbuf()->pubsetbuf(buffer_.get(), kStreamBuffer);
+    out_.open(path, std::ios::binary | std::ios::trunc);
+    if (!out_) {
+      throw std::runtime_error("Cannot open capture file " + path);
+    }
+    char header[kFileHeaderSize] = {};
+    std::memcpy(header, kMagic, sizeof(kMagic));
+    header[4] = static_cast<char>(kVersion & 0xff);
+    header[5] = static_cast<char>(kVersion >> 8);
+    auto wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+    for (int i = 0; i < 8; ++i) {
+      header[8 + i] = static_cast<char>((wall_us >> (8 * i)) & 0xff);
+    }
+    out_.write(header, sizeof(header));
+  }
+
+  ~TrafficRecorder() { out_.flush(); }
+
+  void record_open(std::uint32_t session_id) {
+    begin_record(RecordKind::kOpen, session_id);
+    flush_record();
+  }
+
+  void record_close(std::uint32_t session_id) {
+    begin_record(RecordKind::kClose, session_id);
+    flush_record();
+  }
+
+  void record_frame(std::uint32_t session_id, const char* frame,
+                    std::size_t size) {
+    begin_record(RecordKind::kFrame, session_id);
+    put_varint(scratch_, size);
+    scratch_.insert(scratch_.end(), frame, frame + size);
+    flush_record();
+  }
+
+  // Сбрасывает буфер на диск; сервер зовёт раз в секунду, чтобы
+  // запись не терялась целиком при аварийном завершении
+  void flush() { out_.flush(); }
+
+ private:
+  static constexpr std::size_t kStreamBuffer = 1 << 20;
+
+  void begin_record(RecordKind kind, std::uint32_t session_id) {
+    auto now_us = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                              start_)
+            .count());
+    scratch_.clear();
+    scratch_.push_back(static_cast<char>(kind));
+    put_varint(scratch_, now_us - last_us_);
+    put_varint(scratch_, session_id);
+    last_us_ = now_us;
+  }
+
+  void flush_record() {
+    out_.write(scratch_.data(), static_cast<std::streamsize>(scratch_.size()));
+  }
+
+  std::unique_ptr<char[]> buffer_;
+  std::ofstream out_;
+  Clock::time_point start_;
+  std::uint64_t last_us_;
+  std::vector<char> scratch_;
+};
+
+class TrafficReader {
+ public:
+  explicit TrafficReader(const std::string& path)
+      : in_(path, std::ios::binary) {
+    char header[kFileHeaderSize];
+    if (!in_.read(header, sizeof(header)) ||
+        std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+      throw std::runtime_error("Not a capture file: " + path);
+    }
+    std::uint16_t version = static_cast<std::uint16_t>(
+        static_cast<unsigned char>(header[4]) |
+        static_cast<unsigned char>(header[5]) << 8);
+    if (version != kVersion) {
+      throw std::runtime_error("Unsupported capture version " +
+                               std::to_string(version));
+    }
+  }
+
+  // false — конец файла; обрезанная последняя запись тоже считается концом
+  bool next(Record& record) {
+    int kind = in_.get();
+    if (kind == std::char_traits<char>::eof()) {
+      return false;
+    }
+    std::uint64_t delta = 0;
+    std::uint64_t session_id = 0;
+    if (!get_varint(delta) || !get_varint(session_id)) {
+      return false;
+    }
+    time_us_ += delta;
+    record.kind = static_cast<RecordKind>(kind);
+    record.time_us = time_us_;
+    record.session_id = static_cast<std::uint32_t>(session_id);
+    record.frame.clear();
+    if (record.kind == RecordKind::kFrame) {
+      std::uint64_t length = 0;
+      if (!get_varint(length)) {
+        return false;
+      }
+      record.frame.resize(length);
+      if (!in_.read(record.frame.data(),
+                    static_cast<std::streamsize>(length))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  bool get_varint(std::uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int byte = in_.get();
+      if (byte == std::char_traits<char>::eof()) {
+        return false;
+      }
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::ifstream in_;
+  std::uint64_t time_us_ = 0;
+};
+
+}  // namespace capture
+
+#endif  // TRAFFIC_CAPTURE_H
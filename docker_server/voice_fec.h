@@ -0,0 +1,377 @@
+#ifndef VOICE_FEC_H
+#define VOICE_FEC_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "protocol.h"
+
+// Прямая коррекция потерь голоса: после каждых k кадров одного
+// отправителя идёт кадр kAudioParity с их XOR. Получатель восстанавливает
+// по нему один потерянный кадр группы, остальные потери заметает
+// audio::LossConcealer (loss_concealment.h). Накладные расходы — 1/k,
+// поэтому k подбирается по измеренной доле потерь (FecPolicy).
+
+// Размер группы по доле потерь. Потери читаются сглаженными, а ослабить
+// защиту можно, только когда потерь вдвое меньше порога, — иначе группа
+// прыгала бы на каждой оценке.
+class FecPolicy {
+ public:
+  static constexpr double kSmoothing = 0.3;
+
+  // Кадры голоса и потери из них с прошлого вызова; 0 — без чётности
+  std::uint8_t update(std::uint64_t frames, std::uint64_t lost) {
+    if (frames == 0) {
+      return group_;
+    }
+    loss_ += kSmoothing * (static_cast<double>(lost) / frames - loss_);
+    std::uint8_t stronger = group_for(loss_);
+    std::uint8_t weaker = group_for(loss_ * 2);
+    if (strength(stronger) > strength(group_)) {
+      group_ = stronger;
+    } else if (strength(weaker) < strength(group_)) {
+      group_ = weaker;
+    }
+    return group_;
+  }
+
+  std::uint8_t group() const { return group_; }
+  double loss() const { return loss_; }
+
+  static std::uint8_t group_for(double loss) {
+    if (loss >= 0.10) {
+      return 2;
+    }
+    if (loss >= 0.04) {
+      return 3;
+    }
+    if (loss >= 0.01) {
+      return 5;
+    }
+    return loss >= 0.002 ? 10 : 0;
+  }
+
+ private:
+  static int strength(std::uint8_t group) {
+    return group == 0 ? 0 : 256 - group;
+  }
+
+  double loss_ = 0;
+  std::uint8_t group_ = 0;
+};
+
+// Копит XOR кадров группы. Группа — подряд идущие номера одного
+// отправителя; разрыв в номерах начинает её заново.
+class ParityEncoder {
+ public:
+  // Новый размер действует со следующей группы; 0 — без чётности
+  void set_group(std::uint8_t group) { group_ = group; }
+  std::uint8_t group() const { return group_; }
+
+  // frame — кадр kAudio целиком; true — группа закрыта, а в parity
+  // готовый кадр kAudioParity
+  bool add(const char* frame, std::vector<char>& parity) {
+    auto header = protocol::decode_header(frame);
+    if (count_ > 0 && (header.sequence != next_sequence_ ||
+                       header.stream != stream_)) {
+      count_ = 0;
+    }
+    if (header.length + protocol::kParityHeaderSize >
+        protocol::kMaxPayloadSize) {
+      count_ = 0;
+      return false;
+    }
+    if (count_ == 0) {
+      if (group_ == 0) {
+        return false;
+      }
+      size_ = group_;
+      first_sequence_ = header.sequence;
+      stream_ = header.stream;
+      info_ = protocol::ParityHeader();
+      data_.clear();
+    }
+    if (data_.size() < header.length) {
+      data_.resize(header.length, 0);
+    }
+    const char* payload = frame + protocol::kHeaderSize;
+    for (std::uint32_t i = 0; i < header.length; ++i) {
+      data_[i] ^= payload[i];
+    }
+    info_.flags_xor ^= header.flags;
+    info_.length_xor ^= header.length;
+    info_.timestamp_xor ^= header.timestamp;
+    next_sequence_ = header.sequence + 1;
+    if (++count_ < size_) {
+      return false;
+    }
+    info_.count = count_;
+    count_ = 0;
+    protocol::FrameHeader parity_header;
+    parity_header.type = protocol::MessageType::kAudioParity;
+    parity_header.stream = stream_;
+    parity_header.sequence = first_sequence_;
+    parity_header.length =
+        static_cast<std::uint32_t>(protocol::kParityHeaderSize + data_.size());
+    parity = FramePool::acquire(protocol::kHeaderSize + parity_header.length);
+    protocol::encode_header(parity_header, parity.data());
+    protocol::encode_parity_header(info_,
+                                   parity.data() + protocol::kHeaderSize);
+    std::copy(data_.begin(), data_.end(),
+              parity.begin() + protocol::kHeaderSize +
+                  protocol::kParityHeaderSize);
+    return true;
+  }
+
+ private:
+  std::uint8_t group_ = 0;
+  std::uint8_t size_ = 0;
+  std::uint8_t count_ = 0;
+  std::uint16_t stream_ = 0;
+  std::uint32_t first_sequence_ = 0;
+  std::uint32_t next_sequence_ = 0;
+  protocol::ParityHeader info_;
+  std::vector<char> data_;
+};
+
+// Кадр голоса в порядке номеров: принятый, восстановленный по чётности
+// или потерянный (тогда известен только номер)
+struct ReceivedVoice {
+  enum class Kind : std::uint8_t { kReceived, kRecovered, kLost };
+
+  Kind kind = Kind::kReceived;
+  protocol::FrameHeader header;
+  std::vector<char> payload;
+};
+
+// Голос одного отправителя на стороне получателя: восстанавливает кадры
+// по чётности и отдаёт их по порядку. Пропущенный кадр ждёт, пока
+// не придёт чётность его группы (она идёт сразу за последним кадром
+// группы), а без чётности объявляется потерянным, как только пришло
+// reorder кадров после него. Отданные кадры хранятся в окне, пока
+// нужны для восстановления соседей.
+class FecReceiver {
+ public:
+  static constexpr std::uint32_t kWindow = 32;
+  static constexpr std::size_t kMaxParities = 8;
+
+  // reorder — сколько более поздних кадров ждём опоздавший; для TCP 0
+  explicit FecReceiver(std::uint32_t reorder = 0) : reorder_(reorder) {}
+
+  void on_audio(const protocol::FrameHeader& header, const char* payload) {
+    std::uint32_t sequence = header.sequence;
+    std::uint32_t gap = before(sequence, next_) ? distance(sequence, next_)
+                                                : distance(next_, sequence);
+    if (!started_ || gap >= kWindow) {
+      // Первый кадр или долгий разрыв: это пауза или новый отправитель
+      // с тем же номером, а не потери
+      started_ = true;
+      next_ = end_ = sequence;
+      parities_.clear();
+      for (Slot& slot : slots_) {
+        slot.present = false;
+      }
+    } else if (before(sequence, next_)) {
+      ++late_;
+      return;
+    }
+    Slot& slot = slots_[sequence % kWindow];
+    if (slot.present && slot.header.sequence == sequence) {
+      return;
+    }
+    slot.present = true;
+    slot.recovered = false;
+    slot.header = header;
+    slot.payload.assign(payload, payload + header.length);
+    if (!before(sequence, end_)) {
+      end_ = sequence + 1;
+    }
+    ++received_;
+    for (const Parity& parity : parities_) {
+      recover(parity);
+    }
+  }
+
+  void on_parity(const protocol::FrameHeader& header, const char* payload) {
+    Parity parity;
+    if (!started_ ||
+        !protocol::decode_parity_header(payload, header.length, parity.info)) {
+      return;
+    }
+    parity.first = header.sequence;
+    parity.stream = header.stream;
+    parity.data.assign(payload + protocol::kParityHeaderSize,
+                       payload + header.length);
+    std::uint32_t last = parity.first + parity.info.count - 1;
+    if (before(last, next_) || distance(next_, last) >= kWindow) {
+      return;
+    }
+    group_hint_ = parity.info.count;
+    parity_end_ = last + 1;
+    has_parity_ = true;
+    ++parities_received_;
+    recover(parity);
+    parities_.push_back(std::move(parity));
+    if (parities_.size() > kMaxParities) {
+      parities_.pop_front();
+    }
+  }
+
+  // Следующий кадр по порядку; false — кадров нет или ждём
+  bool pop(ReceivedVoice& out) {
+    if (!started_ || !before(next_, end_)) {
+      return false;
+    }
+    const Slot& slot = slots_[next_ % kWindow];
+    if (slot.present && slot.header.sequence == next_) {
+      out.kind = slot.recovered ? ReceivedVoice::Kind::kRecovered
+                                : ReceivedVoice::Kind::kReceived;
+      out.header = slot.header;
+      out.payload = slot.payload;
+    } else if (given_up(next_)) {
+      out.kind = ReceivedVoice::Kind::kLost;
+      out.header = protocol::FrameHeader();
+      out.header.sequence = next_;
+      out.payload.clear();
+      ++lost_;
+    } else {
+      return false;
+    }
+    ++next_;
+    while (!parities_.empty() &&
+           before(parities_.front().first + parities_.front().info.count - 1,
+                  next_)) {
+      parities_.pop_front();
+    }
+    return true;
+  }
+
+  std::uint64_t received() const { return received_; }
+  std::uint64_t recovered() const { return recovered_; }
+  std::uint64_t lost() const { return lost_; }
+  std::uint64_t late() const { return late_; }
+  std::uint64_t parities() const { return parities_received_; }
+
+ private:
+  struct Slot {
+    bool present = false;
+    bool recovered = false;
+    protocol::FrameHeader header;
+    std::vector<char> payload;
+  };
+
+  struct Parity {
+    std::uint32_t first = 0;
+    std::uint16_t stream = 0;
+    protocol::ParityHeader info;
+    std::vector<char> data;
+  };
+
+  static std::uint32_t distance(std::uint32_t from, std::uint32_t to) {
+    return to - from;
+  }
+  static bool before(std::uint32_t a, std::uint32_t b) {
+    return static_cast<std::int32_t>(a - b) < 0;
+  }
+
+  bool has(std::uint32_t sequence) const {
+    const Slot& slot = slots_[sequence % kWindow];
+    return slot.present && slot.header.sequence == sequence;
+  }
+
+  // Ждать дальше бессмысленно: чётность группы пришла и не помогла,
+  // или её уже не будет
+  bool given_up(std::uint32_t sequence) const {
+    std::uint32_t after = distance(sequence, end_) - 1;
+    if (after < reorder_) {
+      return false;
+    }
+    bool protected_stream =
+        has_parity_ && distance(parity_end_, end_) <= 2u * group_hint_ + 1;
+    if (!protected_stream) {
+      return true;
+    }
+    for (const Parity& parity : parities_) {
+      if (distance(parity.first, sequence) < parity.info.count) {
+        return true;
+      }
+    }
+    return after >= reorder_ + group_hint_;
+  }
+
+  // Восстанавливает кадр группы, если из неё пропал ровно один
+  void recover(const Parity& parity) {
+    std::uint32_t missing = 0;
+    std::uint8_t missing_count = 0;
+    for (std::uint8_t i = 0; i < parity.info.count; ++i) {
+      if (!has(parity.first + i)) {
+        missing = parity.first + i;
+        ++missing_count;
+      }
+    }
+    if (missing_count != 1 || before(missing, next_) ||
+        distance(next_, missing) >= kWindow) {
+      return;
+    }
+    protocol::FrameHeader header;
+    header.type = protocol::MessageType::kAudio;
+    header.stream = parity.stream;
+    header.sequence = missing;
+    header.flags = parity.info.flags_xor;
+    header.length = parity.info.length_xor;
+    header.timestamp = parity.info.timestamp_xor;
+    for (std::uint8_t i = 0; i < parity.info.count; ++i) {
+      if (parity.first + i != missing) {
+        const Slot& slot = slots_[(parity.first + i) % kWindow];
+        header.flags ^= slot.header.flags;
+        header.length ^= slot.header.length;
+        header.timestamp ^= slot.header.timestamp;
+      }
+    }
+    if (header.length > parity.data.size()) {
+      return;
+    }
+    Slot& slot = slots_[missing % kWindow];
+    slot.payload.assign(parity.data.begin(),
+                        parity.data.begin() + header.length);
+    for (std::uint8_t i = 0; i < parity.info.count; ++i) {
+      if (parity.first + i != missing) {
+        const Slot& other = slots_[(parity.first + i) % kWindow];
+        std::size_t length =
+            std::min<std::size_t>(other.payload.size(), header.length);
+        for (std::size_t j = 0; j < length; ++j) {
+          slot.payload[j] ^= other.payload[j];
+        }
+      }
+    }
+    slot.present = true;
+    slot.recovered = true;
+    slot.header = header;
+    if (!before(missing, end_)) {
+      end_ = missing + 1;
+    }
+    ++recovered_;
+  }
+
+  std::uint32_t reorder_;
+  bool started_ = false;
+  // Следующий кадр к выдаче и номер за последним известным кадром
+  std::uint32_t next_ = 0;
+  std::uint32_t end_ = 0;
+  Slot slots_[kWindow];
+  std::deque<Parity> parities_;
+  bool has_parity_ = false;
+  std::uint8_t group_hint_ = 0;
+  std::uint32_t parity_end_ = 0;
+  std::uint64_t received_ = 0;
+  std::uint64_t recovered_ = 0;
+  std::uint64_t lost_ = 0;
+  std::uint64_t late_ = 0;
+  std::uint64_t parities_received_ = 0;
+};
+
+#endif  // VOICE_FEC_H
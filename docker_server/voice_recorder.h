@@ -0,0 +1,538 @@
+#ifndef VOICE_RECORDER_H
+#define VOICE_RECORDER_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "logger.h"
+#include "protocol.h"
+#include "stream_scheduler.h"
+
+// Запись голоса для модерации. Канал — голос одной сессии в том
+// формате, в котором его прислал клиент.
+//
+// io-поток только кладёт кадр в кольцо (SPSC, без блокировок,
+// выделения памяти и системных вызовов); если кольцо полно, кадр
+// теряется и учитывается. Фоновый поток раскладывает кадры по каналам,
+// копит PCM в выровненных буферах и пишет их целиком, так что на диск
+// уходят большие записи кратно 4 КиБ, а не кадр за кадром.
+//
+// Файлы: <dir>/ch<канал>-<UTC начала>-<n>.wav. Сегмент закрывается
+// по длине, при смене формата и после долгого перерыва; короткие
+// перерывы заполняются тишиной по меткам времени кадров. Пока сегмент
+// пишется, он называется .wav.part, и размеры в заголовке WAV
+// обновляются после каждой записи: после сбоя файл читается до
+// последней записи, а recover() при старте доводит такие файлы.
+namespace recording {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string dir;
+  // Длина сегмента в секундах
+  unsigned segment_seconds = 300;
+};
+
+constexpr std::size_t kWavHeaderSize = 44;
+constexpr char kPartSuffix[] = ".part";
+
+inline void patch_wav_sizes(char* header, std::uint32_t data_bytes) {
+  protocol::put_u32(header + 4, 36 + data_bytes);
+  protocol::put_u32(header + 40, data_bytes);
+}
+
+// Моно; float32 — WAVE_FORMAT_IEEE_FLOAT
+inline void make_wav_header(char* out, const protocol::AudioFormat& format,
+                            std::uint32_t data_bytes) {
+  auto width = static_cast<std::uint16_t>(
+      protocol::bytes_per_sample(format.sample_format));
+  bool is_float = format.sample_format == protocol::SampleFormat::kFloat32;
+  std::memcpy(out, "RIFF", 4);
+  std::memcpy(out + 8, "WAVEfmt ", 8);
+  protocol::put_u32(out + 16, 16);
+  protocol::put_u16(out + 20, is_float ? 3 : 1);
+  protocol::put_u16(out + 22, 1);
+  protocol::put_u32(out + 24, format.sample_rate);
+  protocol::put_u32(out + 28, format.sample_rate * width);
+  protocol::put_u16(out + 32, width);
+  protocol::put_u16(out + 34, static_cast<std::uint16_t>(width * 8));
+  std::memcpy(out + 36, "data", 4);
+  patch_wav_sizes(out, data_bytes);
+}
+
+// Кадр для записи; frame == nullptr — канал закрыт
+struct Tap {
+  std::uint32_t channel = 0;
+  SharedFrame frame;
+};
+
+// Кольцо одного писателя (io-поток) и одного читателя (поток записи)
+class TapRing {
+ public:
+  static constexpr std::size_t kCapacity = 8192;
+
+  TapRing() : slots_(new Tap[kCapacity]) {}
+
+  bool push(std::uint32_t channel, SharedFrame frame) {
+    std::uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+      return false;
+    }
+    Tap& slot = slots_[head % kCapacity];
+    slot.channel = channel;
+    slot.frame = std::move(frame);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consume забирает кадр из ячейки
+  template <typename F>
+  std::size_t drain(F&& consume) {
+    std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+    std::uint64_t head = head_.load(std::memory_order_acquire);
+    for (std::uint64_t i = tail; i != head; ++i) {
+      Tap& slot = slots_[i % kCapacity];
+      consume(slot);
+      slot.frame.reset();
+    }
+    tail_.store(head, std::memory_order_release);
+    return static_cast<std::size_t>(head - tail);
+  }
+
+ private:
+  alignas(64) std::atomic<std::uint64_t> head_{0};
+  alignas(64) std::atomic<std::uint64_t> tail_{0};
+  std::unique_ptr<Tap[]> slots_;
+};
+
+// Один файл WAV. Байты копятся в буфере, выровненном по странице,
+// и уходят на диск целыми блоками.
+class WavSegment {
+ public:
+  static constexpr std::size_t kBufferSize = 64 * 1024;
+  static constexpr std::size_t kBlockSize = 4096;
+
+  // nullptr — файл не создать
+  static std::unique_ptr<WavSegment> create(
+      const std::string& path, const protocol::AudioFormat& format) {
+    std::string part = path + kPartSuffix;
+    int fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+      return nullptr;
+    }
+    return std::unique_ptr<WavSegment>(new WavSegment(fd, path, format));
+  }
+
+  ~WavSegment() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  WavSegment(const WavSegment&) = delete;
+  WavSegment& operator=(const WavSegment&) = delete;
+
+  const protocol::AudioFormat& format() const { return format_; }
+  std::uint64_t data_bytes() const { return data_bytes_; }
+  double seconds() const {
+    return static_cast<double>(data_bytes_) /
+           (format_.sample_rate *
+            protocol::bytes_per_sample(format_.sample_format));
+  }
+  Clock::time_point last_write() const { return last_write_; }
+
+  // data == nullptr — тишина
+  bool append(const char* data, std::size_t size) {
+    while (size > 0) {
+      std::size_t room = std::min(size, kBufferSize - used_);
+      if (data) {
+        std::memcpy(buffer_.get() + used_, data, room);
+        data += room;
+      } else {
+        std::memset(buffer_.get() + used_, 0, room);
+      }
+      used_ += room;
+      data_bytes_ += room;
+      size -= room;
+      if (used_ == kBufferSize && !write_blocks(used_)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Пишет всё накопленное целыми блоками; остаток ждёт следующей записи
+  bool flush() { return write_blocks(used_ / kBlockSize * kBlockSize); }
+
+  // Дописывает хвост, обновляет заголовок, сбрасывает данные на диск
+  // и снимает .part
+  bool finish() {
+    bool ok = write_blocks(used_) && ::fdatasync(fd_) == 0;
+    ::close(fd_);
+    fd_ = -1;
+    std::string part = path_ + kPartSuffix;
+    return ok && std::rename(part.c_str(), path_.c_str()) == 0;
+  }
+
+  // Самая долгая запись с прошлого вызова, мкс
+  std::uint64_t take_max_write_us() {
+    return std::exchange(max_write_us_, 0);
+  }
+
+ private:
+  struct FreeDeleter {
+    void operator()(char* p) const { std::free(p); }
+  };
+
+  WavSegment(int fd, std::string path, const protocol::AudioFormat& format)
+      : fd_(fd),
+        path_(std::move(path)),
+        format_(format),
+        buffer_(static_cast<char*>(std::aligned_alloc(kBlockSize,
+                                                      kBufferSize))),
+        last_write_(Clock::now()) {
+    make_wav_header(buffer_.get(), format_, 0);
+    used_ = kWavHeaderSize;
+  }
+
+  bool write_blocks(std::size_t size) {
+    auto started = Clock::now();
+    last_write_ = started;
+    if (size == 0) {
+      return true;
+    }
+    for (std::size_t written = 0; written < size;) {
+      ssize_t n = ::write(fd_, buffer_.get() + written, size - written);
+      if (n < 0) {
+        return false;
+      }
+      written += static_cast<std::size_t>(n);
+    }
+    std::memmove(buffer_.get(), buffer_.get() + size, used_ - size);
+    used_ -= size;
+    file_bytes_ += size;
+    // Заголовок описывает то, что уже в файле
+    char sizes[kWavHeaderSize];
+    std::uint64_t on_disk = file_bytes_ - kWavHeaderSize;
+    patch_wav_sizes(sizes, static_cast<std::uint32_t>(
+                               std::min<std::uint64_t>(on_disk, 0xffffffd0)));
+    if (::pwrite(fd_, sizes + 4, 4, 4) != 4 ||
+        ::pwrite(fd_, sizes + 40, 4, 40) != 4) {
+      return false;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                  Clock::now() - started)
+                  .count();
+    max_write_us_ = std::max(max_write_us_, static_cast<std::uint64_t>(us));
+    return true;
+  }
+
+  int fd_;
+  std::string path_;
+  protocol::AudioFormat format_;
+  std::unique_ptr<char, FreeDeleter> buffer_;
+  std::size_t used_ = 0;
+  std::uint64_t file_bytes_ = 0;
+  std::uint64_t data_bytes_ = 0;
+  Clock::time_point last_write_;
+  std::uint64_t max_write_us_ = 0;
+};
+
+// Доводит .wav.part, оставшиеся после сбоя: хвост обрезается до целого
+// сэмпла, размеры в заголовке берутся по длине файла. Возвращает
+// число восстановленных файлов.
+inline std::size_t recover(const std::string& dir) {
+  DIR* handle = opendir(dir.c_str());
+  if (!handle) {
+    return 0;
+  }
+  std::vector<std::string> parts;
+  const std::size_t suffix = std::strlen(kPartSuffix);
+  while (dirent* entry = readdir(handle)) {
+    std::string name = entry->d_name;
+    if (name.size() > suffix &&
+        name.compare(name.size() - suffix, suffix, kPartSuffix) == 0) {
+      parts.push_back(dir + "/" + name);
+    }
+  }
+  closedir(handle);
+  std::size_t recovered = 0;
+  for (const auto& part : parts) {
+    int fd = ::open(part.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    char header[kWavHeaderSize];
+    struct stat info {};
+    if (::fstat(fd, &info) != 0 ||
+        ::pread(fd, header, sizeof(header), 0) !=
+            static_cast<ssize_t>(sizeof(header)) ||
+        std::memcmp(header, "RIFF", 4) != 0) {
+      ::close(fd);
+      std::remove(part.c_str());
+      continue;
+    }
+    std::uint64_t align =
+        std::max<std::uint16_t>(protocol::get_u16(header + 32), 1);
+    std::uint64_t data = (static_cast<std::uint64_t>(info.st_size) -
+                          kWavHeaderSize) / align * align;
+    data = std::min<std::uint64_t>(data, 0xffffffd0);
+    patch_wav_sizes(header, static_cast<std::uint32_t>(data));
+    bool ok = ::ftruncate(fd, static_cast<off_t>(kWavHeaderSize + data)) ==
+                  0 &&
+              ::pwrite(fd, header, sizeof(header), 0) ==
+                  static_cast<ssize_t>(sizeof(header)) &&
+              ::fdatasync(fd) == 0;
+    ::close(fd);
+    std::string path = part.substr(0, part.size() - suffix);
+    if (ok && std::rename(part.c_str(), path.c_str()) == 0) {
+      ++recovered;
+    }
+  }
+  return recovered;
+}
+
+// Счётчики для отчёта сервера; пишет поток записи
+struct RecorderStats {
+  std::atomic<std::uint64_t> frames{0};
+  std::atomic<std::uint64_t> bytes{0};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<std::uint64_t> segments{0};
+  std::atomic<std::uint64_t> errors{0};
+  std::atomic<std::uint64_t> channels{0};
+  std::atomic<std::uint64_t> max_write_us{0};
+};
+
+class Recorder {
+ public:
+  // Перерыв, который заполняется тишиной; дольше — новый сегмент
+  static constexpr std::int64_t kMaxFillMs = 2000;
+  // Канал без кадров столько времени закрывается и без close()
+  static constexpr std::chrono::seconds kIdleClose{10};
+  // Неполный буфер уходит на диск не реже этого
+  static constexpr std::chrono::seconds kFlushInterval{1};
+  static constexpr std::chrono::milliseconds kIdleSleep{10};
+
+  explicit Recorder(Options options) : options_(std::move(options)) {
+    mkdir(options_.dir.c_str(), 0755);
+    recovered_ = recover(options_.dir);
+    writer_ = std::thread([this]() { run(); });
+  }
+
+  // Дописывает всё, что уже в кольце, и закрывает сегменты
+  ~Recorder() {
+    stop_.store(true, std::memory_order_release);
+    writer_.join();
+  }
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  // Только из io-потока
+  void tap(std::uint32_t channel, SharedFrame frame) {
+    if (!ring_.push(channel, std::move(frame))) {
+      stats_.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  // Потерянное закрытие доделает kIdleClose
+  void close(std::uint32_t channel) { ring_.push(channel, nullptr); }
+
+  std::size_t recovered() const { return recovered_; }
+  RecorderStats& stats() { return stats_; }
+
+ private:
+  struct Channel {
+    std::unique_ptr<WavSegment> segment;
+    unsigned segments = 0;
+    // Метка времени, с которой должен начаться следующий кадр
+    std::uint32_t next_timestamp = 0;
+    Clock::time_point last_frame;
+  };
+
+  // Без уведомлений от io-потока, как у журнала: поток записи сам
+  // опрашивает кольцо
+  void run() {
+    Clock::time_point maintained = Clock::now();
+    while (!stop_.load(std::memory_order_acquire)) {
+      std::size_t taken = ring_.drain([this](Tap& tap) { consume(tap); });
+      Clock::time_point now = Clock::now();
+      if (now - maintained >= kIdleSleep * 10) {
+        maintain(now);
+        maintained = now;
+      }
+      if (taken == 0) {
+        std::this_thread::sleep_for(kIdleSleep);
+      }
+    }
+    ring_.drain([this](Tap& tap) { consume(tap); });
+    for (auto& entry : channels_) {
+      finish(entry.second);
+    }
+    channels_.clear();
+    stats_.channels.store(0, std::memory_order_relaxed);
+  }
+
+  void consume(Tap& tap) {
+    if (!tap.frame) {
+      auto it = channels_.find(tap.channel);
+      if (it != channels_.end()) {
+        finish(it->second);
+        channels_.erase(it);
+        stats_.channels.store(channels_.size(), std::memory_order_relaxed);
+      }
+      return;
+    }
+    const std::vector<char>& frame = *tap.frame;
+    auto header = protocol::decode_header(frame.data());
+    auto format = protocol::audio_format_from_flags(header.flags);
+    std::size_t width = protocol::bytes_per_sample(format.sample_format);
+    if (!protocol::is_valid_audio_format(format) || header.length == 0 ||
+        header.length % width != 0 ||
+        protocol::kHeaderSize + header.length > frame.size()) {
+      return;
+    }
+    Channel& channel = channels_[tap.channel];
+    stats_.channels.store(channels_.size(), std::memory_order_relaxed);
+    channel.last_frame = Clock::now();
+    if (channel.segment) {
+      auto gap = static_cast<std::int32_t>(header.timestamp -
+                                           channel.next_timestamp);
+      if (protocol::audio_flags(channel.segment->format()) != header.flags ||
+          channel.segment->seconds() >= options_.segment_seconds ||
+          gap > kMaxFillMs || gap < -kMaxFillMs) {
+        finish(channel);
+      } else if (gap > 0) {
+        std::size_t silence = static_cast<std::size_t>(gap) *
+                              format.sample_rate / 1000 * width;
+        write(channel, nullptr, silence);
+      }
+    }
+    if (!channel.segment && !open(tap.channel, channel, format)) {
+      return;
+    }
+    if (write(channel, frame.data() + protocol::kHeaderSize,
+              header.length)) {
+      stats_.frames.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::size_t samples = header.length / width;
+    channel.next_timestamp =
+        header.timestamp +
+        static_cast<std::uint32_t>(samples * 1000 / format.sample_rate);
+  }
+
+  bool open(std::uint32_t id, Channel& channel,
+            const protocol::AudioFormat& format) {
+    std::time_t now = std::time(nullptr);
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char started[32];
+    std::strftime(started, sizeof(started), "%Y%m%dT%H%M%SZ", &utc);
+    std::string path = options_.dir + "/ch" + std::to_string(id) + "-" +
+                       started + "-" + std::to_string(channel.segments) +
+                       ".wav";
+    channel.segment = WavSegment::create(path, format);
+    if (!channel.segment) {
+      stats_.errors.fetch_add(1, std::memory_order_relaxed);
+      LOG_RATE_LIMITED(::logger::Level::kWarning, 5000,
+                       "Recording: cannot create {}", path);
+      return false;
+    }
+    ++channel.segments;
+    return true;
+  }
+
+  bool write(Channel& channel, const char* data, std::size_t size) {
+    if (!channel.segment->append(data, size)) {
+      fail(channel);
+      return false;
+    }
+    note_write_time(*channel.segment);
+    stats_.bytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+  }
+
+  void finish(Channel& channel) {
+    if (!channel.segment) {
+      return;
+    }
+    bool finished = channel.segment->finish();
+    note_write_time(*channel.segment);
+    if (finished) {
+      stats_.segments.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      stats_.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    channel.segment.reset();
+  }
+
+  // Ошибка записи: сегмент остаётся .part до recover(), следующий кадр
+  // начнёт новый
+  void fail(Channel& channel) {
+    stats_.errors.fetch_add(1, std::memory_order_relaxed);
+    LOG_RATE_LIMITED(::logger::Level::kWarning, 5000,
+                     "Recording: write failed: {}", std::strerror(errno));
+    channel.segment.reset();
+  }
+
+  // Отчёт сервера обнуляет максимум, поэтому сравнение и запись
+  // не атомарны вместе: в худшем случае теряется одно значение
+  void note_write_time(WavSegment& segment) {
+    std::uint64_t us = segment.take_max_write_us();
+    if (us > stats_.max_write_us.load(std::memory_order_relaxed)) {
+      stats_.max_write_us.store(us, std::memory_order_relaxed);
+    }
+  }
+
+  void maintain(Clock::time_point now) {
+    for (auto it = channels_.begin(); it != channels_.end();) {
+      Channel& channel = it->second;
+      if (now - channel.last_frame >= kIdleClose) {
+        finish(channel);
+        it = channels_.erase(it);
+        continue;
+      }
+      if (channel.segment &&
+          now - channel.segment->last_write() >= kFlushInterval) {
+        if (!channel.segment->flush()) {
+          fail(channel);
+        } else {
+          note_write_time(*channel.segment);
+        }
+      }
+      ++it;
+    }
+    stats_.channels.store(channels_.size(), std::memory_order_relaxed);
+  }
+
+  Options options_;
+  TapRing ring_;
+  std::atomic<bool> stop_{false};
+  std::size_t recovered_ = 0;
+  RecorderStats stats_;
+  // Только в потоке записи
+  std::unordered_map<std::uint32_t, Channel> channels_;
+  std::thread writer_;
+};
+
+}  // namespace recording
+
+#endif  // VOICE_RECORDER_H
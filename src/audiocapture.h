@@ -1,12 +1,40 @@
+#ifndef AUDIOCAPTURE_H
+#define AUDIOCAPTURE_H
+
 #include <portaudio.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <utility>
 #include <vector>
 
+#include "../docker_server/audio_pipeline.h"
+#include "../docker_server/protocol.h"
+
+// Захват с устройства и нарезка на пакеты. Буфер устройства сразу
+// проходит цикл из audio_pipeline.h, выбранный под формат устройства:
+// в пакет попадает моно float с усилением, а детектор речи получает
+// энергию буфера без отдельного прохода.
 class AudioCapture {
  public:
-  AudioCapture() : stream_(nullptr) { Pa_Initialize(); }
+  static constexpr int kDefaultSampleRate = 44100;
+  static constexpr unsigned long kFramesPerBuffer = 256;
+  static constexpr std::uint16_t kMaxPacketMs = protocol::kMaxPacketMs;
+
+  // Пакет моно-сэмплов; voiced — в нём была речь по детектору
+  using PacketHandler =
+      std::function<void(const std::vector<float>& packet, bool voiced)>;
+
+  explicit AudioCapture(int sample_rate = kDefaultSampleRate)
+      : stream_(nullptr),
+        sample_rate_(sample_rate),
+        packet_ms_(protocol::kDefaultPacketMs),
+        packet_frames_(frames_for_ms(protocol::kDefaultPacketMs)) {
+    Pa_Initialize();
+  }
 
   ~AudioCapture() {
     if (stream_) {
@@ -15,16 +43,26 @@ class AudioCapture {
     Pa_Terminate();
   }
 
-  void start_capture(std::function<void(const std::vector<float>&)> callback) {
-    data_callback_ = callback;
+  // Колбэк получает ровно столько сэмплов, сколько помещается
+  // в один интервал пакетизации, независимо от буфера устройства
+  void start_capture(PacketHandler callback) {
+    data_callback_ = std::move(callback);
+    packet_frames_ = frames_for_ms(packet_ms_);
+    packet_.clear();
+    packet_.reserve(frames_for_ms(kMaxPacketMs) + kFramesPerBuffer);
+    block_.resize(kFramesPerBuffer);
+    capture_block_ = audio::select_capture(format_, kFramesPerBuffer);
+    vad_ = audio::VoiceActivity();
+    packet_voiced_ = false;
 
     Pa_OpenDefaultStream(&stream_,
-                         1,          // 1 input channel
-                         0,          // 0 output channels
-                         paFloat32,  // 32 bit floating point output
-                         44100,      // Sample rate
-                         256,        // Frames per buffer
-                         audio_callback, this);
+                         format_.channels,  // входные каналы
+                         0,                 // без выхода
+                         format_.sample == audio::DeviceSample::kInt16
+                             ? paInt16
+                             : paFloat32,
+                         sample_rate_, kFramesPerBuffer, audio_callback,
+                         this);
 
     Pa_StartStream(stream_);
   }
@@ -32,23 +70,102 @@ class AudioCapture {
   void stop_capture() {
     if (stream_) {
       Pa_StopStream(stream_);
+      Pa_CloseStream(stream_);
+      stream_ = nullptr;
     }
   }
 
+  // Частота устройства, применяется при следующем start_capture
+  void set_sample_rate(int sample_rate) { sample_rate_ = sample_rate; }
+  int sample_rate() const { return sample_rate_; }
+
+  // Формат устройства, применяется при следующем start_capture
+  void set_device_format(const audio::DeviceFormat& format) {
+    format_ = format;
+  }
+  const audio::DeviceFormat& device_format() const { return format_; }
+
+  // Усиление в разах; можно менять во время захвата
+  void set_gain(float gain) { gain_ = gain; }
+
+  // Можно вызывать во время захвата: новый размер применяется
+  // со следующего пакета
+  void set_packet_ms(std::uint16_t packet_ms) {
+    if (packet_ms > kMaxPacketMs) {
+      packet_ms = kMaxPacketMs;
+    }
+    packet_ms_ = packet_ms;
+    packet_frames_ = frames_for_ms(packet_ms);
+  }
+
+  std::uint16_t packet_ms() const { return packet_ms_; }
+
  private:
+  std::size_t frames_for_ms(std::uint16_t ms) const {
+    return static_cast<std::size_t>(sample_rate_) * ms / 1000;
+  }
+
   static int audio_callback(const void* input, void* output,
                             unsigned long frameCount,
                             const PaStreamCallbackTimeInfo* timeInfo,
                             PaStreamCallbackFlags statusFlags, void* userData) {
-    auto* capture = static_cast<AudioCapture*>(userData);
-    const float* inputBuffer = static_cast<const float*>(input);
+    static_cast<AudioCapture*>(userData)->process(input, frameCount);
+    return paContinue;
+  }
 
-    std::vector<float> audioData(inputBuffer, inputBuffer + frameCount);
-    capture->data_callback_(audioData);
+  // PortAudio обычно отдаёт ровно kFramesPerBuffer; другой длине
+  // достаётся общий цикл кусками размером с block_
+  void process(const void* input, unsigned long frameCount) {
+    const char* in = static_cast<const char*>(input);
+    const std::size_t frame_bytes =
+        audio::bytes_per_sample(format_.sample) * format_.channels;
+    const float gain = gain_;
+    while (frameCount > 0) {
+      std::size_t frames =
+          std::min<std::size_t>(frameCount, block_.size());
+      audio::CaptureBlock block = frames == kFramesPerBuffer
+                                      ? capture_block_
+                                      : &audio::pipeline::capture_generic;
+      float energy = block(format_, in, block_.data(), frames, gain);
+      bool voiced = vad_.update(energy, frames, sample_rate_);
+      aggregate(block_.data(), frames, voiced);
+      in += frames * frame_bytes;
+      frameCount -= frames;
+    }
+  }
 
-    return paContinue;
+  void aggregate(const float* input, std::size_t frameCount, bool voiced) {
+    const std::size_t packet_frames = packet_frames_;
+    while (frameCount > 0) {
+      std::size_t room =
+          packet_.size() < packet_frames ? packet_frames - packet_.size() : 0;
+      std::size_t take = std::min<std::size_t>(room, frameCount);
+      packet_.insert(packet_.end(), input, input + take);
+      packet_voiced_ = packet_voiced_ || voiced;
+      input += take;
+      frameCount -= take;
+      // Остаток буфера устройства уходит в следующий пакет
+      if (packet_.size() >= packet_frames) {
+        data_callback_(packet_, packet_voiced_);
+        packet_.clear();
+        packet_voiced_ = false;
+      }
+    }
   }
 
   PaStream* stream_;
-  std::function<void(const std::vector<float>&)> data_callback_;
+  PacketHandler data_callback_;
+  audio::DeviceFormat format_;
+  std::atomic<float> gain_{1.0f};
+  std::atomic<int> sample_rate_;
+  std::atomic<std::uint16_t> packet_ms_;
+  std::atomic<std::size_t> packet_frames_;
+  std::vector<float> packet_;
+  // Состояние потока PortAudio
+  audio::CaptureBlock capture_block_ = &audio::pipeline::capture_generic;
+  std::vector<float> block_;
+  audio::VoiceActivity vad_;
+  bool packet_voiced_ = false;
 };
+
+#endif  // AUDIOCAPTURE_H
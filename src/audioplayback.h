@@ -0,0 +1,372 @@
+#ifndef AUDIOPLAYBACK_H
+#define AUDIOPLAYBACK_H
+
+#include <portaudio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "../docker_server/audio_pipeline.h"
+#include "../docker_server/loss_concealment.h"
+#include "../docker_server/protocol.h"
+
+// Проигрывание голоса участников с буфером воспроизведения. У каждого
+// отправителя своя ячейка: кольцо сэмплов на частоте устройства и кольцо
+// отрезков (принятый кадр или потерянный), оба одного писателя (io-поток)
+// и одного читателя (колбэк PortAudio), без блокировок. Память под них
+// выделяется в start, колбэк ничего не выделяет и не освобождает.
+//
+// Отправитель начинает звучать, когда в ячейке набралось на kJitterMs
+// больше первого кадра, — это постоянная задержка воспроизведения.
+// Потерянный кадр и нехватка сэмплов к сроку подменяются маскировкой
+// прямо в колбэке. Подменённое при нехватке время — долг: столько же
+// пришедшего позже звука уже опоздало и выбрасывается, так что задержка
+// после каждой потери возвращается к целевой, а не растёт. Набранное
+// сверх цели больше чем на kJitterMs тоже сбрасывается до цели. После
+// kIdleMs подмены без данных отправитель замолчал: следующая речь снова
+// набирает задержку. Смесь в моно float переводит в формат устройства
+// цикл из audio_pipeline.h вместе с ограничением.
+class AudioPlayback {
+ public:
+  static constexpr unsigned long kFramesPerBuffer = 256;
+  // Запас на разброс прихода сверх длины кадра
+  static constexpr unsigned kJitterMs = 40;
+  // Больше этого кольцо ячейки не держит
+  static constexpr unsigned kMaxBufferedMs = 200;
+  // Подмена без данных дольше этого — конец речи, а не потеря
+  static constexpr unsigned kIdleMs = 100;
+  // Ячейки отправителей; тот, кто молчит дольше kSourceIdle, уступает
+  // свою новому
+  static constexpr std::size_t kMaxSources = 16;
+  static constexpr std::chrono::seconds kSourceIdle{10};
+
+  AudioPlayback() { Pa_Initialize(); }
+
+  ~AudioPlayback() {
+    stop();
+    Pa_Terminate();
+  }
+
+  void start(int sample_rate) {
+    if (stream_) {
+      return;
+    }
+    sample_rate_ = sample_rate;
+    mixed_.resize(kFramesPerBuffer);
+    voice_.resize(kFramesPerBuffer);
+    playback_block_ = audio::select_playback(format_, kFramesPerBuffer);
+    // Кольцо держит kMaxBufferedMs и ещё самый длинный кадр
+    std::size_t capacity = 1;
+    while (capacity < ms_to_samples(kMaxBufferedMs + protocol::kMaxPacketMs) +
+                          kFramesPerBuffer) {
+      capacity <<= 1;
+    }
+    sources_.reset(new Source[kMaxSources]);
+    for (std::size_t i = 0; i < kMaxSources; ++i) {
+      sources_[i].init(sample_rate, capacity);
+    }
+    Pa_OpenDefaultStream(&stream_,
+                         0,  // без входа
+                         format_.channels,
+                         format_.sample == audio::DeviceSample::kInt16
+                             ? paInt16
+                             : paFloat32,
+                         sample_rate, kFramesPerBuffer, audio_callback, this);
+    Pa_StartStream(stream_);
+  }
+
+  void stop() {
+    if (stream_) {
+      Pa_StopStream(stream_);
+      Pa_CloseStream(stream_);
+      stream_ = nullptr;
+    }
+  }
+
+  bool running() const { return stream_ != nullptr; }
+  int sample_rate() const { return sample_rate_; }
+
+  // Формат устройства, применяется при следующем start
+  void set_device_format(const audio::DeviceFormat& format) {
+    format_ = format;
+  }
+
+  // Сэмплы кадра отправителя source на частоте устройства; false — для
+  // отправителя нет ячейки или она переполнена
+  bool push(std::uint16_t source, const float* samples, std::size_t count) {
+    Source* slot = find_source(source);
+    return slot && slot->push(samples, count);
+  }
+
+  // Потерянный кадр из count сэмплов на частоте устройства: колбэк
+  // подменит его в свой срок
+  bool push_lost(std::uint16_t source, std::size_t count) {
+    Source* slot = find_source(source);
+    return slot && slot->push(nullptr, count);
+  }
+
+  // Кадры отправителя, пришедшие позже своего срока и выброшенные
+  std::uint64_t late_frames(std::uint16_t source) const {
+    for (std::size_t i = 0; sources_ && i < kMaxSources; ++i) {
+      if (sources_[i].id == source) {
+        return sources_[i].late.load(std::memory_order_relaxed);
+      }
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr std::size_t kSegments = 64;
+
+  // Принятый кадр или потерянный (lost); end — позиция конца отрезка
+  // на шкале отправителя
+  struct Segment {
+    std::uint64_t end = 0;
+    std::uint32_t samples = 0;
+    bool lost = false;
+  };
+
+  struct Source {
+    void init(int sample_rate, std::size_t capacity) {
+      ring.assign(capacity, 0.0f);
+      mask = capacity - 1;
+      concealer.emplace(sample_rate);
+    }
+
+    // io-поток
+    bool push(const float* samples, std::size_t count) {
+      std::uint64_t head = segment_head.load(std::memory_order_relaxed);
+      if (count == 0 ||
+          head - segment_tail.load(std::memory_order_acquire) == kSegments) {
+        return false;
+      }
+      if (samples) {
+        std::uint64_t start = sample_head.load(std::memory_order_relaxed);
+        if (start + count - sample_tail.load(std::memory_order_acquire) >
+            ring.size()) {
+          return false;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+          ring[(start + i) & mask] = samples[i];
+        }
+        sample_head.store(start + count, std::memory_order_relaxed);
+      }
+      pushed += count;
+      Segment& segment = segments[head % kSegments];
+      segment.end = pushed;
+      segment.samples = static_cast<std::uint32_t>(count);
+      segment.lost = samples == nullptr;
+      segment_head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Дальше — только колбэк. Сколько ещё не сыграно
+    std::size_t queued(std::uint64_t head) const {
+      return head == read_segment ? 0
+                                  : segments[(head - 1) % kSegments].end -
+                                        played;
+    }
+
+    // Пропускает count сэмплов с начала или меньше, если столько нет
+    // (out == nullptr), иначе читает их в out; возвращает прочитанное
+    std::size_t take(std::uint64_t head, float* out, std::size_t count,
+                     bool* lost) {
+      std::size_t done = 0;
+      while (done < count && read_segment != head) {
+        const Segment& segment = segments[read_segment % kSegments];
+        std::size_t n = std::min<std::size_t>(count - done,
+                                              segment.samples - offset);
+        if (lost && done == 0) {
+          *lost = segment.lost;
+        } else if (lost && *lost != segment.lost) {
+          break;  // отрезок другого рода — в следующий заход
+        }
+        if (!segment.lost) {
+          for (std::size_t i = 0; out && i < n; ++i) {
+            out[done + i] = ring[(read_sample + i) & mask];
+          }
+          read_sample += n;
+        }
+        done += n;
+        offset += n;
+        played += n;
+        if (offset == segment.samples) {
+          ++read_segment;
+          offset = 0;
+        }
+      }
+      return done;
+    }
+
+    // Колбэк вернул прочитанное писателю
+    void release() {
+      sample_tail.store(read_sample, std::memory_order_release);
+      segment_tail.store(read_segment, std::memory_order_release);
+    }
+
+    std::vector<float> ring;
+    std::size_t mask = 0;
+    Segment segments[kSegments];
+    alignas(64) std::atomic<std::uint64_t> segment_head{0};
+    std::atomic<std::uint64_t> sample_head{0};
+    alignas(64) std::atomic<std::uint64_t> segment_tail{0};
+    std::atomic<std::uint64_t> sample_tail{0};
+    std::atomic<std::uint64_t> late{0};
+
+    // Состояние io-потока
+    std::optional<std::uint16_t> id;
+    std::chrono::steady_clock::time_point last_push;
+    std::uint64_t pushed = 0;
+
+    // Состояние колбэка
+    std::optional<audio::LossConcealer> concealer;
+    std::uint64_t read_segment = 0;
+    std::uint64_t read_sample = 0;
+    std::uint64_t played = 0;
+    std::size_t offset = 0;
+    bool playing = false;
+    // Сколько ждём набора задержки; сколько подряд подменено без данных
+    std::size_t waited = 0;
+    std::size_t starved = 0;
+    // Подменённое при нехватке, ещё не выброшенное из пришедшего
+    std::size_t debt = 0;
+  };
+
+  std::size_t ms_to_samples(unsigned ms) const {
+    return static_cast<std::size_t>(sample_rate_) * ms / 1000;
+  }
+
+  // Ячейка отправителя, при первом кадре — свободная или давно молчащая.
+  // Молчащую колбэк уже доиграл, её кольца пусты.
+  Source* find_source(std::uint16_t id) {
+    if (!sources_) {
+      return nullptr;
+    }
+    auto now = std::chrono::steady_clock::now();
+    Source* free = nullptr;
+    for (std::size_t i = 0; i < kMaxSources; ++i) {
+      Source& source = sources_[i];
+      if (source.id == id) {
+        source.last_push = now;
+        return &source;
+      }
+      if (!free && (!source.id || now - source.last_push >= kSourceIdle)) {
+        free = &source;
+      }
+    }
+    if (free) {
+      free->id = id;
+      free->last_push = now;
+      free->late.store(0, std::memory_order_relaxed);
+    }
+    return free;
+  }
+
+  static int audio_callback(const void* input, void* output,
+                            unsigned long frameCount,
+                            const PaStreamCallbackTimeInfo* timeInfo,
+                            PaStreamCallbackFlags statusFlags, void* userData) {
+    static_cast<AudioPlayback*>(userData)->render(output, frameCount);
+    return paContinue;
+  }
+
+  // Длину не из kFramesPerBuffer выводит общий цикл кусками
+  void render(void* output, unsigned long frameCount) {
+    char* out = static_cast<char*>(output);
+    const std::size_t frame_bytes =
+        audio::bytes_per_sample(format_.sample) * format_.channels;
+    while (frameCount > 0) {
+      std::size_t frames = std::min<std::size_t>(frameCount, mixed_.size());
+      audio::PlaybackBlock block = frames == kFramesPerBuffer
+                                       ? playback_block_
+                                       : &audio::pipeline::playback_generic;
+      std::fill(mixed_.begin(), mixed_.begin() + frames, 0.0f);
+      for (std::size_t i = 0; i < kMaxSources; ++i) {
+        mix(sources_[i], mixed_.data(), frames);
+      }
+      block(format_, mixed_.data(), out, frames, 1.0f);
+      out += frames * frame_bytes;
+      frameCount -= frames;
+    }
+  }
+
+  void mix(Source& source, float* out, std::size_t count) {
+    std::uint64_t head = source.segment_head.load(std::memory_order_acquire);
+    // Пришедшее за уже подменённое время опоздало
+    if (source.debt > 0) {
+      std::uint64_t before = source.read_segment;
+      source.debt -= source.take(head, nullptr, source.debt, nullptr);
+      source.late.fetch_add(source.read_segment - before,
+                            std::memory_order_relaxed);
+    }
+    std::size_t queued = source.queued(head);
+    if (queued == 0) {
+      source.waited = 0;
+    } else {
+      // Цель — запас и кадр, которым отрезок начинается сейчас
+      const std::size_t jitter = ms_to_samples(kJitterMs);
+      const Segment& next = source.segments[source.read_segment % kSegments];
+      std::size_t target = jitter + next.samples;
+      if (queued > target + jitter) {
+        source.take(head, nullptr, queued - target, nullptr);
+        queued = target;
+      }
+      if (source.playing) {
+        source.waited = 0;
+      } else {
+        // Короткая фраза целиком меньше цели: играет, прождав столько же
+        source.waited += count;
+        source.playing = queued >= target || source.waited >= target;
+      }
+    }
+    if (!source.playing) {
+      source.release();
+      return;
+    }
+    float* voice = voice_.data();
+    std::size_t done = 0;
+    while (done < count) {
+      bool lost = false;
+      std::size_t n = source.take(head, voice + done, count - done, &lost);
+      if (n == 0) {
+        // Нехватка к сроку: подмена, и столько же пришедшего позже
+        // придётся выбросить
+        n = count - done;
+        source.concealer->conceal(voice + done, n);
+        source.debt += n;
+        source.starved += n;
+      } else if (lost) {
+        source.concealer->conceal(voice + done, n);
+      } else {
+        source.concealer->receive(voice + done, n);
+        source.starved = 0;
+      }
+      done += n;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      out[i] += voice[i];
+    }
+    if (source.starved >= ms_to_samples(kIdleMs)) {
+      source.playing = false;
+      source.debt = 0;
+      source.starved = 0;
+    }
+    source.release();
+  }
+
+  PaStream* stream_ = nullptr;
+  int sample_rate_ = 0;
+  audio::DeviceFormat format_;
+  std::unique_ptr<Source[]> sources_;
+  // Состояние потока PortAudio
+  audio::PlaybackBlock playback_block_ = &audio::pipeline::playback_generic;
+  std::vector<float> mixed_;
+  std::vector<float> voice_;
+};
+
+#endif  // AUDIOPLAYBACK_H
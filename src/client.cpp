@@ -1,70 +1,130 @@
-#include <portaudio.h>
-
+#include <algorithm>
 #include <atomic>
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "../docker_server/audio_convert.h"
+#include "../docker_server/logger.h"
+#include "../docker_server/protocol.h"
+#include "../docker_server/stream_scheduler.h"
+#include "../docker_server/voice_fec.h"
+#include "audiocapture.h"
+#include "audioplayback.h"
+#include "file_transfer.h"
+#include "peer_link.h"
+
 using boost::asio::ip::tcp;
 
-class AudioCapture {
+// Переводит пакеты с частоты устройства в сетевой формат:
+// ресемплинг и, при необходимости, float32 -> int16 с дизерингом
+class WireEncoder {
  public:
-  AudioCapture() : stream_(nullptr) { Pa_Initialize(); }
-
-  ~AudioCapture() {
-    if (stream_) {
-      Pa_CloseStream(stream_);
-    }
-    Pa_Terminate();
+  void configure(int device_rate, const protocol::AudioFormat& format) {
+    format_ = format;
+    resampler_ = std::make_unique<audio::PolyphaseResampler>(
+        device_rate, static_cast<int>(format.sample_rate));
   }
 
-  void start_capture(std::function<void(const std::vector<float>&)> callback) {
-    data_callback_ = callback;
-
-    Pa_OpenDefaultStream(&stream_,
-                         1,          // 1 input channel
-                         0,          // 0 output channels
-                         paFloat32,  // 32 bit floating point output
-                         44100,      // Sample rate
-                         256,        // Frames per buffer
-                         audio_callback, this);
-
-    Pa_StartStream(stream_);
+  bool matches(int device_rate, const protocol::AudioFormat& format) const {
+    return resampler_ && resampler_->in_rate() == device_rate &&
+           protocol::audio_flags(format_) == protocol::audio_flags(format);
   }
 
-  void stop_capture() {
-    if (stream_) {
-      Pa_StopStream(stream_);
+  const protocol::AudioFormat& format() const { return format_; }
+
+  // Сэмплы пишутся в порядке байт хоста; все поддерживаемые
+  // платформы little-endian, как и остальной протокол
+  void encode(const std::vector<float>& samples, std::vector<char>& payload) {
+    resampled_.clear();
+    resampler_->process(samples.data(), samples.size(), resampled_);
+    if (format_.sample_format == protocol::SampleFormat::kInt16) {
+      payload.resize(resampled_.size() * sizeof(std::int16_t));
+      audio::float_to_int16(resampled_.data(),
+                            reinterpret_cast<std::int16_t*>(payload.data()),
+                            resampled_.size(), dither_);
+    } else {
+      payload.resize(resampled_.size() * sizeof(float));
+      std::memcpy(payload.data(), resampled_.data(), payload.size());
     }
   }
 
  private:
-  static int audio_callback(const void* input, void* output,
-                            unsigned long frameCount,
-                            const PaStreamCallbackTimeInfo* timeInfo,
-                            PaStreamCallbackFlags statusFlags, void* userData) {
-    auto* capture = static_cast<AudioCapture*>(userData);
-    const float* inputBuffer = static_cast<const float*>(input);
-
-    std::vector<float> audioData(inputBuffer, inputBuffer + frameCount);
-    capture->data_callback_(audioData);
-
-    return paContinue;
-  }
+  protocol::AudioFormat format_;
+  std::unique_ptr<audio::PolyphaseResampler> resampler_;
+  std::vector<float> resampled_;
+  audio::DitherState dither_;
+};
 
-  PaStream* stream_;
-  std::function<void(const std::vector<float>&)> data_callback_;
+struct ClientTlsOptions {
+  bool enabled = false;
+  // Корневые сертификаты для проверки сервера; пусто — без проверки
+  std::string ca_path;
 };
 
 class Client {
  public:
-  Client(boost::asio::io_context& io_context)
+  // Срок неотправленного голоса: более старый выбрасывается при отправке
+  static constexpr std::chrono::milliseconds kMaxVoiceBacklog{200};
+  // Окно перестановки кадров собеседника: при переходе между UDP
+  // и сервером кадры двух путей приходят вперемешку
+  static constexpr std::uint8_t kDirectReorder = 3;
+
+  Client(boost::asio::io_context& io_context, const ClientTlsOptions& tls)
       : io_context_(io_context),
         socket_(io_context),
+        tls_options_(tls),
+        tls_context_(boost::asio::ssl::context::tls_client),
         audio_capture_(),
+        peer_(
+            io_context,
+            [this](const protocol::FrameHeader& header, const char* payload) {
+              on_voice(header, payload);
+            },
+            [this](bool direct) { on_peer_path(direct); }),
         is_connected_(false),
-        is_capturing_(false) {}
+        is_capturing_(false) {
+    if (tls_options_.enabled) {
+      configure_tls();
+    }
+  }
+
+  ~Client() {
+    if (tls_session_) {
+      SSL_SESSION_free(tls_session_);
+    }
+  }
+
+  // Токен входа для сервера с --auth-key; задаётся до подключения
+  void set_token(const protocol::SessionToken& token) {
+    token_ = token;
+    has_token_ = true;
+  }
+
+  // Кадры чётности к чужому голосу; задаётся до подключения
+  void set_fec(bool fec) { fec_ = fec; }
+  // Проигрывать чужой голос; сервер рассылает и собственный
+  void set_playback(bool playback) { playback_enabled_ = playback; }
+  // Голос напрямую по UDP в звонке вдвоём; задаётся до подключения
+  void set_direct(bool direct) { direct_ = direct; }
+  // Формат звуковой карты и усиление для захвата и проигрывания;
+  // задаётся до start_audio
+  void set_audio_device(const audio::DeviceFormat& format, float gain) {
+    audio_capture_.set_device_format(format);
+    audio_capture_.set_gain(gain);
+    playback_.set_device_format(format);
+  }
+  // Не отправлять пакеты без речи: номер кадра не растёт, метка
+  // времени — растёт, и получатель видит паузу, а не потерю
+  void set_vad(bool vad) { vad_ = vad; }
 
   void connect(const std::string& host, const std::string& port) {
     std::cout << "Attempting to connect to " << host << ":" << port << "..."
@@ -74,12 +134,17 @@ class Client {
     boost::asio::async_connect(
         socket_, endpoints,
         [this, host, port](boost::system::error_code ec, tcp::endpoint) {
-          if (!ec) {
-            is_connected_ = true;
-            std::cout << "Connected to " << host << ":" << port << std::endl;
-          } else {
+          if (ec) {
             std::cerr << "Connection failed: " << ec.message() << std::endl;
+            return;
           }
+          if (tls_options_.enabled) {
+            start_tls(host);
+            return;
+          }
+          is_connected_ = true;
+          std::cout << "Connected to " << host << ":" << port << std::endl;
+          start_session();
         });
 
     // Ждем немного, чтобы асинхронное подключение успело выполниться
@@ -104,8 +169,9 @@ class Client {
     }
     is_capturing_ = true;
     audio_capture_.start_capture(
-        [this](const std::vector<float>& audioData) { send_audio(audioData); });
-    receive_audio();
+        [this](const std::vector<float>& audioData, bool voiced) {
+          send_audio(audioData, voiced);
+        });
     std::cout << "Audio capture started." << std::endl;
   }
 
@@ -119,53 +185,693 @@ class Client {
     std::cout << "Audio capture stopped." << std::endl;
   }
 
+  // Запрашивает у сервера интервал пакетизации; сервер может
+  // ответить другим значением, если у него задан больший минимум
+  void set_packet_interval(std::uint16_t packet_ms) {
+    if (!protocol::is_valid_packet_interval(packet_ms)) {
+      std::cout << "Packet interval must be 10, 20, 40 or 60 ms."
+                << std::endl;
+      return;
+    }
+    requested_packet_ms_ = packet_ms;
+    if (is_connected_) {
+      send_session_config();
+    } else {
+      audio_capture_.set_packet_ms(packet_ms);
+    }
+  }
+
+  // Частоты устройства и сети независимы: захват идёт на частоте
+  // устройства, в сеть уходит ресемплированный поток
+  void set_audio_format(int device_rate, const protocol::AudioFormat& wire) {
+    if (device_rate != 44100 && device_rate != 48000) {
+      std::cout << "Device rate must be 44100 or 48000 Hz." << std::endl;
+      return;
+    }
+    if (!protocol::is_valid_audio_format(wire)) {
+      std::cout << "Unsupported wire format." << std::endl;
+      return;
+    }
+    if (is_capturing_) {
+      std::cout << "Stop audio before changing the device rate." << std::endl;
+      return;
+    }
+    audio_capture_.set_sample_rate(device_rate);
+    requested_format_ = wire;
+    wire_flags_ = protocol::audio_flags(wire);
+    if (is_connected_) {
+      send_session_config();
+    }
+  }
+
   bool is_connected() const { return is_connected_; }
 
+  // Хеш файла считается здесь, в потоке меню; передача идёт в потоке
+  // io_context и продолжается с места обрыва при повторном вызове
+  void upload(const std::string& path) {
+    if (!is_connected_) {
+      std::cout << "Not connected to server. Please connect first."
+                << std::endl;
+      return;
+    }
+    std::shared_ptr<FileUpload> upload = FileUpload::open(path);
+    if (!upload) {
+      std::cout << "Cannot read " << path << std::endl;
+      return;
+    }
+    std::cout << "Uploading " << upload->size() << " bytes, file id "
+              << to_hex(upload->id()) << std::endl;
+    boost::asio::post(io_context_, [this, upload]() {
+      upload_ = upload;
+      transfer_start_ = std::chrono::steady_clock::now();
+      queue_frame(upload_->begin_frame());
+    });
+  }
+
+  void download(const std::string& file_id, const std::string& path) {
+    if (!is_connected_) {
+      std::cout << "Not connected to server. Please connect first."
+                << std::endl;
+      return;
+    }
+    protocol::FileId id;
+    if (!from_hex(file_id, id)) {
+      std::cout << "File id must be 64 hex digits." << std::endl;
+      return;
+    }
+    std::shared_ptr<FileDownload> download = FileDownload::open(id, path);
+    if (!download) {
+      std::cout << "Cannot write " << path << std::endl;
+      return;
+    }
+    boost::asio::post(io_context_, [this, download]() {
+      download_ = download;
+      transfer_start_ = std::chrono::steady_clock::now();
+      queue_frame(download_->request_frame());
+    });
+  }
+
+  // Снимает ссылку на загруженный файл; содержимое сервер удалит,
+  // когда на его куски не останется ссылок
+  void release(const std::string& file_id) {
+    if (!is_connected_) {
+      std::cout << "Not connected to server. Please connect first."
+                << std::endl;
+      return;
+    }
+    protocol::FileId id;
+    if (!from_hex(file_id, id)) {
+      std::cout << "File id must be 64 hex digits." << std::endl;
+      return;
+    }
+    boost::asio::post(io_context_, [this, id]() {
+      releasing_.push_back(id);
+      queue_frame(protocol::make_release_file(id));
+    });
+  }
+
  private:
-  void send_audio(const std::vector<float>& audioData) {
-    std::vector<char> buffer(audioData.size() * sizeof(float));
-    std::memcpy(buffer.data(), audioData.data(), buffer.size());
+  void configure_tls() {
+    SSL_CTX* ctx = tls_context_.native_handle();
+    SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+    // Билеты сервера приходят после рукопожатия; последний сохраняем
+    // для возобновления при следующем подключении
+    SSL_CTX_set_app_data(ctx, this);
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, [](SSL* ssl, SSL_SESSION* session) {
+      auto* client =
+          static_cast<Client*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+      if (client->tls_session_) {
+        SSL_SESSION_free(client->tls_session_);
+      }
+      client->tls_session_ = session;
+      return 1;
+    });
+    if (tls_options_.ca_path.empty()) {
+      std::cout << "Warning: server certificate is not verified (no --tls-ca)"
+                << std::endl;
+      tls_context_.set_verify_mode(boost::asio::ssl::verify_none);
+    } else {
+      tls_context_.load_verify_file(tls_options_.ca_path);
+      tls_context_.set_verify_mode(boost::asio::ssl::verify_peer);
+    }
+  }
 
-    boost::asio::async_write(
-        socket_, boost::asio::buffer(buffer),
-        [this](boost::system::error_code ec, std::size_t /*length*/) {
+  void start_tls(const std::string& host) {
+    tls_stream_ = std::make_unique<TlsStream>(socket_, tls_context_);
+    SSL* ssl = tls_stream_->native_handle();
+    SSL_set_tlsext_host_name(ssl, host.c_str());
+    if (!tls_options_.ca_path.empty()) {
+      tls_stream_->set_verify_callback(
+          boost::asio::ssl::host_name_verification(host));
+    }
+    if (tls_session_) {
+      SSL_set_session(ssl, tls_session_);
+    }
+    tls_stream_->async_handshake(
+        boost::asio::ssl::stream_base::client,
+        [this, host](boost::system::error_code ec) {
           if (ec) {
-            std::cerr << "Error sending audio: " << ec.message() << std::endl;
+            std::cerr << "TLS handshake failed: " << ec.message() << std::endl;
+            return;
           }
+          SSL* ssl = tls_stream_->native_handle();
+          is_connected_ = true;
+          std::cout << "Connected to " << host << " over "
+                    << SSL_get_version(ssl)
+                    << (SSL_session_reused(ssl) ? " (resumed)" : "")
+                    << std::endl;
+          start_session();
         });
   }
 
-  void receive_audio() {
-    socket_.async_read_some(
-        boost::asio::buffer(receive_buffer_),
-        [this](boost::system::error_code ec, std::size_t length) {
-          if (!ec) {
-            std::cout << "Received " << length << " bytes of audio data"
-                      << std::endl;
+  // Чтение и запись идут через TLS, если он включён
+  template <typename Buffer, typename Handler>
+  void async_read_exact(const Buffer& buffer, Handler&& handler) {
+    if (tls_stream_) {
+      boost::asio::async_read(*tls_stream_, buffer,
+                              std::forward<Handler>(handler));
+    } else {
+      boost::asio::async_read(socket_, buffer,
+                              std::forward<Handler>(handler));
+    }
+  }
+
+  template <typename Buffer, typename Handler>
+  void async_write_all(const Buffer& buffer, Handler&& handler) {
+    if (tls_stream_) {
+      boost::asio::async_write(*tls_stream_, buffer,
+                               std::forward<Handler>(handler));
+    } else {
+      boost::asio::async_write(socket_, buffer,
+                               std::forward<Handler>(handler));
+    }
+  }
+
+  // kHello идёт первым: до входа сервер отбрасывает остальные кадры
+  void start_session() {
+    if (playback_enabled_) {
+      playback_.start(audio_capture_.sample_rate());
+    }
+    if (has_token_) {
+      queue_frame(protocol::make_hello(token_));
+    }
+    receive_header();
+    send_session_config();
+    if (direct_) {
+      auto candidates = peer_.open();
+      if (!candidates.empty()) {
+        queue_frame(protocol::make_peer_candidates(candidates));
+      }
+    }
+  }
+
+  void send_session_config() {
+    protocol::SessionConfig config;
+    config.packet_ms = requested_packet_ms_;
+    config.wire_format = requested_format_;
+    config.fec = fec_;
+    send_frame(protocol::make_session_config(config));
+  }
+
+  // Вызывается из потока PortAudio с одним пакетом звука
+  void send_audio(const std::vector<float>& audioData, bool voiced) {
+    const int device_rate = audio_capture_.sample_rate();
+    if (vad_ && !voiced) {
+      captured_frames_ += audioData.size();
+      return;
+    }
+    auto wire_format = protocol::audio_format_from_flags(wire_flags_);
+    if (!encoder_.matches(device_rate, wire_format)) {
+      encoder_.configure(device_rate, wire_format);
+    }
+
+    protocol::FrameHeader header;
+    header.type = protocol::MessageType::kAudio;
+    header.flags = protocol::audio_flags(wire_format);
+    header.sequence = audio_sequence_++;
+    header.timestamp =
+        static_cast<std::uint32_t>(captured_frames_ * 1000 / device_rate);
+    captured_frames_ += audioData.size();
+
+    encoder_.encode(audioData, payload_);
+    boost::asio::post(
+        io_context_,
+        [this, frame = protocol::make_frame(header, payload_.data(),
+                                            payload_.size())]() mutable {
+          queue_audio(std::move(frame));
+        });
+  }
+
+  // Канал не успевает за голосом: пропуск лучше растущей задержки,
+  // и пропадает самый старый кадр, а не свежий. Сервер тем временем
+  // увидит задержку по меткам времени и понизит битрейт через
+  // SessionConfig.
+  void queue_audio(std::vector<char> frame) {
+    if (peer_.send(frame)) {
+      return;
+    }
+    auto now = StreamScheduler::Clock::now();
+    outgoing_.push(make_shared_frame(std::move(frame)), now,
+                   now + kMaxVoiceBacklog);
+    if (!writing_) {
+      do_write();
+    }
+  }
+
+  // Кадры ставятся в очередь в потоке io_context, чтобы буфер жил
+  // до конца записи и записи не перемешивались
+  void send_frame(std::vector<char> frame) {
+    boost::asio::post(io_context_, [this, frame = std::move(frame)]() mutable {
+      queue_frame(std::move(frame));
+    });
+  }
+
+  // Только из потока io_context
+  void queue_frame(std::vector<char> frame) {
+    outgoing_.push(make_shared_frame(std::move(frame)),
+                   StreamScheduler::Clock::now());
+    if (!writing_) {
+      do_write();
+    }
+  }
+
+  // Сообщение логического потока: режется на куски и уходит в паузах
+  // между голосовыми кадрами
+  void send_message(std::uint16_t stream, std::vector<char> payload) {
+    boost::asio::post(io_context_, [this, stream,
+                                    payload = std::move(payload)]() {
+      outgoing_.push_message(
+          stream, 1,
+          make_shared_message(
+              protocol::make_chunks(stream, payload.data(), payload.size())),
+          StreamScheduler::Clock::now());
+      if (!writing_) {
+        do_write();
+      }
+    });
+  }
+
+  void do_write() {
+    SharedFrame frame = outgoing_.pop(StreamScheduler::Clock::now());
+    if (std::uint64_t expired = outgoing_.take_expired_audio()) {
+      voice_dropped_ += expired;
+      LOG_RATE_LIMITED(::logger::Level::kWarning, 1000,
+                       "Uplink congested: {} audio packets dropped",
+                       voice_dropped_);
+    }
+    if (!frame) {
+      return;
+    }
+    writing_ = true;
+    const auto& data = *frame;
+    async_write_all(
+        boost::asio::buffer(data.data(), data.size()),
+        [this, frame](boost::system::error_code ec, std::size_t /*length*/) {
+          writing_ = false;
+          if (ec) {
+            LOG_ERROR("Error sending audio: {}", ec.message());
+            outgoing_ = StreamScheduler();
+            return;
+          }
+          if (!outgoing_.empty()) {
+            do_write();
+          }
+        });
+  }
 
-            // Выводим первые несколько байт для отладки
-            std::cout << "First few bytes: ";
-            for (size_t i = 0; i < std::min(length, size_t(10)); ++i) {
-              std::cout << static_cast<int>(receive_buffer_[i]) << " ";
+  void receive_header() {
+    async_read_exact(
+        boost::asio::buffer(receive_header_.data(), receive_header_.size()),
+        [this](boost::system::error_code ec, std::size_t /*length*/) {
+          if (!ec) {
+            auto header = protocol::decode_header(receive_header_.data());
+            if (header.length > protocol::kMaxPayloadSize) {
+              LOG_WARNING("Frame too large: {}", header.length);
+              return;
             }
-            std::cout << std::endl;
+            receive_body(header);
+          } else {
+            handle_receive_error(ec);
+          }
+        });
+  }
 
+  void receive_body(protocol::FrameHeader header) {
+    receive_buffer_.resize(header.length);
+    async_read_exact(
+        boost::asio::buffer(receive_buffer_),
+        [this, header](boost::system::error_code ec, std::size_t /*length*/) {
+          if (!ec) {
+            handle_frame(header);
             // Продолжаем получать данные
-            receive_audio();
-          } else if (ec == boost::asio::error::eof) {
-            std::cout << "Server closed the connection." << std::endl;
+            receive_header();
           } else {
-            std::cerr << "Error receiving audio: " << ec.message() << std::endl;
+            handle_receive_error(ec);
           }
         });
   }
 
+  void handle_frame(const protocol::FrameHeader& header) {
+    switch (header.type) {
+      case protocol::MessageType::kAudio:
+      case protocol::MessageType::kAudioParity:
+        on_voice(header, receive_buffer_.data());
+        break;
+      case protocol::MessageType::kPeerOffer: {
+        protocol::PeerOffer offer;
+        if (protocol::decode_peer_offer(receive_buffer_.data(),
+                                        receive_buffer_.size(), offer)) {
+          voice_sources_[offer.peer].receiver = FecReceiver(kDirectReorder);
+          peer_.on_offer(offer);
+        }
+        break;
+      }
+      case protocol::MessageType::kPeerState:
+        // Сервер отозвал звонок: в комнате уже не двое
+        peer_.reset();
+        break;
+      case protocol::MessageType::kSessionConfig: {
+        protocol::SessionConfig config;
+        if (protocol::decode_session_config(
+                receive_buffer_.data(), receive_buffer_.size(), config) &&
+            protocol::is_valid_packet_interval(config.packet_ms)) {
+          audio_capture_.set_packet_ms(config.packet_ms);
+          wire_flags_ = protocol::audio_flags(config.wire_format);
+          LOG_INFO("Packet interval: {} ms, {} Hz {}", config.packet_ms,
+                   config.wire_format.sample_rate,
+                   config.wire_format.sample_format ==
+                           protocol::SampleFormat::kInt16
+                       ? "int16"
+                       : "float32");
+        }
+        break;
+      }
+      case protocol::MessageType::kData:
+        on_data(header);
+        break;
+      case protocol::MessageType::kTransferStatus:
+        on_transfer_status();
+        break;
+      case protocol::MessageType::kFileData:
+        on_file_data(header);
+        break;
+      case protocol::MessageType::kWelcome:
+        // Продлённый токен для следующего подключения
+        protocol::decode_session_token(receive_buffer_.data(),
+                                       receive_buffer_.size(), token_);
+        break;
+      case protocol::MessageType::kPing:
+        // Сервер считает RTT по возвращённому времени отправки
+        send_frame(protocol::make_pong(receive_buffer_.data(),
+                                       receive_buffer_.size()));
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Кадр голоса с сервера или от собеседника напрямую
+  void on_voice(const protocol::FrameHeader& header, const char* payload) {
+    VoiceSource& source = voice_sources_[header.stream];
+    if (header.type == protocol::MessageType::kAudioParity) {
+      source.receiver.on_parity(header, payload);
+      play_voice(header.stream, source);
+      return;
+    }
+    // Пакеты идут каждые 10-60 мс: в журнал попадает каждый сотый
+    LOG_SAMPLED(::logger::Level::kDebug, 100,
+                "Received {} bytes of audio data, sequence {}",
+                header.length, header.sequence);
+    source.receiver.on_audio(header, payload);
+    play_voice(header.stream, source);
+  }
+
+  // Свой голос переходит на UDP или обратно; сервер перестаёт или снова
+  // начинает его пересылать
+  void on_peer_path(bool direct) {
+    LOG_INFO("Voice goes {}", direct ? "directly to the peer"
+                                     : "through the server");
+    queue_frame(protocol::make_peer_state(direct
+                                              ? protocol::PeerState::kDirect
+                                              : protocol::PeerState::kRelay));
+  }
+
+  // Голос одного отправителя: восстановление по чётности и перевод
+  // на частоту устройства. Оставшиеся потери маскирует проигрывание
+  // в срок их воспроизведения.
+  struct VoiceSource {
+    FecReceiver receiver;
+    std::unique_ptr<audio::PolyphaseResampler> resampler;
+    // Частота и длина последнего кадра: такой же подменяется потерянный
+    int sample_rate = 0;
+    std::size_t frame_samples = 0;
+    std::uint64_t lost_reported = 0;
+  };
+
+  // Кадры отправителя по порядку номеров, по мере готовности
+  void play_voice(std::uint16_t stream, VoiceSource& source) {
+    ReceivedVoice voice;
+    while (source.receiver.pop(voice)) {
+      if (voice.kind == ReceivedVoice::Kind::kLost) {
+        if (source.frame_samples != 0 && playback_.running()) {
+          playback_.push_lost(
+              stream, source.frame_samples * playback_.sample_rate() /
+                          static_cast<std::size_t>(source.sample_rate));
+        }
+        continue;
+      }
+      if (!decode_voice(voice, source)) {
+        continue;
+      }
+      if (playback_.running()) {
+        int rate = source.sample_rate;
+        if (!source.resampler || source.resampler->in_rate() != rate ||
+            source.resampler->out_rate() != playback_.sample_rate()) {
+          source.resampler = std::make_unique<audio::PolyphaseResampler>(
+              rate, playback_.sample_rate());
+        }
+        device_samples_.clear();
+        source.resampler->process(voice_samples_.data(),
+                                  voice_samples_.size(), device_samples_);
+        playback_.push(stream, device_samples_.data(),
+                       device_samples_.size());
+      }
+    }
+    // Опоздавшие к сроку воспроизведения выбрасывает проигрывание: срок
+    // отсчитывается от начала речи и после долгой нехватки набирается
+    // заново, так что устойчивый сдвиг задержки теряет один промежуток,
+    // а не весь голос
+    std::uint64_t late = playback_.late_frames(stream);
+    if (source.receiver.lost() + late > source.lost_reported) {
+      source.lost_reported = source.receiver.lost() + late;
+      LOG_RATE_LIMITED(::logger::Level::kInfo, 5000,
+                       "Voice from {}: {} frames lost, {} late, {} recovered "
+                       "by FEC",
+                       stream, source.receiver.lost(), late,
+                       source.receiver.recovered());
+    }
+  }
+
+  // Сэмплы кадра в voice_samples_; false — формат не разобрать
+  bool decode_voice(const ReceivedVoice& voice, VoiceSource& source) {
+    auto format = protocol::audio_format_from_flags(voice.header.flags);
+    std::size_t width = protocol::bytes_per_sample(format.sample_format);
+    if (!protocol::is_valid_audio_format(format) ||
+        voice.payload.size() % width != 0) {
+      return false;
+    }
+    std::size_t count = voice.payload.size() / width;
+    voice_samples_.resize(count);
+    if (format.sample_format == protocol::SampleFormat::kInt16) {
+      voice_int16_.resize(count);
+      std::memcpy(voice_int16_.data(), voice.payload.data(),
+                  voice.payload.size());
+      audio::int16_to_float(voice_int16_.data(), voice_samples_.data(),
+                            count);
+    } else {
+      std::memcpy(voice_samples_.data(), voice.payload.data(),
+                  voice.payload.size());
+    }
+    source.sample_rate = static_cast<int>(format.sample_rate);
+    source.frame_samples = count;
+    return true;
+  }
+
+  void on_data(const protocol::FrameHeader& header) {
+    auto& message = incoming_[header.stream];
+    if (message.size() + receive_buffer_.size() > protocol::kMaxMessageSize) {
+      LOG_WARNING("Message on stream {} too large, dropped", header.stream);
+      incoming_.erase(header.stream);
+      return;
+    }
+    message.insert(message.end(), receive_buffer_.begin(),
+                   receive_buffer_.end());
+    if (header.flags & protocol::kFlagMoreChunks) {
+      return;
+    }
+    LOG_DEBUG("Message on stream {}: {} bytes", header.stream, message.size());
+    incoming_.erase(header.stream);
+  }
+
+  void on_transfer_status() {
+    protocol::TransferStatus status;
+    if (!protocol::decode_transfer_status(receive_buffer_.data(),
+                                          receive_buffer_.size(), status)) {
+      return;
+    }
+    if (upload_ && upload_->id() == status.id) {
+      on_upload_status(status);
+    } else if (download_ && download_->id() == status.id) {
+      on_download_status(status);
+    } else {
+      auto it = std::find(releasing_.begin(), releasing_.end(), status.id);
+      if (it != releasing_.end()) {
+        releasing_.erase(it);
+        const char* result = "File not found: ";
+        if (status.state == protocol::TransferState::kComplete) {
+          result = "File deleted: ";
+        } else if (status.state == protocol::TransferState::kDenied) {
+          result = "File was not uploaded by you: ";
+        }
+        std::cout << result << to_hex(status.id) << std::endl;
+      }
+    }
+  }
+
+  void on_upload_status(const protocol::TransferStatus& status) {
+    switch (status.state) {
+      case protocol::TransferState::kInProgress:
+      case protocol::TransferState::kBadChunk: {
+        std::vector<std::vector<char>> frames;
+        upload_->on_status(status, frames);
+        for (auto& frame : frames) {
+          queue_frame(std::move(frame));
+        }
+        break;
+      }
+      case protocol::TransferState::kComplete:
+        std::cout << "Upload complete: " << to_hex(status.id) << " ("
+                  << throughput(upload_->bytes_sent()) << ")" << std::endl;
+        upload_.reset();
+        break;
+      default:
+        std::cout << "Upload failed: "
+                  << (status.state == protocol::TransferState::kBusy
+                          ? "file is being uploaded by another client"
+                          : "server error")
+                  << std::endl;
+        upload_.reset();
+        break;
+    }
+  }
+
+  void on_download_status(const protocol::TransferStatus& status) {
+    if (status.state != protocol::TransferState::kInProgress) {
+      std::cout << "Download failed: "
+                << (status.state == protocol::TransferState::kNotFound
+                        ? "no such file"
+                        : "server error")
+                << std::endl;
+      download_.reset();
+      return;
+    }
+    download_->on_status(status);
+    LOG_INFO("Downloading {} bytes from offset {}", status.size,
+             download_->offset());
+  }
+
+  void on_file_data(const protocol::FrameHeader& header) {
+    if (!download_) {
+      return;
+    }
+    if (!download_->on_data(receive_buffer_.data(), receive_buffer_.size())) {
+      std::cout << "Download failed: cannot write file" << std::endl;
+      download_.reset();
+      return;
+    }
+    if (header.flags & protocol::kFlagMoreChunks) {
+      return;
+    }
+    if (download_->finish()) {
+      std::cout << "Download complete: " << download_->path() << " ("
+                << throughput(download_->size()) << ")" << std::endl;
+    } else {
+      std::cout << "Download failed: file hash mismatch" << std::endl;
+    }
+    download_.reset();
+  }
+
+  std::string throughput(std::uint64_t bytes) const {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - transfer_start_)
+                         .count();
+    char text[64];
+    std::snprintf(text, sizeof(text), "%.1f MB/s",
+                  seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    return text;
+  }
+
+  void handle_receive_error(const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::eof) {
+      LOG_INFO("Server closed the connection.");
+    } else {
+      LOG_ERROR("Error receiving audio: {}", ec.message());
+    }
+  }
+
+  using TlsStream = boost::asio::ssl::stream<tcp::socket&>;
+
   boost::asio::io_context& io_context_;
   tcp::socket socket_;
+  ClientTlsOptions tls_options_;
+  boost::asio::ssl::context tls_context_;
+  // Создаётся на каждое подключение поверх socket_
+  std::unique_ptr<TlsStream> tls_stream_;
+  // Билет последнего соединения для возобновления без полного
+  // рукопожатия
+  SSL_SESSION* tls_session_ = nullptr;
+  protocol::SessionToken token_{};
+  bool has_token_ = false;
   AudioCapture audio_capture_;
-  std::array<char, 1024> receive_buffer_;
+  // Прямой путь к собеседнику — только в потоке io_context
+  PeerLink peer_;
+  std::array<char, protocol::kHeaderSize> receive_header_;
+  std::vector<char> receive_buffer_;
+  // Очередь отправки и сборка входящих сообщений — только в потоке
+  // io_context
+  StreamScheduler outgoing_;
+  bool writing_ = false;
+  std::uint64_t voice_dropped_ = 0;
+  std::unordered_map<std::uint16_t, std::vector<char>> incoming_;
+  // Чужой голос по отправителям и буферы его разбора — только в потоке
+  // io_context
+  std::unordered_map<std::uint16_t, VoiceSource> voice_sources_;
+  std::vector<float> voice_samples_;
+  std::vector<std::int16_t> voice_int16_;
+  std::vector<float> device_samples_;
+  AudioPlayback playback_;
+  bool playback_enabled_ = false;
+  bool fec_ = false;
+  bool direct_ = false;
+  bool vad_ = false;
+  std::shared_ptr<FileUpload> upload_;
+  std::shared_ptr<FileDownload> download_;
+  std::vector<protocol::FileId> releasing_;
+  std::chrono::steady_clock::time_point transfer_start_;
   std::atomic<bool> is_connected_;
   std::atomic<bool> is_capturing_;
+  std::uint16_t requested_packet_ms_ = protocol::kDefaultPacketMs;
+  protocol::AudioFormat requested_format_;
+  // Формат, принятый сервером; читается из потока PortAudio
+  std::atomic<std::uint8_t> wire_flags_{
+      protocol::audio_flags(protocol::AudioFormat())};
+  // Используются только в потоке PortAudio
+  WireEncoder encoder_;
+  std::vector<char> payload_;
+  std::uint32_t audio_sequence_ = 0;
+  std::uint64_t captured_frames_ = 0;
 };
 
 void print_menu() {
@@ -173,15 +879,81 @@ void print_menu() {
   std::cout << "1. Connect to server" << std::endl;
   std::cout << "2. Start audio" << std::endl;
   std::cout << "3. Stop audio" << std::endl;
-  std::cout << "4. Exit" << std::endl;
+  std::cout << "4. Set packet interval" << std::endl;
+  std::cout << "5. Set audio format" << std::endl;
+  std::cout << "6. Upload file" << std::endl;
+  std::cout << "7. Download file" << std::endl;
+  std::cout << "8. Delete file" << std::endl;
+  std::cout << "9. Exit" << std::endl;
   std::cout << "Enter your choice: ";
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+  // Журнал идёт в stderr, чтобы не смешиваться с меню
+  logger::Options log;
+  ClientTlsOptions tls;
+  std::string token_hex;
+  bool fec = false;
+  bool playback = false;
+  bool direct = false;
+  bool vad = false;
+  audio::DeviceFormat device_format;
+  float gain_db = 0.0f;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--log-level") {
+      logger::parse_level(argv[i + 1], log.level);
+    } else if (arg == "--log-file") {
+      log.path = argv[i + 1];
+    } else if (arg == "--tls") {
+      tls.enabled = std::string(argv[i + 1]) == "on";
+    } else if (arg == "--tls-ca") {
+      tls.enabled = true;
+      tls.ca_path = argv[i + 1];
+    } else if (arg == "--token") {
+      token_hex = argv[i + 1];
+    } else if (arg == "--fec") {
+      fec = std::string(argv[i + 1]) == "on";
+    } else if (arg == "--playback") {
+      playback = std::string(argv[i + 1]) == "on";
+    } else if (arg == "--direct") {
+      direct = std::string(argv[i + 1]) == "on";
+    } else if (arg == "--vad") {
+      vad = std::string(argv[i + 1]) == "on";
+    } else if (arg == "--device-format") {
+      device_format.sample = std::string(argv[i + 1]) == "int16"
+                                 ? audio::DeviceSample::kInt16
+                                 : audio::DeviceSample::kFloat32;
+    } else if (arg == "--channels") {
+      device_format.channels = std::string(argv[i + 1]) == "2" ? 2 : 1;
+    } else if (arg == "--gain-db") {
+      gain_db = std::strtof(argv[i + 1], nullptr);
+    }
+  }
+  logger::configure(log);
+
   try {
     boost::asio::io_context io_context;
-    Client client(io_context);
+    Client client(io_context, tls);
+    client.set_fec(fec);
+    client.set_playback(playback);
+    client.set_direct(direct);
+    client.set_vad(vad);
+    client.set_audio_device(device_format,
+                            std::pow(10.0f, gain_db / 20.0f));
+    if (!token_hex.empty()) {
+      protocol::SessionToken token;
+      if (!from_hex(token_hex, token)) {
+        std::cerr << "Token must be "
+                  << 2 * protocol::kSessionTokenSize << " hex digits"
+                  << std::endl;
+        return 1;
+      }
+      client.set_token(token);
+    }
 
+    // Без guard поток io_context завершится раньше, чем появится работа
+    auto work = boost::asio::make_work_guard(io_context);
     std::thread io_thread([&io_context]() { io_context.run(); });
 
     while (true) {
@@ -205,10 +977,56 @@ int main() {
         case 3:
           client.stop_audio();
           break;
-        case 4:
+        case 4: {
+          int packet_ms;
+          std::cout << "Enter packet interval (10, 20, 40, 60 ms): ";
+          std::cin >> packet_ms;
+          client.set_packet_interval(static_cast<std::uint16_t>(packet_ms));
+          break;
+        }
+        case 5: {
+          int device_rate, wire_rate, use_int16;
+          std::cout << "Enter device rate (44100, 48000 Hz): ";
+          std::cin >> device_rate;
+          std::cout << "Enter wire rate (48000, 44100, 24000, 16000 Hz): ";
+          std::cin >> wire_rate;
+          std::cout << "Send int16 instead of float32 (1/0): ";
+          std::cin >> use_int16;
+          protocol::AudioFormat wire;
+          wire.sample_rate = static_cast<std::uint32_t>(wire_rate);
+          wire.sample_format = use_int16 ? protocol::SampleFormat::kInt16
+                                         : protocol::SampleFormat::kFloat32;
+          client.set_audio_format(device_rate, wire);
+          break;
+        }
+        case 6: {
+          std::string path;
+          std::cout << "Enter file path: ";
+          std::cin >> path;
+          client.upload(path);
+          break;
+        }
+        case 7: {
+          std::string file_id, path;
+          std::cout << "Enter file id: ";
+          std::cin >> file_id;
+          std::cout << "Save as: ";
+          std::cin >> path;
+          client.download(file_id, path);
+          break;
+        }
+        case 8: {
+          std::string file_id;
+          std::cout << "Enter file id: ";
+          std::cin >> file_id;
+          client.release(file_id);
+          break;
+        }
+        case 9:
           std::cout << "Exiting..." << std::endl;
           io_context.stop();
           io_thread.join();
+          logger::shutdown();
           return 0;
         default:
           std::cout << "Invalid choice. Please try again." << std::endl;
@@ -0,0 +1,170 @@
+#ifndef FILE_TRANSFER_H
+#define FILE_TRANSFER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../docker_server/protocol.h"
+#include "../docker_server/sha256.h"
+
+// Клиентская сторона передачи файлов (см. protocol.h). Объекты живут
+// в потоке io_context и только готовят кадры; отправляет их Client.
+
+inline bool hash_file(std::ifstream& in, protocol::FileId& id,
+                      std::uint64_t& size) {
+  Sha256 sha;
+  std::vector<char> buffer(protocol::kFileChunkSize);
+  size = 0;
+  in.clear();
+  in.seekg(0);
+  while (in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    auto n = static_cast<std::size_t>(in.gcount());
+    sha.update(buffer.data(), n);
+    size += n;
+  }
+  if (!in.eof()) {
+    return false;
+  }
+  id = sha.finish();
+  in.clear();
+  return true;
+}
+
+// Загрузка окном из нескольких неподтверждённых кусков: сервер
+// подтверждает каждый, и после обрыва продолжение начинается с куска,
+// который сервер назовёт в ответе на kUploadBegin
+class FileUpload {
+ public:
+  static constexpr std::uint32_t kWindow = 8;
+
+  static std::unique_ptr<FileUpload> open(const std::string& path) {
+    std::unique_ptr<FileUpload> upload(new FileUpload());
+    upload->in_.open(path, std::ios::binary);
+    if (!upload->in_ ||
+        !hash_file(upload->in_, upload->begin_.id, upload->begin_.size)) {
+      return nullptr;
+    }
+    upload->chunk_count_ = protocol::file_chunk_count(upload->begin_.size);
+    return upload;
+  }
+
+  const protocol::FileId& id() const { return begin_.id; }
+  std::uint64_t size() const { return begin_.size; }
+  std::uint64_t bytes_sent() const { return bytes_sent_; }
+
+  std::vector<char> begin_frame() const {
+    return protocol::make_upload_begin(begin_);
+  }
+
+  // Сдвигает окно по ответу сервера и добавляет в frames куски,
+  // которые можно отправить
+  void on_status(const protocol::TransferStatus& status,
+                 std::vector<std::vector<char>>& frames) {
+    acked_ = status.next_chunk;
+    if (status.state == protocol::TransferState::kBadChunk ||
+        next_to_send_ < acked_) {
+      next_to_send_ = acked_;
+    }
+    while (next_to_send_ < chunk_count_ && next_to_send_ - acked_ < kWindow) {
+      frames.push_back(read_chunk(next_to_send_++));
+    }
+  }
+
+ private:
+  FileUpload() : buffer_(protocol::kFileChunkSize) {}
+
+  std::vector<char> read_chunk(std::uint32_t index) {
+    protocol::UploadChunk chunk;
+    chunk.id = begin_.id;
+    chunk.index = index;
+    in_.clear();
+    in_.seekg(static_cast<std::streamoff>(std::uint64_t{index} *
+                                          protocol::kFileChunkSize));
+    in_.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    chunk.data = buffer_.data();
+    chunk.size = static_cast<std::size_t>(in_.gcount());
+    chunk.hash = Sha256::digest(chunk.data, chunk.size);
+    bytes_sent_ += chunk.size;
+    return protocol::make_upload_chunk(chunk);
+  }
+
+  std::ifstream in_;
+  protocol::UploadBegin begin_;
+  std::uint32_t chunk_count_ = 0;
+  std::uint32_t acked_ = 0;
+  std::uint32_t next_to_send_ = 0;
+  std::uint64_t bytes_sent_ = 0;
+  std::vector<char> buffer_;
+};
+
+// Скачивание в PATH.part с продолжением с его длины; по последнему
+// куску хеш сверяется с идентификатором, и файл переименовывается в PATH
+class FileDownload {
+ public:
+  static std::unique_ptr<FileDownload> open(const protocol::FileId& id,
+                                            const std::string& path) {
+    std::unique_ptr<FileDownload> download(new FileDownload());
+    download->request_.id = id;
+    download->path_ = path;
+    download->out_.open(download->part_path(),
+                        std::ios::binary | std::ios::app);
+    if (!download->out_) {
+      return nullptr;
+    }
+    download->out_.seekp(0, std::ios::end);
+    download->request_.offset =
+        static_cast<std::uint64_t>(download->out_.tellp());
+    return download;
+  }
+
+  const protocol::FileId& id() const { return request_.id; }
+  const std::string& path() const { return path_; }
+  std::uint64_t offset() const { return request_.offset; }
+  std::uint64_t size() const { return size_; }
+
+  std::vector<char> request_frame() const {
+    return protocol::make_download_request(request_);
+  }
+
+  void on_status(const protocol::TransferStatus& status) {
+    size_ = status.size;
+  }
+
+  // false — запись на диск не удалась
+  bool on_data(const char* data, std::size_t size) {
+    out_.write(data, static_cast<std::streamsize>(size));
+    request_.offset += size;
+    return static_cast<bool>(out_);
+  }
+
+  // Сверяет файл с идентификатором; при расхождении .part удаляется,
+  // чтобы следующая попытка начала с нуля
+  bool finish() {
+    out_.close();
+    std::ifstream in(part_path(), std::ios::binary);
+    protocol::FileId id;
+    std::uint64_t size = 0;
+    if (!hash_file(in, id, size) || id != request_.id) {
+      std::remove(part_path().c_str());
+      return false;
+    }
+    return std::rename(part_path().c_str(), path_.c_str()) == 0;
+  }
+
+ private:
+  FileDownload() = default;
+
+  std::string part_path() const { return path_ + ".part"; }
+
+  protocol::DownloadRequest request_;
+  std::string path_;
+  std::ofstream out_;
+  std::uint64_t size_ = 0;
+};
+
+#endif  // FILE_TRANSFER_H
@@ -0,0 +1,256 @@
+#ifndef PEER_LINK_H
+#define PEER_LINK_H
+
+#include <ifaddrs.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "../docker_server/logger.h"
+#include "../docker_server/protocol.h"
+
+// Прямой UDP-путь к собеседнику в звонке один на один (protocol.h,
+// kPeerOffer). Пробы уходят на все адреса собеседника сразу; первый
+// ответ выбирает путь. На прямом пути пробы продолжаются реже, и если
+// ответы пропали, голос возвращается к серверу. Все методы — в потоке
+// io_context клиента.
+class PeerLink {
+ public:
+  using udp = boost::asio::ip::udp;
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::milliseconds kProbeInterval{50};
+  // Сколько ищем путь после предложения сервера
+  static constexpr std::chrono::seconds kCheckTimeout{3};
+  static constexpr std::chrono::milliseconds kKeepalive{500};
+  // Прямой путь без ответов столько времени считается потерянным
+  static constexpr std::chrono::seconds kDeadAfter{2};
+
+  // Кадр голоса собеседника; stream заголовка — его номер у сервера
+  using AudioHandler =
+      std::function<void(const protocol::FrameHeader&, const char*)>;
+  // Голос переходит на прямой путь или возвращается к серверу
+  using StateHandler = std::function<void(bool direct)>;
+
+  PeerLink(boost::asio::io_context& io_context, AudioHandler on_audio,
+           StateHandler on_state)
+      : socket_(io_context),
+        timer_(io_context),
+        on_audio_(std::move(on_audio)),
+        on_state_(std::move(on_state)),
+        buffer_(kMaxDatagram) {}
+
+  // Открывает сокет и возвращает адреса для kPeerCandidates;
+  // пусто — UDP недоступен
+  std::vector<protocol::PeerCandidate> open() {
+    boost::system::error_code ec;
+    if (!socket_.is_open()) {
+      socket_.open(udp::v4(), ec);
+      if (!ec) {
+        socket_.bind(udp::endpoint(udp::v4(), 0), ec);
+      }
+      if (ec) {
+        LOG_WARNING("Direct media unavailable: {}", ec.message());
+        socket_.close(ec);
+        return {};
+      }
+      socket_.non_blocking(true, ec);
+      receive();
+    }
+    std::uint16_t port = socket_.local_endpoint(ec).port();
+    std::vector<protocol::PeerCandidate> candidates;
+    ifaddrs* list = nullptr;
+    if (getifaddrs(&list) == 0) {
+      for (ifaddrs* entry = list; entry; entry = entry->ifa_next) {
+        if (!entry->ifa_addr || entry->ifa_addr->sa_family != AF_INET ||
+            candidates.size() == protocol::kMaxPeerCandidates) {
+          continue;
+        }
+        const auto* address =
+            reinterpret_cast<const sockaddr_in*>(entry->ifa_addr);
+        candidates.push_back(
+            protocol::PeerCandidate{ntohl(address->sin_addr.s_addr), port});
+      }
+      freeifaddrs(list);
+    }
+    return candidates;
+  }
+
+  void on_offer(const protocol::PeerOffer& offer) {
+    if (!socket_.is_open()) {
+      return;
+    }
+    reset();
+    offer_ = offer;
+    state_ = State::kChecking;
+    checks_started_ = Clock::now();
+    LOG_INFO("Direct media: checking {} addresses of {}",
+             offer.candidates.size(), offer.peer);
+    tick();
+  }
+
+  // Звонок отозван сервером
+  void reset() {
+    bool was_direct = state_ == State::kDirect;
+    state_ = State::kIdle;
+    verified_.clear();
+    timer_.cancel();
+    if (was_direct) {
+      on_state_(false);
+    }
+  }
+
+  bool direct() const { return state_ == State::kDirect; }
+
+  // false — не ушло, кадр нужно отправить через сервер
+  bool send(const std::vector<char>& frame) {
+    if (state_ != State::kDirect) {
+      return false;
+    }
+    boost::system::error_code ec;
+    socket_.send_to(boost::asio::buffer(frame), path_, 0, ec);
+    return !ec;
+  }
+
+ private:
+  static constexpr std::size_t kMaxDatagram = 65507;
+
+  enum class State : std::uint8_t {
+    kIdle,
+    kChecking,
+    kDirect,
+    kFailed,  // до следующего предложения голос идёт через сервер
+  };
+
+  void receive() {
+    socket_.async_receive_from(
+        boost::asio::buffer(buffer_), sender_,
+        [this](boost::system::error_code ec, std::size_t size) {
+          if (ec == boost::asio::error::operation_aborted) {
+            return;
+          }
+          if (!ec) {
+            on_datagram(size);
+          }
+          receive();
+        });
+  }
+
+  void on_datagram(std::size_t size) {
+    if (state_ == State::kIdle || size < protocol::kHeaderSize) {
+      return;
+    }
+    auto header = protocol::decode_header(buffer_.data());
+    if (protocol::kHeaderSize + header.length != size) {
+      return;
+    }
+    const char* payload = buffer_.data() + protocol::kHeaderSize;
+    if (header.type == protocol::MessageType::kPeerProbe) {
+      if (header.length < protocol::kPeerProbeSize ||
+          protocol::get_u64(payload) != offer_.key) {
+        return;
+      }
+      if (std::find(verified_.begin(), verified_.end(), sender_) ==
+          verified_.end()) {
+        verified_.push_back(sender_);
+      }
+      if (header.flags & protocol::kFlagProbeAck) {
+        on_ack();
+      } else {
+        send_probe(sender_, true);
+      }
+      return;
+    }
+    // Голос принимается только с адресов, знающих ключ пары
+    if ((header.type == protocol::MessageType::kAudio ||
+         header.type == protocol::MessageType::kAudioParity) &&
+        std::find(verified_.begin(), verified_.end(), sender_) !=
+            verified_.end()) {
+      header.stream = offer_.peer;
+      on_audio_(header, payload);
+    }
+  }
+
+  void on_ack() {
+    last_ack_ = Clock::now();
+    if (state_ != State::kChecking) {
+      return;
+    }
+    state_ = State::kDirect;
+    path_ = sender_;
+    LOG_INFO("Direct media: path to {} via {}:{}", offer_.peer,
+             path_.address().to_string(), path_.port());
+    on_state_(true);
+    schedule(kKeepalive);
+  }
+
+  void tick() {
+    Clock::time_point now = Clock::now();
+    switch (state_) {
+      case State::kChecking:
+        if (now - checks_started_ >= kCheckTimeout) {
+          state_ = State::kFailed;
+          LOG_WARNING("Direct media: no path to {}, staying on relay",
+                      offer_.peer);
+          return;
+        }
+        for (const auto& candidate : offer_.candidates) {
+          send_probe(udp::endpoint(boost::asio::ip::address_v4(
+                                       candidate.address),
+                                   candidate.port),
+                     false);
+        }
+        schedule(kProbeInterval);
+        break;
+      case State::kDirect:
+        if (now - last_ack_ >= kDeadAfter) {
+          state_ = State::kFailed;
+          LOG_WARNING("Direct media: path to {} lost, back to relay",
+                      offer_.peer);
+          on_state_(false);
+          return;
+        }
+        send_probe(path_, false);
+        schedule(kKeepalive);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void schedule(Clock::duration delay) {
+    timer_.expires_after(delay);
+    timer_.async_wait([this](boost::system::error_code ec) {
+      if (!ec) {
+        tick();
+      }
+    });
+  }
+
+  void send_probe(const udp::endpoint& to, bool ack) {
+    auto probe = protocol::make_peer_probe(offer_.key, ack);
+    boost::system::error_code ec;
+    socket_.send_to(boost::asio::buffer(probe), to, 0, ec);
+  }
+
+  udp::socket socket_;
+  boost::asio::steady_timer timer_;
+  AudioHandler on_audio_;
+  StateHandler on_state_;
+  std::vector<char> buffer_;
+  udp::endpoint sender_;
+  State state_ = State::kIdle;
+  protocol::PeerOffer offer_;
+  Clock::time_point checks_started_;
+  Clock::time_point last_ack_;
+  udp::endpoint path_;
+  // Адреса, с которых приходили пробы с ключом пары
+  std::vector<udp::endpoint> verified_;
+};
+
+#endif  // PEER_LINK_H